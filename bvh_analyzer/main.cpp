@@ -0,0 +1,830 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+// Quality report of the hierarchies that can be built over the geometry of a scene.
+// The samples give the driver one BLAS per OBJ model (objectToVkGeometryKHR) or per glTF
+// primitive (primitiveToGeometry). This tool loads the same geometry with the same loaders,
+// builds the reference hierarchies of bvh.h on the CPU for each of these BLAS, and prints
+// their SAH cost, overlap, leaf sizes, triangle sizes and empty space (see bvh_analysis.h),
+// then the same for the top level over the instances.
+// The benchmarks run on all instances flattened into one world-space mesh:
+// - --build-times: both builders on 1 thread and on --threads, best of --repeat builds, with
+//   the SAH cost of the trees, which must not depend on the thread count.
+// - --rays <count>: random rays around the scene through the binary, 4 and 8-wide trees, closest
+//   and any hit, in Mrays/s on one thread. All layouts must return the same hits, and the first
+//   rays the same as testing every triangle.
+// - --coherent <resolution>: primary rays of a square image in 64x64 tiles, then shadow rays from
+//   their hits towards the sun, as single rays, packets of 8 and 16 and streams of one tile, in
+//   Mrays/s on one thread. Packets and streams must return the same hits as single rays, up to
+//   the order of overlapping triangles and to rounding when the compiler fuses multiply-adds.
+// - --deform <frames>: the scene rippling like the sphere of the animation sample (anim.comp),
+//   updated every frame with DeformingBvh (refit, Morton rebuild when the SAH cost grew too
+//   much), with refits only and with Morton rebuilds only, against binned SAH rebuilds. After
+//   the last frame all trees must return the hits of a test of every triangle.
+//
+// Usage: bvh_analyzer <scene.obj|scene.gltf|scene.glb> [--leaf <size>] [--bins <count>] [--csv <file>]
+//                     [--build-times] [--rays <count>] [--coherent <resolution>] [--deform <frames>]
+//                     [--threads <count>] [--repeat <count>]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// The samples define these in their main file; common/texture_loader.cpp needs stb_image too
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include "bvh_analysis.h"
+#include "lbvh.h"
+#include "ray_packet.h"
+#include "wide_bvh.h"
+#include "fileformats/tiny_gltf.h"
+#include "nvh/gltfscene.hpp"
+#include "obj_loader.h"
+#include "parallel.h"
+
+namespace {
+using nvmath::vec3f;
+
+// Primitives with fewer triangles are cheaper merged with their neighbors than as a BLAS
+// of their own: the top level then does the work of a tree that is barely one
+const size_t kMergeTriangleCount = 64;
+// Fraction of slivers, or of empty leaf area, above which pre-splitting should pay off
+const float kSplitSliverRatio    = 0.1f;
+const float kSplitLeafEmptySpace = 0.8f;
+// Rays checked against all triangles by --rays
+const size_t kBruteForceRayCount = 2000;
+// Screen tiles of --coherent, traced as one stream each, and their blocks of 4x4 pixels
+const uint32_t kTileSize  = 64;
+const uint32_t kBlockSize = 4;
+
+// When the target has FMA the compiler may fuse the multiply-adds of the scalar triangle test,
+// which then rounds differently from the SIMD lanes of the packets (see ray_packet.h): the hit
+// distances may move by a few ulps.
+#ifdef __FP_FAST_FMAF
+const bool kFusedMultiplyAdd = true;
+#else
+const bool kFusedMultiplyAdd = false;
+#endif
+const float kMaxFusedDistanceError = 1e-5f;  // Relative
+
+bool sameDistance(float a, float b)
+{
+  return kFusedMultiplyAdd ? std::abs(a - b) <= kMaxFusedDistanceError * std::max(a, b) : a == b;
+}
+
+// Triangles overlapping at the hit (duplicated faces) may be found in another order: a hit on
+// another triangle is the same if the ray meets that triangle at the same distance
+bool sameHit(const TriangleBvh&           bvh,
+             const std::vector<uint32_t>& slotOfTriangle,
+             const BvhRay&                ray,
+             const BvhHit&                hit,
+             const BvhHit&                reference)
+{
+  if(!hit.valid() || !reference.valid())
+    return hit.valid() == reference.valid();
+  if(!sameDistance(hit.t, reference.t))
+    return false;
+  if(hit.triangle == reference.triangle)
+    return true;
+  BvhHit other;
+  const BvhTriangle& triangle = bvh.triangles[slotOfTriangle[hit.triangle]];
+  return intersectTriangle(triangle, ray, WatertightRay(ray.direction), FLT_MAX, other)
+         && sameDistance(other.t, reference.t);
+}
+
+// Geometry of one BLAS, pointing into the loaded scene
+struct Primitive
+{
+  std::string     name;
+  const vec3f*    positions{nullptr};
+  size_t          positionStride{sizeof(vec3f)};
+  const uint32_t* indices{nullptr};
+  size_t          indexCount{0};
+  size_t          vertexCount{0};
+  uint32_t        instanceCount{0};
+};
+
+struct Scene
+{
+  std::vector<Primitive> primitives;
+  std::vector<BvhBox>    instanceBoxes;  // World box of each instance, for the top level
+
+  // All instances in world space, for the benchmarks (flattenScene)
+  std::vector<vec3f>    worldPositions;
+  std::vector<uint32_t> worldIndices;
+
+  ObjLoader      obj;
+  nvh::GltfScene gltf;
+};
+
+bool endsWith(const std::string& s, const char* suffix)
+{
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+BvhBox primitiveBox(const Primitive& prim)
+{
+  BvhBox box;
+  for(size_t i = 0; i < prim.indexCount; i++)
+  {
+    const vec3f& p = *reinterpret_cast<const vec3f*>(reinterpret_cast<const uint8_t*>(prim.positions)
+                                                     + prim.indices[i] * prim.positionStride);
+    box.bboxMin    = nvmath::nv_min(box.bboxMin, p);
+    box.bboxMax    = nvmath::nv_max(box.bboxMax, p);
+  }
+  return box;
+}
+
+BvhBox transformBox(const nvmath::mat4f& transform, const BvhBox& box)
+{
+  BvhBox world;
+  for(int corner = 0; corner < 8; corner++)
+  {
+    nvmath::vec4f p(corner & 1 ? box.bboxMax.x : box.bboxMin.x, corner & 2 ? box.bboxMax.y : box.bboxMin.y,
+                    corner & 4 ? box.bboxMax.z : box.bboxMin.z, 1.f);
+    vec3f w       = vec3f(transform * p);
+    world.bboxMin = nvmath::nv_min(world.bboxMin, w);
+    world.bboxMax = nvmath::nv_max(world.bboxMax, w);
+  }
+  return world;
+}
+
+// Whole model in one BLAS, as in the OBJ samples
+bool loadObj(const std::string& filename, Scene& scene)
+{
+  scene.obj.loadModel(filename);
+  if(scene.obj.m_indices.empty())
+    return false;
+
+  Primitive prim;
+  prim.name           = filename.substr(filename.find_last_of("/\\") + 1);
+  prim.positions      = &scene.obj.m_vertices.data()->pos;
+  prim.positionStride = sizeof(VertexObj);
+  prim.indices        = scene.obj.m_indices.data();
+  prim.indexCount     = scene.obj.m_indices.size();
+  prim.vertexCount    = scene.obj.m_vertices.size();
+  prim.instanceCount  = 1;
+  scene.primitives.push_back(prim);
+  scene.instanceBoxes.push_back(primitiveBox(prim));
+  return true;
+}
+
+// One BLAS per primitive mesh and one instance per node, as in the glTF samples
+bool loadGltf(const std::string& filename, Scene& scene)
+{
+  tinygltf::Model    tmodel;
+  tinygltf::TinyGLTF tcontext;
+  std::string        warn, error;
+
+  bool loaded = endsWith(filename, ".glb") ? tcontext.LoadBinaryFromFile(&tmodel, &error, &warn, filename) :
+                                             tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, filename);
+  if(!warn.empty())
+    fprintf(stderr, "%s\n", warn.c_str());
+  if(!loaded)
+  {
+    fprintf(stderr, "%s\n", error.c_str());
+    return false;
+  }
+  scene.gltf.importDrawableNodes(tmodel, nvh::GltfAttributes::Position);
+
+  std::vector<BvhBox> objectBoxes;
+  for(size_t i = 0; i < scene.gltf.m_primMeshes.size(); i++)
+  {
+    const auto& primMesh = scene.gltf.m_primMeshes[i];
+    Primitive   prim;
+    prim.name       = "primitive " + std::to_string(i);
+    prim.positions  = &scene.gltf.m_positions[primMesh.vertexOffset];
+    prim.indices    = &scene.gltf.m_indices[primMesh.firstIndex];
+    prim.indexCount  = primMesh.indexCount;
+    prim.vertexCount = primMesh.vertexCount;
+    scene.primitives.push_back(prim);
+    objectBoxes.push_back(primitiveBox(prim));
+  }
+  for(const auto& node : scene.gltf.m_nodes)
+  {
+    scene.primitives[node.primMesh].instanceCount++;
+    scene.instanceBoxes.push_back(transformBox(node.worldMatrix, objectBoxes[node.primMesh]));
+  }
+  return true;
+}
+
+// "12/30/7/1" for 12 leaves of one item, 30 of two...
+std::string leafHistogram(const std::vector<size_t>& leafSizes)
+{
+  std::string text;
+  for(size_t i = 1; i < leafSizes.size(); i++)
+    text += (i > 1 ? "/" : "") + std::to_string(leafSizes[i]);
+  return text;
+}
+
+struct Report
+{
+  BvhQuality        sah;
+  BvhQuality        morton;
+  TriangleSizeStats sizes;
+  double            sahMs{0.0};
+  double            mortonMs{0.0};
+
+  std::string hint(size_t triangleCount) const
+  {
+    bool merge = triangleCount < kMergeTriangleCount;
+    bool split = sizes.sliverCount > kSplitSliverRatio * sizes.triangleCount
+                 || sah.leafEmptySpace > kSplitLeafEmptySpace;
+    return merge && split ? "merge split" : merge ? "merge" : split ? "split" : "";
+  }
+};
+
+Report analyze(const Primitive& prim, const BvhBuildSettings& settings)
+{
+  Report report;
+  for(BvhBuildMethod method : {BvhBuildMethod::eBinnedSah, BvhBuildMethod::eMorton})
+  {
+    BvhBuildSettings methodSettings = settings;
+    methodSettings.method           = method;
+
+    auto        startTime = std::chrono::high_resolution_clock::now();
+    TriangleBvh bvh =
+        buildTriangleBvh(prim.positions, prim.positionStride, prim.indices, prim.indexCount, methodSettings);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime);
+
+    if(method == BvhBuildMethod::eBinnedSah)
+    {
+      report.sah   = bvhQuality(bvh, methodSettings);
+      report.sahMs = elapsed.count();
+    }
+    else
+    {
+      report.morton   = bvhQuality(bvh, methodSettings);
+      report.mortonMs = elapsed.count();
+    }
+  }
+  report.sizes = triangleSizeStats(prim.positions, prim.positionStride, prim.indices, prim.indexCount);
+  return report;
+}
+
+// Copies every instance of every primitive in world space into one mesh
+void flattenScene(Scene& scene)
+{
+  auto append = [&](const Primitive& prim, const nvmath::mat4f* transform) {
+    uint32_t base = uint32_t(scene.worldPositions.size());
+    for(size_t v = 0; v < prim.vertexCount; v++)
+    {
+      const vec3f& p = *reinterpret_cast<const vec3f*>(reinterpret_cast<const uint8_t*>(prim.positions)
+                                                       + v * prim.positionStride);
+      scene.worldPositions.push_back(transform ? vec3f(*transform * nvmath::vec4f(p.x, p.y, p.z, 1.f)) : p);
+    }
+    for(size_t i = 0; i < prim.indexCount; i++)
+      scene.worldIndices.push_back(base + prim.indices[i]);
+  };
+  if(!scene.obj.m_indices.empty())
+    append(scene.primitives[0], nullptr);
+  for(const auto& node : scene.gltf.m_nodes)
+    append(scene.primitives[node.primMesh], &node.worldMatrix);
+}
+
+double elapsedMs(std::chrono::high_resolution_clock::time_point startTime)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+TriangleBvh buildWorldBvh(const Scene& scene, const BvhBuildSettings& settings)
+{
+  return buildTriangleBvh(scene.worldPositions.data(), sizeof(vec3f), scene.worldIndices.data(),
+                          scene.worldIndices.size(), settings);
+}
+
+// Best time of `repeat` builds of the world mesh, and the last tree
+TriangleBvh timeBuild(const Scene& scene, const BvhBuildSettings& settings, uint32_t repeat, double& bestMs)
+{
+  TriangleBvh bvh;
+  for(uint32_t i = 0; i < repeat; i++)
+  {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    bvh            = buildWorldBvh(scene, settings);
+    double ms      = elapsedMs(startTime);
+    bestMs         = i == 0 ? ms : std::min(bestMs, ms);
+  }
+  return bvh;
+}
+
+// Returns false if the thread count changed the trees
+bool benchBuild(const Scene& scene, const BvhBuildSettings& settings, uint32_t threadCount, uint32_t repeat)
+{
+  size_t triangleCount = scene.worldIndices.size() / 3;
+  printf("\nBuild times of the whole scene, %zu triangles, best of %u\n", triangleCount, repeat);
+  bool same = true;
+  for(BvhBuildMethod method : {BvhBuildMethod::eBinnedSah, BvhBuildMethod::eMorton})
+  {
+    BvhBuildSettings methodSettings = settings;
+    methodSettings.method           = method;
+    methodSettings.threadCount      = 1;
+    double   serialMs = 0.0, parallelMs = 0.0;
+    BvhStats serial   = bvhStats(timeBuild(scene, methodSettings, repeat, serialMs).bvh, methodSettings);
+    methodSettings.threadCount = threadCount;
+    BvhStats parallel = bvhStats(timeBuild(scene, methodSettings, repeat, parallelMs).bvh, methodSettings);
+    bool     sameTree = serial.sahCost == parallel.sahCost && serial.nodeCount == parallel.nodeCount
+                    && serial.leafCount == parallel.leafCount;
+    same = same && sameTree;
+    printf("  %-10s SAH cost %6.2f, %8.1f ms (%5.2f Mtri/s) on 1 thread, %8.1f ms (%5.2f Mtri/s) on %u, %s\n",
+           method == BvhBuildMethod::eBinnedSah ? "binned SAH" : "Morton", serial.sahCost, serialMs,
+           triangleCount / (serialMs * 1000.0), parallelMs, triangleCount / (parallelMs * 1000.0), threadCount,
+           sameTree ? "same tree" : "DIFFERENT TREES");
+  }
+  return same;
+}
+
+BvhBox sceneBox(const Scene& scene)
+{
+  BvhBox box;
+  for(const vec3f& p : scene.worldPositions)
+  {
+    box.bboxMin = nvmath::nv_min(box.bboxMin, p);
+    box.bboxMax = nvmath::nv_max(box.bboxMax, p);
+  }
+  return box;
+}
+
+// Origins in the box of the scene grown by a fifth on each side, directions uniform on the sphere
+std::vector<BvhRay> randomRays(const Scene& scene, size_t count)
+{
+  BvhBox                                box    = sceneBox(scene);
+  vec3f                                 margin = (box.bboxMax - box.bboxMin) * 0.2f;
+  std::mt19937                          rng(2020);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  std::normal_distribution<float>       gaussian;
+  std::vector<BvhRay>                   rays(count);
+  for(BvhRay& ray : rays)
+  {
+    for(int c = 0; c < 3; c++)
+      ray.origin[c] = box.bboxMin[c] - margin[c] + uniform(rng) * (box.bboxMax[c] - box.bboxMin[c] + 2.f * margin[c]);
+    do
+      ray.direction = vec3f(gaussian(rng), gaussian(rng), gaussian(rng));
+    while(nvmath::length(ray.direction) < 1e-6f);
+    ray.direction = nvmath::normalize(ray.direction);
+  }
+  return rays;
+}
+
+// Best time of `repeat` runs of fn(), in Mrays/s
+template <class Fn>
+double timeRays(size_t count, uint32_t repeat, Fn&& fn)
+{
+  double bestMs = 0.0;
+  for(uint32_t i = 0; i < repeat; i++)
+  {
+    auto   startTime = std::chrono::high_resolution_clock::now();
+    fn();
+    double ms = elapsedMs(startTime);
+    bestMs    = i == 0 ? ms : std::min(bestMs, ms);
+  }
+  return double(count) / (bestMs * 1000.0);
+}
+
+// Closest hit over every triangle, in the order of the leaves
+BvhHit bruteForceClosest(const TriangleBvh& bvh, const BvhRay& ray)
+{
+  WatertightRay wray(ray.direction);
+  BvhHit        hit;
+  for(const BvhTriangle& triangle : bvh.triangles)
+    intersectTriangle(triangle, ray, wray, hit.t < ray.tMax ? hit.t : ray.tMax, hit);
+  return hit;
+}
+
+// Returns false if the layouts disagree
+bool benchRays(const Scene& scene, const BvhBuildSettings& settings, size_t rayCount, uint32_t repeat)
+{
+  TriangleBvh         bvh2 = buildWorldBvh(scene, settings);
+  Bvh4                bvh4 = collapseBvh<4>(bvh2);
+  Bvh8                bvh8 = collapseBvh<8>(bvh2);
+  std::vector<BvhRay> rays = randomRays(scene, rayCount);
+
+  std::vector<BvhHit>  hits[3];
+  std::vector<uint8_t> occluded[3];
+  double               closestRate[3], anyRate[3];
+  auto                 run = [&](int layout, auto& bvh) {
+    hits[layout].assign(rayCount, BvhHit());
+    occluded[layout].assign(rayCount, 0);
+    closestRate[layout] = timeRays(rayCount, repeat, [&]() {
+      for(size_t i = 0; i < rayCount; i++)
+        intersectClosest(bvh, rays[i], hits[layout][i]);
+    });
+    anyRate[layout] = timeRays(rayCount, repeat, [&]() {
+      for(size_t i = 0; i < rayCount; i++)
+        occluded[layout][i] = intersectAny(bvh, rays[i]) ? 1 : 0;
+    });
+  };
+  run(0, bvh2);
+  run(1, bvh4);
+  run(2, bvh8);
+
+  size_t differences = 0, bruteForceDifferences = 0, hitCount = 0;
+  for(size_t i = 0; i < rayCount; i++)
+  {
+    hitCount += hits[0][i].valid() ? 1 : 0;
+    for(int layout = 1; layout < 3; layout++)
+    {
+      bool same = hits[layout][i].t == hits[0][i].t && hits[layout][i].valid() == hits[0][i].valid()
+                  && occluded[layout][i] == occluded[0][i];
+      differences += same ? 0 : 1;
+    }
+    if(i < kBruteForceRayCount)
+    {
+      BvhHit reference = bruteForceClosest(bvh2, rays[i]);
+      bool   same      = reference.t == hits[0][i].t && reference.valid() == hits[0][i].valid()
+                  && reference.valid() == (occluded[0][i] != 0);
+      bruteForceDifferences += same ? 0 : 1;
+    }
+  }
+
+  printf("\nRandom rays, %zu from around the scene, %.1f%% hitting, Mrays/s on one thread, best of %u\n", rayCount,
+         100.0 * double(hitCount) / double(rayCount), repeat);
+  const char* names[3] = {"bvh2", "bvh4", "bvh8"};
+  for(int layout = 0; layout < 3; layout++)
+    printf("  %s  closest %6.2f  any %6.2f\n", names[layout], closestRate[layout], anyRate[layout]);
+  printf("  %zu differences between the layouts, %zu with all triangles on the first %zu rays\n", differences,
+         bruteForceDifferences, std::min(rayCount, kBruteForceRayCount));
+  return differences == 0 && bruteForceDifferences == 0;
+}
+
+// Primary rays of a pinhole camera looking at the center of the scene, in the order of the
+// 4x4 blocks of each tile, so that 16 consecutive rays cover a block and 8 half of it
+std::vector<BvhRay> primaryRays(const Scene& scene, uint32_t resolution)
+{
+  BvhBox box    = sceneBox(scene);
+  vec3f  center = (box.bboxMin + box.bboxMax) * 0.5f;
+  float  radius = nvmath::length(box.bboxMax - box.bboxMin) * 0.5f;
+  vec3f  eye    = center + nvmath::normalize(vec3f(0.6f, 0.4f, 1.f)) * radius * 1.8f;
+  vec3f  front  = nvmath::normalize(center - eye);
+  vec3f  right  = nvmath::normalize(nvmath::cross(front, vec3f(0.f, 1.f, 0.f)));
+  vec3f  up     = nvmath::cross(right, front);
+
+  std::vector<BvhRay> rays;
+  rays.reserve(size_t(resolution) * resolution);
+  for(uint32_t ty = 0; ty < resolution; ty += kTileSize)
+    for(uint32_t tx = 0; tx < resolution; tx += kTileSize)
+      for(uint32_t by = ty; by < ty + kTileSize; by += kBlockSize)
+        for(uint32_t bx = tx; bx < tx + kTileSize; bx += kBlockSize)
+          for(uint32_t y = by; y < by + kBlockSize; y++)
+            for(uint32_t x = bx; x < bx + kBlockSize; x++)
+            {
+              float  u = (float(x) + 0.5f) / float(resolution) * 2.f - 1.f;
+              float  v = (float(y) + 0.5f) / float(resolution) * 2.f - 1.f;
+              BvhRay ray;
+              ray.origin    = eye;
+              ray.direction = nvmath::normalize(front + right * (u * 0.6f) + up * (v * 0.6f));
+              rays.push_back(ray);
+            }
+  return rays;
+}
+
+// Groups of N consecutive rays, the last one partial
+template <uint32_t N>
+void closestPackets(const TriangleBvh& bvh, const std::vector<BvhRay>& rays, std::vector<BvhHit>& hits)
+{
+  for(size_t first = 0; first < rays.size(); first += N)
+  {
+    uint32_t          count = uint32_t(std::min<size_t>(N, rays.size() - first));
+    BvhRayPacket<N>   packet;
+    BvhHitPacket<N>   packetHits;
+    for(uint32_t lane = 0; lane < N; lane++)
+      packet.set(lane, rays[first + std::min(lane, count - 1)]);
+    intersectClosest(bvh, packet, packetHits, count == N ? (1u << N) - 1 : (1u << count) - 1);
+    for(uint32_t lane = 0; lane < count; lane++)
+      hits[first + lane] = packetHits.hits[lane];
+  }
+}
+
+template <uint32_t N>
+void anyPackets(const TriangleBvh& bvh, const std::vector<BvhRay>& rays, std::vector<uint8_t>& occluded)
+{
+  for(size_t first = 0; first < rays.size(); first += N)
+  {
+    uint32_t        count = uint32_t(std::min<size_t>(N, rays.size() - first));
+    BvhRayPacket<N> packet;
+    for(uint32_t lane = 0; lane < N; lane++)
+      packet.set(lane, rays[first + std::min(lane, count - 1)]);
+    uint32_t mask = intersectAny(bvh, packet, count == N ? (1u << N) - 1 : (1u << count) - 1);
+    for(uint32_t lane = 0; lane < count; lane++)
+      occluded[first + lane] = (mask >> lane) & 1;
+  }
+}
+
+// Returns false if packets or streams differ from single rays
+bool benchCoherent(const Scene& scene, const BvhBuildSettings& settings, uint32_t resolution, uint32_t repeat)
+{
+  TriangleBvh         bvh     = buildWorldBvh(scene, settings);
+  std::vector<BvhRay> primary = primaryRays(scene, resolution);
+  size_t              tileRays = size_t(kTileSize) * kTileSize;
+
+  std::vector<uint32_t> slotOfTriangle(scene.worldIndices.size() / 3);
+  for(size_t slot = 0; slot < bvh.triangles.size(); slot++)
+    slotOfTriangle[bvh.triangles[slot].triangle] = uint32_t(slot);
+
+  // Primary rays: the single rays are the reference
+  std::vector<BvhHit> reference(primary.size()), hits(primary.size());
+  size_t              primaryDifferences = 0;
+  auto                compareHits        = [&]() {
+    for(size_t i = 0; i < primary.size(); i++)
+      primaryDifferences += sameHit(bvh, slotOfTriangle, primary[i], hits[i], reference[i]) ? 0 : 1;
+  };
+  double primaryRates[4];
+  primaryRates[0] = timeRays(primary.size(), repeat, [&]() {
+    for(size_t i = 0; i < primary.size(); i++)
+      intersectClosest(bvh, primary[i], reference[i]);
+  });
+  primaryRates[1] = timeRays(primary.size(), repeat, [&]() { closestPackets<8>(bvh, primary, hits); });
+  compareHits();
+  primaryRates[2] = timeRays(primary.size(), repeat, [&]() { closestPackets<16>(bvh, primary, hits); });
+  compareHits();
+  primaryRates[3] = timeRays(primary.size(), repeat, [&]() {
+    for(size_t first = 0; first < primary.size(); first += tileRays)
+      intersectClosest(bvh, &primary[first], std::min(tileRays, primary.size() - first), &hits[first]);
+  });
+  compareHits();
+
+  // Shadow rays towards the sun from the primary hits, in the same order
+  BvhBox              box    = sceneBox(scene);
+  float               radius = nvmath::length(box.bboxMax - box.bboxMin) * 0.5f;
+  vec3f               sun    = nvmath::normalize(vec3f(0.3f, 1.f, 0.2f));
+  std::vector<BvhRay> shadow;
+  for(size_t i = 0; i < primary.size(); i++)
+  {
+    if(!reference[i].valid())
+      continue;
+    BvhRay ray;
+    ray.origin    = primary[i].origin + primary[i].direction * reference[i].t;
+    ray.direction = sun;
+    ray.tMin      = 1e-3f * radius;
+    shadow.push_back(ray);
+  }
+  std::vector<uint8_t> occludedReference(shadow.size()), occluded(shadow.size());
+  size_t               shadowDifferences = 0;
+  auto                 compareOccluded   = [&]() {
+    for(size_t i = 0; i < shadow.size(); i++)
+      shadowDifferences += occluded[i] == occludedReference[i] ? 0 : 1;
+  };
+  double shadowRates[4];
+  shadowRates[0] = timeRays(shadow.size(), repeat, [&]() {
+    for(size_t i = 0; i < shadow.size(); i++)
+      occludedReference[i] = intersectAny(bvh, shadow[i]) ? 1 : 0;
+  });
+  shadowRates[1] = timeRays(shadow.size(), repeat, [&]() { anyPackets<8>(bvh, shadow, occluded); });
+  compareOccluded();
+  shadowRates[2] = timeRays(shadow.size(), repeat, [&]() { anyPackets<16>(bvh, shadow, occluded); });
+  compareOccluded();
+  shadowRates[3] = timeRays(shadow.size(), repeat, [&]() {
+    for(size_t first = 0; first < shadow.size(); first += tileRays)
+      intersectAny(bvh, &shadow[first], std::min(tileRays, shadow.size() - first), &occluded[first]);
+  });
+  compareOccluded();
+
+  printf("\nCoherent rays, %ux%u image in %ux%u tiles, Mrays/s on one thread, best of %u\n", resolution, resolution,
+         kTileSize, kTileSize, repeat);
+  printf("  %-24s %7s %7s %7s %7s\n", "", "single", "p8", "p16", "stream");
+  printf("  primary, %9zu rays  %7.2f %7.2f %7.2f %7.2f\n", primary.size(), primaryRates[0], primaryRates[1],
+         primaryRates[2], primaryRates[3]);
+  printf("  shadow,  %9zu rays  %7.2f %7.2f %7.2f %7.2f\n", shadow.size(), shadowRates[0], shadowRates[1],
+         shadowRates[2], shadowRates[3]);
+  printf("  %zu primary and %zu shadow results differ from single rays%s\n", primaryDifferences, shadowDifferences,
+         kFusedMultiplyAdd ? " (fused multiply-adds)" : "");
+  return primaryDifferences == 0 && shadowDifferences == 0;
+}
+
+// Ripple of anim.comp scaled to the scene: the vertices move up and down with a wave over their
+// distance to the vertical axis through the center, by a tenth of the size of the scene
+void rippleScene(const Scene& scene, float time, std::vector<vec3f>& positions)
+{
+  const float PI     = 3.14159265f;
+  BvhBox      box    = sceneBox(scene);
+  vec3f       center = (box.bboxMin + box.bboxMax) * 0.5f;
+  float       size   = std::max(nvmath::length(box.bboxMax - box.bboxMin), 1e-6f);
+  positions.resize(scene.worldPositions.size());
+  parallelRanges(positions.size(), 4096, [&](size_t begin, size_t end) {
+    for(size_t v = begin; v < end; v++)
+    {
+      const vec3f& p      = scene.worldPositions[v];
+      float        radius = std::sqrt((p.x - center.x) * (p.x - center.x) + (p.z - center.z) * (p.z - center.z));
+      positions[v]        = p + vec3f(0.f, 0.1f * size * std::sin(time * 4.f + radius / size * 4.f * PI), 0.f);
+    }
+  });
+}
+
+// Returns false if a tree misses the hits of the deformed scene
+bool benchDeform(const Scene& scene, const BvhBuildSettings& settings, uint32_t frameCount)
+{
+  const float        kFrameTime = 1.f / 30.f;
+  const uint32_t*    indices    = scene.worldIndices.data();
+  size_t             indexCount = scene.worldIndices.size();
+  std::vector<vec3f> positions;
+  DeformingBvh       updated, refitted;
+  BvhBuildSettings   mortonSettings = settings;
+  mortonSettings.method             = BvhBuildMethod::eMorton;
+  updated.build(scene.worldPositions.data(), sizeof(vec3f), indices, indexCount, settings);
+  refitted.build(scene.worldPositions.data(), sizeof(vec3f), indices, indexCount, settings);
+  refitted.m_rebuildThreshold = FLT_MAX;
+
+  double      updateMs = 0.0, refitMs = 0.0, mortonMs = 0.0, sahMs = 0.0;
+  uint32_t    rebuildCount = 0;
+  float       maxUpdatedCost = 0.f, maxRefittedCost = 0.f;
+  TriangleBvh morton, sah;
+  for(uint32_t frame = 1; frame <= frameCount; frame++)
+  {
+    rippleScene(scene, float(frame) * kFrameTime, positions);
+    auto startTime = std::chrono::high_resolution_clock::now();
+    rebuildCount += updated.update(positions.data(), sizeof(vec3f)) ? 1 : 0;
+    updateMs += elapsedMs(startTime);
+    startTime = std::chrono::high_resolution_clock::now();
+    refitted.update(positions.data(), sizeof(vec3f));
+    refitMs += elapsedMs(startTime);
+    startTime = std::chrono::high_resolution_clock::now();
+    morton    = buildTriangleBvh(positions.data(), sizeof(vec3f), indices, indexCount, mortonSettings);
+    mortonMs += elapsedMs(startTime);
+    startTime = std::chrono::high_resolution_clock::now();
+    sah       = buildTriangleBvh(positions.data(), sizeof(vec3f), indices, indexCount, settings);
+    sahMs += elapsedMs(startTime);
+    maxUpdatedCost  = std::max(maxUpdatedCost, updated.sahCost());
+    maxRefittedCost = std::max(maxRefittedCost, refitted.sahCost());
+  }
+
+  // Hits on the last frame, the brute force running over the triangles of the binned SAH tree
+  Scene deformed;
+  deformed.worldPositions = positions;
+  std::vector<BvhRay> rays    = randomRays(deformed, kBruteForceRayCount);
+  const TriangleBvh*  trees[] = {updated.bvh().get(), refitted.bvh().get(), &morton, &sah};
+  size_t              differences = 0;
+  for(const BvhRay& ray : rays)
+  {
+    BvhHit reference = bruteForceClosest(sah, ray);
+    for(const TriangleBvh* bvh : trees)
+    {
+      BvhHit hit;
+      intersectClosest(*bvh, ray, hit);
+      differences += hit.t == reference.t && hit.valid() == reference.valid() ? 0 : 1;
+    }
+  }
+
+  double frames = double(frameCount);
+  printf("\nDeformation, %u frames of a ripple of a tenth of the scene, %zu triangles, average per frame\n",
+         frameCount, indexCount / 3);
+  printf("  update          %8.2f ms, SAH cost %6.2f, at most %6.2f, %u rebuilds above %.2fx\n", updateMs / frames,
+         updated.sahCost(), maxUpdatedCost, rebuildCount, updated.m_rebuildThreshold);
+  printf("  refit only      %8.2f ms, SAH cost %6.2f, at most %6.2f\n", refitMs / frames, refitted.sahCost(),
+         maxRefittedCost);
+  printf("  Morton rebuild  %8.2f ms, SAH cost %6.2f\n", mortonMs / frames, bvhSahCost(morton.bvh, settings));
+  printf("  binned SAH      %8.2f ms, SAH cost %6.2f\n", sahMs / frames, bvhSahCost(sah.bvh, settings));
+  printf("  %zu differences with all triangles on %zu rays of the last frame\n", differences, rays.size());
+  return differences == 0;
+}
+
+void printUsage()
+{
+  fprintf(stderr,
+          "Usage: bvh_analyzer <scene.obj|scene.gltf|scene.glb> [--leaf <size>] [--bins <count>] [--csv <file>]\n"
+          "                    [--build-times] [--rays <count>] [--coherent <resolution>] [--deform <frames>]\n"
+          "                    [--threads <count>] [--repeat <count>]\n");
+}
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// Application Entry
+//
+int main(int argc, char** argv)
+{
+  std::string      filename, csvFilename;
+  BvhBuildSettings settings;
+  bool             buildTimes  = false;
+  size_t           rayCount    = 0;
+  uint32_t         resolution  = 0;
+  uint32_t         frameCount  = 0;
+  uint32_t         threadCount = getWorkerCount();
+  uint32_t         repeat      = 3;
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--leaf") && i + 1 < argc)
+      settings.maxLeafSize = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--bins") && i + 1 < argc)
+      settings.binCount = std::min(std::max(2u, uint32_t(atoi(argv[++i]))), kBvhMaxBins);
+    else if(!strcmp(argv[i], "--csv") && i + 1 < argc)
+      csvFilename = argv[++i];
+    else if(!strcmp(argv[i], "--build-times"))
+      buildTimes = true;
+    else if(!strcmp(argv[i], "--rays") && i + 1 < argc)
+      rayCount = size_t(std::max(0, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--coherent") && i + 1 < argc)  // Whole tiles
+      resolution = (uint32_t(std::max(1, atoi(argv[++i]))) + kTileSize - 1) / kTileSize * kTileSize;
+    else if(!strcmp(argv[i], "--deform") && i + 1 < argc)
+      frameCount = uint32_t(std::max(0, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+      threadCount = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = std::max(1, atoi(argv[++i]));
+    else if(argv[i][0] != '-' && filename.empty())
+      filename = argv[i];
+    else
+    {
+      printUsage();
+      return -1;
+    }
+  }
+  if(filename.empty())
+  {
+    printUsage();
+    return -1;
+  }
+
+  Scene scene;
+  bool  loaded = endsWith(filename, ".obj") ? loadObj(filename, scene) : loadGltf(filename, scene);
+  if(!loaded)
+  {
+    fprintf(stderr, "Could not load %s\n", filename.c_str());
+    return -1;
+  }
+
+  FILE* csv = nullptr;
+  if(!csvFilename.empty())
+  {
+    csv = fopen(csvFilename.c_str(), "w");
+    if(!csv)
+    {
+      fprintf(stderr, "Could not write %s\n", csvFilename.c_str());
+      return -1;
+    }
+    fprintf(csv,
+            "primitive,triangles,instances,sah_cost,morton_cost,sah_ms,morton_ms,overlap_sah,overlap_ratio,"
+            "leaf_empty_space,max_depth,leaf_sizes,degenerate,area_min,area_p10,area_p50,area_p90,area_max,"
+            "box_empty_space,slivers,hint\n");
+  }
+
+  // Costs are relative to the root of each primitive; the totals weight them by triangle count
+  printf("%-24s %9s %5s %7s %7s %7s %7s %7s %7s %8s  %-30s %s\n", "Primitive", "Triangles", "Inst", "SAH",
+         "Morton", "Overlap", "LeafEmp", "BoxEmp", "Slivers", "Area p50", "Leaves 1/2/3/...", "Hint");
+  double totalSah = 0.0, totalMorton = 0.0, totalSahMs = 0.0, totalMortonMs = 0.0;
+  size_t totalTriangles = 0;
+  for(const Primitive& prim : scene.primitives)
+  {
+    if(prim.indexCount < 3)
+      continue;
+    Report report        = analyze(prim, settings);
+    size_t triangleCount = prim.indexCount / 3;
+    totalTriangles += triangleCount;
+    totalSah += report.sah.stats.sahCost * triangleCount;
+    totalMorton += report.morton.stats.sahCost * triangleCount;
+    totalSahMs += report.sahMs;
+    totalMortonMs += report.mortonMs;
+
+    std::string leaves = leafHistogram(report.sah.leafSizes);
+    std::string hint   = report.hint(triangleCount);
+    printf("%-24s %9zu %5u %7.2f %7.2f %6.1f%% %6.1f%% %6.1f%% %7zu %8.2g  %-30s %s\n", prim.name.c_str(),
+           triangleCount, prim.instanceCount, report.sah.stats.sahCost, report.morton.stats.sahCost,
+           100.f * report.sah.overlapRatio, 100.f * report.sah.leafEmptySpace, 100.f * report.sizes.boxEmptySpace,
+           report.sizes.sliverCount, report.sizes.area[2], leaves.c_str(), hint.c_str());
+    if(csv)
+    {
+      fprintf(csv, "\"%s\",%zu,%u,%g,%g,%g,%g,%g,%g,%g,%zu,%s,%zu,%g,%g,%g,%g,%g,%g,%zu,%s\n", prim.name.c_str(),
+              triangleCount, prim.instanceCount, report.sah.stats.sahCost, report.morton.stats.sahCost, report.sahMs,
+              report.mortonMs, report.sah.overlapSah, report.sah.overlapRatio, report.sah.leafEmptySpace,
+              report.sah.stats.maxDepth, leaves.c_str(), report.sizes.degenerateCount, report.sizes.area[0],
+              report.sizes.area[1], report.sizes.area[2], report.sizes.area[3], report.sizes.area[4],
+              report.sizes.boxEmptySpace, report.sizes.sliverCount, hint.c_str());
+    }
+  }
+  if(csv)
+    fclose(csv);
+
+  if(totalTriangles > 0)
+  {
+    printf("\n%zu triangles in %zu primitives: SAH cost %.2f in %.1f ms (binned SAH), %.2f in %.1f ms (Morton)\n",
+           totalTriangles, scene.primitives.size(), totalSah / totalTriangles, totalSahMs,
+           totalMorton / totalTriangles, totalMortonMs);
+  }
+
+  // Top level as the TLAS sees it: one leaf per instance
+  BvhBuildSettings tlasSettings = settings;
+  tlasSettings.maxLeafSize      = 1;
+  Bvh        tlas               = buildBvh(scene.instanceBoxes.data(), scene.instanceBoxes.size(), tlasSettings);
+  BvhQuality top                = bvhQuality(tlas, tlasSettings);
+  printf("Top level over %zu instances: SAH cost %.2f, depth %zu, %.1f%% overlap\n", scene.instanceBoxes.size(),
+         top.stats.sahCost, top.stats.maxDepth, 100.f * top.overlapRatio);
+
+  if(!buildTimes && !rayCount && !resolution && !frameCount)
+    return 0;
+  flattenScene(scene);
+  bool passed = true;
+  if(buildTimes)
+    passed = benchBuild(scene, settings, threadCount, repeat) && passed;
+  if(rayCount)
+    passed = benchRays(scene, settings, rayCount, repeat) && passed;
+  if(resolution)
+    passed = benchCoherent(scene, settings, resolution, repeat) && passed;
+  if(frameCount)
+    passed = benchDeform(scene, settings, frameCount) && passed;
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "texture_baker.h"
+#include <cstring>
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/commands_vk.hpp"
+#include "nvvk/images_vk.hpp"
+
+// Vulkan side of the texture baker: formats, and upload of the baked mip chains.
+
+inline vk::Format bakedTextureFormat(TextureCompression compression, bool srgb)
+{
+  switch(compression)
+  {
+    case TextureCompression::eBC1:
+      return srgb ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eBc1RgbUnormBlock;
+    case TextureCompression::eBC3:
+      return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+    case TextureCompression::eBC7:
+      return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+    default:
+      return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+  }
+}
+
+// Returns `compression` if the device can sample it with linear filtering, eNone otherwise
+inline TextureCompression supportedTextureCompression(const vk::PhysicalDevice& physicalDevice,
+                                                      TextureCompression        compression,
+                                                      bool                      srgb)
+{
+  vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+  vk::FormatProperties properties = physicalDevice.getFormatProperties(bakedTextureFormat(compression, srgb));
+  return (properties.optimalTilingFeatures & needed) == needed ? compression : TextureCompression::eNone;
+}
+
+// Creates the images of baked textures with all their levels and appends them to
+// `textures`. Everything goes through one staging buffer and one submission.
+template <class Allocator, class Texture>
+void createBakedTextures(Allocator&                                              alloc,
+                         const vk::Device&                                       device,
+                         uint32_t                                                queueFamily,
+                         const std::vector<std::shared_ptr<const BakedTexture>>& baked,
+                         const vk::SamplerCreateInfo&                            samplerCreateInfo,
+                         std::vector<Texture>&                                   textures)
+{
+  if(baked.empty())
+    return;
+
+  // Level offsets are multiples of the block size, so the textures are packed with that alignment
+  std::vector<vk::DeviceSize> offsets;
+  vk::DeviceSize              stagingSize = 0;
+  for(const auto& texture : baked)
+  {
+    stagingSize = (stagingSize + 15) & ~vk::DeviceSize(15);
+    offsets.push_back(stagingSize);
+    stagingSize += texture->dataSize;
+  }
+
+  auto staging = alloc.createBuffer(stagingSize, vk::BufferUsageFlagBits::eTransferSrc,
+                                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+  uint8_t* mapped = static_cast<uint8_t*>(alloc.map(staging));
+  for(size_t i = 0; i < baked.size(); i++)
+    memcpy(mapped + offsets[i], baked[i]->data, baked[i]->dataSize);
+  alloc.unmap(staging);
+
+  {
+    nvvk::ScopeCommandBuffer cmdBuf(device, queueFamily);
+    for(size_t i = 0; i < baked.size(); i++)
+    {
+      const BakedTexture& texture = *baked[i];
+      vk::Format          format  = bakedTextureFormat(texture.compression, texture.srgb);
+      vk::ImageCreateInfo imageCreateInfo =
+          nvvk::makeImage2DCreateInfo(vk::Extent2D(texture.levels[0].width, texture.levels[0].height), format,
+                                      vk::ImageUsageFlagBits::eSampled);
+      imageCreateInfo.setMipLevels(static_cast<uint32_t>(texture.levels.size()));
+      auto image = alloc.createImage(imageCreateInfo);
+
+      std::vector<vk::BufferImageCopy> regions;
+      for(uint32_t l = 0; l < texture.levels.size(); l++)
+      {
+        const BakedMipLevel& level = texture.levels[l];
+        vk::BufferImageCopy  region;
+        region.setBufferOffset(offsets[i] + level.offset);
+        region.setImageSubresource({vk::ImageAspectFlagBits::eColor, l, 0, 1});
+        region.setImageExtent({level.width, level.height, 1});
+        regions.push_back(region);
+      }
+
+      vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, imageCreateInfo.mipLevels, 0, 1};
+      nvvk::cmdBarrierImageLayout(cmdBuf, image.image, vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eTransferDstOptimal, range);
+      vk::CommandBuffer(cmdBuf).copyBufferToImage(staging.buffer, image.image, vk::ImageLayout::eTransferDstOptimal, regions);
+      nvvk::cmdBarrierImageLayout(cmdBuf, image.image, vk::ImageLayout::eTransferDstOptimal,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal, range);
+
+      vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
+      textures.push_back(alloc.createTexture(image, ivInfo, samplerCreateInfo));
+    }
+  }  // Submitted and waited for here
+
+  alloc.destroy(staging);
+}
@@ -0,0 +1,608 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "bvh.h"
+#include "lbvh.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace {
+using nvmath::vec3f;
+
+struct Bounds
+{
+  vec3f lo{FLT_MAX, FLT_MAX, FLT_MAX};
+  vec3f hi{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+  void grow(const vec3f& p)
+  {
+    lo = nvmath::nv_min(lo, p);
+    hi = nvmath::nv_max(hi, p);
+  }
+  void grow(const Bounds& b)
+  {
+    lo = nvmath::nv_min(lo, b.lo);
+    hi = nvmath::nv_max(hi, b.hi);
+  }
+  // Half the surface, which is all the SAH needs
+  float area() const
+  {
+    if(lo.x > hi.x)
+      return 0.f;
+    vec3f d = hi - lo;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+  }
+};
+
+float nodeArea(const BvhNode& node)
+{
+  vec3f d = node.bboxMax - node.bboxMin;
+  return std::max(0.f, d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+struct Bin
+{
+  Bounds   bounds;
+  Bounds   centroids;
+  uint32_t count{0};
+};
+
+// Bins of the three axes
+struct BinSet
+{
+  Bin bins[3][kBvhMaxBins];
+
+  void merge(const BinSet& other, uint32_t binCount)
+  {
+    for(int axis = 0; axis < 3; axis++)
+      for(uint32_t b = 0; b < binCount; b++)
+      {
+        bins[axis][b].bounds.grow(other.bins[axis][b].bounds);
+        bins[axis][b].centroids.grow(other.bins[axis][b].centroids);
+        bins[axis][b].count += other.bins[axis][b].count;
+      }
+  }
+};
+
+// Range of items becoming a node
+struct Task
+{
+  uint32_t node;  // In the node array being filled
+  uint32_t begin;
+  uint32_t end;
+  uint32_t depth;
+  Bounds   bounds;
+  Bounds   centroidBounds;
+
+  uint32_t count() const { return end - begin; }
+};
+
+struct Split
+{
+  int      axis{-1};  // -1: no split better than a leaf was found
+  uint32_t bin{0};    // First bin on the right side
+  float    cost{FLT_MAX};
+  Bounds   left, right, leftCentroids, rightCentroids;
+};
+
+class BvhBuilder
+{
+public:
+  BvhBuilder(const BvhBox* boxes, size_t count, const BvhBuildSettings& settings)
+      : m_boxes(boxes)
+      , m_settings(settings)
+      , m_centroids(count)
+  {
+    m_settings.binCount    = std::min(std::max(m_settings.binCount, 2u), kBvhMaxBins);
+    m_settings.maxLeafSize = std::max(m_settings.maxLeafSize, 1u);
+    m_threadCount          = m_settings.threadCount ? m_settings.threadCount : getWorkerCount();
+  }
+
+  Bvh build()
+  {
+    Bvh    bvh;
+    size_t count = m_centroids.size();
+    if(count == 0)
+      return bvh;
+
+    // Centroids and root bounds
+    bvh.items.resize(count);
+    std::mutex mutex;
+    Task       root{};
+    root.end = uint32_t(count);
+    parallelRanges(
+        count, 4096,
+        [&](size_t begin, size_t end) {
+          Bounds bounds, centroids;
+          for(size_t i = begin; i < end; i++)
+          {
+            const BvhBox& box = m_boxes[i];
+            m_centroids[i]    = (box.bboxMin + box.bboxMax) * 0.5f;
+            bvh.items[i]      = uint32_t(i);
+            bounds.grow(Bounds{box.bboxMin, box.bboxMax});
+            centroids.grow(m_centroids[i]);
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          root.bounds.grow(bounds);
+          root.centroidBounds.grow(centroids);
+        },
+        m_threadCount);
+
+    // Top of the tree, on the calling thread with the binning of large nodes spread over
+    // the workers, until there are enough subtrees to keep all of them busy
+    m_items = bvh.items.data();
+    bvh.nodes.resize(2);  // Root, then one unused node so that the pairs are cache aligned
+    size_t subtreeSize = m_threadCount > 1 ? std::max<size_t>(count / (m_threadCount * 8), 1024) : count;
+    std::vector<Task> subtrees;
+    std::vector<Task> stack{root};
+    while(!stack.empty())
+    {
+      Task task = stack.back();
+      stack.pop_back();
+      if(task.count() <= subtreeSize)
+      {
+        subtrees.push_back(task);
+        continue;
+      }
+      Task left, right;
+      if(!split(task, left, right, bvh.nodes[task.node], true))
+        continue;
+      left.node  = uint32_t(bvh.nodes.size());
+      right.node = left.node + 1;
+      bvh.nodes[task.node].offset = left.node;
+      bvh.nodes.resize(bvh.nodes.size() + 2);
+      stack.push_back(right);
+      stack.push_back(left);
+    }
+
+    // Subtrees in parallel, largest first, each in its own array: root at 0 and pairs from 1
+    std::sort(subtrees.begin(), subtrees.end(), [](const Task& a, const Task& b) { return a.count() > b.count(); });
+    std::vector<std::vector<BvhNode>> subtreeNodes(subtrees.size());
+    parallelFor(
+        subtrees.size(), [&](size_t i) { subtreeNodes[i] = buildSubtree(subtrees[i]); }, m_threadCount);
+
+    // Stitching: the subtree root replaces its placeholder, the other nodes are appended.
+    // The node array always has an even size, so the pairs stay on even indices.
+    for(size_t i = 0; i < subtrees.size(); i++)
+    {
+      const std::vector<BvhNode>& nodes = subtreeNodes[i];
+      uint32_t                    base  = uint32_t(bvh.nodes.size()) - 1;  // Local index 1 lands on an even index
+      auto                        remap = [base](BvhNode node) {
+        if(!node.isLeaf())
+          node.offset += base;
+        return node;
+      };
+      bvh.nodes[subtrees[i].node] = remap(nodes[0]);
+      for(size_t n = 1; n < nodes.size(); n++)
+        bvh.nodes.push_back(remap(nodes[n]));
+    }
+    return bvh;
+  }
+
+private:
+  std::vector<BvhNode> buildSubtree(const Task& root)
+  {
+    std::vector<BvhNode> nodes(1);
+    std::vector<Task>    stack{root};
+    stack.back().node = 0;
+    while(!stack.empty())
+    {
+      Task task = stack.back();
+      stack.pop_back();
+      Task left, right;
+      if(!split(task, left, right, nodes[task.node], false))
+        continue;
+      left.node              = uint32_t(nodes.size());
+      right.node             = left.node + 1;
+      nodes[task.node].offset = left.node;
+      nodes.resize(nodes.size() + 2);
+      stack.push_back(right);
+      stack.push_back(left);
+    }
+    return nodes;
+  }
+
+  // Writes the node of the task. Returns true with the two children tasks if it is split,
+  // false if it is a leaf.
+  bool split(const Task& task, Task& left, Task& right, BvhNode& node, bool parallel)
+  {
+    node.bboxMin = task.bounds.lo;
+    node.bboxMax = task.bounds.hi;
+    node.offset  = task.begin;
+    node.count   = task.count();
+
+    uint32_t count = task.count();
+    if(count == 1)
+      return false;
+
+    Split best;
+    if(task.depth < kBvhMaxDepth - 32)
+      best = findSplit(task, parallel);
+
+    float leafCost = m_settings.intersectionCost * count;
+    if(count <= m_settings.maxLeafSize && (best.axis < 0 || leafCost <= best.cost))
+      return false;
+
+    uint32_t middle;
+    if(best.axis >= 0)
+    {
+      int           axis    = best.axis;
+      const Bounds& cb      = task.centroidBounds;
+      float         scale   = m_settings.binCount / (cb.hi[axis] - cb.lo[axis]);
+      auto          isLeft  = [&](uint32_t item) { return binIndex(m_centroids[item][axis], cb.lo[axis], scale) < best.bin; };
+      middle                = uint32_t(std::partition(m_items + task.begin, m_items + task.end, isLeft) - m_items);
+      left.bounds           = best.left;
+      right.bounds          = best.right;
+      left.centroidBounds   = best.leftCentroids;
+      right.centroidBounds  = best.rightCentroids;
+    }
+    else
+    {
+      // Median split on the largest axis of the centroids: too deep, or all centroids in one bin
+      vec3f extent = task.centroidBounds.hi - task.centroidBounds.lo;
+      int   axis   = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+      middle       = task.begin + count / 2;
+      std::nth_element(m_items + task.begin, m_items + middle, m_items + task.end,
+                       [&](uint32_t a, uint32_t b) { return m_centroids[a][axis] < m_centroids[b][axis]; });
+      for(uint32_t i = task.begin; i < task.end; i++)
+      {
+        uint32_t item = m_items[i];
+        Task&    side = i < middle ? left : right;
+        side.bounds.grow(Bounds{m_boxes[item].bboxMin, m_boxes[item].bboxMax});
+        side.centroidBounds.grow(m_centroids[item]);
+      }
+    }
+
+    left.begin  = task.begin;
+    left.end    = middle;
+    right.begin = middle;
+    right.end   = task.end;
+    left.depth = right.depth = task.depth + 1;
+    node.count               = 0;
+    return true;
+  }
+
+  static uint32_t binIndex(float centroid, float lo, float scale)
+  {
+    return std::min(uint32_t(std::max((centroid - lo) * scale, 0.f)), kBvhMaxBins - 1);
+  }
+
+  void binItems(const Task& task, size_t begin, size_t end, BinSet& bins) const
+  {
+    const Bounds& cb = task.centroidBounds;
+    float         scale[3];
+    for(int axis = 0; axis < 3; axis++)
+    {
+      float extent = cb.hi[axis] - cb.lo[axis];
+      scale[axis]  = extent > 0.f ? m_settings.binCount / extent : 0.f;
+    }
+    uint32_t lastBin = m_settings.binCount - 1;
+    for(size_t i = begin; i < end; i++)
+    {
+      uint32_t      item = m_items[i];
+      const vec3f&  c    = m_centroids[item];
+      Bounds        box{m_boxes[item].bboxMin, m_boxes[item].bboxMax};
+      for(int axis = 0; axis < 3; axis++)
+      {
+        Bin& bin = bins.bins[axis][std::min(binIndex(c[axis], cb.lo[axis], scale[axis]), lastBin)];
+        bin.bounds.grow(box);
+        bin.centroids.grow(c);
+        bin.count++;
+      }
+    }
+  }
+
+  Split findSplit(const Task& task, bool parallel)
+  {
+    uint32_t binCount = m_settings.binCount;
+    BinSet   bins;
+    if(parallel)
+    {
+      std::mutex mutex;
+      parallelRanges(
+          task.count(), 16384,
+          [&](size_t begin, size_t end) {
+            BinSet local;
+            binItems(task, task.begin + begin, task.begin + end, local);
+            std::lock_guard<std::mutex> lock(mutex);
+            bins.merge(local, binCount);
+          },
+          m_threadCount);
+    }
+    else
+    {
+      binItems(task, task.begin, task.end, bins);
+    }
+
+    // Sweep: costs of all planes between bins, from the right then from the left
+    Split best;
+    float invArea = 1.f / std::max(task.bounds.area(), FLT_MIN);
+    for(int axis = 0; axis < 3; axis++)
+    {
+      if(task.centroidBounds.hi[axis] <= task.centroidBounds.lo[axis])
+        continue;
+      const Bin* axisBins = bins.bins[axis];
+      float      rightArea[kBvhMaxBins];
+      uint32_t   rightCount[kBvhMaxBins];
+      Bounds     accumulated;
+      uint32_t   accumulatedCount = 0;
+      for(uint32_t b = binCount - 1; b > 0; b--)
+      {
+        accumulated.grow(axisBins[b].bounds);
+        accumulatedCount += axisBins[b].count;
+        rightArea[b]  = accumulated.area();
+        rightCount[b] = accumulatedCount;
+      }
+      accumulated      = Bounds();
+      accumulatedCount = 0;
+      for(uint32_t b = 1; b < binCount; b++)
+      {
+        accumulated.grow(axisBins[b - 1].bounds);
+        accumulatedCount += axisBins[b - 1].count;
+        if(accumulatedCount == 0 || rightCount[b] == 0)
+          continue;
+        float cost = m_settings.traversalCost
+                     + m_settings.intersectionCost * invArea
+                           * (accumulated.area() * accumulatedCount + rightArea[b] * rightCount[b]);
+        if(cost < best.cost)
+        {
+          best.axis = axis;
+          best.bin  = b;
+          best.cost = cost;
+        }
+      }
+    }
+
+    // Bounds of both sides of the best plane
+    if(best.axis >= 0)
+    {
+      for(uint32_t b = 0; b < binCount; b++)
+      {
+        const Bin& bin = bins.bins[best.axis][b];
+        if(b < best.bin)
+        {
+          best.left.grow(bin.bounds);
+          best.leftCentroids.grow(bin.centroids);
+        }
+        else
+        {
+          best.right.grow(bin.bounds);
+          best.rightCentroids.grow(bin.centroids);
+        }
+      }
+    }
+    return best;
+  }
+
+  const BvhBox*      m_boxes;
+  BvhBuildSettings   m_settings;
+  uint32_t           m_threadCount{1};
+  std::vector<vec3f> m_centroids;
+  uint32_t*          m_items{nullptr};
+};
+}  // namespace
+
+Bvh buildBvh(const BvhBox* boxes, size_t count, const BvhBuildSettings& settings)
+{
+  if(settings.method == BvhBuildMethod::eMorton)
+    return buildLbvh(boxes, count, settings);
+  return BvhBuilder(boxes, count, settings).build();
+}
+
+float bvhSahCost(const Bvh& bvh, const BvhBuildSettings& settings)
+{
+  return bvhStats(bvh, settings).sahCost;
+}
+
+BvhStats bvhStats(const Bvh& bvh, const BvhBuildSettings& settings)
+{
+  BvhStats stats;
+  if(bvh.empty())
+    return stats;
+
+  float invRootArea = 1.f / std::max(nodeArea(bvh.nodes[0]), FLT_MIN);
+  std::vector<std::pair<uint32_t, uint32_t>> stack{{0, 1}};  // Node and depth
+  while(!stack.empty())
+  {
+    auto [index, depth] = stack.back();
+    stack.pop_back();
+    const BvhNode& node = bvh.nodes[index];
+    float          area = nodeArea(node) * invRootArea;
+    stats.nodeCount++;
+    stats.maxDepth = std::max<size_t>(stats.maxDepth, depth);
+    if(node.isLeaf())
+    {
+      stats.leafCount++;
+      stats.sahCost += settings.intersectionCost * node.count * area;
+    }
+    else
+    {
+      stats.sahCost += settings.traversalCost * area;
+      stack.push_back({node.offset, depth + 1});
+      stack.push_back({node.offset + 1, depth + 1});
+    }
+  }
+  stats.averageLeafSize = float(bvh.items.size()) / float(stats.leafCount);
+  return stats;
+}
+
+void refitBvh(Bvh& bvh, const BvhBox* boxes)
+{
+  // Children always come after their parent in the node array
+  for(size_t i = bvh.nodes.size(); i-- > 0;)
+  {
+    BvhNode& node = bvh.nodes[i];
+    if(i == 1)
+      continue;  // Unused
+    Bounds bounds;
+    if(node.isLeaf())
+    {
+      for(uint32_t k = node.offset; k < node.offset + node.count; k++)
+        bounds.grow(Bounds{boxes[bvh.items[k]].bboxMin, boxes[bvh.items[k]].bboxMax});
+    }
+    else
+    {
+      for(uint32_t k = node.offset; k < node.offset + 2; k++)
+        bounds.grow(Bounds{bvh.nodes[k].bboxMin, bvh.nodes[k].bboxMax});
+    }
+    node.bboxMin = bounds.lo;
+    node.bboxMax = bounds.hi;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Triangle meshes
+//
+
+TriangleBvh buildTriangleBvh(const nvmath::vec3f*    positions,
+                             size_t                  positionStride,
+                             const uint32_t*         indices,
+                             size_t                  indexCount,
+                             const BvhBuildSettings& settings)
+{
+  const uint8_t* bytes    = reinterpret_cast<const uint8_t*>(positions);
+  auto           position = [&](uint32_t index) -> const vec3f& {
+    return *reinterpret_cast<const vec3f*>(bytes + index * positionStride);
+  };
+
+  size_t              triangleCount = indexCount / 3;
+  std::vector<BvhBox> boxes(triangleCount);
+  uint32_t            threadCount = settings.threadCount ? settings.threadCount : getWorkerCount();
+  parallelRanges(
+      triangleCount, 4096,
+      [&](size_t begin, size_t end) {
+        for(size_t t = begin; t < end; t++)
+        {
+          for(int k = 0; k < 3; k++)
+          {
+            const vec3f& p  = position(indices[t * 3 + k]);
+            boxes[t].bboxMin = nvmath::nv_min(boxes[t].bboxMin, p);
+            boxes[t].bboxMax = nvmath::nv_max(boxes[t].bboxMax, p);
+          }
+        }
+      },
+      threadCount);
+
+  TriangleBvh result;
+  result.bvh = buildBvh(boxes.data(), triangleCount, settings);
+
+  // Triangles in leaf order
+  result.triangles.resize(triangleCount);
+  parallelRanges(
+      triangleCount, 4096,
+      [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+          uint32_t     t        = result.bvh.items[i];
+          BvhTriangle& triangle = result.triangles[i];
+          triangle.v0           = position(indices[t * 3 + 0]);
+          triangle.triangle     = t;
+          triangle.v1           = position(indices[t * 3 + 1]);
+          triangle.v2           = position(indices[t * 3 + 2]);
+        }
+      },
+      threadCount);
+  return result;
+}
+
+namespace {
+// Ordered traversal: the closer child is visited first, the other one is pushed.
+// With anyHit the traversal stops at the first intersection the filter accepts.
+template <bool anyHit>
+bool traverse(const TriangleBvh& tbvh, const BvhRay& ray, BvhHit& hit, const BvhHitFilter* filter)
+{
+  const auto& nodes = tbvh.bvh.nodes;
+  if(nodes.empty())
+    return false;
+
+  struct Entry
+  {
+    uint32_t node;
+    float    tEnter;
+  };
+  Entry         stack[kBvhMaxDepth];
+  uint32_t      stackSize    = 0;
+  vec3f         invDirection = safeInverse(ray.direction);
+  WatertightRay wray(ray.direction);
+  float         tMax  = ray.tMax;
+  bool          found = false;
+
+  if(intersectBox(nodes[0], ray.origin, invDirection, ray.tMin, tMax) == FLT_MAX)
+    return false;
+  uint32_t index = 0;
+  while(true)
+  {
+    const BvhNode& node = nodes[index];
+    if(node.isLeaf())
+    {
+      for(uint32_t i = node.offset; i < node.offset + node.count; i++)
+      {
+        BvhHit candidate;
+        if(intersectTriangle(tbvh.triangles[i], ray, wray, tMax, candidate) && (!filter || (*filter)(candidate)))
+        {
+          if(anyHit)
+            return true;
+          found = true;
+          hit   = candidate;
+          tMax  = hit.t;
+        }
+      }
+    }
+    else
+    {
+      float    near   = intersectBox(nodes[node.offset], ray.origin, invDirection, ray.tMin, tMax);
+      float    far    = intersectBox(nodes[node.offset + 1], ray.origin, invDirection, ray.tMin, tMax);
+      uint32_t first  = node.offset;
+      uint32_t second = node.offset + 1;
+      if(far < near)
+      {
+        std::swap(near, far);
+        std::swap(first, second);
+      }
+      if(near != FLT_MAX)
+      {
+        if(far != FLT_MAX)
+          stack[stackSize++] = {second, far};
+        index = first;
+        continue;
+      }
+    }
+
+    // Next node still in front of the closest hit, with the slack of the box tests
+    do
+    {
+      if(stackSize == 0)
+        return found;
+      stackSize--;
+    } while(stack[stackSize].tEnter > tMax * kBvhRobustExit);
+    index = stack[stackSize].node;
+  }
+}
+}  // namespace
+
+bool intersectClosest(const TriangleBvh& bvh, const BvhRay& ray, BvhHit& hit)
+{
+  hit = BvhHit();
+  return traverse<false>(bvh, ray, hit, nullptr);
+}
+
+bool intersectAny(const TriangleBvh& bvh, const BvhRay& ray)
+{
+  BvhHit hit;
+  return traverse<true>(bvh, ray, hit, nullptr);
+}
+
+bool intersectClosest(const TriangleBvh& bvh, const BvhRay& ray, BvhHit& hit, const BvhHitFilter& filter)
+{
+  hit = BvhHit();
+  return traverse<false>(bvh, ray, hit, filter ? &filter : nullptr);
+}
+
+bool intersectAny(const TriangleBvh& bvh, const BvhRay& ray, const BvhHitFilter& filter)
+{
+  BvhHit hit;
+  return traverse<true>(bvh, ray, hit, filter ? &filter : nullptr);
+}
@@ -0,0 +1,271 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+#include "simd.h"
+
+// CPU-side bounding volume hierarchy, for picking, validation and fallback rendering
+// against the geometry given to the acceleration structure builds.
+// The builder bins the centroids of the primitives (surface area heuristic over a fixed
+// number of bins per axis). The top of the tree is split with the binning spread over the
+// worker threads, then the subtrees are built concurrently and stitched in one flat array.
+// Nodes are 32 bytes and the two children of a node are stored next to each other, on the
+// same 64-byte cache line.
+
+struct BvhBox
+{
+  nvmath::vec3f bboxMin{FLT_MAX, FLT_MAX, FLT_MAX};
+  nvmath::vec3f bboxMax{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+};
+
+struct alignas(32) BvhNode
+{
+  nvmath::vec3f bboxMin;
+  uint32_t      offset;  // Interior node: first child, the second one follows. Leaf: first item in Bvh::items
+  nvmath::vec3f bboxMax;
+  uint32_t      count;  // Items of a leaf, 0 for interior nodes
+
+  bool isLeaf() const { return count != 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "Two nodes per cache line");
+
+// Allocator of the node array, so that sibling pairs never straddle two cache lines
+template <class T, size_t Alignment>
+struct AlignedAllocator
+{
+  using value_type = T;
+  template <class U>
+  struct rebind
+  {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+  {
+  }
+
+  T*   allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+  void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+  bool operator==(const AlignedAllocator&) const { return true; }
+  bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+struct Bvh
+{
+  // Root at index 0 and index 1 unused, so that every sibling pair starts on an even index
+  std::vector<BvhNode, AlignedAllocator<BvhNode, 64>> nodes;
+  std::vector<uint32_t>                               items;  // Primitive of each leaf slot
+
+  bool empty() const { return nodes.empty(); }
+};
+
+enum class BvhBuildMethod
+{
+  eBinnedSah,  // Best trees, for static geometry
+  eMorton,     // Linear BVH over Morton codes (lbvh.h): several times faster, for geometry rebuilt every frame
+};
+
+struct BvhBuildSettings
+{
+  uint32_t       binCount{16};        // Bins per axis, at most kBvhMaxBins
+  uint32_t       maxLeafSize{4};      // Larger leaves are always split
+  float          traversalCost{1.f};  // Cost of a node visit, relative to the intersection of one item
+  float          intersectionCost{1.f};
+  uint32_t       threadCount{0};  // 0: getWorkerCount()
+  BvhBuildMethod method{BvhBuildMethod::eBinnedSah};
+};
+
+const uint32_t kBvhMaxBins = 64;
+
+// Bound of the depth of the trees, hence of the traversal stacks. Deeper nodes are split at
+// the median instead of with the SAH, which halves the items at each level.
+const uint32_t kBvhMaxDepth = 64;
+
+// Hierarchy over `count` boxes, items being indices in the `boxes` array
+Bvh buildBvh(const BvhBox* boxes, size_t count, const BvhBuildSettings& settings = {});
+
+// SAH cost of the hierarchy, relative to the surface of its root
+float bvhSahCost(const Bvh& bvh, const BvhBuildSettings& settings = {});
+
+struct BvhStats
+{
+  size_t nodeCount{0};  // Interior nodes and leaves
+  size_t leafCount{0};
+  size_t maxDepth{0};
+  float  averageLeafSize{0.f};
+  float  sahCost{0.f};
+};
+
+BvhStats bvhStats(const Bvh& bvh, const BvhBuildSettings& settings = {});
+
+// Recomputes the boxes of all nodes from new `boxes` of the items, keeping the tree as it is.
+// Much cheaper than a build, but the quality degrades as the items move away from where they
+// were built: check bvhSahCost and rebuild when it grew too much.
+void refitBvh(Bvh& bvh, const BvhBox* boxes);
+
+//--------------------------------------------------------------------------------------------------
+// Triangle meshes
+//
+
+// Triangle as stored in the leaves of a TriangleBvh, in leaf order: the vertices are read
+// along with the nodes instead of through the index and vertex buffers. The vertices are
+// stored as they are, not as edges, so that neighbors share their edges exactly.
+struct alignas(16) BvhTriangle
+{
+  nvmath::vec3f v0;
+  uint32_t      triangle;  // In the source index buffer
+  nvmath::vec3f v1;
+  float         padding1{0.f};
+  nvmath::vec3f v2;
+  float         padding2{0.f};
+};
+
+struct TriangleBvh
+{
+  Bvh                      bvh;        // Items are the source triangles
+  std::vector<BvhTriangle> triangles;  // Triangle of each item: leaves index this array directly
+};
+
+// Positions are read with a stride in bytes, like buildMeshlets, so interleaved vertices can be used directly
+TriangleBvh buildTriangleBvh(const nvmath::vec3f*    positions,
+                             size_t                  positionStride,
+                             const uint32_t*         indices,
+                             size_t                  indexCount,
+                             const BvhBuildSettings& settings = {});
+
+struct BvhRay
+{
+  nvmath::vec3f origin;
+  float         tMin{0.f};
+  nvmath::vec3f direction;
+  float         tMax{FLT_MAX};
+};
+
+struct BvhHit
+{
+  float    t{FLT_MAX};
+  float    u{0.f};  // Barycentrics of v1 and v2
+  float    v{0.f};
+  uint32_t triangle{~0u};  // In the source index buffer, ~0u if nothing was hit
+
+  bool valid() const { return triangle != ~0u; }
+};
+
+// Closest hit between ray.tMin and ray.tMax. Returns false if nothing was hit.
+bool intersectClosest(const TriangleBvh& bvh, const BvhRay& ray, BvhHit& hit);
+
+// True if anything is hit between ray.tMin and ray.tMax (shadow rays)
+bool intersectAny(const TriangleBvh& bvh, const BvhRay& ray);
+
+// Called on each candidate hit, like an any-hit shader: returning false ignores the hit
+// (alpha tested or blended surfaces) and the traversal goes on
+using BvhHitFilter = std::function<bool(const BvhHit&)>;
+
+bool intersectClosest(const TriangleBvh& bvh, const BvhRay& ray, BvhHit& hit, const BvhHitFilter& filter);
+bool intersectAny(const TriangleBvh& bvh, const BvhRay& ray, const BvhHitFilter& filter);
+
+//--------------------------------------------------------------------------------------------------
+// Ray/triangle test shared by the traversal kernels
+// Watertight test of Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013):
+// the vertices are sheared into the space of the ray, so rays going through an edge or a vertex
+// shared by several triangles hit at least one of them. The box tests of the traversals are
+// made conservative to match.
+//
+
+struct WatertightRay
+{
+  int   kx, ky, kz;  // kz is the dominant axis of the direction
+  float sx, sy, sz;  // Shear
+
+  WatertightRay() = default;
+  explicit WatertightRay(const nvmath::vec3f& direction)
+  {
+    float ax = direction.x < 0.f ? -direction.x : direction.x;
+    float ay = direction.y < 0.f ? -direction.y : direction.y;
+    float az = direction.z < 0.f ? -direction.z : direction.z;
+    kz       = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+    kx       = (kz + 1) % 3;
+    ky       = (kx + 1) % 3;
+    if(direction[kz] < 0.f)
+      std::swap(kx, ky);  // Keeps the winding
+    sx = direction[kx] / direction[kz];
+    sy = direction[ky] / direction[kz];
+    sz = 1.f / direction[kz];
+  }
+};
+
+// Exit distances of the box tests are scaled up by this, so that rounding never culls a box
+// that the watertight test would hit (Ize, "Robust BVH Ray Traversal", JCGT 2013)
+const float kBvhRobustExit = 1.0000004f;
+
+// Updates the hit if the triangle is hit before tMax
+inline bool intersectTriangle(const BvhTriangle& triangle, const BvhRay& ray, const WatertightRay& wray, float tMax, BvhHit& hit)
+{
+  nvmath::vec3f a  = triangle.v0 - ray.origin;
+  nvmath::vec3f b  = triangle.v1 - ray.origin;
+  nvmath::vec3f c  = triangle.v2 - ray.origin;
+  float         ax = a[wray.kx] - wray.sx * a[wray.kz];
+  float         ay = a[wray.ky] - wray.sy * a[wray.kz];
+  float         bx = b[wray.kx] - wray.sx * b[wray.kz];
+  float         by = b[wray.ky] - wray.sy * b[wray.kz];
+  float         cx = c[wray.kx] - wray.sx * c[wray.kz];
+  float         cy = c[wray.ky] - wray.sy * c[wray.kz];
+
+  // Scaled barycentrics, recomputed in double precision on the edges. The products are rounded
+  // on their own, so that an edge shared by two triangles gives them opposite signs.
+  float u = unfused(cx * by) - unfused(cy * bx);
+  float v = unfused(ax * cy) - unfused(ay * cx);
+  float w = unfused(bx * ay) - unfused(by * ax);
+  if(u == 0.f || v == 0.f || w == 0.f)
+  {
+    u = float(double(cx) * double(by) - double(cy) * double(bx));
+    v = float(double(ax) * double(cy) - double(ay) * double(cx));
+    w = float(double(bx) * double(ay) - double(by) * double(ax));
+  }
+  if((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f))
+    return false;
+  float det = u + v + w;
+  if(det == 0.f)
+    return false;
+
+  float invDet = 1.f / det;
+  float t = (u * wray.sz * a[wray.kz] + v * wray.sz * b[wray.kz] + w * wray.sz * c[wray.kz]) * invDet;
+  if(!(t >= ray.tMin && t < tMax))
+    return false;
+  hit.t        = t;
+  hit.u        = v * invDet;
+  hit.v        = w * invDet;
+  hit.triangle = triangle.triangle;
+  return true;
+}
+
+// Inverse of the direction for the slab tests, without infinities
+inline nvmath::vec3f safeInverse(const nvmath::vec3f& d)
+{
+  auto inverse = [](float f) { return (f < 0.f ? -f : f) > 1e-20f ? 1.f / f : (f < 0.f ? -1e20f : 1e20f); };
+  return nvmath::vec3f(inverse(d.x), inverse(d.y), inverse(d.z));
+}
+
+// Slab test, returns the entry distance or FLT_MAX if the box is missed before tMax
+inline float intersectBox(const BvhNode& node, const nvmath::vec3f& origin, const nvmath::vec3f& invDirection, float tMin, float tMax)
+{
+  nvmath::vec3f t0    = (node.bboxMin - origin) * invDirection;
+  nvmath::vec3f t1    = (node.bboxMax - origin) * invDirection;
+  float         enter = std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::max(std::min(t0.z, t1.z), tMin));
+  float         exit  = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::min(std::max(t0.z, t1.z), tMax));
+  return enter <= exit * kBvhRobustExit ? enter : FLT_MAX;
+}
@@ -0,0 +1,135 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "bvh_analysis.h"
+#include <cmath>
+
+namespace {
+using nvmath::vec3f;
+
+float boxArea(const vec3f& lo, const vec3f& hi)
+{
+  vec3f d = hi - lo;
+  return std::max(0.f, d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Area of the intersection of two boxes, 0 if they are disjoint
+float overlapArea(const BvhNode& a, const BvhNode& b)
+{
+  vec3f lo = nvmath::nv_max(a.bboxMin, b.bboxMin);
+  vec3f hi = nvmath::nv_min(a.bboxMax, b.bboxMax);
+  if(lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+    return 0.f;
+  return boxArea(lo, hi);
+}
+
+float triangleArea(const vec3f& v0, const vec3f& v1, const vec3f& v2)
+{
+  return 0.5f * nvmath::length(nvmath::cross(v1 - v0, v2 - v0));
+}
+
+// Leaves are only measured against their triangles if there are some
+BvhQuality measure(const Bvh& bvh, const BvhTriangle* triangles, const BvhBuildSettings& settings)
+{
+  BvhQuality quality;
+  quality.stats = bvhStats(bvh, settings);
+  if(bvh.empty())
+    return quality;
+
+  const auto& nodes       = bvh.nodes;
+  float       invRootArea = 1.f / std::max(boxArea(nodes[0].bboxMin, nodes[0].bboxMax), FLT_MIN);
+  double      childArea = 0.0, sharedArea = 0.0;
+  double      leafArea = 0.0, emptyArea = 0.0;
+  // Children always come after their parent and every node but index 1 is used
+  for(size_t i = 0; i < nodes.size(); i++)
+  {
+    if(i == 1)
+      continue;
+    const BvhNode& node = nodes[i];
+    float          area = boxArea(node.bboxMin, node.bboxMax);
+    if(node.isLeaf())
+    {
+      if(quality.leafSizes.size() <= node.count)
+        quality.leafSizes.resize(node.count + 1);
+      quality.leafSizes[node.count]++;
+      if(!triangles)
+        continue;
+
+      float covered = 0.f;
+      for(uint32_t k = node.offset; k < node.offset + node.count; k++)
+        covered += triangleArea(triangles[k].v0, triangles[k].v1, triangles[k].v2);
+      // Stacked triangles can cover more than the box
+      leafArea += area;
+      emptyArea += std::max(0.f, area - covered);
+    }
+    else
+    {
+      const BvhNode& left   = nodes[node.offset];
+      const BvhNode& right  = nodes[node.offset + 1];
+      float          shared = overlapArea(left, right);
+      childArea += boxArea(left.bboxMin, left.bboxMax) + boxArea(right.bboxMin, right.bboxMax);
+      sharedArea += 2.0 * shared;
+      quality.overlapSah += settings.traversalCost * shared * invRootArea;
+    }
+  }
+  quality.overlapRatio   = childArea > 0.0 ? float(sharedArea / childArea) : 0.f;
+  quality.leafEmptySpace = leafArea > 0.0 ? float(emptyArea / leafArea) : 0.f;
+  return quality;
+}
+}  // namespace
+
+BvhQuality bvhQuality(const Bvh& bvh, const BvhBuildSettings& settings)
+{
+  return measure(bvh, nullptr, settings);
+}
+
+BvhQuality bvhQuality(const TriangleBvh& bvh, const BvhBuildSettings& settings)
+{
+  return measure(bvh.bvh, bvh.triangles.data(), settings);
+}
+
+TriangleSizeStats triangleSizeStats(const nvmath::vec3f* positions, size_t positionStride, const uint32_t* indices, size_t indexCount)
+{
+  const uint8_t* bytes    = reinterpret_cast<const uint8_t*>(positions);
+  auto           position = [&](uint32_t index) -> const vec3f& {
+    return *reinterpret_cast<const vec3f*>(bytes + index * positionStride);
+  };
+
+  TriangleSizeStats stats;
+  stats.triangleCount = indexCount / 3;
+  if(stats.triangleCount == 0)
+    return stats;
+
+  std::vector<float> areas(stats.triangleCount);
+  double             boxTotal = 0.0, emptyTotal = 0.0;
+  for(size_t t = 0; t < stats.triangleCount; t++)
+  {
+    const vec3f& v0   = position(indices[t * 3 + 0]);
+    const vec3f& v1   = position(indices[t * 3 + 1]);
+    const vec3f& v2   = position(indices[t * 3 + 2]);
+    float        area = triangleArea(v0, v1, v2);
+    float        box  = boxArea(nvmath::nv_min(nvmath::nv_min(v0, v1), v2), nvmath::nv_max(nvmath::nv_max(v0, v1), v2));
+    areas[t]          = area;
+    if(area == 0.f)
+      stats.degenerateCount++;
+    if(box > 0.f)
+    {
+      float empty = std::max(0.f, 1.f - area / box);
+      boxTotal += box;
+      emptyTotal += empty * box;
+      if(empty > kSliverEmptySpace)
+        stats.sliverCount++;
+    }
+  }
+  stats.boxEmptySpace = boxTotal > 0.0 ? float(emptyTotal / boxTotal) : 0.f;
+
+  const double percentiles[5] = {0.0, 0.1, 0.5, 0.9, 1.0};
+  for(int k = 0; k < 5; k++)
+  {
+    auto nth = areas.begin() + size_t(percentiles[k] * double(areas.size() - 1) + 0.5);
+    std::nth_element(areas.begin(), nth, areas.end());
+    stats.area[k] = *nth;
+  }
+  return stats;
+}
@@ -0,0 +1,53 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "bvh.h"
+
+// Quality measures of triangle hierarchies, to judge the geometry given to the BLAS builds.
+// The driver builds are opaque, but a binned SAH tree built on the CPU is a good proxy of what
+// ePreferFastTrace can reach on the same triangles: where it is poor, pre-splitting the large
+// or thin triangles, or merging small primitives, is where the traversal time goes.
+// Areas are half surface areas, like the SAH of the builders.
+
+struct BvhQuality
+{
+  BvhStats stats;
+
+  // Area shared by the boxes of sibling nodes: rays crossing it visit both subtrees.
+  // overlapSah is its contribution to the SAH cost (relative to the root like sahCost),
+  // overlapRatio the fraction of the area of all children that is shared with their sibling.
+  float overlapSah{0.f};
+  float overlapRatio{0.f};
+
+  // Fraction of the area of the leaves not covered by their triangles, weighted by the area of
+  // each leaf (the probability that a ray enters it). Near 1, rays mostly enter leaves to miss.
+  // Only measured on triangle hierarchies.
+  float leafEmptySpace{0.f};
+
+  std::vector<size_t> leafSizes;  // Number of leaves holding 1, 2, ... items, from index 1
+};
+
+BvhQuality bvhQuality(const Bvh& bvh, const BvhBuildSettings& settings = {});
+BvhQuality bvhQuality(const TriangleBvh& bvh, const BvhBuildSettings& settings = {});
+
+struct TriangleSizeStats
+{
+  size_t triangleCount{0};
+  size_t degenerateCount{0};  // Zero area, never hit
+
+  // Distribution of the triangle areas: minimum, 10th, 50th, 90th percentile and maximum
+  float area[5]{0.f, 0.f, 0.f, 0.f, 0.f};
+
+  // Empty space of the triangle boxes: 1 - triangle area / box area. It is 0.5 for a right
+  // triangle in an axis plane and goes to 1 for long diagonal triangles, whose box is mostly
+  // empty however the tree is built. boxEmptySpace is weighted by the box areas.
+  float  boxEmptySpace{0.f};
+  size_t sliverCount{0};  // Triangles whose box is more than kSliverEmptySpace empty: pre-split candidates
+};
+
+const float kSliverEmptySpace = 0.9f;
+
+// Positions are read with a stride in bytes, like buildTriangleBvh
+TriangleSizeStats triangleSizeStats(const nvmath::vec3f* positions, size_t positionStride, const uint32_t* indices, size_t indexCount);
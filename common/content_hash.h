@@ -0,0 +1,21 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit content hash (xxHash64 algorithm), used to key the baked caches on the
+// content of their source files rather than on timestamps.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Hash of the whole content of a file. Returns false if the file cannot be read.
+bool hashFile(const std::string& filename, uint64_t& hash, uint64_t seed = 0);
+
+// Order dependent combination of two hashes
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+  return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
@@ -0,0 +1,53 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "content_hash.h"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Table of unique values, for the arrays uploaded as they are (materials, ...).
+// Values are compared byte for byte, so T must not have padding: two values differing
+// only by their padding would be kept apart. The index of a value never changes.
+template <class T>
+class DedupTable
+{
+  static_assert(std::is_trivially_copyable<T>::value, "Values are hashed and compared as bytes");
+
+public:
+  // Index of the value identical to `value`, added at the end of the table if there is none
+  uint32_t findOrAdd(const T& value)
+  {
+    m_requested++;
+    uint64_t hash  = hashBytes(&value, sizeof(T));
+    auto     range = m_index.equal_range(hash);
+    for(auto it = range.first; it != range.second; ++it)
+      if(memcmp(&m_values[it->second], &value, sizeof(T)) == 0)
+        return it->second;
+
+    uint32_t index = static_cast<uint32_t>(m_values.size());
+    m_values.push_back(value);
+    m_index.emplace(hash, index);
+    return index;
+  }
+
+  const std::vector<T>& values() const { return m_values; }
+  size_t                size() const { return m_values.size(); }
+  size_t                requested() const { return m_requested; }  // Calls to findOrAdd, duplicates included
+
+  void clear()
+  {
+    m_values.clear();
+    m_index.clear();
+    m_requested = 0;
+  }
+
+private:
+  std::vector<T>                             m_values;
+  std::unordered_multimap<uint64_t, uint32_t> m_index;  // Hash of the bytes to index in m_values
+  size_t                                     m_requested{0};
+};
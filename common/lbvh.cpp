@@ -0,0 +1,472 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "lbvh.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+namespace {
+using nvmath::vec3f;
+
+// The 10 low bits of v, spread to every third bit
+inline uint32_t expandBits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// Point in [0, 1]^3
+inline uint32_t mortonCode(const vec3f& p)
+{
+  auto quantize = [](float f) { return uint32_t(std::min(std::max(f * 1024.f, 0.f), 1023.f)); };
+  return expandBits(quantize(p.x)) * 4 + expandBits(quantize(p.y)) * 2 + expandBits(quantize(p.z));
+}
+
+inline void growBox(BvhBox& box, const BvhBox& other)
+{
+  box.bboxMin = nvmath::nv_min(box.bboxMin, other.bboxMin);
+  box.bboxMax = nvmath::nv_max(box.bboxMax, other.bboxMax);
+}
+
+// Half the surface, like the binned builder
+inline float boxArea(const BvhBox& box)
+{
+  vec3f d = box.bboxMax - box.bboxMin;
+  return std::max(0.f, d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Children of the interior nodes: index of an interior node, or of a sorted item with this flag
+const uint32_t kLeafFlag = 0x80000000u;
+const uint32_t kNoEnd    = ~0u;
+
+// Array whose elements are not initialized on allocation. They are written for the first time
+// by the parallel passes, which spreads the page faults over the threads; std::vector::resize
+// would zero the whole array on the calling thread first.
+template <typename T>
+class UninitializedArray
+{
+public:
+  static_assert(std::is_trivially_destructible<T>::value, "Elements are never constructed nor destroyed");
+
+  void resize(size_t count) { m_data.reset(static_cast<T*>(::operator new(count * sizeof(T)))); }
+  void swap(UninitializedArray& other) { m_data.swap(other.m_data); }
+
+  T&       operator[](size_t i) { return m_data.get()[i]; }
+  const T& operator[](size_t i) const { return m_data.get()[i]; }
+
+private:
+  struct Free
+  {
+    void operator()(T* data) const { ::operator delete(data); }
+  };
+  std::unique_ptr<T, Free> m_data;
+};
+
+class LbvhBuilder
+{
+public:
+  LbvhBuilder(const BvhBox* boxes, size_t count, const BvhBuildSettings& settings)
+      : m_boxes(boxes)
+      , m_count(uint32_t(count))
+      , m_settings(settings)
+  {
+    m_settings.maxLeafSize = std::max(m_settings.maxLeafSize, 1u);
+    m_threadCount          = m_settings.threadCount ? m_settings.threadCount : getWorkerCount();
+  }
+
+  Bvh build()
+  {
+    Bvh bvh;
+    if(m_count == 0)
+      return bvh;
+
+    sortItems();
+    if(m_count == 1)
+    {
+      bvh.items = std::move(m_items);
+      bvh.nodes.resize(2);
+      bvh.nodes[0] = {m_boxes[0].bboxMin, 0, m_boxes[0].bboxMax, 1};
+      return bvh;
+    }
+    buildHierarchy();
+    emit(bvh);
+    bvh.items = std::move(m_items);
+    return bvh;
+  }
+
+private:
+  //------------------------------------------------------------------------------------------------
+  // Morton codes of the centroids, sorted with a parallel LSD radix sort: 3 passes of 10 bits,
+  // each counting the digits of every chunk then scattering the chunks to their offsets
+  //
+  void sortItems()
+  {
+    std::mutex mutex;
+    BvhBox     centroidBounds;
+    parallelRanges(
+        m_count, 16384,
+        [&](size_t begin, size_t end) {
+          BvhBox local;
+          for(size_t i = begin; i < end; i++)
+          {
+            vec3f c = (m_boxes[i].bboxMin + m_boxes[i].bboxMax) * 0.5f;
+            growBox(local, {c, c});
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          growBox(centroidBounds, local);
+        },
+        m_threadCount);
+
+    vec3f extent = centroidBounds.bboxMax - centroidBounds.bboxMin;
+    vec3f scale(extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f,
+                extent.z > 0.f ? 1.f / extent.z : 0.f);
+    m_codes.resize(m_count);
+    m_items.resize(m_count);
+    parallelRanges(
+        m_count, 16384,
+        [&](size_t begin, size_t end) {
+          for(size_t i = begin; i < end; i++)
+          {
+            vec3f c    = (m_boxes[i].bboxMin + m_boxes[i].bboxMax) * 0.5f;
+            m_codes[i] = mortonCode((c - centroidBounds.bboxMin) * scale);
+            m_items[i] = uint32_t(i);
+          }
+        },
+        m_threadCount);
+
+    const uint32_t kDigitBits  = 10;
+    const uint32_t kDigitCount = 1u << kDigitBits;
+    size_t         chunkCount  = std::max<size_t>(1, std::min<size_t>(m_threadCount * 4, m_count / 16384));
+    size_t         chunkSize   = (m_count + chunkCount - 1) / chunkCount;
+    std::vector<uint32_t> counts(chunkCount * kDigitCount);
+    UninitializedArray<uint32_t> codes;
+    codes.resize(m_count);
+    std::vector<uint32_t> items(m_count);
+    for(uint32_t shift = 0; shift < 30; shift += kDigitBits)
+    {
+      std::fill(counts.begin(), counts.end(), 0);
+      parallelFor(
+          chunkCount,
+          [&](size_t chunk) {
+            uint32_t* chunkCounts = &counts[chunk * kDigitCount];
+            size_t    end         = std::min<size_t>(m_count, (chunk + 1) * chunkSize);
+            for(size_t i = chunk * chunkSize; i < end; i++)
+              chunkCounts[(m_codes[i] >> shift) & (kDigitCount - 1)]++;
+          },
+          m_threadCount);
+
+      // Offsets, digit major so that the sort is stable
+      uint32_t offset = 0;
+      for(uint32_t digit = 0; digit < kDigitCount; digit++)
+        for(size_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+          uint32_t count                      = counts[chunk * kDigitCount + digit];
+          counts[chunk * kDigitCount + digit] = offset;
+          offset += count;
+        }
+
+      parallelFor(
+          chunkCount,
+          [&](size_t chunk) {
+            uint32_t* chunkOffsets = &counts[chunk * kDigitCount];
+            size_t    end          = std::min<size_t>(m_count, (chunk + 1) * chunkSize);
+            for(size_t i = chunk * chunkSize; i < end; i++)
+            {
+              uint32_t target = chunkOffsets[(m_codes[i] >> shift) & (kDigitCount - 1)]++;
+              codes[target]   = m_codes[i];
+              items[target]   = m_items[i];
+            }
+          },
+          m_threadCount);
+      m_codes.swap(codes);
+      m_items.swap(items);
+    }
+  }
+
+  //------------------------------------------------------------------------------------------------
+  // Hierarchy, boxes and SAH costs in one pass from the leaves up (Apetrei, "Fast and Simple
+  // Agglomerative LBVH Construction", 2014). Interior node i splits sorted positions i and
+  // i + 1. A node covering [first, last] is a child of node last if its right neighbor shares
+  // a longer prefix with it than its left neighbor, of node first - 1 otherwise. The first
+  // child to arrive at a node leaves its far end there and stops, the second one completes
+  // the node and goes on up.
+  //
+
+  // Distance between the keys at sorted positions i and i + 1: the smaller, the longer their
+  // common prefix. Equal codes compare their positions.
+  uint64_t distance(uint32_t i) const
+  {
+    uint64_t a = (uint64_t(m_codes[i]) << 32) | i;
+    uint64_t b = (uint64_t(m_codes[i + 1]) << 32) | (i + 1);
+    return a ^ b;
+  }
+
+  void buildHierarchy()
+  {
+    uint32_t interiorCount = m_count - 1;
+    m_children.resize(interiorCount * 2);
+    m_first.resize(interiorCount);
+    m_last.resize(interiorCount);
+    m_interiorBoxes.resize(interiorCount);
+    m_costs.resize(interiorCount);
+    m_nodesBelow.resize(interiorCount);
+    m_leafBoxes.resize(m_count);
+    UninitializedArray<std::atomic<uint32_t>> farEnds;
+    farEnds.resize(interiorCount);
+    parallelRanges(
+        m_count, 4096,
+        [&](size_t begin, size_t end) {
+          for(size_t i = begin; i < end; i++)
+            m_leafBoxes[i] = m_boxes[m_items[i]];
+          for(size_t i = begin; i < end && i < interiorCount; i++)
+            farEnds[i].store(kNoEnd, std::memory_order_relaxed);
+        },
+        m_threadCount);
+
+    std::atomic<uint32_t> root{0};
+    parallelRanges(
+        m_count, 4096,
+        [&](size_t begin, size_t end) {
+          for(size_t leaf = begin; leaf < end; leaf++)
+          {
+            uint32_t node  = uint32_t(leaf) | kLeafFlag;
+            uint32_t first = uint32_t(leaf);
+            uint32_t last  = uint32_t(leaf);
+            while(true)
+            {
+              if(first == 0 && last == m_count - 1)
+              {
+                root.store(node, std::memory_order_relaxed);
+                break;
+              }
+              uint32_t parent;
+              uint32_t farEnd;
+              if(first == 0 || (last != m_count - 1 && distance(last) < distance(first - 1)))
+              {
+                parent                     = last;
+                m_children[parent * 2 + 0] = node;
+                farEnd                     = farEnds[parent].exchange(first, std::memory_order_acq_rel);
+                if(farEnd == kNoEnd)
+                  break;
+                last = farEnd;
+              }
+              else
+              {
+                parent                     = first - 1;
+                m_children[parent * 2 + 1] = node;
+                farEnd                     = farEnds[parent].exchange(last, std::memory_order_acq_rel);
+                if(farEnd == kNoEnd)
+                  break;
+                first = farEnd;
+              }
+              completeNode(parent, first, last);
+              node = parent;
+            }
+          }
+        },
+        m_threadCount);
+    m_root = root.load();
+  }
+
+  void completeNode(uint32_t node, uint32_t first, uint32_t last)
+  {
+    uint32_t left  = m_children[node * 2 + 0];
+    uint32_t right = m_children[node * 2 + 1];
+    BvhBox   box   = childBox(left);
+    growBox(box, childBox(right));
+    float    area      = boxArea(box);
+    uint32_t itemCount = last - first + 1;
+    float    splitCost = m_settings.traversalCost * area + childCost(left) + childCost(right);
+    float    leafCost  = m_settings.intersectionCost * itemCount * area;
+    bool     collapse  = itemCount <= m_settings.maxLeafSize && leafCost <= splitCost;
+    m_first[node]         = first;
+    m_last[node]          = last;
+    m_interiorBoxes[node] = box;
+    m_costs[node]         = collapse ? leafCost : splitCost;
+    m_nodesBelow[node]    = collapse ? 0 : 2 + childNodesBelow(left) + childNodesBelow(right);
+  }
+
+  BvhBox childBox(uint32_t child) const
+  {
+    return child & kLeafFlag ? m_leafBoxes[child & ~kLeafFlag] : m_interiorBoxes[child];
+  }
+  float childCost(uint32_t child) const
+  {
+    return child & kLeafFlag ? m_settings.intersectionCost * boxArea(m_leafBoxes[child & ~kLeafFlag]) : m_costs[child];
+  }
+  uint32_t childNodesBelow(uint32_t child) const { return child & kLeafFlag ? 0 : m_nodesBelow[child]; }
+
+  //------------------------------------------------------------------------------------------------
+  // Layout of buildBvh: root at 0, index 1 unused, then the children pair of every node
+  // followed by the nodes below the first child and those below the second one. The node
+  // counts give every subtree its place, so the subtrees are written concurrently.
+  //
+  struct EmitTask
+  {
+    uint32_t child;  // As in m_children
+    uint32_t slot;   // Of the node in Bvh::nodes
+    uint32_t pairs;  // First pair below it
+  };
+
+  void emit(Bvh& bvh)
+  {
+    bvh.nodes.resize(2 + childNodesBelow(m_root));
+    std::vector<EmitTask> subtrees;
+    std::vector<EmitTask> stack{{m_root, 0, 2}};
+    uint32_t              subtreeSize = m_threadCount > 1 ? std::max<uint32_t>(m_count / (m_threadCount * 8), 1024) : m_count;
+    while(!stack.empty())
+    {
+      EmitTask task = stack.back();
+      stack.pop_back();
+      if((task.child & kLeafFlag) || m_last[task.child] - m_first[task.child] < subtreeSize)
+        subtrees.push_back(task);
+      else
+        emitNode(bvh, task, stack);
+    }
+    parallelFor(
+        subtrees.size(),
+        [&](size_t i) {
+          std::vector<EmitTask> local{subtrees[i]};
+          while(!local.empty())
+          {
+            EmitTask task = local.back();
+            local.pop_back();
+            emitNode(bvh, task, local);
+          }
+        },
+        m_threadCount);
+  }
+
+  void emitNode(Bvh& bvh, const EmitTask& task, std::vector<EmitTask>& stack) const
+  {
+    BvhNode& node = bvh.nodes[task.slot];
+    BvhBox   box  = childBox(task.child);
+    node.bboxMin  = box.bboxMin;
+    node.bboxMax  = box.bboxMax;
+    if(task.child & kLeafFlag)
+    {
+      node.offset = task.child & ~kLeafFlag;
+      node.count  = 1;
+      return;
+    }
+    if(m_nodesBelow[task.child] == 0)
+    {
+      node.offset = m_first[task.child];
+      node.count  = m_last[task.child] - m_first[task.child] + 1;
+      return;
+    }
+    uint32_t left  = m_children[task.child * 2 + 0];
+    uint32_t right = m_children[task.child * 2 + 1];
+    node.offset    = task.pairs;
+    node.count     = 0;
+    stack.push_back({right, task.pairs + 1, task.pairs + 2 + childNodesBelow(left)});
+    stack.push_back({left, task.pairs, task.pairs + 2});
+  }
+
+  const BvhBox*    m_boxes;
+  uint32_t         m_count;
+  BvhBuildSettings m_settings;
+  uint32_t         m_threadCount;
+
+  UninitializedArray<uint32_t> m_codes;  // Sorted
+  std::vector<uint32_t>        m_items;  // Item at each sorted position, moved to Bvh::items
+
+  UninitializedArray<BvhBox> m_leafBoxes;  // Sorted
+
+  // Interior nodes
+  uint32_t                     m_root{0};
+  UninitializedArray<uint32_t> m_children;  // Two per node
+  UninitializedArray<uint32_t> m_first;     // Range of sorted positions
+  UninitializedArray<uint32_t> m_last;
+  UninitializedArray<BvhBox>   m_interiorBoxes;
+  UninitializedArray<float>    m_costs;       // SAH cost of the subtree, not normalized
+  UninitializedArray<uint32_t> m_nodesBelow;  // 0 for subtrees collapsed into a leaf
+};
+}  // namespace
+
+Bvh buildLbvh(const BvhBox* boxes, size_t count, const BvhBuildSettings& settings)
+{
+  return LbvhBuilder(boxes, count, settings).build();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Deforming meshes
+//
+
+void DeformingBvh::build(const nvmath::vec3f*    positions,
+                         size_t                  positionStride,
+                         const uint32_t*         indices,
+                         size_t                  indexCount,
+                         const BvhBuildSettings& settings)
+{
+  uint32_t vertexCount = 0;
+  for(size_t i = 0; i < indexCount; i++)
+    vertexCount = std::max(vertexCount, indices[i] + 1);
+
+  m_settings = settings;
+  m_indices.assign(indices, indices + indexCount);
+  m_positions.resize(vertexCount);
+  m_boxes.resize(indexCount / 3);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(positions);
+  for(uint32_t v = 0; v < vertexCount; v++)
+    m_positions[v] = *reinterpret_cast<const vec3f*>(bytes + v * positionStride);
+  rebuild();
+  m_settings.method = BvhBuildMethod::eMorton;
+}
+
+bool DeformingBvh::update(const nvmath::vec3f* positions, size_t positionStride)
+{
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(positions);
+  for(size_t v = 0; v < m_positions.size(); v++)
+    m_positions[v] = *reinterpret_cast<const vec3f*>(bytes + v * positionStride);
+
+  // Triangles in leaf order and boxes of the source triangles, for the refit
+  TriangleBvh& bvh = *m_bvh;
+  parallelRanges(
+      bvh.triangles.size(), 4096,
+      [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+          BvhTriangle&    triangle = bvh.triangles[i];
+          const uint32_t* index    = &m_indices[triangle.triangle * 3];
+          triangle.v0              = m_positions[index[0]];
+          triangle.v1              = m_positions[index[1]];
+          triangle.v2              = m_positions[index[2]];
+          BvhBox& box              = m_boxes[triangle.triangle];
+          box.bboxMin              = nvmath::nv_min(triangle.v0, nvmath::nv_min(triangle.v1, triangle.v2));
+          box.bboxMax              = nvmath::nv_max(triangle.v0, nvmath::nv_max(triangle.v1, triangle.v2));
+        }
+      },
+      m_settings.threadCount ? m_settings.threadCount : getWorkerCount());
+  refitBvh(bvh.bvh, m_boxes.data());
+
+  m_sahCost = bvhSahCost(bvh.bvh, m_settings);
+  if(m_sahCost <= m_builtSahCost * m_rebuildThreshold)
+    return false;
+
+  // After a first build with the SAH, the Morton tree can be worse than the refitted one: the
+  // refitted tree is then kept, and its cost becomes the reference of the next rebuild
+  TriangleBvh rebuilt = buildTriangleBvh(m_positions.data(), sizeof(vec3f), m_indices.data(), m_indices.size(), m_settings);
+  float       cost    = bvhSahCost(rebuilt.bvh, m_settings);
+  m_builtSahCost      = std::min(cost, m_sahCost);
+  if(cost >= m_sahCost)
+    return false;
+  bvh       = std::move(rebuilt);
+  m_sahCost = cost;
+  return true;
+}
+
+void DeformingBvh::rebuild()
+{
+  *m_bvh         = buildTriangleBvh(m_positions.data(), sizeof(vec3f), m_indices.data(), m_indices.size(), m_settings);
+  m_sahCost      = bvhSahCost(m_bvh->bvh, m_settings);
+  m_builtSahCost = m_sahCost;
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "bvh.h"
+#include <memory>
+
+// Linear BVH builder, for geometry that changes every frame (Karras, "Maximizing Parallelism
+// in the Construction of BVHs, Octrees, and k-d Trees", HPG 2012).
+// The centroids are sorted along a Morton curve with a parallel radix sort, then every
+// interior node is found independently from the common prefixes of neighboring codes. The
+// boxes and SAH costs are accumulated from the leaves up, and subtrees of at most maxLeafSize
+// items become leaves where the SAH prefers it. Trees cost about 10-20% more to traverse than
+// the binned SAH ones, but the build does no search at all.
+// The output has the same layout as buildBvh (children after their parent, pairs on even
+// indices), so all traversals and refitBvh work on it. Codes are 30 bits with the item index
+// breaking ties, which keeps the depth below kBvhMaxDepth.
+
+// Same as buildBvh with BvhBuildMethod::eMorton
+Bvh buildLbvh(const BvhBox* boxes, size_t count, const BvhBuildSettings& settings = {});
+
+// Triangle hierarchy of a mesh whose vertices move every frame, the indices staying the same.
+// After a deformation, refitting keeps the tree and only grows the boxes, which is the
+// cheapest update but lets the quality drift; rebuilding with the Morton builder restores it.
+// update() refits, measures the SAH cost of the refit tree and rebuilds when it grew more
+// than m_rebuildThreshold times over the cost of the last build, keeping the cheaper tree.
+class DeformingBvh
+{
+public:
+  // The first build uses the given settings, the rebuilds of update() the Morton builder
+  void build(const nvmath::vec3f*    positions,
+             size_t                  positionStride,
+             const uint32_t*         indices,
+             size_t                  indexCount,
+             const BvhBuildSettings& settings = {});
+
+  // New positions of all vertices, same stride as build(). Returns true if the tree was replaced
+  // by a rebuild.
+  bool update(const nvmath::vec3f* positions, size_t positionStride);
+
+  // Updated in place, so the pointer can be shared with a SceneBvh
+  std::shared_ptr<const TriangleBvh> bvh() const { return m_bvh; }
+
+  const std::vector<nvmath::vec3f>& positions() const { return m_positions; }
+
+  float sahCost() const { return m_sahCost; }
+  float builtSahCost() const { return m_builtSahCost; }
+
+  float m_rebuildThreshold{1.3f};
+
+private:
+  void rebuild();
+
+  std::shared_ptr<TriangleBvh> m_bvh{std::make_shared<TriangleBvh>()};
+  std::vector<nvmath::vec3f>   m_positions;
+  std::vector<uint32_t>        m_indices;
+  std::vector<BvhBox>          m_boxes;  // Of each source triangle
+  BvhBuildSettings             m_settings;
+  float                        m_sahCost{0.f};
+  float                        m_builtSahCost{0.f};
+};
@@ -0,0 +1,146 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "mapped_file.h"
+
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if(this != &other)
+  {
+    close();
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_isEmpty, other.m_isEmpty);
+#ifdef WIN32
+    std::swap(m_file, other.m_file);
+    std::swap(m_mapping, other.m_mapping);
+#else
+    std::swap(m_fd, other.m_fd);
+#endif
+  }
+  return *this;
+}
+
+#ifdef WIN32
+
+bool MappedFile::open(const std::string& filename)
+{
+  close();
+
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if(file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(file, &fileSize))
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  m_file = file;
+  m_size = static_cast<size_t>(fileSize.QuadPart);
+  if(m_size == 0)
+  {
+    m_isEmpty = true;
+    return true;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if(mapping == nullptr)
+  {
+    close();
+    return false;
+  }
+  m_mapping = mapping;
+  m_data    = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if(m_data == nullptr)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(m_data)
+    UnmapViewOfFile(m_data);
+  if(m_mapping)
+    CloseHandle(static_cast<HANDLE>(m_mapping));
+  if(m_file)
+    CloseHandle(static_cast<HANDLE>(m_file));
+  m_data    = nullptr;
+  m_mapping = nullptr;
+  m_file    = nullptr;
+  m_size    = 0;
+  m_isEmpty = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  m_fd   = fd;
+  m_size = static_cast<size_t>(st.st_size);
+  if(m_size == 0)
+  {
+    m_isEmpty = true;
+    return true;
+  }
+
+  void* ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(ptr == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+  // The loaders walk the files front to back
+  madvise(ptr, m_size, MADV_SEQUENTIAL);
+  m_data = static_cast<const uint8_t*>(ptr);
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(m_data)
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+  if(m_fd >= 0)
+    ::close(m_fd);
+  m_data    = nullptr;
+  m_fd      = -1;
+  m_size    = 0;
+  m_isEmpty = false;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Read-only memory mapping of a whole file.
+// The mapping stays valid until the object is closed or destroyed, so pointers
+// into data() must not outlive it.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  explicit MappedFile(const std::string& filename) { open(filename); }
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  bool open(const std::string& filename);
+  void close();
+
+  bool           valid() const { return m_data != nullptr || m_isEmpty; }
+  const uint8_t* data() const { return m_data; }
+  size_t         size() const { return m_size; }
+  const char*    begin() const { return reinterpret_cast<const char*>(m_data); }
+  const char*    end() const { return reinterpret_cast<const char*>(m_data) + m_size; }
+
+private:
+  const uint8_t* m_data{nullptr};
+  size_t         m_size{0};
+  bool           m_isEmpty{false};  // Empty files cannot be mapped but are still valid
+#ifdef WIN32
+  void* m_file{nullptr};
+  void* m_mapping{nullptr};
+#else
+  int m_fd{-1};
+#endif
+};
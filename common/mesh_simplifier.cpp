@@ -0,0 +1,455 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "mesh_simplifier.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+using nvmath::vec3f;
+
+// Sum of squared distances to a set of planes, each weighted by the area of its triangle
+struct Quadric
+{
+  double a00{0}, a11{0}, a22{0}, a01{0}, a02{0}, a12{0};  // Symmetric 3x3
+  double b0{0}, b1{0}, b2{0};
+  double c{0};
+  double weight{0};
+
+  void addPlane(const vec3f& n, double d, double w)
+  {
+    a00 += w * n.x * n.x;
+    a11 += w * n.y * n.y;
+    a22 += w * n.z * n.z;
+    a01 += w * n.x * n.y;
+    a02 += w * n.x * n.z;
+    a12 += w * n.y * n.z;
+    b0 += w * n.x * d;
+    b1 += w * n.y * d;
+    b2 += w * n.z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric& q)
+  {
+    a00 += q.a00, a11 += q.a11, a22 += q.a22, a01 += q.a01, a02 += q.a02, a12 += q.a12;
+    b0 += q.b0, b1 += q.b1, b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+
+  // Weighted RMS distance of p to the planes
+  float distance(const vec3f& p) const
+  {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+               + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0.0 && e > 0.0 ? float(std::sqrt(e / weight)) : 0.f;
+  }
+};
+
+struct Collapse
+{
+  uint32_t from;
+  uint32_t to;
+  float    error;
+};
+
+class Simplifier
+{
+public:
+  Simplifier(const vec3f* positions, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount, const uint32_t* groups)
+      : m_vertexCount(vertexCount)
+  {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(positions);
+    m_positions.resize(vertexCount);
+    for(size_t v = 0; v < vertexCount; v++)
+      m_positions[v] = *reinterpret_cast<const vec3f*>(bytes + v * stride);
+
+    // Out of range and degenerate triangles are dropped from the start
+    for(size_t t = 0; t + 2 < indexCount; t += 3)
+    {
+      const uint32_t* idx = indices + t;
+      if(idx[0] >= vertexCount || idx[1] >= vertexCount || idx[2] >= vertexCount || idx[0] == idx[1]
+         || idx[1] == idx[2] || idx[0] == idx[2])
+        continue;
+      m_indices.insert(m_indices.end(), idx, idx + 3);
+      m_triangles.push_back(uint32_t(t / 3));
+    }
+
+    lockOpenEdges(groups);
+    computeQuadrics();
+  }
+
+  SimplifiedMesh simplify(size_t targetIndexCount, float maxError)
+  {
+    SimplifiedMesh result;
+    while(m_indices.size() > targetIndexCount)
+    {
+      buildAdjacency();
+      std::vector<Collapse> collapses = cheapestCollapses(maxError);
+      if(collapses.empty())
+        break;
+
+      // Each collapse removes about two triangles. Only the cheapest part of the candidates
+      // is taken in one pass, the others are evaluated again on the simplified mesh.
+      size_t needed = (m_indices.size() - targetIndexCount) / 6 + 1;
+      float  limit  = collapses[std::min(collapses.size() - 1, needed + needed / 2)].error;
+
+      size_t triangleCount = m_indices.size() / 3;
+      size_t target        = targetIndexCount / 3;
+      size_t applied       = 0;
+      m_touched.assign(m_vertexCount, false);
+      for(const Collapse& collapse : collapses)
+      {
+        if(collapse.error > limit || triangleCount <= target)
+          break;
+        if(m_touched[collapse.from] || m_touched[collapse.to] || !keepsManifold(collapse) || flips(collapse))
+          continue;
+        triangleCount -= apply(collapse);
+        result.error = std::max(result.error, collapse.error);
+        applied++;
+      }
+      if(!applied)
+        break;
+      compact();
+    }
+
+    result.indices   = std::move(m_indices);
+    result.triangles = std::move(m_triangles);
+    return result;
+  }
+
+private:
+  // Vertices on an edge not shared by exactly two triangles (open or non-manifold), or between
+  // triangles of different groups
+  void lockOpenEdges(const uint32_t* groups)
+  {
+    std::vector<uint64_t> edges;
+    edges.reserve(m_indices.size());
+    for(size_t t = 0; t < m_indices.size(); t += 3)
+      for(int c = 0; c < 3; c++)
+      {
+        uint64_t a = m_indices[t + c], b = m_indices[t + (c + 1) % 3];
+        edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+      }
+    std::sort(edges.begin(), edges.end());
+
+    m_locked.assign(m_vertexCount, false);
+    for(size_t e = 0; e < edges.size();)
+    {
+      size_t next = e + 1;
+      while(next < edges.size() && edges[next] == edges[e])
+        next++;
+      if(next - e != 2)
+      {
+        m_locked[edges[e] >> 32]        = true;
+        m_locked[edges[e] & 0xFFFFFFFF] = true;
+      }
+      e = next;
+    }
+
+    if(!groups)
+      return;
+    const uint32_t        kNoGroup = ~0u;
+    std::vector<uint32_t> vertexGroup(m_vertexCount, kNoGroup);
+    for(size_t t = 0; t < m_triangles.size(); t++)
+    {
+      uint32_t group = groups[m_triangles[t]];
+      for(int c = 0; c < 3; c++)
+      {
+        uint32_t& g = vertexGroup[m_indices[t * 3 + c]];
+        if(g == kNoGroup)
+          g = group;
+        else if(g != group)
+          m_locked[m_indices[t * 3 + c]] = true;
+      }
+    }
+  }
+
+  void computeQuadrics()
+  {
+    m_quadrics.assign(m_vertexCount, Quadric());
+    for(size_t t = 0; t < m_indices.size(); t += 3)
+    {
+      const vec3f& p0     = m_positions[m_indices[t]];
+      vec3f        normal = nvmath::cross(m_positions[m_indices[t + 1]] - p0, m_positions[m_indices[t + 2]] - p0);
+      float        length = nvmath::length(normal);
+      if(length <= FLT_MIN)
+        continue;
+      normal = normal * (1.f / length);
+      double d = -double(nvmath::dot(normal, p0));
+      for(int c = 0; c < 3; c++)
+        m_quadrics[m_indices[t + c]].addPlane(normal, d, length * 0.5);
+    }
+  }
+
+  // Triangles around each vertex
+  void buildAdjacency()
+  {
+    m_adjacencyOffsets.assign(m_vertexCount + 1, 0);
+    for(uint32_t v : m_indices)
+      m_adjacencyOffsets[v + 1]++;
+    for(size_t v = 0; v < m_vertexCount; v++)
+      m_adjacencyOffsets[v + 1] += m_adjacencyOffsets[v];
+    m_adjacency.resize(m_indices.size());
+    std::vector<uint32_t> fill(m_adjacencyOffsets.begin(), m_adjacencyOffsets.end() - 1);
+    for(size_t i = 0; i < m_indices.size(); i++)
+      m_adjacency[fill[m_indices[i]]++] = uint32_t(i / 3);
+  }
+
+  // Best collapse of each free vertex onto one of its neighbors, sorted by error
+  std::vector<Collapse> cheapestCollapses(float maxError) const
+  {
+    std::vector<Collapse> collapses;
+    for(uint32_t from = 0; from < m_vertexCount; from++)
+    {
+      if(m_locked[from] || m_adjacencyOffsets[from] == m_adjacencyOffsets[from + 1])
+        continue;
+      Collapse best{from, ~0u, FLT_MAX};
+      for(uint32_t a = m_adjacencyOffsets[from]; a < m_adjacencyOffsets[from + 1]; a++)
+      {
+        const uint32_t* idx = &m_indices[size_t(m_adjacency[a]) * 3];
+        for(int c = 0; c < 3; c++)
+        {
+          uint32_t to = idx[c];
+          if(to == from || to == best.to)
+            continue;
+          Quadric q = m_quadrics[from];
+          q.add(m_quadrics[to]);
+          float error = q.distance(m_positions[to]);
+          if(error < best.error)
+            best = {from, to, error};
+        }
+      }
+      if(best.to != ~0u && best.error <= maxError)
+        collapses.push_back(best);
+    }
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+    return collapses;
+  }
+
+  // Link condition: the vertices connected to both `from` and `to` must be the third vertices
+  // of the triangles on the edge. Any other common neighbor would get an edge used by more
+  // than two triangles, or two copies of the same triangle, once `from` is moved onto `to`.
+  // Both ends are untouched in the current pass, so their adjacency is up to date.
+  bool keepsManifold(const Collapse& collapse)
+  {
+    uint32_t opposite[2];
+    uint32_t oppositeCount = 0;
+    m_neighbors.clear();
+    for(uint32_t a = m_adjacencyOffsets[collapse.from]; a < m_adjacencyOffsets[collapse.from + 1]; a++)
+    {
+      const uint32_t* idx    = &m_indices[size_t(m_adjacency[a]) * 3];
+      bool            onEdge = idx[0] == collapse.to || idx[1] == collapse.to || idx[2] == collapse.to;
+      for(int c = 0; c < 3; c++)
+      {
+        if(idx[c] == collapse.from || idx[c] == collapse.to)
+          continue;
+        if(onEdge)
+        {
+          if(oppositeCount == 2)
+            return false;  // More than two triangles on the edge
+          opposite[oppositeCount++] = idx[c];
+        }
+        m_neighbors.push_back(idx[c]);
+      }
+    }
+    std::sort(m_neighbors.begin(), m_neighbors.end());
+
+    for(uint32_t a = m_adjacencyOffsets[collapse.to]; a < m_adjacencyOffsets[collapse.to + 1]; a++)
+    {
+      const uint32_t* idx = &m_indices[size_t(m_adjacency[a]) * 3];
+      for(int c = 0; c < 3; c++)
+      {
+        uint32_t v = idx[c];
+        if(v == collapse.from || v == collapse.to || (oppositeCount > 0 && v == opposite[0])
+           || (oppositeCount > 1 && v == opposite[1]))
+          continue;
+        if(std::binary_search(m_neighbors.begin(), m_neighbors.end(), v))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  // True if moving `from` onto `to` turns a remaining triangle over
+  bool flips(const Collapse& collapse) const
+  {
+    const vec3f& target = m_positions[collapse.to];
+    for(uint32_t a = m_adjacencyOffsets[collapse.from]; a < m_adjacencyOffsets[collapse.from + 1]; a++)
+    {
+      const uint32_t* idx = &m_indices[size_t(m_adjacency[a]) * 3];
+      if(idx[0] == collapse.to || idx[1] == collapse.to || idx[2] == collapse.to)
+        continue;  // Removed by the collapse
+      vec3f p[3], moved[3];
+      for(int c = 0; c < 3; c++)
+      {
+        p[c]     = m_positions[idx[c]];
+        moved[c] = idx[c] == collapse.from ? target : p[c];
+      }
+      vec3f before = nvmath::cross(p[1] - p[0], p[2] - p[0]);
+      vec3f after  = nvmath::cross(moved[1] - moved[0], moved[2] - moved[0]);
+      // Also rejects triangles becoming slivers, which would flip on a later collapse
+      if(nvmath::dot(before, after) < 0.25f * nvmath::length(before) * nvmath::length(after))
+        return true;
+    }
+    return false;
+  }
+
+  // Returns the number of triangles removed. The one-ring of `from` is marked, as its
+  // triangles are changed and the adjacency is no longer valid for them.
+  size_t apply(const Collapse& collapse)
+  {
+    size_t removed = 0;
+    for(uint32_t a = m_adjacencyOffsets[collapse.from]; a < m_adjacencyOffsets[collapse.from + 1]; a++)
+    {
+      uint32_t* idx = &m_indices[size_t(m_adjacency[a]) * 3];
+      for(int c = 0; c < 3; c++)
+        m_touched[idx[c]] = true;
+      removed += (idx[0] == collapse.to || idx[1] == collapse.to || idx[2] == collapse.to) ? 1 : 0;
+      for(int c = 0; c < 3; c++)
+        if(idx[c] == collapse.from)
+          idx[c] = collapse.to;
+    }
+    m_quadrics[collapse.to].add(m_quadrics[collapse.from]);
+    return removed;
+  }
+
+  // Drops the triangles that became degenerate
+  void compact()
+  {
+    size_t kept = 0;
+    for(size_t t = 0; t < m_triangles.size(); t++)
+    {
+      const uint32_t* idx = &m_indices[t * 3];
+      if(idx[0] == idx[1] || idx[1] == idx[2] || idx[0] == idx[2])
+        continue;
+      for(int c = 0; c < 3; c++)
+        m_indices[kept * 3 + c] = idx[c];
+      m_triangles[kept++] = m_triangles[t];
+    }
+    m_indices.resize(kept * 3);
+    m_triangles.resize(kept);
+  }
+
+  size_t                m_vertexCount;
+  std::vector<vec3f>    m_positions;
+  std::vector<uint32_t> m_indices;    // Current mesh
+  std::vector<uint32_t> m_triangles;  // Source triangle of each current triangle
+  std::vector<bool>     m_locked;
+  std::vector<Quadric>  m_quadrics;
+
+  std::vector<uint32_t> m_adjacencyOffsets;  // Per vertex, in m_adjacency
+  std::vector<uint32_t> m_adjacency;         // Triangles around each vertex
+  std::vector<bool>     m_touched;           // Vertices changed in the current pass
+  std::vector<uint32_t> m_neighbors;         // Scratch of keepsManifold
+};
+}  // namespace
+
+SimplifiedMesh simplifyMesh(const nvmath::vec3f* positions,
+                            size_t               positionStride,
+                            size_t               vertexCount,
+                            const uint32_t*      indices,
+                            size_t               indexCount,
+                            size_t               targetIndexCount,
+                            float                maxError,
+                            const uint32_t*      triangleGroups)
+{
+  Simplifier simplifier(positions, positionStride, vertexCount, indices, indexCount, triangleGroups);
+  return simplifier.simplify(targetIndexCount, maxError);
+}
+
+LodChain buildLodChain(const nvmath::vec3f* positions,
+                       size_t               positionStride,
+                       size_t               vertexCount,
+                       const uint32_t*      indices,
+                       size_t               indexCount,
+                       const uint32_t*      triangleGroups,
+                       uint32_t             maxLevels,
+                       size_t               minTriangles)
+{
+  LodChain chain;
+  chain.indices.assign(indices, indices + indexCount);
+  chain.triangles.resize(indexCount / 3);
+  for(size_t t = 0; t < chain.triangles.size(); t++)
+    chain.triangles[t] = uint32_t(t);
+  chain.lods.levels.push_back({0, uint32_t(indexCount), 0.f});
+
+  // Bounding sphere: center of the box, radius to the farthest vertex
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(positions);
+  auto position = [&](size_t v) -> const vec3f& { return *reinterpret_cast<const vec3f*>(bytes + v * positionStride); };
+  if(vertexCount)
+  {
+    vec3f boxMin = position(0), boxMax = position(0);
+    for(size_t v = 1; v < vertexCount; v++)
+    {
+      boxMin = nvmath::nv_min(boxMin, position(v));
+      boxMax = nvmath::nv_max(boxMax, position(v));
+    }
+    chain.lods.center = (boxMin + boxMax) * 0.5f;
+    for(size_t v = 0; v < vertexCount; v++)
+      chain.lods.radius = std::max(chain.lods.radius, nvmath::length(position(v) - chain.lods.center));
+  }
+
+  // Each level is simplified from the previous one: its triangles are mapped back to the
+  // source and its error is added to the one of the previous level.
+  std::vector<uint32_t> groups;
+  while(chain.lods.levels.size() < maxLevels)
+  {
+    const LodLevel& previous      = chain.lods.levels.back();
+    size_t          triangleCount = previous.indexCount / 3;
+    if(triangleCount / 2 < minTriangles)
+      break;
+
+    const uint32_t* levelIndices   = &chain.indices[previous.firstIndex];
+    const uint32_t* levelTriangles = &chain.triangles[previous.firstIndex / 3];
+    if(triangleGroups)
+    {
+      groups.resize(triangleCount);
+      for(size_t t = 0; t < triangleCount; t++)
+        groups[t] = triangleGroups[levelTriangles[t]];
+    }
+    SimplifiedMesh level = simplifyMesh(positions, positionStride, vertexCount, levelIndices, previous.indexCount,
+                                        (triangleCount / 2) * 3, FLT_MAX, triangleGroups ? groups.data() : nullptr);
+    if(level.indices.size() > previous.indexCount * 4 / 5)
+      break;
+
+    LodLevel lod;
+    lod.firstIndex = uint32_t(chain.indices.size());
+    lod.indexCount = uint32_t(level.indices.size());
+    lod.error      = previous.error + level.error;
+    for(uint32_t& t : level.triangles)
+      t = levelTriangles[t];
+    chain.indices.insert(chain.indices.end(), level.indices.begin(), level.indices.end());
+    chain.triangles.insert(chain.triangles.end(), level.triangles.begin(), level.triangles.end());
+    chain.lods.levels.push_back(lod);
+  }
+  return chain;
+}
+
+uint32_t selectLodLevel(const LodSet&        lods,
+                        const nvmath::mat4f& transform,
+                        const nvmath::vec3f& eye,
+                        float                fovY,
+                        float                viewportHeight,
+                        float                pixelThreshold)
+{
+  // Largest scale of the transform, for the radius and the error
+  float scale = std::max(std::max(nvmath::length(vec3f(transform.a00, transform.a10, transform.a20)),
+                                  nvmath::length(vec3f(transform.a01, transform.a11, transform.a21))),
+                         nvmath::length(vec3f(transform.a02, transform.a12, transform.a22)));
+  vec3f center   = vec3f(transform * nvmath::vec4f(lods.center, 1.f));
+  float distance = nvmath::length(center - eye) - lods.radius * scale;
+  if(distance <= 0.f)
+    return 0;
+
+  uint32_t level = 0;
+  for(uint32_t l = 1; l < lods.levels.size(); l++)
+    if(projectedSize(lods.levels[l].error * scale, distance, fovY, viewportHeight) <= pixelThreshold)
+      level = l;
+  return level;
+}
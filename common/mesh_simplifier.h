@@ -0,0 +1,95 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+
+// Mesh simplification and LOD chains
+// Edges are collapsed onto one of their vertices (half-edge collapse), cheapest first by
+// quadric error. As no vertex is created or moved, every level indexes the vertex buffer of
+// the source mesh and only needs its own index buffer. Vertices on an open or non-manifold
+// edge are never removed: this keeps the mesh borders, the attribute seams (split vertices:
+// normals, UVs) and the borders between triangle groups (materials) in place. Meshes with
+// many seams simplify less, flat shaded ones like the cubes not at all. A collapse is only
+// done if it keeps the mesh manifold (link condition) and turns no triangle over.
+
+const uint32_t kLodMaxLevels    = 6;   // Including the source mesh
+const size_t   kLodMinTriangles = 32;  // No level is made below that
+
+// Collapses edges until the mesh is down to targetIndexCount indices or the next collapse
+// would go over maxError. Positions are read with a stride in bytes.
+struct SimplifiedMesh
+{
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> triangles;  // Source triangle of each triangle, for per-triangle data
+  float                 error{0.f};  // Estimated distance to the source surface, in model units
+};
+
+SimplifiedMesh simplifyMesh(const nvmath::vec3f* positions,
+                            size_t               positionStride,
+                            size_t               vertexCount,
+                            const uint32_t*      indices,
+                            size_t               indexCount,
+                            size_t               targetIndexCount,
+                            float                maxError       = FLT_MAX,
+                            const uint32_t*      triangleGroups = nullptr);
+
+// All levels of a mesh in one index buffer, level 0 being the source mesh. Each level has
+// about half the triangles of the previous one; the chain stops when a level does not get
+// below 80% of the previous one, or at kLodMaxLevels / kLodMinTriangles.
+struct LodLevel
+{
+  uint32_t firstIndex{0};
+  uint32_t indexCount{0};
+  float    error{0.f};  // Accumulated over the levels, in model units
+};
+
+// What the LOD selection needs to know of a model
+struct LodSet
+{
+  std::vector<LodLevel> levels;
+  nvmath::vec3f         center{0.f, 0.f, 0.f};  // Bounding sphere of the source mesh
+  float                 radius{0.f};
+};
+
+struct LodChain
+{
+  std::vector<uint32_t> indices;    // All levels, one after the other
+  std::vector<uint32_t> triangles;  // Source triangle of each triangle in `indices`
+  LodSet                lods;
+};
+
+LodChain buildLodChain(const nvmath::vec3f* positions,
+                       size_t               positionStride,
+                       size_t               vertexCount,
+                       const uint32_t*      indices,
+                       size_t               indexCount,
+                       const uint32_t*      triangleGroups = nullptr,
+                       uint32_t             maxLevels      = kLodMaxLevels,
+                       size_t               minTriangles   = kLodMinTriangles);
+
+// Pixels covered by a length `size` seen at `distance` by a perspective camera with a
+// vertical field of view of fovY degrees, over a viewport `viewportHeight` pixels high.
+inline float projectedSize(float size, float distance, float fovY, float viewportHeight)
+{
+  float halfHeight = std::max(distance, 1e-4f) * std::tan(fovY * (0.5f * 3.14159265f / 180.f));
+  return size * 0.5f * viewportHeight / halfHeight;
+}
+
+// Coarsest level of an instance placed by `transform` whose error, projected at the closest
+// point of its bounding sphere, covers at most pixelThreshold pixels. 0 when the camera is
+// inside the sphere.
+uint32_t selectLodLevel(const LodSet&        lods,
+                        const nvmath::mat4f& transform,
+                        const nvmath::vec3f& eye,
+                        float                fovY,
+                        float                viewportHeight,
+                        float                pixelThreshold = 1.f);
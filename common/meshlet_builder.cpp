@@ -0,0 +1,342 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "meshlet_builder.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+using nvmath::vec3f;
+
+// Spreads the 10 low bits of v so that there are two zero bits between each
+uint32_t expandBits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+uint32_t mortonCode(const vec3f& p, const vec3f& boxMin, const vec3f& invExtent)
+{
+  auto quantize = [](float f) { return uint32_t(std::min(std::max(f * 1024.f, 0.f), 1023.f)); };
+  uint32_t x    = quantize((p.x - boxMin.x) * invExtent.x);
+  uint32_t y    = quantize((p.y - boxMin.y) * invExtent.y);
+  uint32_t z    = quantize((p.z - boxMin.z) * invExtent.z);
+  return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+// Indices of the 30-bit keys in increasing key order: radix sort, 3 passes of 10 bits
+std::vector<uint32_t> sortByKey(const std::vector<uint32_t>& keys)
+{
+  std::vector<uint32_t> order(keys.size()), swap(keys.size());
+  for(size_t i = 0; i < keys.size(); i++)
+    order[i] = uint32_t(i);
+  for(uint32_t shift = 0; shift < 30; shift += 10)
+  {
+    std::vector<size_t> offsets(1025, 0);
+    for(uint32_t i : order)
+      offsets[((keys[i] >> shift) & 1023) + 1]++;
+    for(size_t b = 0; b < 1024; b++)
+      offsets[b + 1] += offsets[b];
+    for(uint32_t i : order)
+      swap[offsets[(keys[i] >> shift) & 1023]++] = i;
+    order.swap(swap);
+  }
+  return order;
+}
+
+float distance2(const vec3f& a, const vec3f& b)
+{
+  vec3f d = a - b;
+  return nvmath::dot(d, d);
+}
+
+class MeshletBuilder
+{
+public:
+  MeshletBuilder(const nvmath::vec3f* positions, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount)
+      : m_positions(reinterpret_cast<const uint8_t*>(positions))
+      , m_stride(stride)
+      , m_vertexCount(vertexCount)
+      , m_indices(indices)
+      , m_triangleCount(indexCount / 3)
+  {
+  }
+
+  MeshletMesh build(std::vector<uint32_t>* triangleOrder, uint32_t maxVertices, uint32_t maxTriangles)
+  {
+    m_maxVertices  = std::min(maxVertices, 256u);  // Local indices are 8-bit
+    m_maxTriangles = maxTriangles;
+    prepare();
+
+    MeshletMesh mesh;
+    if(triangleOrder)
+      triangleOrder->clear();
+    size_t cursor = 0;  // In m_mortonOrder
+    while(true)
+    {
+      while(cursor < m_mortonOrder.size() && m_emitted[m_mortonOrder[cursor]])
+        cursor++;
+      if(cursor == m_mortonOrder.size())
+        break;
+
+      // New meshlet, grown from the next unused triangle along the curve
+      Meshlet meshlet;
+      meshlet.vertexOffset   = uint32_t(mesh.vertices.size());
+      meshlet.triangleOffset = uint32_t(mesh.triangles.size() / 3);
+      m_meshletCenter        = vec3f(0.f, 0.f, 0.f);
+      m_meshletId++;
+
+      uint32_t triangle = m_mortonOrder[cursor];
+      while(true)
+      {
+        addTriangle(mesh, meshlet, triangle);
+        if(triangleOrder)
+          triangleOrder->push_back(triangle);
+        if(meshlet.triangleCount == m_maxTriangles)
+          break;
+
+        triangle = bestNeighbor(triangle, meshlet, mesh);
+        if(triangle == ~0u)
+        {
+          // Nothing connected fits: continue along the curve if the next triangle fits
+          while(cursor < m_mortonOrder.size() && m_emitted[m_mortonOrder[cursor]])
+            cursor++;
+          if(cursor == m_mortonOrder.size() || meshlet.vertexCount + newVertices(m_mortonOrder[cursor]) > m_maxVertices)
+            break;
+          triangle = m_mortonOrder[cursor];
+        }
+      }
+
+      computeBounds(mesh, meshlet);
+      mesh.meshlets.push_back(meshlet);
+    }
+    return mesh;
+  }
+
+private:
+  const vec3f& position(uint32_t v) const { return *reinterpret_cast<const vec3f*>(m_positions + v * m_stride); }
+  const uint32_t* triangleIndices(uint32_t t) const { return m_indices + size_t(t) * 3; }
+
+  bool validTriangle(uint32_t t) const
+  {
+    const uint32_t* idx = triangleIndices(t);
+    return idx[0] < m_vertexCount && idx[1] < m_vertexCount && idx[2] < m_vertexCount;
+  }
+
+  // Triangles around each vertex, centroids and the Morton order of the triangles.
+  // Triangles with out of range indices are left out.
+  void prepare()
+  {
+    m_emitted.assign(m_triangleCount, false);
+    for(size_t t = 0; t < m_triangleCount; t++)
+      m_emitted[t] = !validTriangle(uint32_t(t));
+
+    m_adjacencyOffsets.assign(m_vertexCount + 1, 0);
+    for(size_t t = 0; t < m_triangleCount; t++)
+      for(int c = 0; c < 3 && !m_emitted[t]; c++)
+        m_adjacencyOffsets[triangleIndices(uint32_t(t))[c] + 1]++;
+    for(size_t v = 0; v < m_vertexCount; v++)
+      m_adjacencyOffsets[v + 1] += m_adjacencyOffsets[v];
+    m_adjacency.resize(m_adjacencyOffsets.back());
+    std::vector<uint32_t> fill(m_adjacencyOffsets.begin(), m_adjacencyOffsets.end() - 1);
+    for(size_t t = 0; t < m_triangleCount; t++)
+      for(int c = 0; c < 3 && !m_emitted[t]; c++)
+        m_adjacency[fill[triangleIndices(uint32_t(t))[c]]++] = uint32_t(t);
+
+    vec3f boxMin(FLT_MAX, FLT_MAX, FLT_MAX), boxMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    m_centroids.resize(m_triangleCount);
+    for(size_t t = 0; t < m_triangleCount; t++)
+    {
+      if(m_emitted[t])
+        continue;
+      const uint32_t* idx = triangleIndices(uint32_t(t));
+      m_centroids[t]      = (position(idx[0]) + position(idx[1]) + position(idx[2])) * (1.f / 3.f);
+      boxMin              = nvmath::nv_min(boxMin, m_centroids[t]);
+      boxMax              = nvmath::nv_max(boxMax, m_centroids[t]);
+    }
+    vec3f extent = boxMax - boxMin;
+    vec3f invExtent(extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f,
+                    extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+    std::vector<uint32_t> codes(m_triangleCount);
+    for(size_t t = 0; t < m_triangleCount; t++)
+      codes[t] = mortonCode(m_centroids[t], boxMin, invExtent);
+    m_mortonOrder = sortByKey(codes);
+
+    m_vertexStamp.assign(m_vertexCount, 0);
+    m_vertexSlot.assign(m_vertexCount, 0);
+    m_meshletId = 0;
+  }
+
+  bool inMeshlet(uint32_t v) const { return m_vertexStamp[v] == m_meshletId; }
+
+  uint32_t newVertices(uint32_t t) const
+  {
+    const uint32_t* idx = triangleIndices(t);
+    return uint32_t(!inMeshlet(idx[0])) + uint32_t(!inMeshlet(idx[1])) + uint32_t(!inMeshlet(idx[2]));
+  }
+
+  void addTriangle(MeshletMesh& mesh, Meshlet& meshlet, uint32_t t)
+  {
+    const uint32_t* idx = triangleIndices(t);
+    for(int c = 0; c < 3; c++)
+    {
+      uint32_t v = idx[c];
+      if(!inMeshlet(v))
+      {
+        m_vertexStamp[v] = m_meshletId;
+        m_vertexSlot[v]  = uint8_t(meshlet.vertexCount++);
+        mesh.vertices.push_back(v);
+      }
+      mesh.triangles.push_back(m_vertexSlot[v]);
+    }
+    m_emitted[t] = true;
+    meshlet.triangleCount++;
+    m_meshletCenter += (m_centroids[t] - m_meshletCenter) * (1.f / float(meshlet.triangleCount));
+  }
+
+  // Unused triangle around `vertices` adding the fewest vertices, then closest to the meshlet
+  void scoreNeighbors(const uint32_t* vertices, size_t count, const Meshlet& meshlet, uint32_t& best, uint32_t& bestNew, float& bestDistance) const
+  {
+    for(size_t i = 0; i < count; i++)
+    {
+      uint32_t v = vertices[i];
+      for(uint32_t a = m_adjacencyOffsets[v]; a < m_adjacencyOffsets[v + 1]; a++)
+      {
+        uint32_t t = m_adjacency[a];
+        if(m_emitted[t])
+          continue;
+        uint32_t added = newVertices(t);
+        if(meshlet.vertexCount + added > m_maxVertices || added > bestNew)
+          continue;
+        float d = distance2(m_centroids[t], m_meshletCenter);
+        if(added < bestNew || d < bestDistance)
+        {
+          best         = t;
+          bestNew      = added;
+          bestDistance = d;
+        }
+      }
+    }
+  }
+
+  uint32_t bestNeighbor(uint32_t last, const Meshlet& meshlet, const MeshletMesh& mesh) const
+  {
+    uint32_t best = ~0u, bestNew = 4;
+    float    bestDistance = FLT_MAX;
+    scoreNeighbors(triangleIndices(last), 3, meshlet, best, bestNew, bestDistance);
+    if(best == ~0u)  // The last triangle is surrounded, look around the whole meshlet
+      scoreNeighbors(&mesh.vertices[meshlet.vertexOffset], meshlet.vertexCount, meshlet, best, bestNew, bestDistance);
+    return best;
+  }
+
+  void computeBounds(const MeshletMesh& mesh, Meshlet& meshlet) const
+  {
+    const uint32_t* vertices = &mesh.vertices[meshlet.vertexOffset];
+    meshlet.bboxMin          = vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    meshlet.bboxMax          = vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for(uint32_t i = 0; i < meshlet.vertexCount; i++)
+    {
+      meshlet.bboxMin = nvmath::nv_min(meshlet.bboxMin, position(vertices[i]));
+      meshlet.bboxMax = nvmath::nv_max(meshlet.bboxMax, position(vertices[i]));
+    }
+    meshlet.center = (meshlet.bboxMin + meshlet.bboxMax) * 0.5f;
+    float radius2  = 0.f;
+    for(uint32_t i = 0; i < meshlet.vertexCount; i++)
+      radius2 = std::max(radius2, distance2(position(vertices[i]), meshlet.center));
+    meshlet.radius = std::sqrt(radius2);
+
+    // Normal cone: average of the unit triangle normals, opened to the farthest of them
+    const uint8_t*     triangles = &mesh.triangles[size_t(meshlet.triangleOffset) * 3];
+    std::vector<vec3f> normals;
+    normals.reserve(meshlet.triangleCount);
+    vec3f axis(0.f, 0.f, 0.f);
+    for(uint32_t t = 0; t < meshlet.triangleCount; t++)
+    {
+      const vec3f& p0  = position(vertices[triangles[t * 3 + 0]]);
+      vec3f        n   = nvmath::cross(position(vertices[triangles[t * 3 + 1]]) - p0, position(vertices[triangles[t * 3 + 2]]) - p0);
+      float        len = nvmath::length(n);
+      if(len <= FLT_MIN)
+        continue;  // Degenerate triangles do not constrain the cone
+      normals.push_back(n * (1.f / len));
+      axis += normals.back();
+    }
+    float axisLength   = nvmath::length(axis);
+    meshlet.coneAxis   = axisLength > FLT_MIN ? axis * (1.f / axisLength) : vec3f(0.f, 0.f, 1.f);
+    meshlet.coneCutoff = 1.f;
+    if(axisLength <= FLT_MIN || normals.empty())
+      return;
+    float minDot = 1.f;
+    for(const auto& n : normals)
+      minDot = std::min(minDot, nvmath::dot(n, meshlet.coneAxis));
+    // Beyond about 84 degrees the cone is too wide to ever cull anything
+    if(minDot > 0.1f)
+      meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+  }
+
+  const uint8_t*  m_positions;
+  size_t          m_stride;
+  size_t          m_vertexCount;
+  const uint32_t* m_indices;
+  size_t          m_triangleCount;
+  uint32_t        m_maxVertices{kMeshletMaxVertices};
+  uint32_t        m_maxTriangles{kMeshletMaxTriangles};
+
+  std::vector<uint32_t> m_adjacencyOffsets;  // Per vertex, in m_adjacency
+  std::vector<uint32_t> m_adjacency;         // Triangles around each vertex
+  std::vector<vec3f>    m_centroids;
+  std::vector<uint32_t> m_mortonOrder;
+  std::vector<bool>     m_emitted;
+
+  // Meshlet being built: vertices stamped with its id have a local index in m_vertexSlot
+  std::vector<uint32_t> m_vertexStamp;
+  std::vector<uint8_t>  m_vertexSlot;
+  uint32_t              m_meshletId{0};
+  vec3f                 m_meshletCenter{0.f, 0.f, 0.f};
+};
+}  // namespace
+
+MeshletMesh buildMeshlets(const nvmath::vec3f*   positions,
+                          size_t                 positionStride,
+                          size_t                 vertexCount,
+                          const uint32_t*        indices,
+                          size_t                 indexCount,
+                          std::vector<uint32_t>* triangleOrder,
+                          uint32_t               maxVertices,
+                          uint32_t               maxTriangles)
+{
+  MeshletBuilder builder(positions, positionStride, vertexCount, indices, indexCount);
+  return builder.build(triangleOrder, std::max(maxVertices, 3u), std::max(maxTriangles, 1u));
+}
+
+std::vector<uint32_t> reorderIndices(const uint32_t* indices, const std::vector<uint32_t>& triangleOrder)
+{
+  std::vector<uint32_t> reordered(triangleOrder.size() * 3);
+  for(size_t t = 0; t < triangleOrder.size(); t++)
+    for(int c = 0; c < 3; c++)
+      reordered[t * 3 + c] = indices[size_t(triangleOrder[t]) * 3 + c];
+  return reordered;
+}
+
+MeshletStats meshletStats(const MeshletMesh& mesh)
+{
+  MeshletStats stats;
+  stats.meshletCount = mesh.meshlets.size();
+  for(const auto& meshlet : mesh.meshlets)
+  {
+    stats.triangleCount += meshlet.triangleCount;
+    stats.vertexCount += meshlet.vertexCount;
+    stats.cullableCount += meshlet.coneCutoff < 1.f ? 1 : 0;
+  }
+  if(stats.meshletCount)
+  {
+    stats.averageVertices  = float(stats.vertexCount) / float(stats.meshletCount);
+    stats.averageTriangles = float(stats.triangleCount) / float(stats.meshletCount);
+  }
+  return stats;
+}
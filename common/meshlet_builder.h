@@ -0,0 +1,77 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "nvmath/nvmath.h"
+
+// Meshlets: small spatially coherent clusters of triangles
+// Triangles are grown greedily over the shared edges of the mesh, preferring the ones
+// adding the fewest vertices, then the ones closest to the cluster. When the neighborhood
+// is exhausted the next unused triangle along a Morton curve starts over. Each meshlet
+// has a bounding sphere and box and a normal cone for backface culling.
+// The limits (64 vertices, 124 triangles) are the ones of the mesh shader samples: the
+// triangle indices of a meshlet fit in 8 bits and its data in a small fixed budget.
+
+const uint32_t kMeshletMaxVertices  = 64;
+const uint32_t kMeshletMaxTriangles = 124;
+
+struct Meshlet
+{
+  uint32_t vertexOffset{0};    // First vertex in MeshletMesh::vertices
+  uint32_t triangleOffset{0};  // First triangle in MeshletMesh::triangles, counted in triangles
+  uint32_t vertexCount{0};
+  uint32_t triangleCount{0};
+
+  nvmath::vec3f bboxMin{0.f, 0.f, 0.f};
+  nvmath::vec3f bboxMax{0.f, 0.f, 0.f};
+  nvmath::vec3f center{0.f, 0.f, 0.f};  // Bounding sphere
+  float         radius{0.f};
+  nvmath::vec3f coneAxis{0.f, 0.f, 1.f};  // Normal cone, see meshletBackfacing
+  float         coneCutoff{1.f};          // 1 when the normals are too spread to cull
+};
+
+struct MeshletMesh
+{
+  std::vector<Meshlet>  meshlets;
+  std::vector<uint32_t> vertices;   // Mesh vertex of each meshlet vertex
+  std::vector<uint8_t>  triangles;  // 3 indices per triangle, in the vertices of its meshlet
+};
+
+// Splits a triangle list. Positions are read with a stride in bytes, so interleaved vertices
+// can be used directly. When triangleOrder is given, it receives the source triangle of each
+// meshlet triangle, in meshlet order.
+MeshletMesh buildMeshlets(const nvmath::vec3f*   positions,
+                          size_t                 positionStride,
+                          size_t                 vertexCount,
+                          const uint32_t*        indices,
+                          size_t                 indexCount,
+                          std::vector<uint32_t>* triangleOrder = nullptr,
+                          uint32_t               maxVertices   = kMeshletMaxVertices,
+                          uint32_t               maxTriangles  = kMeshletMaxTriangles);
+
+// Mesh indices in meshlet order, `indices` being the ones given to buildMeshlets
+std::vector<uint32_t> reorderIndices(const uint32_t* indices, const std::vector<uint32_t>& triangleOrder);
+
+// True if all triangles of the meshlet face away from the camera (positions in the same space)
+inline bool meshletBackfacing(const Meshlet& meshlet, const nvmath::vec3f& cameraPosition)
+{
+  nvmath::vec3f toCenter = meshlet.center - cameraPosition;
+  return nvmath::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * nvmath::length(toCenter) + meshlet.radius;
+}
+
+struct MeshletStats
+{
+  size_t meshletCount{0};
+  size_t triangleCount{0};
+  size_t vertexCount{0};       // Sum over the meshlets, shared vertices counted once per meshlet
+  size_t cullableCount{0};     // Meshlets with a usable normal cone
+  float  averageVertices{0.f};
+  float  averageTriangles{0.f};
+};
+
+MeshletStats meshletStats(const MeshletMesh& mesh);
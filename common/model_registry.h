@@ -0,0 +1,33 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "content_hash.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+// Content-addressed registry of the loaded models.
+// A model is identified by its source path and the hash of its content, so
+// loading the same file again can reuse the existing model (buffers and BLAS)
+// and only add an instance, while a file modified on disk is loaded anew.
+class ModelRegistry
+{
+public:
+  // Returns the index of the model already loaded from this file with the same
+  // content. Otherwise registers the file under newIndex and returns newIndex.
+  uint32_t findOrAdd(const std::string& filename, uint32_t newIndex)
+  {
+    uint64_t hash;
+    if(!hashFile(filename, hash))
+      return newIndex;  // Nothing to share, loading will report the error
+    return m_models.emplace(std::make_pair(filename, hash), newIndex).first->second;
+  }
+
+  void clear() { m_models.clear(); }
+
+private:
+  std::map<std::pair<std::string, uint64_t>, uint32_t> m_models;
+};
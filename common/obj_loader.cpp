@@ -6,6 +6,9 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "obj_loader.h"
 #include "nvh/nvprint.hpp"
+#include "scene_cache.h"
+#include <cstring>
+#include <fstream>
 
 //-----------------------------------------------------------------------------
 // Extract the directory component from a complete path.
@@ -31,19 +34,192 @@ static inline std::string get_path(const std::string& file)
   return dir;
 }
 
-void ObjLoader::loadModel(const std::string& filename)
+void ObjLoader::loadModel(const std::string& filename, ObjParser parser)
 {
-  tinyobj::ObjReader reader;
-  reader.ParseFromFile(filename);
-  if(!reader.Valid())
+  bool hasNormals = parser == ObjParser::eParallel ? parseParallel(filename) : parseTinyObj(filename);
+
+  // If there were none, add a default
+  if(m_materials.empty())
+    m_materials.emplace_back(MaterialObj());
+
+  // Fixing material indices
+  for(auto& mi : m_matIndx)
   {
-    LOGE(reader.Error().c_str());
-    std::cerr << "Cannot load: " << filename << std::endl;
-    assert(reader.Valid());
+    if(mi < 0 || mi > m_materials.size())
+      mi = 0;
   }
 
-  // Collecting the material in the scene
-  for(const auto& material : reader.GetMaterials())
+
+  // Compute normal when no normal were provided.
+  if(!hasNormals)
+  {
+    for(size_t i = 0; i < m_indices.size(); i += 3)
+    {
+      VertexObj& v0 = m_vertices[m_indices[i + 0]];
+      VertexObj& v1 = m_vertices[m_indices[i + 1]];
+      VertexObj& v2 = m_vertices[m_indices[i + 2]];
+
+      nvmath::vec3f n = nvmath::normalize(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
+      v0.nrm          = n;
+      v1.nrm          = n;
+      v2.nrm          = n;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Hash-based welding. Vertices are compared bitwise, which is what we want here:
+// they all come from the same parsed attributes.
+//
+float ObjLoader::weldVertices()
+{
+  if(m_vertices.empty())
+    return 1.f;
+
+  auto hashVertex = [](const VertexObj& v) {
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(&v);
+    uint64_t        h     = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < sizeof(VertexObj) / sizeof(uint32_t); i++)
+      h = (h ^ words[i]) * 0x100000001b3ull;
+    return h ^ (h >> 32);
+  };
+
+  // Open addressing table holding indices in the welded vertex array
+  size_t tableSize = 1;
+  while(tableSize < m_vertices.size() * 2)
+    tableSize <<= 1;
+  const uint32_t        empty = ~0u;
+  std::vector<uint32_t> table(tableSize, empty);
+
+  std::vector<VertexObj> welded;
+  welded.reserve(m_vertices.size() / 3);
+  std::vector<uint32_t> remap(m_vertices.size());
+  for(size_t i = 0; i < m_vertices.size(); i++)
+  {
+    const VertexObj& v    = m_vertices[i];
+    size_t           slot = hashVertex(v) & (tableSize - 1);
+    while(table[slot] != empty && memcmp(&welded[table[slot]], &v, sizeof(VertexObj)) != 0)
+      slot = (slot + 1) & (tableSize - 1);
+    if(table[slot] == empty)
+    {
+      table[slot] = static_cast<uint32_t>(welded.size());
+      welded.push_back(v);
+    }
+    remap[i] = table[slot];
+  }
+
+  for(auto& index : m_indices)
+    index = remap[index];
+
+  float ratio = float(m_vertices.size()) / float(welded.size());
+  LOGI("Welded %zu vertices into %zu (%.2fx)\n", m_vertices.size(), welded.size(), ratio);
+  m_vertices = std::move(welded);
+  m_vertices.shrink_to_fit();
+  m_welded = true;
+  return ratio;
+}
+
+//-----------------------------------------------------------------------------
+// Meshlets over the whole model, the triangles being reordered to match
+//
+void ObjLoader::buildMeshlets()
+{
+  std::vector<uint32_t> triangleOrder;
+  m_meshlets = ::buildMeshlets(&m_vertices.data()->pos, sizeof(VertexObj), m_vertices.size(), m_indices.data(),
+                               m_indices.size(), &triangleOrder);
+
+  m_indices = reorderIndices(m_indices.data(), triangleOrder);
+  if(m_matIndx.size() * 3 >= m_indices.size())
+  {
+    std::vector<uint32_t> matIndx(triangleOrder.size());
+    for(size_t t = 0; t < triangleOrder.size(); t++)
+      matIndx[t] = m_matIndx[triangleOrder[t]];
+    m_matIndx = std::move(matIndx);
+  }
+
+  MeshletStats stats = meshletStats(m_meshlets);
+  LOGI("%zu meshlets, %.1f vertices and %.1f triangles on average, %zu with a normal cone\n", stats.meshletCount,
+       stats.averageVertices, stats.averageTriangles, stats.cullableCount);
+}
+
+//-----------------------------------------------------------------------------
+// Baked cache: all arrays are stored as they are, texture names zero separated
+//
+namespace {
+const uint32_t kObjCacheVersion       = 3;
+const uint32_t kChunkVertices         = makeChunkId('V', 'E', 'R', 'T');
+const uint32_t kChunkIndices          = makeChunkId('I', 'N', 'D', 'X');
+const uint32_t kChunkMaterials        = makeChunkId('M', 'A', 'T', 'L');
+const uint32_t kChunkMatIndices       = makeChunkId('M', 'I', 'D', 'X');
+const uint32_t kChunkTextures         = makeChunkId('T', 'E', 'X', 'N');
+const uint32_t kChunkMeshlets         = makeChunkId('M', 'S', 'H', 'L');
+const uint32_t kChunkMeshletVertices  = makeChunkId('M', 'S', 'H', 'V');
+const uint32_t kChunkMeshletTriangles = makeChunkId('M', 'S', 'H', 'T');
+const uint32_t kChunkWelded           = makeChunkId('W', 'E', 'L', 'D');
+}  // namespace
+
+bool ObjLoader::loadCache(const std::string& filename, bool welded)
+{
+  SceneCache cache;
+  if(!cache.open(sceneCacheFilename(filename), kObjCacheVersion))
+    return false;
+
+  std::vector<uint32_t> cachedWelded;
+  if(!cache.read(kChunkWelded, cachedWelded) || cachedWelded.size() != 1 || (cachedWelded[0] != 0) != welded)
+    return false;
+
+  std::vector<char> textureNames;
+  if(!cache.read(kChunkVertices, m_vertices) || !cache.read(kChunkIndices, m_indices)
+     || !cache.read(kChunkMaterials, m_materials) || !cache.read(kChunkMatIndices, m_matIndx)
+     || !cache.read(kChunkTextures, textureNames) || !cache.read(kChunkMeshlets, m_meshlets.meshlets)
+     || !cache.read(kChunkMeshletVertices, m_meshlets.vertices) || !cache.read(kChunkMeshletTriangles, m_meshlets.triangles))
+  {
+    *this = ObjLoader();
+    return false;
+  }
+
+  m_textures.clear();
+  for(size_t pos = 0; pos < textureNames.size();)
+  {
+    m_textures.emplace_back(&textureNames[pos], strnlen(&textureNames[pos], textureNames.size() - pos));
+    pos += m_textures.back().size() + 1;
+  }
+  m_welded = welded;
+
+  LOGI("Loaded %s from cache: %zu vertices, %zu triangles\n", filename.c_str(), m_vertices.size(),
+       m_indices.size() / 3);
+  return true;
+}
+
+bool ObjLoader::saveCache(const std::string& filename) const
+{
+  std::vector<char> textureNames;
+  for(const auto& name : m_textures)
+    textureNames.insert(textureNames.end(), name.c_str(), name.c_str() + name.size() + 1);
+
+  std::vector<uint32_t> welded = {m_welded ? 1u : 0u};
+
+  SceneCacheWriter writer;
+  for(const auto& source : m_sourceFiles)
+    writer.addSource(source);
+  writer.addChunk(kChunkWelded, welded);
+  writer.addChunk(kChunkVertices, m_vertices);
+  writer.addChunk(kChunkIndices, m_indices);
+  writer.addChunk(kChunkMaterials, m_materials);
+  writer.addChunk(kChunkMatIndices, m_matIndx);
+  writer.addChunk(kChunkTextures, textureNames);
+  writer.addChunk(kChunkMeshlets, m_meshlets.meshlets);
+  writer.addChunk(kChunkMeshletVertices, m_meshlets.vertices);
+  writer.addChunk(kChunkMeshletTriangles, m_meshlets.triangles);
+  return writer.write(sceneCacheFilename(filename), kObjCacheVersion);
+}
+
+//-----------------------------------------------------------------------------
+// Collecting the material in the scene
+//
+void ObjLoader::addMaterials(const std::vector<tinyobj::material_t>& materials)
+{
+  for(const auto& material : materials)
   {
     MaterialObj m;
     m.ambient  = nvmath::vec3f(material.ambient[0], material.ambient[1], material.ambient[2]);
@@ -64,14 +240,63 @@ void ObjLoader::loadModel(const std::string& filename)
 
     m_materials.emplace_back(m);
   }
+}
 
-  // If there were none, add a default
-  if(m_materials.empty())
-    m_materials.emplace_back(MaterialObj());
+//-----------------------------------------------------------------------------
+// Reference parser, using tinyobjloader
+//
+namespace {
+// Material library reader of tinyobj, the one ObjReader uses, also listing the files it read
+class TrackingMaterialReader : public tinyobj::MaterialReader
+{
+public:
+  TrackingMaterialReader(const std::string& baseDir, std::vector<std::string>& files)
+      : m_reader(baseDir)
+      , m_baseDir(baseDir)
+      , m_files(files)
+  {
+  }
+
+  bool operator()(const std::string&               matId,
+                  std::vector<tinyobj::material_t>* materials,
+                  std::map<std::string, int>*       matMap,
+                  std::string*                      warn,
+                  std::string*                      err) override
+  {
+    bool found = m_reader(matId, materials, matMap, warn, err);
+    if(found)
+      m_files.push_back(m_baseDir + matId);
+    return found;
+  }
+
+private:
+  tinyobj::MaterialFileReader m_reader;
+  std::string                 m_baseDir;
+  std::vector<std::string>&   m_files;
+};
+}  // namespace
 
-  const tinyobj::attrib_t& attrib = reader.GetAttrib();
+bool ObjLoader::parseTinyObj(const std::string& filename)
+{
+  // The OBJ and the material libraries it names, for the cache
+  m_sourceFiles = {filename};
 
-  for(const auto& shape : reader.GetShapes())
+  tinyobj::attrib_t                attrib;
+  std::vector<tinyobj::shape_t>    shapes;
+  std::vector<tinyobj::material_t> materials;
+  std::string                      warn, err;
+  std::ifstream                    stream(filename);
+  TrackingMaterialReader           materialReader(get_path(filename), m_sourceFiles);
+  if(!stream || !tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &stream, &materialReader))
+  {
+    LOGE(err.c_str());
+    std::cerr << "Cannot load: " << filename << std::endl;
+    assert(false);
+  }
+
+  addMaterials(materials);
+
+  for(const auto& shape : shapes)
   {
     m_vertices.reserve(shape.mesh.indices.size() + m_vertices.size());
     m_indices.reserve(shape.mesh.indices.size() + m_indices.size());
@@ -107,27 +332,5 @@ void ObjLoader::loadModel(const std::string& filename)
     }
   }
 
-  // Fixing material indices
-  for(auto& mi : m_matIndx)
-  {
-    if(mi < 0 || mi > m_materials.size())
-      mi = 0;
-  }
-
-
-  // Compute normal when no normal were provided.
-  if(attrib.normals.empty())
-  {
-    for(size_t i = 0; i < m_indices.size(); i += 3)
-    {
-      VertexObj& v0 = m_vertices[m_indices[i + 0]];
-      VertexObj& v1 = m_vertices[m_indices[i + 1]];
-      VertexObj& v2 = m_vertices[m_indices[i + 2]];
-
-      nvmath::vec3f n = nvmath::normalize(nvmath::cross((v1.pos - v0.pos), (v2.pos - v0.pos)));
-      v0.nrm          = n;
-      v1.nrm          = n;
-      v2.nrm          = n;
-    }
-  }
+  return !attrib.normals.empty();
 }
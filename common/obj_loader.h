@@ -4,6 +4,7 @@
 
 #pragma once
 #include "fileformats/tiny_obj_loader.h"
+#include "meshlet_builder.h"
 #include "nvmath/nvmath.h"
 #include <array>
 #include <iostream>
@@ -42,14 +43,49 @@ struct shapeObj
   uint32_t matIndex;
 };
 
+// Parser used by ObjLoader::loadModel
+enum class ObjParser
+{
+  eTinyObj,   // tinyobjloader, single threaded
+  eParallel,  // Memory mapped file, line-aligned chunks parsed on all cores
+};
+
 class ObjLoader
 {
 public:
-  void loadModel(const std::string& filename);
+  void loadModel(const std::string& filename, ObjParser parser = ObjParser::eParallel);
+
+  // Merges identical vertices (same position, normal, color and uv), turning the
+  // one-vertex-per-corner output of loadModel into an indexed mesh. The triangle
+  // order is unchanged, so m_matIndx stays valid. Optional: nothing calls it implicitly.
+  // Returns the reduction ratio: number of vertices before / after.
+  float weldVertices();
+
+  // Baked cache of the loaded model (see scene_cache.h), stored next to the OBJ
+  // file and keyed on the content of the OBJ and of its material libraries.
+  // loadCache returns false when there is no valid cache, or when the cached model
+  // was welded and `welded` is false or the other way around; saveCache stores the
+  // current state, so call it after weldVertices and buildMeshlets.
+  bool loadCache(const std::string& filename, bool welded = false);
+  bool saveCache(const std::string& filename) const;
+
+  // Splits the model in meshlets (see meshlet_builder.h) and reorders the triangles,
+  // m_matIndx with them, in meshlet order. Call it after weldVertices.
+  void buildMeshlets();
 
   std::vector<VertexObj>   m_vertices;
   std::vector<uint32_t>    m_indices;
   std::vector<MaterialObj> m_materials;
   std::vector<std::string> m_textures;
   std::vector<uint32_t>    m_matIndx;
+  MeshletMesh              m_meshlets;
+
+private:
+  // Both parsers fill the vectors above and return false when the file has no normals
+  bool parseTinyObj(const std::string& filename);
+  bool parseParallel(const std::string& filename);
+  void addMaterials(const std::vector<tinyobj::material_t>& materials);
+
+  std::vector<std::string> m_sourceFiles;  // OBJ and material libraries that were read
+  bool                     m_welded{false};
 };
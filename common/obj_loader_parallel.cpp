@@ -0,0 +1,474 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+// Multithreaded OBJ parser.
+// The file is memory mapped and split in line-aligned chunks which are parsed
+// independently. Each chunk only knows its own element counts, so indices
+// relative to the end of the vertex list and materials inherited from a
+// previous chunk are resolved once all chunks are done. The final vertices are
+// then written in parallel, each chunk at its own offset.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "mapped_file.h"
+#include "nvh/nvprint.hpp"
+#include "obj_loader.h"
+#include "parallel.h"
+
+namespace {
+
+constexpr size_t kMinChunkSize = 1 << 20;  // Don't split small files
+
+enum RelativeFlags : uint32_t
+{
+  eRelativeV  = 1,
+  eRelativeVt = 2,
+  eRelativeVn = 4,
+};
+
+// One corner of a triangle, 0-based.
+// Negative OBJ indices are relative to the last element read; they are stored
+// here relative to the start of the chunk and flagged, to be offset at merge time.
+struct ObjCorner
+{
+  int32_t  v{0};
+  int32_t  vt{-1};
+  int32_t  vn{-1};
+  uint32_t relative{0};
+};
+
+struct ObjChunk
+{
+  std::vector<nvmath::vec3f> positions;
+  std::vector<nvmath::vec3f> colors;  // Empty if the chunk has no vertex colors
+  std::vector<nvmath::vec3f> normals;
+  std::vector<nvmath::vec2f> texcoords;
+  std::vector<ObjCorner>     corners;       // 3 per triangle
+  std::vector<int32_t>       triMaterials;  // Index in materialNames, -1: inherited from previous chunk
+  std::vector<std::string>   materialNames;
+  std::vector<std::string>   mtlLibs;
+  int32_t                    lastMaterial{-1};  // Material in use at the end of the chunk
+
+  // Resolved at merge time
+  size_t               vBase{0}, vtBase{0}, vnBase{0}, triBase{0};
+  std::vector<int32_t> globalMaterials;  // materialNames -> index in m_materials
+};
+
+inline bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void skipSpaces(const char*& p, const char* end)
+{
+  while(p < end && isSpace(*p))
+    p++;
+}
+
+inline bool parseInt(const char*& p, const char* end, int32_t& value)
+{
+  bool negative = false;
+  if(p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  if(p >= end || *p < '0' || *p > '9')
+    return false;
+  int64_t v = 0;
+  while(p < end && *p >= '0' && *p <= '9')
+    v = v * 10 + (*p++ - '0');
+  value = static_cast<int32_t>(negative ? -v : v);
+  return true;
+}
+
+// Locale independent float parsing, good enough for geometry
+inline bool parseFloat(const char*& p, const char* end, float& value)
+{
+  skipSpaces(p, end);
+  const char* start    = p;
+  bool        negative = false;
+  if(p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  double mantissa = 0.0;
+  bool   hasDigit = false;
+  while(p < end && *p >= '0' && *p <= '9')
+  {
+    mantissa = mantissa * 10.0 + (*p++ - '0');
+    hasDigit = true;
+  }
+  if(p < end && *p == '.')
+  {
+    p++;
+    double scale = 0.1;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+      mantissa += (*p++ - '0') * scale;
+      scale *= 0.1;
+      hasDigit = true;
+    }
+  }
+  if(!hasDigit)
+  {
+    p = start;
+    return false;
+  }
+  if(p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char* expStart = p++;
+    int32_t     exponent = 0;
+    if(parseInt(p, end, exponent))
+      mantissa *= std::pow(10.0, exponent);
+    else
+      p = expStart;
+  }
+  value = static_cast<float>(negative ? -mantissa : mantissa);
+  return true;
+}
+
+inline std::string parseName(const char* p, const char* end)
+{
+  skipSpaces(p, end);
+  while(end > p && isSpace(end[-1]))
+    end--;
+  return std::string(p, end);
+}
+
+inline bool startsWith(const char* p, const char* end, const char* keyword)
+{
+  size_t n = strlen(keyword);
+  return size_t(end - p) > n && memcmp(p, keyword, n) == 0 && isSpace(p[n]);
+}
+
+// Converts an OBJ index to a 0-based one. Returns false for relative indices,
+// which are then relative to the start of the chunk.
+inline bool resolveIndex(int32_t objIndex, size_t localCount, int32_t& index)
+{
+  if(objIndex > 0)
+  {
+    index = objIndex - 1;
+    return true;
+  }
+  index = static_cast<int32_t>(localCount) + objIndex;
+  return false;
+}
+
+bool parseCorner(const char*& p, const char* end, const ObjChunk& chunk, ObjCorner& corner)
+{
+  int32_t value;
+  if(!parseInt(p, end, value) || value == 0)
+    return false;
+  corner = {};
+  if(!resolveIndex(value, chunk.positions.size(), corner.v))
+    corner.relative |= eRelativeV;
+
+  if(p < end && *p == '/')
+  {
+    p++;
+    if(p < end && *p != '/' && parseInt(p, end, value) && value != 0)
+    {
+      if(!resolveIndex(value, chunk.texcoords.size(), corner.vt))
+        corner.relative |= eRelativeVt;
+    }
+    if(p < end && *p == '/')
+    {
+      p++;
+      if(parseInt(p, end, value) && value != 0)
+      {
+        if(!resolveIndex(value, chunk.normals.size(), corner.vn))
+          corner.relative |= eRelativeVn;
+      }
+    }
+  }
+  // Skip anything left in this token
+  while(p < end && !isSpace(*p))
+    p++;
+  return true;
+}
+
+void parseLine(const char* p, const char* end, ObjChunk& chunk)
+{
+  skipSpaces(p, end);
+  if(end - p < 2)
+    return;
+
+  if(p[0] == 'v')
+  {
+    const char* q = p + 2;
+    if(isSpace(p[1]))  // Position, with optional color
+    {
+      nvmath::vec3f pos(0.f);
+      parseFloat(q, end, pos.x);
+      parseFloat(q, end, pos.y);
+      parseFloat(q, end, pos.z);
+      nvmath::vec3f color(1.f);
+      if(parseFloat(q, end, color.x) && parseFloat(q, end, color.y) && parseFloat(q, end, color.z))
+      {
+        if(chunk.colors.empty())
+          chunk.colors.resize(chunk.positions.size(), nvmath::vec3f(1.f));
+        chunk.colors.push_back(color);
+      }
+      else if(!chunk.colors.empty())
+        chunk.colors.push_back(nvmath::vec3f(1.f));
+      chunk.positions.push_back(pos);
+    }
+    else if(p[1] == 'n' && end - p > 2 && isSpace(p[2]))
+    {
+      q++;
+      nvmath::vec3f nrm(0.f);
+      parseFloat(q, end, nrm.x);
+      parseFloat(q, end, nrm.y);
+      parseFloat(q, end, nrm.z);
+      chunk.normals.push_back(nrm);
+    }
+    else if(p[1] == 't' && end - p > 2 && isSpace(p[2]))
+    {
+      q++;
+      nvmath::vec2f uv(0.f);
+      parseFloat(q, end, uv.x);
+      parseFloat(q, end, uv.y);
+      chunk.texcoords.push_back(uv);
+    }
+  }
+  else if(p[0] == 'f' && isSpace(p[1]))
+  {
+    // Triangle fan, same as tinyobj's default triangulation
+    p += 2;
+    ObjCorner first, previous, current;
+    int       nbCorners = 0;
+    while(true)
+    {
+      skipSpaces(p, end);
+      if(p >= end || !parseCorner(p, end, chunk, current))
+        break;
+      if(nbCorners == 0)
+        first = current;
+      else if(nbCorners >= 2)
+      {
+        chunk.corners.push_back(first);
+        chunk.corners.push_back(previous);
+        chunk.corners.push_back(current);
+        chunk.triMaterials.push_back(chunk.lastMaterial);
+      }
+      previous = current;
+      nbCorners++;
+    }
+  }
+  else if(startsWith(p, end, "usemtl"))
+  {
+    std::string name = parseName(p + 6, end);
+    auto        it   = std::find(chunk.materialNames.begin(), chunk.materialNames.end(), name);
+    if(it == chunk.materialNames.end())
+      it = chunk.materialNames.insert(it, name);
+    chunk.lastMaterial = static_cast<int32_t>(it - chunk.materialNames.begin());
+  }
+  else if(startsWith(p, end, "mtllib"))
+  {
+    chunk.mtlLibs.push_back(parseName(p + 6, end));
+  }
+  // Anything else (groups, smoothing groups, comments, ...) does not affect the output
+}
+
+void parseChunk(const char* p, const char* end, ObjChunk& chunk)
+{
+  // Rough guess to avoid most reallocations: ~30 bytes per line
+  size_t lines = (end - p) / 30;
+  chunk.positions.reserve(lines / 2);
+  chunk.corners.reserve(lines * 3);
+
+  while(p < end)
+  {
+    const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+    if(lineEnd == nullptr)
+      lineEnd = end;
+    parseLine(p, lineEnd, chunk);
+    p = lineEnd + 1;
+  }
+
+  if(!chunk.colors.empty())
+    chunk.colors.resize(chunk.positions.size(), nvmath::vec3f(1.f));
+}
+
+// Loads all the materials of a library, tinyobj style: the first file of the list that can be opened.
+// Returns the name of the file that was read, or an empty string.
+std::string loadMaterialLibrary(const std::string&                baseDir,
+                                const std::string&                mtlLib,
+                                std::map<std::string, int>&       materialMap,
+                                std::vector<tinyobj::material_t>& materials)
+{
+  std::istringstream names(mtlLib);
+  std::string        name;
+  while(names >> name)
+  {
+    std::ifstream stream(baseDir + name);
+    if(!stream)
+      continue;
+    std::string warning, error;
+    tinyobj::LoadMtl(&materialMap, &materials, &stream, &warning, &error);
+    if(!error.empty())
+      LOGE("%s", error.c_str());
+    return baseDir + name;
+  }
+  LOGW("Material library not found: %s\n", mtlLib.c_str());
+  return {};
+}
+
+template <class T>
+inline const T* fetch(const std::vector<T>& data, int32_t index)
+{
+  return index >= 0 && size_t(index) < data.size() ? &data[index] : nullptr;
+}
+
+}  // namespace
+
+
+bool ObjLoader::parseParallel(const std::string& filename)
+{
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  MappedFile file(filename);
+  if(!file.valid())
+  {
+    std::cerr << "Cannot load: " << filename << std::endl;
+    assert(file.valid());
+    return false;
+  }
+
+  // Line-aligned chunks
+  uint32_t nbThreads = getWorkerCount();
+  size_t   nbChunks  = std::max<size_t>(1, std::min<size_t>(nbThreads * 4, file.size() / kMinChunkSize));
+  std::vector<const char*> boundaries(nbChunks + 1, file.end());
+  boundaries[0] = file.begin();
+  for(size_t c = 1; c < nbChunks; c++)
+  {
+    const char* p = std::max(boundaries[c - 1], file.begin() + c * (file.size() / nbChunks));
+    const char* lineEnd = static_cast<const char*>(memchr(p, '\n', file.end() - p));
+    boundaries[c]       = lineEnd ? lineEnd + 1 : file.end();
+  }
+
+  std::vector<ObjChunk> chunks(nbChunks);
+  parallelFor(
+      nbChunks, [&](size_t c) { parseChunk(boundaries[c], boundaries[c + 1], chunks[c]); }, nbThreads);
+
+  // Materials, in the order the libraries were declared
+  std::string baseDir;
+  size_t      sep = filename.find_last_of("\\/");
+  if(sep != std::string::npos)
+    baseDir = filename.substr(0, sep + 1);
+
+  std::map<std::string, int>       materialMap;
+  std::vector<tinyobj::material_t> materials;
+  m_sourceFiles = {filename};
+  for(const auto& chunk : chunks)
+    for(const auto& mtlLib : chunk.mtlLibs)
+    {
+      std::string mtlFile = loadMaterialLibrary(baseDir, mtlLib, materialMap, materials);
+      if(!mtlFile.empty())
+        m_sourceFiles.push_back(mtlFile);
+    }
+  addMaterials(materials);
+
+  // Merge: element offsets and material inheritance
+  size_t  nbPositions = 0, nbTexcoords = 0, nbNormals = 0, nbTriangles = 0;
+  bool    hasColors   = false;
+  int32_t material    = -1;
+  for(auto& chunk : chunks)
+  {
+    chunk.vBase   = nbPositions;
+    chunk.vtBase  = nbTexcoords;
+    chunk.vnBase  = nbNormals;
+    chunk.triBase = nbTriangles;
+    nbPositions += chunk.positions.size();
+    nbTexcoords += chunk.texcoords.size();
+    nbNormals += chunk.normals.size();
+    nbTriangles += chunk.triMaterials.size();
+    hasColors |= !chunk.colors.empty();
+
+    chunk.globalMaterials.reserve(chunk.materialNames.size());
+    for(const auto& name : chunk.materialNames)
+    {
+      auto it = materialMap.find(name);
+      chunk.globalMaterials.push_back(it != materialMap.end() ? it->second : -1);
+    }
+    for(auto& triMaterial : chunk.triMaterials)
+      triMaterial = triMaterial < 0 ? material : chunk.globalMaterials[triMaterial];
+    if(chunk.lastMaterial >= 0)
+      material = chunk.globalMaterials[chunk.lastMaterial];
+  }
+
+  // Gather the attributes, faces may reference elements of any chunk
+  std::vector<nvmath::vec3f> positions(nbPositions);
+  std::vector<nvmath::vec3f> colors(hasColors ? nbPositions : 0);
+  std::vector<nvmath::vec3f> normals(nbNormals);
+  std::vector<nvmath::vec2f> texcoords(nbTexcoords);
+  parallelFor(
+      nbChunks,
+      [&](size_t c) {
+        ObjChunk& chunk = chunks[c];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.vBase);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.vnBase);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.vtBase);
+        if(hasColors && chunk.colors.empty())
+          std::fill_n(colors.begin() + chunk.vBase, chunk.positions.size(), nvmath::vec3f(1.f));
+        else
+          std::copy(chunk.colors.begin(), chunk.colors.end(), colors.begin() + chunk.vBase);
+        std::vector<nvmath::vec3f>().swap(chunk.positions);
+        std::vector<nvmath::vec3f>().swap(chunk.normals);
+        std::vector<nvmath::vec2f>().swap(chunk.texcoords);
+        std::vector<nvmath::vec3f>().swap(chunk.colors);
+      },
+      nbThreads);
+
+  // Emit one vertex per corner, like the tinyobj path
+  size_t vertexBase = m_vertices.size();
+  size_t indexBase  = m_indices.size();
+  size_t matBase    = m_matIndx.size();
+  m_vertices.resize(vertexBase + nbTriangles * 3);
+  m_indices.resize(indexBase + nbTriangles * 3);
+  m_matIndx.resize(matBase + nbTriangles);
+
+  parallelFor(
+      nbChunks,
+      [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        for(size_t t = 0; t < chunk.triMaterials.size(); t++)
+        {
+          size_t tri               = chunk.triBase + t;
+          m_matIndx[matBase + tri] = static_cast<uint32_t>(chunk.triMaterials[t]);
+          for(size_t k = 0; k < 3; k++)
+          {
+            const ObjCorner& corner = chunk.corners[t * 3 + k];
+            int32_t v  = corner.v + ((corner.relative & eRelativeV) ? int32_t(chunk.vBase) : 0);
+            int32_t vt = corner.vt + ((corner.relative & eRelativeVt) ? int32_t(chunk.vtBase) : 0);
+            int32_t vn = corner.vn + ((corner.relative & eRelativeVn) ? int32_t(chunk.vnBase) : 0);
+
+            VertexObj vertex = {};
+            if(const nvmath::vec3f* pos = fetch(positions, v))
+              vertex.pos = *pos;
+            if(const nvmath::vec3f* nrm = fetch(normals, vn))
+              vertex.nrm = *nrm;
+            if(const nvmath::vec2f* uv = fetch(texcoords, vt))
+              vertex.texCoord = {uv->x, 1.0f - uv->y};
+            const nvmath::vec3f* color = hasColors ? fetch(colors, v) : nullptr;
+            vertex.color               = color ? *color : nvmath::vec3f(1.f);
+
+            size_t corner3                   = tri * 3 + k;
+            m_vertices[vertexBase + corner3] = vertex;
+            m_indices[indexBase + corner3]   = static_cast<uint32_t>(vertexBase + corner3);
+          }
+        }
+      },
+      nbThreads);
+
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime);
+  LOGI("Parsed %s: %zu triangles, %zu chunks on %u threads in %.1f ms\n", filename.c_str(), nbTriangles,
+       nbChunks, nbThreads, elapsed.count());
+
+  return nbNormals > 0;
+}
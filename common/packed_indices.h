@@ -0,0 +1,56 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Index buffer mixing 16 and 32-bit primitives.
+// A primitive gets 16-bit indices when all of them fit, 32-bit ones otherwise. The
+// buffer is an array of 32-bit words and every primitive starts on a word, 16-bit
+// indices being packed two per word, low half first. The first index of a primitive
+// is counted in indices of its own width: this is what vkCmdDrawIndexed and the
+// acceleration structure builds expect when the whole buffer is bound at offset 0.
+
+struct PackedIndexRange
+{
+  uint32_t firstIndex{0};
+  bool     is16Bit{false};
+};
+
+// Appends the indices of one primitive to `words`
+inline PackedIndexRange appendPackedIndices(std::vector<uint32_t>& words, const uint32_t* indices, size_t count)
+{
+  uint32_t maxIndex = 0;
+  for(size_t i = 0; i < count; i++)
+    maxIndex = std::max(maxIndex, indices[i]);
+
+  PackedIndexRange range;
+  range.is16Bit = maxIndex <= 0xFFFF;
+  if(range.is16Bit)
+  {
+    size_t first     = words.size();
+    range.firstIndex = static_cast<uint32_t>(first * 2);
+    words.resize(first + (count + 1) / 2, 0);
+    for(size_t i = 0; i < count; i++)
+      words[first + i / 2] |= indices[i] << ((i & 1) * 16);
+  }
+  else
+  {
+    range.firstIndex = static_cast<uint32_t>(words.size());
+    words.insert(words.end(), indices, indices + count);
+  }
+  return range;
+}
+
+// Reads back index `i` of a primitive
+inline uint32_t packedIndex(const std::vector<uint32_t>& words, const PackedIndexRange& range, size_t i)
+{
+  if(!range.is16Bit)
+    return words[range.firstIndex + i];
+  size_t index = range.firstIndex + i;
+  return (words[index / 2] >> ((index & 1) * 16)) & 0xFFFF;
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "parallel.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace {
+// A call of runOnWorkers, alive on the caller's stack until it returns
+struct Job
+{
+  void (*work)(void*);
+  void*    context;
+  uint32_t freeSlots;  // Helpers that may still join
+  uint32_t running;    // Helpers inside work
+};
+
+// Threads started once and parked on a condition variable between jobs, so that the
+// loaders and builders do not pay a thread creation per parallel loop
+class WorkerPool
+{
+public:
+  explicit WorkerPool(uint32_t threadCount)
+  {
+    m_threads.reserve(threadCount);
+    for(uint32_t t = 0; t < threadCount; t++)
+      m_threads.emplace_back([this]() { workerLoop(); });
+  }
+
+  ~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for(auto& t : m_threads)
+      t.join();
+  }
+
+  void run(uint32_t helperCount, void (*work)(void*), void* context)
+  {
+    uint32_t slots = std::min<uint32_t>(helperCount, uint32_t(m_threads.size()));
+    Job      job{work, context, slots, 0};
+    if(slots)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(&job);
+      }
+      if(slots == 1)
+        m_wake.notify_one();
+      else
+        m_wake.notify_all();
+    }
+
+    work(context);
+
+    // The items are all taken: close the job to late helpers, then wait for the others
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(job.freeSlots)
+    {
+      job.freeSlots = 0;
+      m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), &job));
+    }
+    m_done.wait(lock, [&]() { return job.running == 0; });
+  }
+
+private:
+  void workerLoop()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;)
+    {
+      m_wake.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+      if(m_stop)
+        return;
+
+      Job* job = m_jobs.front();
+      if(--job->freeSlots == 0)
+        m_jobs.pop_front();
+      job->running++;
+      lock.unlock();
+      job->work(job->context);
+      lock.lock();
+      if(--job->running == 0)
+        m_done.notify_all();
+    }
+  }
+
+  std::vector<std::thread> m_threads;
+  std::mutex               m_mutex;
+  std::condition_variable  m_wake;
+  std::condition_variable  m_done;
+  std::deque<Job*>         m_jobs;  // Jobs with free slots, oldest first
+  bool                     m_stop = false;
+};
+}  // namespace
+
+void runOnWorkers(uint32_t helperCount, void (*work)(void*), void* context)
+{
+  static WorkerPool pool(getWorkerCount() - 1);
+  pool.run(helperCount, work, context);
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Number of threads used by the CPU-side loaders and builders
+inline uint32_t getWorkerCount()
+{
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs work(context) on the calling thread and on up to helperCount threads of a pool
+// that is started on first use and kept for the lifetime of the process. Returns once the
+// calling thread's call has returned and no helper is still inside work. Helpers only join
+// while the caller is still busy, so work must tolerate running on fewer threads, down to
+// the caller alone; this also makes nested calls from inside work safe.
+void runOnWorkers(uint32_t helperCount, void (*work)(void*), void* context);
+
+// Calls fn(i) for every i in [0, count), spreading the calls over nbThreads threads.
+// Items are handed out one at a time, so items of uneven cost still balance. The
+// calling thread takes part in the work and the function returns once all items are done.
+template <class Fn>
+void parallelFor(size_t count, Fn&& fn, uint32_t nbThreads = getWorkerCount())
+{
+  nbThreads = static_cast<uint32_t>(std::min<size_t>(nbThreads, count));
+  if(nbThreads <= 1)
+  {
+    for(size_t i = 0; i < count; i++)
+      fn(i);
+    return;
+  }
+
+  struct Context
+  {
+    size_t              count;
+    Fn&                 fn;
+    std::atomic<size_t> next{0};
+  } context{count, fn};
+  runOnWorkers(
+      nbThreads - 1,
+      [](void* data) {
+        Context& ctx = *static_cast<Context*>(data);
+        for(size_t i = ctx.next++; i < ctx.count; i = ctx.next++)
+          ctx.fn(i);
+      },
+      &context);
+}
+
+// Splits [0, count) in contiguous ranges of at least minBatch items and calls
+// fn(begin, end) for each of them in parallel.
+template <class Fn>
+void parallelRanges(size_t count, size_t minBatch, Fn&& fn, uint32_t nbThreads = getWorkerCount())
+{
+  if(count == 0)
+    return;
+  size_t nbBatches = std::min<size_t>(nbThreads * 4, (count + minBatch - 1) / std::max<size_t>(minBatch, 1));
+  nbBatches        = std::max<size_t>(nbBatches, 1);
+  size_t batchSize = (count + nbBatches - 1) / nbBatches;
+  parallelFor(
+      nbBatches,
+      [&](size_t b) {
+        size_t begin = b * batchSize;
+        size_t end   = std::min(count, begin + batchSize);
+        if(begin < end)
+          fn(begin, end);
+      },
+      nbThreads);
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "quantized_positions.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+const float kQuantizedMax = 65535.f;
+
+uint16_t quantize(float value, float offset, float scale)
+{
+  if(scale <= 0.f)
+    return 0;
+  float q = std::round((value - offset) / scale);
+  return static_cast<uint16_t>(std::min(std::max(q, 0.f), kQuantizedMax));
+}
+}  // namespace
+
+PositionQuantization makePositionQuantization(const nvmath::vec3f* positions, size_t count)
+{
+  PositionQuantization quantization;
+  if(count == 0)
+    return quantization;
+
+  nvmath::vec3f boxMin(FLT_MAX, FLT_MAX, FLT_MAX);
+  nvmath::vec3f boxMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for(size_t i = 0; i < count; i++)
+  {
+    boxMin = nvmath::nv_min(boxMin, positions[i]);
+    boxMax = nvmath::nv_max(boxMax, positions[i]);
+  }
+
+  quantization.offset = boxMin;
+  quantization.scale  = (boxMax - boxMin) / kQuantizedMax;
+  return quantization;
+}
+
+void quantizePositions(const nvmath::vec3f* positions, size_t count, const PositionQuantization& quantization, QuantizedPosition* out)
+{
+  const nvmath::vec3f& offset = quantization.offset;
+  const nvmath::vec3f& scale  = quantization.scale;
+  for(size_t i = 0; i < count; i++)
+  {
+    out[i].x = quantize(positions[i].x, offset.x, scale.x);
+    out[i].y = quantize(positions[i].y, offset.y, scale.y);
+    out[i].z = quantize(positions[i].z, offset.z, scale.z);
+    out[i].w = 0;
+  }
+}
+
+void dequantizePositions(const QuantizedPosition* positions, size_t count, const PositionQuantization& quantization, nvmath::vec3f* out)
+{
+  const nvmath::vec3f& offset = quantization.offset;
+  const nvmath::vec3f& scale  = quantization.scale;
+  for(size_t i = 0; i < count; i++)
+  {
+    out[i].x = offset.x + scale.x * positions[i].x;
+    out[i].y = offset.y + scale.y * positions[i].y;
+    out[i].z = offset.z + scale.z * positions[i].z;
+  }
+}
+
+float quantizationErrorBound(const PositionQuantization& quantization)
+{
+  return 0.5f * nvmath::length(quantization.scale);
+}
@@ -0,0 +1,35 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "nvmath/nvmath.h"
+
+// Quantized vertex positions
+// Each coordinate is a 16-bit unsigned integer relative to the bounding box of the
+// primitive: position = offset + scale * q. The fourth component is padding, so
+// vertices are 8 bytes instead of 12 and can be read as two 32-bit words or as an
+// R16G16B16A16_UNORM vertex attribute (which then needs the scale times 65535).
+
+struct QuantizedPosition
+{
+  uint16_t x, y, z, w;
+};
+
+struct PositionQuantization
+{
+  nvmath::vec3f scale{0.f, 0.f, 0.f};
+  nvmath::vec3f offset{0.f, 0.f, 0.f};
+};
+
+// Quantization covering the bounding box of `positions`
+PositionQuantization makePositionQuantization(const nvmath::vec3f* positions, size_t count);
+
+void quantizePositions(const nvmath::vec3f* positions, size_t count, const PositionQuantization& quantization, QuantizedPosition* out);
+void dequantizePositions(const QuantizedPosition* positions, size_t count, const PositionQuantization& quantization, nvmath::vec3f* out);
+
+// Largest distance between a position of the box and its decoded value: half a step on each axis
+float quantizationErrorBound(const PositionQuantization& quantization);
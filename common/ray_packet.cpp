@@ -0,0 +1,612 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "ray_packet.h"
+#include "simd.h"
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+using nvmath::vec3f;
+
+inline uint32_t lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return uint32_t(index);
+#else
+  return uint32_t(__builtin_ctz(mask));
+#endif
+}
+
+// Child of an interior node to visit first: along the axis separating the two children the
+// most, the one on the side the rays come from
+inline bool secondChildFirst(const BvhNode* children, const bool negative[3])
+{
+  vec3f d    = (children[1].bboxMin + children[1].bboxMax) - (children[0].bboxMin + children[0].bboxMax);
+  vec3f a    = vec3f(std::abs(d.x), std::abs(d.y), std::abs(d.z));
+  int   axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+  return (d[axis] < 0.f) != negative[axis];
+}
+
+//--------------------------------------------------------------------------------------------------
+// Packets
+//
+
+template <uint32_t N>
+struct PreparedPacket
+{
+  // SoA, for the box tests
+  alignas(64) float originX[N];
+  float originY[N];
+  float originZ[N];
+  float invX[N];
+  float invY[N];
+  float invZ[N];
+  float tMin[N];
+  float tMax[N];  // Shrinks with the closest hits
+
+  BvhRay        rays[N];
+  WatertightRay wrays[N];
+
+  // Shear of the watertight test, SoA. When all active rays have the same dominant axis,
+  // the vertices of a triangle are sheared the same way for all lanes and tested with SIMD.
+  float shearX[N];
+  float shearY[N];
+  float shearZ[N];
+  bool  sharedAxes{true};
+
+  // Frustum: bounds of the origins and of the magnitude of the inverse directions, valid when
+  // all active directions have the same signs
+  bool  hasFrustum{true};
+  bool  negative[3]{};
+  float originMin[3], originMax[3];
+  float invMin[3], invMax[3];
+  float tMinAll{FLT_MAX};
+  float tMaxAll{0.f};
+
+  PreparedPacket(const BvhRayPacket<N>& packet, uint32_t active)
+  {
+    for(int axis = 0; axis < 3; axis++)
+    {
+      originMin[axis] = invMin[axis] = FLT_MAX;
+      originMax[axis] = invMax[axis] = -FLT_MAX;
+    }
+    bool first = true;
+    for(uint32_t lane = 0; lane < N; lane++)
+    {
+      rays[lane]     = packet.get(lane);
+      wrays[lane]    = WatertightRay(rays[lane].direction);
+      vec3f inv      = safeInverse(rays[lane].direction);
+      originX[lane]  = packet.originX[lane];
+      originY[lane]  = packet.originY[lane];
+      originZ[lane]  = packet.originZ[lane];
+      invX[lane]     = inv.x;
+      invY[lane]     = inv.y;
+      invZ[lane]     = inv.z;
+      tMin[lane]     = packet.tMin[lane];
+      tMax[lane]     = packet.tMax[lane];
+      shearX[lane]   = wrays[lane].sx;
+      shearY[lane]   = wrays[lane].sy;
+      shearZ[lane]   = wrays[lane].sz;
+      if(!(active & (1u << lane)))
+        continue;
+
+      const WatertightRay& axes = wrays[lowestBit(active)];
+      sharedAxes = sharedAxes && wrays[lane].kx == axes.kx && wrays[lane].ky == axes.ky && wrays[lane].kz == axes.kz;
+
+      tMinAll = std::min(tMinAll, tMin[lane]);
+      tMaxAll = std::max(tMaxAll, tMax[lane]);
+      for(int axis = 0; axis < 3; axis++)
+      {
+        if(first)
+          negative[axis] = inv[axis] < 0.f;
+        hasFrustum      = hasFrustum && negative[axis] == (inv[axis] < 0.f);
+        originMin[axis] = std::min(originMin[axis], rays[lane].origin[axis]);
+        originMax[axis] = std::max(originMax[axis], rays[lane].origin[axis]);
+        invMin[axis]    = std::min(invMin[axis], std::abs(inv[axis]));
+        invMax[axis]    = std::max(invMax[axis], std::abs(inv[axis]));
+      }
+      first = false;
+    }
+  }
+
+  const float* origin(int axis) const { return axis == 0 ? originX : (axis == 1 ? originY : originZ); }
+
+  void updateMaxDistance(uint32_t active)
+  {
+    tMaxAll = 0.f;
+    for(; active; active &= active - 1)
+      tMaxAll = std::max(tMaxAll, tMax[lowestBit(active)]);
+  }
+
+  // True if no ray of the packet can hit the box. Interval arithmetic: the smallest entry
+  // and largest exit distances over all the rays of the frustum.
+  bool frustumMisses(const BvhNode& node) const
+  {
+    if(!hasFrustum)
+      return false;
+    float enter = tMinAll;
+    float exit  = tMaxAll;
+    for(int axis = 0; axis < 3; axis++)
+    {
+      // Distances along the axis, counted in the direction of the rays
+      float nearGap = negative[axis] ? originMin[axis] - node.bboxMax[axis] : node.bboxMin[axis] - originMax[axis];
+      float farGap  = negative[axis] ? originMax[axis] - node.bboxMin[axis] : node.bboxMax[axis] - originMin[axis];
+      enter         = std::max(enter, nearGap * (nearGap >= 0.f ? invMin[axis] : invMax[axis]));
+      exit          = std::min(exit, farGap * (farGap >= 0.f ? invMax[axis] : invMin[axis]));
+    }
+    return enter > exit * kBvhRobustExit;
+  }
+};
+
+// Slab test of one box against the lanes [first, first + count), one at a time
+template <uint32_t N>
+inline uint32_t laneTestScalar(const BvhNode& node, const PreparedPacket<N>& p, uint32_t first, uint32_t count)
+{
+  uint32_t mask = 0;
+  for(uint32_t lane = first; lane < first + count; lane++)
+  {
+    float tx0   = (node.bboxMin.x - p.originX[lane]) * p.invX[lane];
+    float tx1   = (node.bboxMax.x - p.originX[lane]) * p.invX[lane];
+    float ty0   = (node.bboxMin.y - p.originY[lane]) * p.invY[lane];
+    float ty1   = (node.bboxMax.y - p.originY[lane]) * p.invY[lane];
+    float tz0   = (node.bboxMin.z - p.originZ[lane]) * p.invZ[lane];
+    float tz1   = (node.bboxMax.z - p.originZ[lane]) * p.invZ[lane];
+    float enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), p.tMin[lane]));
+    float exit  = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), p.tMax[lane]));
+    if(enter <= exit * kBvhRobustExit)
+      mask |= 1u << lane;
+  }
+  return mask;
+}
+
+#if NV_SIMD_SSE2
+template <uint32_t N>
+inline uint32_t laneTestSse(const BvhNode& node, const PreparedPacket<N>& p, uint32_t first)
+{
+  auto slab = [&](float lo, float hi, const float* origin, const float* inv, __m128& enter, __m128& exit) {
+    __m128 o  = _mm_load_ps(origin + first);
+    __m128 i  = _mm_load_ps(inv + first);
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo), o), i);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi), o), i);
+    enter     = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+    exit      = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+  };
+  __m128 enter = _mm_load_ps(p.tMin + first);
+  __m128 exit  = _mm_load_ps(p.tMax + first);
+  slab(node.bboxMin.x, node.bboxMax.x, p.originX, p.invX, enter, exit);
+  slab(node.bboxMin.y, node.bboxMax.y, p.originY, p.invY, enter, exit);
+  slab(node.bboxMin.z, node.bboxMax.z, p.originZ, p.invZ, enter, exit);
+  return uint32_t(_mm_movemask_ps(_mm_cmple_ps(enter, _mm_mul_ps(exit, _mm_set1_ps(kBvhRobustExit))))) << first;
+}
+#endif
+
+#if NV_SIMD_AVX2
+template <uint32_t N>
+inline uint32_t laneTestAvx(const BvhNode& node, const PreparedPacket<N>& p, uint32_t first)
+{
+  auto slab = [&](float lo, float hi, const float* origin, const float* inv, __m256& enter, __m256& exit) {
+    __m256 o  = _mm256_load_ps(origin + first);
+    __m256 i  = _mm256_load_ps(inv + first);
+    __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(lo), o), i);
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(hi), o), i);
+    enter     = _mm256_max_ps(enter, _mm256_min_ps(t0, t1));
+    exit      = _mm256_min_ps(exit, _mm256_max_ps(t0, t1));
+  };
+  __m256 enter = _mm256_load_ps(p.tMin + first);
+  __m256 exit  = _mm256_load_ps(p.tMax + first);
+  slab(node.bboxMin.x, node.bboxMax.x, p.originX, p.invX, enter, exit);
+  slab(node.bboxMin.y, node.bboxMax.y, p.originY, p.invY, enter, exit);
+  slab(node.bboxMin.z, node.bboxMax.z, p.originZ, p.invZ, enter, exit);
+  __m256 robustExit = _mm256_mul_ps(exit, _mm256_set1_ps(kBvhRobustExit));
+  return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(enter, robustExit, _CMP_LE_OQ))) << first;
+}
+#endif
+
+// Mask of the lanes whose ray hits the box
+template <uint32_t N>
+inline uint32_t laneTest(const BvhNode& node, const PreparedPacket<N>& p)
+{
+  uint32_t mask = 0;
+#if NV_SIMD_AVX2
+  for(uint32_t first = 0; first < N; first += 8)
+    mask |= laneTestAvx(node, p, first);
+#elif NV_SIMD_SSE2
+  for(uint32_t first = 0; first < N; first += 4)
+    mask |= laneTestSse(node, p, first);
+#else
+  mask = laneTestScalar(node, p, 0, N);
+#endif
+  return mask;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Triangle tests of a packet
+// The SIMD versions repeat the operations of intersectTriangle (bvh.h) in the same order, so
+// they give the same bits. Lanes where an edge function is exactly zero go through the scalar
+// test, which has the double precision fallback.
+//
+
+#if NV_SIMD_SSE2
+template <uint32_t N>
+uint32_t triangleTestSse(const BvhTriangle& tri, PreparedPacket<N>& p, uint32_t first, uint32_t mask, BvhHit* hits)
+{
+  const WatertightRay& axes = p.wrays[first + lowestBit(mask >> first)];
+  const float*         ox   = p.origin(axes.kx) + first;
+  const float*         oy   = p.origin(axes.ky) + first;
+  const float*         oz   = p.origin(axes.kz) + first;
+  __m128               sx   = _mm_load_ps(p.shearX + first);
+  __m128               sy   = _mm_load_ps(p.shearY + first);
+  __m128               sz   = _mm_load_ps(p.shearZ + first);
+  auto                 shear = [&](const nvmath::vec3f& vertex, __m128& x, __m128& y, __m128& z) {
+    z = _mm_sub_ps(_mm_set1_ps(vertex[axes.kz]), _mm_load_ps(oz));
+    x = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(vertex[axes.kx]), _mm_load_ps(ox)), _mm_mul_ps(sx, z));
+    y = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(vertex[axes.ky]), _mm_load_ps(oy)), _mm_mul_ps(sy, z));
+  };
+  __m128 ax, ay, az, bx, by, bz, cx, cy, cz;
+  shear(tri.v0, ax, ay, az);
+  shear(tri.v1, bx, by, bz);
+  shear(tri.v2, cx, cy, cz);
+  __m128 u = _mm_sub_ps(unfused(_mm_mul_ps(cx, by)), unfused(_mm_mul_ps(cy, bx)));
+  __m128 v = _mm_sub_ps(unfused(_mm_mul_ps(ax, cy)), unfused(_mm_mul_ps(ay, cx)));
+  __m128 w = _mm_sub_ps(unfused(_mm_mul_ps(bx, ay)), unfused(_mm_mul_ps(by, ax)));
+
+  __m128   zero    = _mm_setzero_ps();
+  uint32_t lanes   = (mask >> first) & 0xF;
+  uint32_t onEdge  = uint32_t(_mm_movemask_ps(_mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(u, zero), _mm_cmpeq_ps(v, zero)), _mm_cmpeq_ps(w, zero))));
+  __m128   anyNeg  = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmplt_ps(v, zero)), _mm_cmplt_ps(w, zero));
+  __m128   anyPos  = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(u, zero), _mm_cmpgt_ps(v, zero)), _mm_cmpgt_ps(w, zero));
+  __m128   det     = _mm_add_ps(_mm_add_ps(u, v), w);
+  __m128   invDet  = _mm_div_ps(_mm_set1_ps(1.f), det);
+  __m128   t       = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(u, sz), az), _mm_mul_ps(_mm_mul_ps(v, sz), bz)),
+                                _mm_mul_ps(_mm_mul_ps(w, sz), cz));
+  t                = _mm_mul_ps(t, invDet);
+  __m128 valid     = _mm_andnot_ps(_mm_and_ps(anyNeg, anyPos), _mm_cmpneq_ps(det, zero));
+  valid            = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_load_ps(p.tMin + first)));
+  valid            = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_load_ps(p.tMax + first)));
+  uint32_t hitLanes = uint32_t(_mm_movemask_ps(valid)) & lanes & ~onEdge;
+
+  alignas(16) float ts[4], us[4], ws[4], inv[4];
+  uint32_t          result = 0;
+  if(hitLanes)
+  {
+    _mm_store_ps(ts, t);
+    _mm_store_ps(us, v);
+    _mm_store_ps(ws, w);
+    _mm_store_ps(inv, invDet);
+  }
+  for(; hitLanes; hitLanes &= hitLanes - 1)
+  {
+    uint32_t k    = lowestBit(hitLanes);
+    uint32_t lane = first + k;
+    p.tMax[lane]  = ts[k];
+    if(hits)
+      hits[lane] = {ts[k], us[k] * inv[k], ws[k] * inv[k], tri.triangle};
+    result |= 1u << lane;
+  }
+  for(uint32_t lanesOnEdge = onEdge & lanes; lanesOnEdge; lanesOnEdge &= lanesOnEdge - 1)
+  {
+    uint32_t lane = first + lowestBit(lanesOnEdge);
+    BvhHit   hit;
+    if(intersectTriangle(tri, p.rays[lane], p.wrays[lane], p.tMax[lane], hit))
+    {
+      p.tMax[lane] = hit.t;
+      if(hits)
+        hits[lane] = hit;
+      result |= 1u << lane;
+    }
+  }
+  return result;
+}
+#endif
+
+#if NV_SIMD_AVX2
+template <uint32_t N>
+uint32_t triangleTestAvx(const BvhTriangle& tri, PreparedPacket<N>& p, uint32_t first, uint32_t mask, BvhHit* hits)
+{
+  const WatertightRay& axes = p.wrays[first + lowestBit(mask >> first)];
+  const float*         ox   = p.origin(axes.kx) + first;
+  const float*         oy   = p.origin(axes.ky) + first;
+  const float*         oz   = p.origin(axes.kz) + first;
+  __m256               sx   = _mm256_load_ps(p.shearX + first);
+  __m256               sy   = _mm256_load_ps(p.shearY + first);
+  __m256               sz   = _mm256_load_ps(p.shearZ + first);
+  auto                 shear = [&](const nvmath::vec3f& vertex, __m256& x, __m256& y, __m256& z) {
+    z = _mm256_sub_ps(_mm256_set1_ps(vertex[axes.kz]), _mm256_load_ps(oz));
+    x = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(vertex[axes.kx]), _mm256_load_ps(ox)), _mm256_mul_ps(sx, z));
+    y = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(vertex[axes.ky]), _mm256_load_ps(oy)), _mm256_mul_ps(sy, z));
+  };
+  __m256 ax, ay, az, bx, by, bz, cx, cy, cz;
+  shear(tri.v0, ax, ay, az);
+  shear(tri.v1, bx, by, bz);
+  shear(tri.v2, cx, cy, cz);
+  __m256 u = _mm256_sub_ps(unfused(_mm256_mul_ps(cx, by)), unfused(_mm256_mul_ps(cy, bx)));
+  __m256 v = _mm256_sub_ps(unfused(_mm256_mul_ps(ax, cy)), unfused(_mm256_mul_ps(ay, cx)));
+  __m256 w = _mm256_sub_ps(unfused(_mm256_mul_ps(bx, ay)), unfused(_mm256_mul_ps(by, ax)));
+
+  auto     cmp    = [](__m256 a, __m256 b, auto op) { return _mm256_cmp_ps(a, b, decltype(op)::value); };
+  __m256   zero   = _mm256_setzero_ps();
+  using Eq        = std::integral_constant<int, _CMP_EQ_OQ>;
+  using Lt        = std::integral_constant<int, _CMP_LT_OQ>;
+  using Gt        = std::integral_constant<int, _CMP_GT_OQ>;
+  using Ge        = std::integral_constant<int, _CMP_GE_OQ>;
+  using Neq       = std::integral_constant<int, _CMP_NEQ_OQ>;
+  uint32_t lanes  = (mask >> first) & 0xFF;
+  uint32_t onEdge = uint32_t(_mm256_movemask_ps(
+      _mm256_or_ps(_mm256_or_ps(cmp(u, zero, Eq()), cmp(v, zero, Eq())), cmp(w, zero, Eq()))));
+  __m256 anyNeg = _mm256_or_ps(_mm256_or_ps(cmp(u, zero, Lt()), cmp(v, zero, Lt())), cmp(w, zero, Lt()));
+  __m256 anyPos = _mm256_or_ps(_mm256_or_ps(cmp(u, zero, Gt()), cmp(v, zero, Gt())), cmp(w, zero, Gt()));
+  __m256 det    = _mm256_add_ps(_mm256_add_ps(u, v), w);
+  __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+  __m256 t      = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(u, sz), az), _mm256_mul_ps(_mm256_mul_ps(v, sz), bz)),
+                           _mm256_mul_ps(_mm256_mul_ps(w, sz), cz));
+  t             = _mm256_mul_ps(t, invDet);
+  __m256 valid  = _mm256_andnot_ps(_mm256_and_ps(anyNeg, anyPos), cmp(det, zero, Neq()));
+  valid         = _mm256_and_ps(valid, cmp(t, _mm256_load_ps(p.tMin + first), Ge()));
+  valid         = _mm256_and_ps(valid, cmp(t, _mm256_load_ps(p.tMax + first), Lt()));
+  uint32_t hitLanes = uint32_t(_mm256_movemask_ps(valid)) & lanes & ~onEdge;
+
+  alignas(32) float ts[8], us[8], ws[8], inv[8];
+  uint32_t          result = 0;
+  if(hitLanes)
+  {
+    _mm256_store_ps(ts, t);
+    _mm256_store_ps(us, v);
+    _mm256_store_ps(ws, w);
+    _mm256_store_ps(inv, invDet);
+  }
+  for(; hitLanes; hitLanes &= hitLanes - 1)
+  {
+    uint32_t k    = lowestBit(hitLanes);
+    uint32_t lane = first + k;
+    p.tMax[lane]  = ts[k];
+    if(hits)
+      hits[lane] = {ts[k], us[k] * inv[k], ws[k] * inv[k], tri.triangle};
+    result |= 1u << lane;
+  }
+  for(uint32_t lanesOnEdge = onEdge & lanes; lanesOnEdge; lanesOnEdge &= lanesOnEdge - 1)
+  {
+    uint32_t lane = first + lowestBit(lanesOnEdge);
+    BvhHit   hit;
+    if(intersectTriangle(tri, p.rays[lane], p.wrays[lane], p.tMax[lane], hit))
+    {
+      p.tMax[lane] = hit.t;
+      if(hits)
+        hits[lane] = hit;
+      result |= 1u << lane;
+    }
+  }
+  return result;
+}
+#endif
+
+// Lanes of `mask` hitting the triangle before their tMax, which is updated along with `hits`
+// (if any)
+template <uint32_t N>
+uint32_t triangleTest(const BvhTriangle& tri, PreparedPacket<N>& p, uint32_t mask, BvhHit* hits)
+{
+  uint32_t result = 0;
+  if(p.sharedAxes)
+  {
+#if NV_SIMD_AVX2
+    for(uint32_t first = 0; first < N; first += 8)
+      if((mask >> first) & 0xFF)
+        result |= triangleTestAvx(tri, p, first, mask, hits);
+    return result;
+#elif NV_SIMD_SSE2
+    for(uint32_t first = 0; first < N; first += 4)
+      if((mask >> first) & 0xF)
+        result |= triangleTestSse(tri, p, first, mask, hits);
+    return result;
+#endif
+  }
+  for(; mask; mask &= mask - 1)
+  {
+    uint32_t lane = lowestBit(mask);
+    BvhHit   hit;
+    if(intersectTriangle(tri, p.rays[lane], p.wrays[lane], p.tMax[lane], hit))
+    {
+      p.tMax[lane] = hit.t;
+      if(hits)
+        hits[lane] = hit;
+      result |= 1u << lane;
+    }
+  }
+  return result;
+}
+
+// Nodes are tested when they are visited, with the distances of the closest hits found so
+// far, so popped nodes need no stored mask
+template <uint32_t N, bool anyHit>
+uint32_t traversePacket(const TriangleBvh& tbvh, const BvhRayPacket<N>& packet, BvhHit* hits, uint32_t active)
+{
+  const auto& nodes = tbvh.bvh.nodes;
+  if(nodes.empty() || active == 0)
+    return 0;
+
+  PreparedPacket<N> p(packet, active);
+  uint32_t          occluded = 0;
+  uint32_t          stack[kBvhMaxDepth];
+  uint32_t          stackSize = 0;
+  uint32_t          index     = 0;
+  while(true)
+  {
+    const BvhNode& node = nodes[index];
+    uint32_t       mask = p.frustumMisses(node) ? 0 : laneTest(node, p) & active;
+    if(mask && !node.isLeaf())
+    {
+      bool swap          = secondChildFirst(&nodes[node.offset], p.negative);
+      stack[stackSize++] = node.offset + (swap ? 0 : 1);
+      index              = node.offset + (swap ? 1 : 0);
+      continue;
+    }
+    if(mask)
+    {
+      for(uint32_t i = node.offset; i < node.offset + node.count && mask; i++)
+      {
+        uint32_t hitLanes = triangleTest(tbvh.triangles[i], p, mask, hits);
+        if(anyHit)
+        {
+          occluded |= hitLanes;
+          mask &= ~hitLanes;
+        }
+      }
+      if(anyHit)
+      {
+        active &= ~occluded;
+        if(active == 0)
+          return occluded;
+      }
+      p.updateMaxDistance(active);
+    }
+
+    if(stackSize == 0)
+      return occluded;
+    index = stack[--stackSize];
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Streams
+//
+
+// Rays of a stream are grouped 8 by 8 in the order they come in, each group being a packet
+constexpr uint32_t kStreamWidth = 8;
+
+// Every node gets the packets with lanes hitting its parent, in a segment of `lists`. The
+// packets with lanes hitting its own box are appended to `lists` as the segment of its
+// children. Segments are released when the node owning them is popped: everything after them
+// belongs to subtrees already visited.
+template <bool anyHit>
+void traverseStream(const TriangleBvh& tbvh, const BvhRay* rays, size_t count, BvhHit* hits, uint8_t* occluded)
+{
+  const auto& nodes = tbvh.bvh.nodes;
+  if(nodes.empty() || count == 0)
+    return;
+
+  using Packet = PreparedPacket<kStreamWidth>;
+  struct Item
+  {
+    uint32_t packet;
+    uint32_t mask;
+  };
+  std::vector<Packet>   packets;
+  std::vector<uint32_t> active;
+  std::vector<Item>     lists;
+  size_t                packetCount = (count + kStreamWidth - 1) / kStreamWidth;
+  packets.reserve(packetCount);
+  active.reserve(packetCount);
+  lists.reserve(packetCount * 4);
+  for(size_t first = 0; first < count; first += kStreamWidth)
+  {
+    BvhRayPacket<kStreamWidth> packet;
+    uint32_t                   mask = 0;
+    for(uint32_t lane = 0; lane < kStreamWidth; lane++)
+    {
+      bool used = first + lane < count;
+      packet.set(lane, used ? rays[first + lane] : BvhRay());
+      mask |= used ? 1u << lane : 0u;
+    }
+    packets.emplace_back(packet, mask);
+    active.push_back(mask);
+    lists.push_back({uint32_t(packets.size() - 1), mask});
+  }
+
+  struct Entry
+  {
+    uint32_t node;
+    uint32_t begin;  // Segment in lists
+    uint32_t end;
+  };
+  Entry    stack[kBvhMaxDepth];
+  uint32_t stackSize = 0;
+  Entry    current{0, 0, uint32_t(lists.size())};
+  while(true)
+  {
+    const BvhNode& node  = nodes[current.node];
+    uint32_t       begin = uint32_t(lists.size());
+    for(uint32_t i = current.begin; i < current.end; i++)
+    {
+      Item         item = lists[i];
+      const Packet& p   = packets[item.packet];
+      uint32_t     mask = p.frustumMisses(node) ? 0 : laneTest(node, p) & item.mask & active[item.packet];
+      if(mask)
+        lists.push_back({item.packet, mask});
+    }
+    uint32_t end = uint32_t(lists.size());
+
+    if(begin != end && !node.isLeaf())
+    {
+      bool swap          = secondChildFirst(&nodes[node.offset], packets[lists[begin].packet].negative);
+      stack[stackSize++] = {node.offset + (swap ? 0 : 1), begin, end};
+      current            = {node.offset + (swap ? 1 : 0), begin, end};
+      continue;
+    }
+    for(uint32_t k = begin; k < end; k++)
+    {
+      Item     item  = lists[k];
+      Packet&  p     = packets[item.packet];
+      BvhHit*  lanes = anyHit ? nullptr : hits + size_t(item.packet) * kStreamWidth;
+      uint32_t mask  = item.mask;
+      for(uint32_t i = node.offset; i < node.offset + node.count && mask; i++)
+      {
+        uint32_t hitLanes = triangleTest(tbvh.triangles[i], p, mask, lanes);
+        if(anyHit)
+        {
+          for(uint32_t bits = hitLanes; bits; bits &= bits - 1)
+            occluded[size_t(item.packet) * kStreamWidth + lowestBit(bits)] = 1;
+          mask &= ~hitLanes;
+          active[item.packet] &= ~hitLanes;
+        }
+      }
+      p.updateMaxDistance(active[item.packet]);
+    }
+
+    if(stackSize == 0)
+      return;
+    current = stack[--stackSize];
+    lists.resize(current.end);
+  }
+}
+}  // namespace
+
+template <uint32_t N>
+void intersectClosest(const TriangleBvh& bvh, const BvhRayPacket<N>& packet, BvhHitPacket<N>& hits, uint32_t activeMask)
+{
+  for(uint32_t lane = 0; lane < N; lane++)
+    if(activeMask & (1u << lane))
+      hits.hits[lane] = BvhHit();
+  traversePacket<N, false>(bvh, packet, hits.hits, activeMask);
+}
+
+template <uint32_t N>
+uint32_t intersectAny(const TriangleBvh& bvh, const BvhRayPacket<N>& packet, uint32_t activeMask)
+{
+  return traversePacket<N, true>(bvh, packet, nullptr, activeMask);
+}
+
+template void intersectClosest<8>(const TriangleBvh&, const BvhRayPacket<8>&, BvhHitPacket<8>&, uint32_t);
+template void intersectClosest<16>(const TriangleBvh&, const BvhRayPacket<16>&, BvhHitPacket<16>&, uint32_t);
+template uint32_t intersectAny<8>(const TriangleBvh&, const BvhRayPacket<8>&, uint32_t);
+template uint32_t intersectAny<16>(const TriangleBvh&, const BvhRayPacket<16>&, uint32_t);
+
+void intersectClosest(const TriangleBvh& bvh, const BvhRay* rays, size_t count, BvhHit* hits)
+{
+  for(size_t i = 0; i < count; i++)
+    hits[i] = BvhHit();
+  traverseStream<false>(bvh, rays, count, hits, nullptr);
+}
+
+void intersectAny(const TriangleBvh& bvh, const BvhRay* rays, size_t count, uint8_t* occluded)
+{
+  for(size_t i = 0; i < count; i++)
+    occluded[i] = 0;
+  traverseStream<true>(bvh, rays, count, nullptr, occluded);
+}
@@ -0,0 +1,75 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "bvh.h"
+
+// Coherent queries on a TriangleBvh, next to the single-ray ones of bvh.h
+// - Packets of 8 or 16 rays go down the tree together: a node is fetched once for all of
+//   them and its box is tested on all lanes with SIMD. When the directions of the packet
+//   share their signs, the packet is bounded by a frustum (interval arithmetic over origins
+//   and inverse directions) that rejects most missed nodes without testing any lane.
+// - Streams filter an arbitrary batch of rays through the tree: the rays are grouped 8 by 8
+//   in the order they come in, each node receives the groups with rays hitting its parent and
+//   passes on the ones with rays hitting its own box, so a node is fetched once per batch.
+// Triangles are tested on all lanes at once when the rays share their dominant axis.
+// Both return the same hits as intersectClosest / intersectAny on every ray, as long as the
+// compiler does not fuse the multiply-adds of the scalar triangle test: the distances then
+// differ in their last bits. They pay off on rays that start close together and go in similar
+// directions: primary rays of a tile, shadow rays towards the sun.
+
+template <uint32_t N>
+struct alignas(64) BvhRayPacket
+{
+  float originX[N];
+  float originY[N];
+  float originZ[N];
+  float directionX[N];
+  float directionY[N];
+  float directionZ[N];
+  float tMin[N];
+  float tMax[N];
+
+  void set(uint32_t lane, const BvhRay& ray)
+  {
+    originX[lane]    = ray.origin.x;
+    originY[lane]    = ray.origin.y;
+    originZ[lane]    = ray.origin.z;
+    directionX[lane] = ray.direction.x;
+    directionY[lane] = ray.direction.y;
+    directionZ[lane] = ray.direction.z;
+    tMin[lane]       = ray.tMin;
+    tMax[lane]       = ray.tMax;
+  }
+  BvhRay get(uint32_t lane) const
+  {
+    BvhRay ray;
+    ray.origin    = nvmath::vec3f(originX[lane], originY[lane], originZ[lane]);
+    ray.direction = nvmath::vec3f(directionX[lane], directionY[lane], directionZ[lane]);
+    ray.tMin      = tMin[lane];
+    ray.tMax      = tMax[lane];
+    return ray;
+  }
+};
+
+template <uint32_t N>
+struct BvhHitPacket
+{
+  BvhHit hits[N];
+};
+
+using BvhRayPacket8  = BvhRayPacket<8>;
+using BvhRayPacket16 = BvhRayPacket<16>;
+
+// Lanes missing from activeMask are left alone: partial packets at the border of a tile
+template <uint32_t N>
+void intersectClosest(const TriangleBvh& bvh, const BvhRayPacket<N>& packet, BvhHitPacket<N>& hits, uint32_t activeMask = (1u << N) - 1);
+
+// Mask of the active lanes that hit anything
+template <uint32_t N>
+uint32_t intersectAny(const TriangleBvh& bvh, const BvhRayPacket<N>& packet, uint32_t activeMask = (1u << N) - 1);
+
+// Streams: hits[i] / occluded[i] receive the result of rays[i]
+void intersectClosest(const TriangleBvh& bvh, const BvhRay* rays, size_t count, BvhHit* hits);
+void intersectAny(const TriangleBvh& bvh, const BvhRay* rays, size_t count, uint8_t* occluded);
@@ -0,0 +1,308 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "sampler.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+// Primitive polynomials and initial direction numbers of dimensions 2 and up, from
+// new-joe-kuo-6.21201 (Joe and Kuo, "Constructing Sobol sequences with better two-dimensional
+// projections", 2008). The first dimension is the van der Corput sequence.
+struct SobolPolynomial
+{
+  uint32_t degree;
+  uint32_t coefficients;
+  uint32_t m[5];
+};
+const SobolPolynomial kSobolPolynomials[kMaxSobolDimensions - 1] = {
+    {1, 0, {1}},          {2, 1, {1, 3}},          {3, 1, {1, 3, 1}},          {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}}, {4, 4, {1, 3, 5, 13}},   {5, 2, {1, 1, 5, 5, 17}},
+};
+
+// Hashes of Burley's paper. The multiplications wrap like the uint ones of GLSL.
+uint32_t reverseBits(uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// lowbias32 of Chris Wellons
+uint32_t hashUint(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t v)
+{
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen scrambling of the bits of x, most significant first
+uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+  return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+inline uint32_t lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return uint32_t(index);
+#else
+  return uint32_t(__builtin_ctz(mask));
+#endif
+}
+
+float toUnitFloat(uint32_t x)
+{
+  return float(x >> 8) * (1.f / 16777216.f);
+}
+
+// The generalized golden ratio of R2, 32-bit fixed point
+const uint32_t kR2Alpha[2] = {3242174889u, 2447445414u};
+}  // namespace
+
+uint32_t tea(uint32_t val0, uint32_t val1)
+{
+  uint32_t v0 = val0;
+  uint32_t v1 = val1;
+  uint32_t s0 = 0;
+
+  for(uint32_t n = 0; n < 16; n++)
+  {
+    s0 += 0x9e3779b9;
+    v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+    v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+  }
+
+  return v0;
+}
+
+std::vector<uint32_t> sobolMatrices(uint32_t dimensions)
+{
+  assert(dimensions <= kMaxSobolDimensions);
+  std::vector<uint32_t> matrices(size_t(dimensions) * 32);
+  for(uint32_t d = 0; d < dimensions; d++)
+  {
+    uint32_t* v = &matrices[size_t(d) * 32];
+    if(d == 0)
+    {
+      for(uint32_t k = 0; k < 32; k++)
+        v[k] = 1u << (31 - k);
+      continue;
+    }
+    const SobolPolynomial& p = kSobolPolynomials[d - 1];
+    for(uint32_t k = 0; k < 32; k++)
+    {
+      if(k < p.degree)
+      {
+        v[k] = p.m[k] << (31 - k);
+        continue;
+      }
+      v[k] = v[k - p.degree] ^ (v[k - p.degree] >> p.degree);
+      for(uint32_t j = 1; j < p.degree; j++)
+      {
+        if((p.coefficients >> (p.degree - 1 - j)) & 1)
+          v[k] ^= v[k - j];
+      }
+    }
+  }
+  return matrices;
+}
+
+std::vector<uint32_t> blueNoiseRanks(uint32_t size, uint32_t seed)
+{
+  const uint32_t count = size * size;
+  std::vector<uint32_t> ranks(count, 0);
+  if(count < 2)
+    return ranks;
+
+  // Gaussian filter of the energies, on the torus
+  const float        sigma = 1.5f;
+  std::vector<float> kernel(count);
+  for(uint32_t y = 0; y < size; y++)
+  {
+    for(uint32_t x = 0; x < size; x++)
+    {
+      float dx = float(std::min(x, size - x));
+      float dy = float(std::min(y, size - y));
+      kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+    }
+  }
+  auto splat = [&](std::vector<float>& energy, uint32_t cell, float sign) {
+    uint32_t cx = cell % size, cy = cell / size;
+    for(uint32_t y = 0; y < size; y++)
+    {
+      const float* row = &kernel[((y + size - cy) % size) * size];
+      float*       e   = &energy[y * size];
+      for(uint32_t x = 0; x < size; x++)
+        e[x] += sign * row[(x + size - cx) % size];
+    }
+  };
+  // Tightest cluster: the set cell of highest energy. Largest void: the empty one of lowest.
+  auto tightestCluster = [&](const std::vector<uint8_t>& pattern, const std::vector<float>& energy) {
+    uint32_t best = count;
+    for(uint32_t i = 0; i < count; i++)
+      if(pattern[i] && (best == count || energy[i] > energy[best]))
+        best = i;
+    return best;
+  };
+  auto largestVoid = [&](const std::vector<uint8_t>& pattern, const std::vector<float>& energy) {
+    uint32_t best = count;
+    for(uint32_t i = 0; i < count; i++)
+      if(!pattern[i] && (best == count || energy[i] < energy[best]))
+        best = i;
+    return best;
+  };
+
+  // Initial binary pattern: a tenth of the cells at random, then spread out by moving the
+  // tightest cluster to the largest void until it is the same cell
+  std::vector<uint8_t> pattern(count, 0);
+  std::vector<float>   energy(count, 0.f);
+  uint32_t             ones = std::max(1u, count / 10);
+  for(uint32_t placed = 0, n = 0; placed < ones; n++)
+  {
+    uint32_t cell = hashUint(hashCombine(hashUint(seed), n)) % count;
+    if(pattern[cell])
+      continue;
+    pattern[cell] = 1;
+    splat(energy, cell, 1.f);
+    placed++;
+  }
+  for(uint32_t iteration = 0; iteration < count; iteration++)
+  {
+    uint32_t cluster = tightestCluster(pattern, energy);
+    pattern[cluster] = 0;
+    splat(energy, cluster, -1.f);
+    uint32_t hole = largestVoid(pattern, energy);
+    pattern[hole] = 1;
+    splat(energy, hole, 1.f);
+    if(hole == cluster)
+      break;
+  }
+
+  // Ranks below the initial pattern: removing its tightest clusters first
+  {
+    std::vector<uint8_t> removing = pattern;
+    std::vector<float>   removingEnergy = energy;
+    for(uint32_t rank = ones; rank-- > 0;)
+    {
+      uint32_t cluster  = tightestCluster(removing, removingEnergy);
+      removing[cluster] = 0;
+      splat(removingEnergy, cluster, -1.f);
+      ranks[cluster] = rank;
+    }
+  }
+  // Ranks above: filling the largest voids
+  for(uint32_t rank = ones; rank < count; rank++)
+  {
+    uint32_t hole = largestVoid(pattern, energy);
+    pattern[hole] = 1;
+    splat(energy, hole, 1.f);
+    ranks[hole] = rank;
+  }
+  return ranks;
+}
+
+SamplerTables::SamplerTables(uint32_t seed)
+{
+  std::vector<uint32_t> matrices = sobolMatrices(kSobolDimensions);
+  std::vector<uint32_t> noise    = blueNoiseRanks(kTileSize, seed);
+
+  m_buffer.resize(kBlueNoiseOffset + kTileSize * kTileSize);
+  std::copy(matrices.begin(), matrices.end(), m_buffer.begin());
+  for(uint32_t i = 0; i < kTileSize * kTileSize; i++)
+    m_buffer[kScrambleOffset + i] = hashUint(hashCombine(hashUint(seed ^ 0x5bd1e995u), i));
+  std::copy(noise.begin(), noise.end(), m_buffer.begin() + kBlueNoiseOffset);
+}
+
+float SamplerTables::sample(int sampler, uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const
+{
+  const uint32_t* scramble = &m_buffer[kScrambleOffset];
+  uint32_t        cell     = (y % kTileSize) * kTileSize + x % kTileSize;
+  if(sampler == kSamplerBlueNoise)
+  {
+    // Every dimension reads the mask with a shift of its own: the offsets of a pixel are
+    // independent from one dimension to the next, but each is blue noise across pixels
+    uint32_t shift  = hashUint(hashCombine(scramble[0], dimension));
+    uint32_t sx     = (x + shift) % kTileSize;
+    uint32_t sy     = (y + (shift >> 16)) % kTileSize;
+    uint32_t rank   = m_buffer[kBlueNoiseOffset + sy * kTileSize + sx];
+    uint32_t offset = (2 * rank + 1) * (0x80000000u / (kTileSize * kTileSize));
+    return toUnitFloat(offset + kR2Alpha[dimension & 1] * index);
+  }
+
+  // The scramble tile repeats, the seed of the tile it is in changes
+  uint32_t pixelSeed = hashCombine(scramble[cell], hashUint((y / kTileSize) << 16 | (x / kTileSize)));
+  uint32_t blockSeed = hashUint(hashCombine(pixelSeed, dimension / kSobolDimensions));
+  uint32_t shuffled  = nestedUniformScramble(index, blockSeed);
+
+  // Only the set bits of the index, the shader goes through all of them
+  const uint32_t* matrix = &m_buffer[(dimension % kSobolDimensions) * 32];
+  uint32_t        v      = 0;
+  for(; shuffled; shuffled &= shuffled - 1)
+    v ^= matrix[lowestBit(shuffled)];
+  return toUnitFloat(nestedUniformScramble(v, hashUint(hashCombine(blockSeed, dimension))));
+}
+
+SampleStream SampleStream::start(const SamplerTables& tables, int sampler, uint32_t x, uint32_t y, uint32_t width, uint32_t index)
+{
+  SampleStream stream;
+  stream.tables  = &tables;
+  stream.sampler = sampler;
+  stream.x       = x;
+  stream.y       = y;
+  stream.index   = index;
+  stream.state   = sampler == kSamplerRandom ? tea(y * width + x, index) : 0;
+  return stream;
+}
+
+float SampleStream::next()
+{
+  if(sampler == kSamplerRandom)
+  {
+    // Numerical Recipes lcg, 24 bits
+    state = 1664525u * state + 1013904223u;
+    return float(state & 0x00FFFFFF) / float(0x01000000);
+  }
+  return tables->sample(sampler, x, y, index, state++);
+}
+
+void SampleStream::startBounce(int rayDepth)
+{
+  if(sampler != kSamplerRandom)
+    state = 4 * uint32_t(rayDepth) + 4;
+}
+
+SampleStream SampleStream::anyHitStream(int rayDepth, bool shadow) const
+{
+  uint32_t     ray    = 2 * uint32_t(rayDepth) + (shadow ? 1 : 0);
+  SampleStream stream = *this;
+  stream.state        = sampler == kSamplerRandom ? tea(state, 0x80000000u | ray) : 0x80000000u + (ray << 16);
+  return stream;
+}
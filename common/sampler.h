@@ -0,0 +1,84 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Random numbers of the path tracers, the CPU side of shaders/sampler.glsl. The shaders and the
+// CPU renderers compute the same values from the same tables, bit for bit.
+// A path draws its numbers one dimension after the other, keyed by its pixel and its sample index
+// (the frame of the GPU accumulation):
+// - kSamplerRandom: the original tea seed and lcg sequence, uncorrelated from one sample to the next
+// - kSamplerSobol: Owen-scrambled Sobol points (Burley, "Practical Hash-based Owen Scrambling",
+//   JCGT 2020). The dimensions come in blocks of kSobolDimensions with their own shuffled sample
+//   order, every pixel scrambles them differently.
+// - kSamplerBlueNoise: the R2 rank-1 lattice (Roberts, "The Unreasonable Effectiveness of
+//   Quasirandom Sequences") shifted per pixel by a blue noise mask, so that the error of
+//   neighbor pixels is spread to high frequencies.
+// The low-discrepancy ones only stratify if the same dimensions are used for the same decisions by
+// every sample of a pixel: the path tracers give each bounce a fixed range (see startBounce).
+
+const int kSamplerRandom    = 0;
+const int kSamplerSobol     = 1;
+const int kSamplerBlueNoise = 2;
+
+// Tiny Encryption Algorithm, the seed of kSamplerRandom, see sampling.glsl
+uint32_t tea(uint32_t val0, uint32_t val1);
+
+// Sobol direction numbers (Joe and Kuo), 32 columns per dimension, most significant bit first.
+// At most kMaxSobolDimensions.
+const uint32_t        kMaxSobolDimensions = 8;
+std::vector<uint32_t> sobolMatrices(uint32_t dimensions);
+
+// Ranks of the cells of a toroidal size x size blue noise mask, by void and cluster
+// (Ulichney, "The void-and-cluster method for dither array generation", 1993)
+std::vector<uint32_t> blueNoiseRanks(uint32_t size, uint32_t seed = 0);
+
+// Tables the samplers read, uploaded as they are to the B_SAMPLER buffer of the shaders
+class SamplerTables
+{
+public:
+  static const uint32_t kTileSize        = 64;  // Pixels of the scramble and blue noise tiles
+  static const uint32_t kSobolDimensions = 4;
+  // Offsets in buffer(), see sampler.glsl
+  static const uint32_t kScrambleOffset  = kSobolDimensions * 32;
+  static const uint32_t kBlueNoiseOffset = kScrambleOffset + kTileSize * kTileSize;
+
+  // Different seeds give independent scrambles and masks, for instance for reference images
+  explicit SamplerTables(uint32_t seed = 0);
+
+  // Sobol matrices, then the scramble seed of each pixel of a tile, then the blue noise ranks
+  const std::vector<uint32_t>& buffer() const { return m_buffer; }
+
+  // Dimension of a sample of pixel (x, y) in [0, 1), with kSamplerSobol or kSamplerBlueNoise
+  float sample(int sampler, uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const;
+
+private:
+  std::vector<uint32_t> m_buffer;
+};
+
+// Random numbers of one path, rnd() of sampling.glsl: the state is the lcg one with
+// kSamplerRandom and the next dimension with the others
+struct SampleStream
+{
+  const SamplerTables* tables{nullptr};
+  int                  sampler{kSamplerRandom};
+  uint32_t             x{0};
+  uint32_t             y{0};
+  uint32_t             index{0};
+  uint32_t             state{0};
+
+  // Stream of sample index of pixel (x, y) in an image width pixels wide
+  static SampleStream start(const SamplerTables& tables, int sampler, uint32_t x, uint32_t y, uint32_t width, uint32_t index);
+
+  float next();
+
+  // The camera uses dimensions [0, 4), bounce n [4n + 4, 4n + 8)
+  void startBounce(int rayDepth);
+  // Stream of the any-hit invocations of the ray traced at rayDepth, or of its shadow ray. Each
+  // ray has dimensions of its own, from 2^31 + (2 * rayDepth + shadow) * 2^16, and kSamplerRandom
+  // a new lcg seed, so that no two rays of a path draw the same numbers.
+  SampleStream anyHitStream(int rayDepth, bool shadow) const;
+};
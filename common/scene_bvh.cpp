@@ -0,0 +1,203 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "scene_bvh.h"
+#include "parallel.h"
+
+namespace {
+using nvmath::vec3f;
+using nvmath::vec4f;
+
+// World box of the transformed box of a BLAS: bounds of its 8 corners
+BvhBox transformBox(const nvmath::mat4f& transform, const BvhNode& root)
+{
+  BvhBox box;
+  for(int corner = 0; corner < 8; corner++)
+  {
+    vec4f p(corner & 1 ? root.bboxMax.x : root.bboxMin.x, corner & 2 ? root.bboxMax.y : root.bboxMin.y,
+            corner & 4 ? root.bboxMax.z : root.bboxMin.z, 1.f);
+    vec3f world = vec3f(transform * p);
+    box.bboxMin = nvmath::nv_min(box.bboxMin, world);
+    box.bboxMax = nvmath::nv_max(box.bboxMax, world);
+  }
+  return box;
+}
+
+const nvmath::mat4f& stridedTransform(const nvmath::mat4f* transforms, size_t stride, size_t i)
+{
+  return *reinterpret_cast<const nvmath::mat4f*>(reinterpret_cast<const uint8_t*>(transforms) + i * stride);
+}
+}  // namespace
+
+void SceneBvh::build(std::vector<std::shared_ptr<const TriangleBvh>> blas,
+                     const std::vector<SceneBvhInstance>&            instances,
+                     const BvhBuildSettings&                         settings)
+{
+  m_blas     = std::move(blas);
+  m_settings = settings;
+  m_instances.resize(instances.size());
+  for(size_t i = 0; i < instances.size(); i++)
+    m_instances[i].blasId = instances[i].blasId;
+  updateBoxes(instances.empty() ? nullptr : &instances[0].transform, sizeof(SceneBvhInstance));
+  buildTopLevel();
+}
+
+bool SceneBvh::refit(const nvmath::mat4f* transforms, size_t transformStride)
+{
+  updateBoxes(transforms, transformStride);
+  refitBvh(m_tlas, m_boxes.data());
+  if(sahCost() <= m_builtSahCost * m_rebuildThreshold)
+    return false;
+  buildTopLevel();
+  return true;
+}
+
+void SceneBvh::buildTopLevel()
+{
+  // One instance per leaf, so that a ray only enters the instances it reaches
+  BvhBuildSettings tlasSettings = m_settings;
+  tlasSettings.maxLeafSize      = 1;
+  m_tlas                        = buildBvh(m_boxes.data(), m_boxes.size(), tlasSettings);
+  m_builtSahCost                = sahCost();
+}
+
+void SceneBvh::updateBoxes(const nvmath::mat4f* transforms, size_t transformStride)
+{
+  m_boxes.resize(m_instances.size());
+  parallelRanges(m_instances.size(), 256, [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end; i++)
+    {
+      const nvmath::mat4f& transform = stridedTransform(transforms, transformStride, i);
+      const TriangleBvh&   blas      = *m_blas[m_instances[i].blasId];
+      m_instances[i].worldToObject   = nvmath::invert(transform);
+      // Empty BLAS: inverted box, never hit
+      m_boxes[i] = blas.bvh.empty() ? BvhBox() : transformBox(transform, blas.bvh.nodes[0]);
+    }
+  });
+}
+
+//--------------------------------------------------------------------------------------------------
+// Traversal of the top level, ordered like the one of the BLAS (bvh.cpp). Leaves hold one
+// instance, whose BLAS is traversed with the ray moved into object space.
+//
+
+namespace {
+template <bool anyHit, class Leaf>
+bool traverseTopLevel(const Bvh& tlas, const BvhRay& ray, float& tMax, Leaf&& leaf)
+{
+  const auto& nodes = tlas.nodes;
+  if(nodes.empty())
+    return false;
+
+  struct Entry
+  {
+    uint32_t node;
+    float    tEnter;
+  };
+  Entry    stack[kBvhMaxDepth];
+  uint32_t stackSize    = 0;
+  vec3f    invDirection = safeInverse(ray.direction);
+  bool     found        = false;
+
+  if(intersectBox(nodes[0], ray.origin, invDirection, ray.tMin, tMax) == FLT_MAX)
+    return false;
+  uint32_t index = 0;
+  while(true)
+  {
+    const BvhNode& node = nodes[index];
+    if(node.isLeaf())
+    {
+      for(uint32_t i = node.offset; i < node.offset + node.count; i++)
+      {
+        if(leaf(tlas.items[i], tMax))
+        {
+          if(anyHit)
+            return true;
+          found = true;
+        }
+      }
+    }
+    else
+    {
+      float    near   = intersectBox(nodes[node.offset], ray.origin, invDirection, ray.tMin, tMax);
+      float    far    = intersectBox(nodes[node.offset + 1], ray.origin, invDirection, ray.tMin, tMax);
+      uint32_t first  = node.offset;
+      uint32_t second = node.offset + 1;
+      if(far < near)
+      {
+        std::swap(near, far);
+        std::swap(first, second);
+      }
+      if(near != FLT_MAX)
+      {
+        if(far != FLT_MAX)
+          stack[stackSize++] = {second, far};
+        index = first;
+        continue;
+      }
+    }
+
+    do
+    {
+      if(stackSize == 0)
+        return found;
+      stackSize--;
+    } while(stack[stackSize].tEnter > tMax * kBvhRobustExit);
+    index = stack[stackSize].node;
+  }
+}
+
+BvhRay toObjectSpace(const nvmath::mat4f& worldToObject, const BvhRay& ray, float tMax)
+{
+  BvhRay local;
+  local.origin    = vec3f(worldToObject * vec4f(ray.origin, 1.f));
+  local.direction = vec3f(worldToObject * vec4f(ray.direction, 0.f));
+  local.tMin      = ray.tMin;
+  local.tMax      = tMax;
+  return local;
+}
+}  // namespace
+
+bool SceneBvh::intersectClosest(const BvhRay& ray, SceneBvhHit& hit) const
+{
+  return intersectClosest(ray, hit, nullptr);
+}
+
+bool SceneBvh::intersectAny(const BvhRay& ray) const
+{
+  return intersectAny(ray, nullptr);
+}
+
+bool SceneBvh::intersectClosest(const BvhRay& ray, SceneBvhHit& hit, const HitFilter& filter) const
+{
+  hit        = SceneBvhHit();
+  float tMax = ray.tMax;
+  return traverseTopLevel<false>(m_tlas, ray, tMax, [&](uint32_t instance, float& t) {
+    const Instance&    inst     = m_instances[instance];
+    const TriangleBvh& blas     = *m_blas[inst.blasId];
+    BvhRay             localRay = toObjectSpace(inst.worldToObject, ray, t);
+    BvhHit             local;
+    bool               found    = filter ? ::intersectClosest(blas, localRay, local,
+                                                         [&](const BvhHit& h) { return filter({h, instance}); }) :
+                                      ::intersectClosest(blas, localRay, local);
+    if(!found)
+      return false;
+    hit.hit      = local;
+    hit.instance = instance;
+    t            = local.t;
+    return true;
+  });
+}
+
+bool SceneBvh::intersectAny(const BvhRay& ray, const HitFilter& filter) const
+{
+  float tMax = ray.tMax;
+  return traverseTopLevel<true>(m_tlas, ray, tMax, [&](uint32_t instance, float& t) {
+    const Instance&    inst     = m_instances[instance];
+    const TriangleBvh& blas     = *m_blas[inst.blasId];
+    BvhRay             localRay = toObjectSpace(inst.worldToObject, ray, t);
+    return filter ? ::intersectAny(blas, localRay, [&](const BvhHit& h) { return filter({h, instance}); }) :
+                    ::intersectAny(blas, localRay);
+  });
+}
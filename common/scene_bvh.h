@@ -0,0 +1,74 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "bvh.h"
+#include <memory>
+
+// Two-level CPU hierarchy, the counterpart of the TLAS/BLAS pair built on the GPU.
+// Each model has one TriangleBvh (the BLAS), shared by all of its instances; the top level is
+// a Bvh over the world boxes of the instances. Rays are moved into the space of each instance
+// they reach: the transforms are affine and directions are not normalized, so distances along
+// the ray are the same in both spaces and tMax carries over.
+// When only the transforms change (animation), refit() updates the boxes of the top level
+// without rebuilding it, and rebuilds it only if its quality dropped too much.
+
+struct SceneBvhInstance
+{
+  nvmath::mat4f transform{1};  // Object to world
+  uint32_t      blasId{0};     // Index in the BLAS array given to build()
+};
+
+struct SceneBvhHit
+{
+  BvhHit   hit;               // Triangle of the BLAS, distance in world space
+  uint32_t instance{~0u};     // Index in the instances given to build()
+
+  bool valid() const { return hit.valid(); }
+};
+
+class SceneBvh
+{
+public:
+  void build(std::vector<std::shared_ptr<const TriangleBvh>> blas,
+             const std::vector<SceneBvhInstance>&            instances,
+             const BvhBuildSettings&                         settings = {});
+
+  // New transforms of all instances, read with a stride in bytes so that the instance arrays
+  // of the samples (ObjInstance::transform) can be given directly.
+  // Returns true if the top level was rebuilt instead of refit.
+  bool refit(const nvmath::mat4f* transforms, size_t transformStride);
+
+  bool   empty() const { return m_tlas.empty(); }
+  size_t instanceCount() const { return m_instances.size(); }
+  float  sahCost() const { return bvhSahCost(m_tlas, m_settings); }
+
+  bool intersectClosest(const BvhRay& ray, SceneBvhHit& hit) const;
+  bool intersectAny(const BvhRay& ray) const;
+
+  // With a filter called on each candidate hit, see BvhHitFilter
+  using HitFilter = std::function<bool(const SceneBvhHit&)>;
+  bool intersectClosest(const BvhRay& ray, SceneBvhHit& hit, const HitFilter& filter) const;
+  bool intersectAny(const BvhRay& ray, const HitFilter& filter) const;
+
+  // Above this factor over the SAH cost of the last build, refit() rebuilds the top level
+  float m_rebuildThreshold{1.5f};
+
+private:
+  struct Instance
+  {
+    nvmath::mat4f worldToObject;
+    uint32_t      blasId;
+  };
+
+  void updateBoxes(const nvmath::mat4f* transforms, size_t transformStride);
+  void buildTopLevel();
+
+  std::vector<std::shared_ptr<const TriangleBvh>> m_blas;
+  std::vector<Instance>                           m_instances;
+  std::vector<BvhBox>                             m_boxes;  // World box of each instance
+  Bvh                                             m_tlas;   // Items are the instances
+  BvhBuildSettings                                m_settings;
+  float                                           m_builtSahCost{0.f};
+};
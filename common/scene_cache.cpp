@@ -0,0 +1,225 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "scene_cache.h"
+#include "content_hash.h"
+#include "nvh/nvprint.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+namespace {
+
+const uint32_t kMagic         = makeChunkId('S', 'C', 'N', 'C');
+const uint32_t kFormatVersion = 2;
+const uint32_t kSourcesChunk  = makeChunkId('S', 'R', 'C', 'S');
+const uint32_t kStampsChunk   = makeChunkId('S', 'T', 'M', 'P');
+const size_t   kAlignment     = 64;
+
+struct FileHeader
+{
+  uint32_t magic;
+  uint32_t formatVersion;
+  uint32_t version;
+  uint32_t chunkCount;
+  uint64_t sourceHash;
+};
+
+struct ChunkEntry
+{
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+};
+
+inline size_t alignUp(size_t v)
+{
+  return (v + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+// Size and modification time of a source, checked before its content
+struct SourceStamp
+{
+  uint64_t size;
+  int64_t  writeTime;
+};
+
+bool stampFile(const std::string& filename, SourceStamp& stamp)
+{
+  std::error_code sizeError, timeError;
+  auto            size      = std::filesystem::file_size(filename, sizeError);
+  auto            writeTime = std::filesystem::last_write_time(filename, timeError);
+  if(sizeError || timeError)
+    return false;
+  stamp = {uint64_t(size), int64_t(writeTime.time_since_epoch().count())};
+  return true;
+}
+
+// Stamps of all sources, or false if one of them is missing
+bool stampSources(const std::vector<std::string>& sources, std::vector<SourceStamp>& stamps)
+{
+  stamps.resize(sources.size());
+  for(size_t i = 0; i < sources.size(); i++)
+    if(!stampFile(sources[i], stamps[i]))
+      return false;
+  return true;
+}
+
+// Hash of the content of all sources, or false if one of them is missing
+bool hashSources(const std::vector<std::string>& sources, uint64_t& hash)
+{
+  hash = 0;
+  for(const auto& source : sources)
+  {
+    uint64_t fileHash;
+    if(!hashFile(source, fileHash))
+      return false;
+    hash = hashCombine(hash, fileHash);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool SceneCacheWriter::write(const std::string& cacheFile, uint32_t version) const
+{
+  // Source names, zero separated, are stored as a chunk
+  std::string sourceNames;
+  for(const auto& source : m_sources)
+    sourceNames.append(source.c_str(), source.size() + 1);
+
+  // Stamped before hashing: a source written in between is seen as changed by the next open
+  std::vector<SourceStamp> stamps;
+  if(!stampSources(m_sources, stamps))
+    return false;
+
+  std::vector<Chunk> chunks = m_chunks;
+  chunks.push_back({kSourcesChunk, sourceNames.data(), sourceNames.size()});
+  chunks.push_back({kStampsChunk, stamps.data(), stamps.size() * sizeof(SourceStamp)});
+
+  FileHeader header{kMagic, kFormatVersion, version, uint32_t(chunks.size()), 0};
+  if(!hashSources(m_sources, header.sourceHash))
+    return false;
+
+  std::vector<ChunkEntry> entries(chunks.size());
+  size_t offset = alignUp(sizeof(FileHeader) + entries.size() * sizeof(ChunkEntry));
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    entries[i] = {chunks[i].id, 0, offset, chunks[i].size};
+    offset     = alignUp(offset + chunks[i].size);
+  }
+
+  std::string tempFile = cacheFile + ".tmp";
+  FILE*       file     = fopen(tempFile.c_str(), "wb");
+  if(!file)
+    return false;
+
+  static const char padding[kAlignment] = {};
+  size_t            written             = 0;
+  bool              ok                  = true;
+  auto              put                 = [&](const void* data, size_t size) {
+    ok = ok && (size == 0 || fwrite(data, 1, size, file) == size);
+    written += size;
+  };
+
+  put(&header, sizeof(header));
+  put(entries.data(), entries.size() * sizeof(ChunkEntry));
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    put(padding, entries[i].offset - written);
+    put(chunks[i].data, chunks[i].size);
+  }
+  put(padding, alignUp(written) - written);
+
+  ok = fclose(file) == 0 && ok && written == offset;
+  remove(cacheFile.c_str());
+  if(!ok || rename(tempFile.c_str(), cacheFile.c_str()) != 0)
+  {
+    remove(tempFile.c_str());
+    LOGW("Could not write the scene cache %s\n", cacheFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool SceneCache::open(const std::string& cacheFile, uint32_t version)
+{
+  if(!m_file.open(cacheFile))
+    return false;
+
+  const FileHeader* header = reinterpret_cast<const FileHeader*>(m_file.data());
+  if(m_file.size() < sizeof(FileHeader) || header->magic != kMagic || header->formatVersion != kFormatVersion
+     || header->version != version
+     || m_file.size() < sizeof(FileHeader) + size_t(header->chunkCount) * sizeof(ChunkEntry))
+  {
+    m_file.close();
+    return false;
+  }
+
+  // Every chunk must be inside the file
+  const ChunkEntry* entries = reinterpret_cast<const ChunkEntry*>(header + 1);
+  for(uint32_t i = 0; i < header->chunkCount; i++)
+  {
+    if(entries[i].offset > m_file.size() || entries[i].size > m_file.size() - entries[i].offset)
+    {
+      m_file.close();
+      return false;
+    }
+  }
+
+  // The sources must not have changed since the cache was written
+  size_t                   namesSize = 0;
+  const char*              names     = static_cast<const char*>(chunk(kSourcesChunk, namesSize));
+  std::vector<std::string> sources;
+  for(size_t pos = 0; names && pos < namesSize;)
+  {
+    sources.emplace_back(names + pos, strnlen(names + pos, namesSize - pos));
+    pos += sources.back().size() + 1;
+  }
+  if(!names)
+  {
+    m_file.close();
+    return false;
+  }
+
+  // Same sizes and modification times: the content is not read again. Otherwise, the
+  // sources may only have been touched, their content decides.
+  size_t                   stampCount = 0;
+  const SourceStamp*       stamps     = chunk<SourceStamp>(kStampsChunk, stampCount);
+  std::vector<SourceStamp> current;
+  if(stamps && stampCount == sources.size() && stampSources(sources, current)
+     && std::equal(current.begin(), current.end(), stamps, [](const SourceStamp& a, const SourceStamp& b) {
+          return a.size == b.size && a.writeTime == b.writeTime;
+        }))
+    return true;
+
+  uint64_t sourceHash;
+  if(!hashSources(sources, sourceHash) || sourceHash != header->sourceHash)
+  {
+    LOGI("Scene cache %s is out of date\n", cacheFile.c_str());
+    m_file.close();
+    return false;
+  }
+  return true;
+}
+
+const void* SceneCache::chunk(uint32_t id, size_t& size) const
+{
+  size = 0;
+  if(!m_file.valid() || m_file.size() < sizeof(FileHeader))
+    return nullptr;
+
+  const FileHeader* header  = reinterpret_cast<const FileHeader*>(m_file.data());
+  const ChunkEntry* entries = reinterpret_cast<const ChunkEntry*>(header + 1);
+  for(uint32_t i = 0; i < header->chunkCount; i++)
+  {
+    if(entries[i].id == id)
+    {
+      size = entries[i].size;
+      return m_file.data() + entries[i].offset;
+    }
+  }
+  return nullptr;
+}
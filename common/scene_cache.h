@@ -0,0 +1,107 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "mapped_file.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Baked scene cache
+//
+// A cache file holds the final, GPU-ready data of a loaded scene as a list of
+// chunks identified by a four character code. Chunks are 64-byte aligned so
+// they can be uploaded or used in place straight from the memory mapping.
+// The file is keyed on the content of all the source files it was built from
+// (the scene file, its buffers, material libraries, images...): a cache is only
+// accepted if none of them changed. Their sizes and modification times are
+// stored as well, and checked first: the sources are only read and hashed again
+// when one of those differs.
+//
+// Each loader defines its own chunks and version number; bump the version when
+// the layout of a chunk changes.
+
+constexpr uint32_t makeChunkId(char a, char b, char c, char d)
+{
+  return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16)
+         | (uint32_t(uint8_t(d)) << 24);
+}
+
+// Cache file used for a source file
+inline std::string sceneCacheFilename(const std::string& sourceFile)
+{
+  return sourceFile + ".scache";
+}
+
+class SceneCacheWriter
+{
+public:
+  // Files the cached data depends on
+  void addSource(const std::string& filename) { m_sources.push_back(filename); }
+
+  // The data is not copied and must stay alive until write()
+  void addChunk(uint32_t id, const void* data, size_t size) { m_chunks.push_back({id, data, size}); }
+
+  template <class T>
+  void addChunk(uint32_t id, const std::vector<T>& data)
+  {
+    static_assert(std::is_standard_layout<T>::value, "Chunks are stored as raw bytes");
+    addChunk(id, data.data(), data.size() * sizeof(T));
+  }
+
+  // Writes to a temporary file first, so a cache is never left half written
+  bool write(const std::string& cacheFile, uint32_t version) const;
+
+private:
+  struct Chunk
+  {
+    uint32_t    id;
+    const void* data;
+    size_t      size;
+  };
+  std::vector<std::string> m_sources;
+  std::vector<Chunk>       m_chunks;
+};
+
+class SceneCache
+{
+public:
+  // Maps the cache and checks the version and the source files: their sizes and
+  // modification times, or their content if those changed
+  bool open(const std::string& cacheFile, uint32_t version);
+  void close() { m_file.close(); }
+
+  // Returns nullptr if the chunk is missing
+  const void* chunk(uint32_t id, size_t& size) const;
+
+  // Typed view of a chunk; count is the number of elements
+  template <class T>
+  const T* chunk(uint32_t id, size_t& count) const
+  {
+    size_t      size = 0;
+    const void* data = chunk(id, size);
+    count            = data && size % sizeof(T) == 0 ? size / sizeof(T) : 0;
+    return count ? static_cast<const T*>(data) : nullptr;
+  }
+
+  // Copy of a chunk. Returns false if the chunk is missing or has the wrong size.
+  template <class T>
+  bool read(uint32_t id, std::vector<T>& out) const
+  {
+    static_assert(std::is_standard_layout<T>::value, "Chunks are stored as raw bytes");
+    size_t      size = 0;
+    const void* data = chunk(id, size);
+    if(!data || size % sizeof(T) != 0)
+      return false;
+    out.resize(size / sizeof(T));
+    if(size)
+      memcpy(out.data(), data, size);
+    return true;
+  }
+
+private:
+  MappedFile m_file;
+};
@@ -0,0 +1,56 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+
+// SIMD support of the CPU-side tools
+// SSE2 is part of x86-64, so it is used unconditionally when compiling for it.
+// SSE4.1 and AVX2 code paths are only enabled when the compiler targets them
+// (-msse4.1 / -mavx2, /arch:AVX2). Other architectures use the scalar code paths.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NV_SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define NV_SIMD_SSE2 0
+#endif
+
+#if NV_SIMD_SSE2 && (defined(__SSE4_1__) || defined(__AVX__))
+#define NV_SIMD_SSE41 1
+#include <smmintrin.h>
+#else
+#define NV_SIMD_SSE41 0
+#endif
+
+#if NV_SIMD_SSE2 && defined(__AVX2__)
+#define NV_SIMD_AVX2 1
+#include <immintrin.h>
+#else
+#define NV_SIMD_AVX2 0
+#endif
+
+// Returns v as a value the compiler cannot fuse with the addition it feeds. When the target
+// has FMA, GCC and Clang contract a * b - c * d into fma(a, b, -(c * d)), which rounds the two
+// products differently: the difference is then no longer antisymmetric, and no longer zero
+// when a * b == c * d. The edge functions of the watertight triangle test need both.
+#if defined(__GNUC__) && NV_SIMD_SSE2
+template <class T>
+inline T unfused(T v)
+{
+  __asm__("" : "+x"(v));
+  return v;
+}
+#elif defined(__GNUC__) && defined(__aarch64__)
+template <class T>
+inline T unfused(T v)
+{
+  __asm__("" : "+w"(v));
+  return v;
+}
+#else
+template <class T>
+inline T unfused(T v)
+{
+  return v;
+}
+#endif
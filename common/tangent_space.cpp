@@ -0,0 +1,160 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "tangent_space.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+namespace {
+using nvmath::vec2f;
+using nvmath::vec3f;
+using nvmath::vec4f;
+
+bool notZero(float f)
+{
+  return std::abs(f) > FLT_MIN;
+}
+
+// Component of v orthogonal to the unit vector n, normalized when not zero
+vec3f projectOnPlane(const vec3f& v, const vec3f& n)
+{
+  vec3f p   = v - n * nvmath::dot(n, v);
+  float len = nvmath::length(p);
+  return notZero(len) ? p * (1.f / len) : p;
+}
+
+// Any unit vector orthogonal to n
+vec3f orthogonal(const vec3f& n)
+{
+  vec3f axis = std::abs(n.x) < 0.9f ? vec3f(1.f, 0.f, 0.f) : vec3f(0.f, 1.f, 0.f);
+  return projectOnPlane(axis, n);
+}
+
+bool validTriangle(const TangentPrimitive& prim, size_t t)
+{
+  const uint32_t* idx = prim.indices + t;
+  return idx[0] < prim.vertexCount && idx[1] < prim.vertexCount && idx[2] < prim.vertexCount;
+}
+
+void generateMikkTSpace(const TangentPrimitive& prim)
+{
+  // Sums of the corners around each vertex, apart for orientation preserving (0) and mirrored (1) UVs
+  struct Corners
+  {
+    vec3f tangent[2]{vec3f(0.f, 0.f, 0.f), vec3f(0.f, 0.f, 0.f)};
+    float angle[2]{0.f, 0.f};
+  };
+  std::vector<Corners> corners(prim.vertexCount);
+
+  for(size_t t = 0; t + 2 < prim.indexCount; t += 3)
+  {
+    if(!validTriangle(prim, t))
+      continue;
+    const uint32_t* idx = prim.indices + t;
+    const vec3f     p[3] = {prim.positions[idx[0]], prim.positions[idx[1]], prim.positions[idx[2]]};
+    const vec2f     uv[3] = {prim.uvs[idx[0]], prim.uvs[idx[1]], prim.uvs[idx[2]]};
+
+    // Direction of increasing u, from the UV area of the triangle
+    vec3f d1   = p[1] - p[0];
+    vec3f d2   = p[2] - p[0];
+    vec2f t21  = uv[1] - uv[0];
+    vec2f t31  = uv[2] - uv[0];
+    float area = t21.x * t31.y - t21.y * t31.x;
+    if(!notZero(area))
+      continue;  // Degenerate UVs, no direction to contribute
+    int   mirrored = area > 0.f ? 0 : 1;
+    vec3f os       = d1 * t31.y - d2 * t21.y;
+    float lenOs    = nvmath::length(os);
+    if(!notZero(lenOs))
+      continue;
+    os = os * ((mirrored ? -1.f : 1.f) / lenOs);
+
+    for(int c = 0; c < 3; c++)
+    {
+      const vec3f& n = prim.normals[idx[c]];
+
+      // Angle of the corner in the tangent plane of the vertex
+      vec3f e1    = projectOnPlane(p[(c + 2) % 3] - p[c], n);
+      vec3f e2    = projectOnPlane(p[(c + 1) % 3] - p[c], n);
+      float angle = std::acos(std::min(std::max(nvmath::dot(e1, e2), -1.f), 1.f));
+
+      Corners& sum = corners[idx[c]];
+      sum.tangent[mirrored] += projectOnPlane(os, n) * angle;
+      sum.angle[mirrored] += angle;
+    }
+  }
+
+  for(size_t v = 0; v < prim.vertexCount; v++)
+  {
+    const Corners& sum      = corners[v];
+    int            mirrored = sum.angle[1] > sum.angle[0] ? 1 : 0;
+    vec3f          tangent  = sum.tangent[mirrored];
+    float          len      = nvmath::length(tangent);
+    tangent                 = notZero(len) ? tangent * (1.f / len) : orthogonal(prim.normals[v]);
+    prim.tangents[v]        = vec4f(tangent.x, tangent.y, tangent.z, mirrored ? -1.f : 1.f);
+  }
+}
+
+void generateAccumulated(const TangentPrimitive& prim)
+{
+  std::fill(prim.tangents, prim.tangents + prim.vertexCount, vec4f(0.f, 0.f, 0.f, 0.f));
+
+  // Accumulate per-triangle tangents
+  for(size_t t = 0; t + 2 < prim.indexCount; t += 3)
+  {
+    if(!validTriangle(prim, t))
+      continue;
+    const uint32_t* idx = prim.indices + t;
+
+    vec2f deltaUV1 = prim.uvs[idx[1]] - prim.uvs[idx[0]];
+    vec2f deltaUV2 = prim.uvs[idx[2]] - prim.uvs[idx[0]];
+
+    vec3f deltaPos1 = prim.positions[idx[1]] - prim.positions[idx[0]];
+    vec3f deltaPos2 = prim.positions[idx[2]] - prim.positions[idx[0]];
+
+    float determinant = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+
+    // Unnormalized tangent
+    vec3f triangleTangent = (deltaPos1 * deltaUV2.y - deltaUV1.y * deltaPos2) * (1 / determinant);
+    for(int c = 0; c < 3; c++)
+      prim.tangents[idx[c]] += vec4f(triangleTangent.x, triangleTangent.y, triangleTangent.z, determinant);
+  }
+
+  // Orthonormalize per vertex
+  for(size_t v = 0; v < prim.vertexCount; v++)
+  {
+    vec4f&       tangent  = prim.tangents[v];
+    vec3f        tangent3 = {tangent.x, tangent.y, tangent.z};
+    const vec3f& normal   = prim.normals[v];
+
+    tangent3 = nvmath::normalize(tangent3 - (nvmath::dot(tangent3, normal) * normal));
+    tangent  = {tangent3.x, tangent3.y, tangent3.z, std::signbit(-tangent.w) ? -1.f : 1.f};
+  }
+}
+}  // namespace
+
+void generateTangents(const TangentPrimitive& primitive, TangentSpaceMode mode)
+{
+  if(!primitive.vertexCount)
+    return;
+  if(mode == TangentSpaceMode::eMikkTSpace)
+    generateMikkTSpace(primitive);
+  else
+    generateAccumulated(primitive);
+}
+
+void generateTangents(const TangentPrimitive* primitives, size_t count, TangentSpaceMode mode, uint32_t nbThreads)
+{
+  // Largest first, so that a big primitive does not start last and serialize the end
+  std::vector<size_t> order(count);
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return primitives[a].indexCount + primitives[a].vertexCount > primitives[b].indexCount + primitives[b].vertexCount;
+  });
+  parallelFor(
+      count, [&](size_t i) { generateTangents(primitives[order[i]], mode); }, nbThreads);
+}
@@ -0,0 +1,50 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "nvmath/nvmath.h"
+#include "parallel.h"
+
+// Per-vertex tangent generation for normal mapping
+// Tangents are vec4: xyz is the direction of increasing u in the tangent plane and w the
+// handedness, bitangent = cross(normal, tangent.xyz) * tangent.w (glTF convention).
+//
+// eMikkTSpace follows the MikkTSpace reference (what Blender, Substance and xNormal bake
+// against, and what glTF asks for when tangents are missing): per-corner tangents projected
+// on the vertex normal, weighted by the corner angle, UV-mirrored triangles accumulated apart.
+// As an indexed vertex only holds one tangent, a vertex shared by mirrored and non-mirrored
+// triangles takes the orientation with the largest angle; authoring tools split such
+// vertices, so this only matters for meshes that were welded afterwards.
+// eAccumulate is the former RenderScene::generateTangentSpace: UV-area weighted, without
+// handling of degenerate UVs.
+
+enum class TangentSpaceMode
+{
+  eMikkTSpace,
+  eAccumulate,
+};
+
+// One primitive, all pointers at its first vertex or index. Indices are local to the
+// primitive and the tangents are written in place, vertexCount of them.
+struct TangentPrimitive
+{
+  const nvmath::vec3f* positions{nullptr};
+  const nvmath::vec3f* normals{nullptr};
+  const nvmath::vec2f* uvs{nullptr};
+  const uint32_t*      indices{nullptr};
+  size_t               indexCount{0};
+  size_t               vertexCount{0};
+  nvmath::vec4f*       tangents{nullptr};
+};
+
+void generateTangents(const TangentPrimitive& primitive, TangentSpaceMode mode = TangentSpaceMode::eMikkTSpace);
+
+// Primitives are processed concurrently, largest first. Their tangent ranges must not overlap.
+void generateTangents(const TangentPrimitive* primitives,
+                      size_t                  count,
+                      TangentSpaceMode        mode      = TangentSpaceMode::eMikkTSpace,
+                      uint32_t                nbThreads = getWorkerCount());
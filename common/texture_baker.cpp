@@ -0,0 +1,627 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "texture_baker.h"
+#include "nvh/nvprint.hpp"
+#include "simd.h"
+#include "texture_loader.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+const uint32_t kTextureCacheVersion = 1;
+const uint32_t kChunkHeader         = makeChunkId('T', 'X', 'H', 'D');
+const uint32_t kChunkLevels         = makeChunkId('T', 'X', 'L', 'V');
+const uint32_t kChunkData           = makeChunkId('T', 'X', 'D', 'A');
+
+struct CachedTextureHeader
+{
+  uint32_t compression;
+  uint32_t srgb;
+};
+
+//-----------------------------------------------------------------------------
+// Mip chain
+//
+
+// Conversions between 8 bit values and the space the texels are averaged in
+struct FilterTables
+{
+  static const int kEncodeSize = 16384;
+  float            decode[256];
+  uint8_t          encode[kEncodeSize + 1];  // Indexed by value * kEncodeSize
+
+  explicit FilterTables(bool srgb)
+  {
+    for(int i = 0; i < 256; i++)
+    {
+      float v   = i / 255.f;
+      decode[i] = srgb ? (v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f)) : v;
+    }
+    for(int i = 0; i <= kEncodeSize; i++)
+    {
+      float v   = i / float(kEncodeSize);
+      float e   = srgb ? (v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f) : v;
+      encode[i] = static_cast<uint8_t>(std::min(255.f, e * 255.f + 0.5f));
+    }
+  }
+};
+
+const FilterTables& filterTables(bool srgb)
+{
+  static const FilterTables linearTables(false);
+  static const FilterTables srgbTables(true);
+  return srgb ? srgbTables : linearTables;
+}
+
+// 2x2 box filter. Odd dimensions clamp at the border. Alpha is always linear.
+void downsample(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst, bool srgb, uint32_t nbThreads)
+{
+  const FilterTables& color = filterTables(srgb);
+  const FilterTables& alpha = filterTables(false);
+  uint32_t            dstW  = std::max(1u, width / 2);
+  uint32_t            dstH  = std::max(1u, height / 2);
+
+  parallelRanges(
+      dstH, 16,
+      [&](size_t yBegin, size_t yEnd) {
+        for(size_t y = yBegin; y < yEnd; y++)
+        {
+          const uint8_t* row0 = src + size_t(std::min<size_t>(2 * y, height - 1)) * width * 4;
+          const uint8_t* row1 = src + size_t(std::min<size_t>(2 * y + 1, height - 1)) * width * 4;
+          for(uint32_t x = 0; x < dstW; x++)
+          {
+            const uint8_t* t[4] = {row0 + std::min(2 * x, width - 1) * 4, row0 + std::min(2 * x + 1, width - 1) * 4,
+                                   row1 + std::min(2 * x, width - 1) * 4, row1 + std::min(2 * x + 1, width - 1) * 4};
+            float avg[4];
+#if NV_SIMD_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for(const uint8_t* p : t)
+              sum = _mm_add_ps(sum, _mm_set_ps(alpha.decode[p[3]], color.decode[p[2]], color.decode[p[1]],
+                                               color.decode[p[0]]));
+            _mm_storeu_ps(avg, _mm_mul_ps(sum, _mm_set1_ps(0.25f * FilterTables::kEncodeSize)));
+#else
+            for(int c = 0; c < 4; c++)
+            {
+              const float* decode = c == 3 ? alpha.decode : color.decode;
+              avg[c] = (decode[t[0][c]] + decode[t[1][c]] + decode[t[2][c]] + decode[t[3][c]]) * 0.25f
+                       * FilterTables::kEncodeSize;
+            }
+#endif
+            uint8_t* out = dst + (y * dstW + x) * 4;
+            for(int c = 0; c < 4; c++)
+              out[c] = (c == 3 ? alpha : color).encode[static_cast<int>(avg[c] + 0.5f)];
+          }
+        }
+      },
+      nbThreads);
+}
+
+//-----------------------------------------------------------------------------
+// Block compression
+// Endpoints come from the principal axis of the block colors, texels take the
+// closest palette entry.
+//
+
+// Fetches the 4x4 block at (bx, by), replicating the border texels
+void fetchBlock(const uint8_t* image, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t block[64])
+{
+  for(uint32_t y = 0; y < 4; y++)
+  {
+    const uint8_t* row = image + size_t(std::min(by * 4 + y, height - 1)) * width * 4;
+    for(uint32_t x = 0; x < 4; x++)
+      memcpy(block + (y * 4 + x) * 4, row + std::min(bx * 4 + x, width - 1) * 4, 4);
+  }
+}
+
+// Extent of the block colors along their principal axis, over `channels` channels.
+// Returns the two endpoints.
+void principalEndpoints(const uint8_t block[64], int channels, float e0[4], float e1[4])
+{
+  float mean[4] = {};
+  for(int i = 0; i < 16; i++)
+    for(int c = 0; c < channels; c++)
+      mean[c] += block[i * 4 + c];
+  for(int c = 0; c < channels; c++)
+    mean[c] /= 16.f;
+
+  float cov[4][4] = {};
+  for(int i = 0; i < 16; i++)
+    for(int a = 0; a < channels; a++)
+      for(int b = a; b < channels; b++)
+        cov[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+  for(int a = 0; a < channels; a++)
+    for(int b = 0; b < a; b++)
+      cov[a][b] = cov[b][a];
+
+  // Power iteration
+  float axis[4] = {1.f, 1.f, 1.f, 1.f};
+  for(int iter = 0; iter < 8; iter++)
+  {
+    float next[4] = {};
+    float len     = 0.f;
+    for(int a = 0; a < channels; a++)
+    {
+      for(int b = 0; b < channels; b++)
+        next[a] += cov[a][b] * axis[b];
+      len = std::max(len, std::fabs(next[a]));
+    }
+    if(len < 1e-6f)
+      break;
+    for(int a = 0; a < channels; a++)
+      axis[a] = next[a] / len;
+  }
+  float norm = 0.f;
+  for(int c = 0; c < channels; c++)
+    norm += axis[c] * axis[c];
+  norm = norm > 0.f ? 1.f / std::sqrt(norm) : 0.f;
+
+  float tMin = 0.f, tMax = 0.f;
+  for(int i = 0; i < 16; i++)
+  {
+    float t = 0.f;
+    for(int c = 0; c < channels; c++)
+      t += (block[i * 4 + c] - mean[c]) * axis[c] * norm;
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+  for(int c = 0; c < channels; c++)
+  {
+    e0[c] = std::min(255.f, std::max(0.f, mean[c] + tMin * axis[c] * norm));
+    e1[c] = std::min(255.f, std::max(0.f, mean[c] + tMax * axis[c] * norm));
+  }
+}
+
+// Index of the closest palette entry for each texel. The palette is stored by
+// channel, padded to a multiple of 4 entries with unreachable values.
+template <int N>
+void closestIndices(const uint8_t block[64], int channels, const float palette[4][N], uint8_t indices[16])
+{
+  static_assert(N % 4 == 0, "Palette must be padded");
+  for(int i = 0; i < 16; i++)
+  {
+    const uint8_t* texel = block + i * 4;
+#if NV_SIMD_SSE2
+    __m128 best      = _mm_set1_ps(1e30f);
+    __m128 bestIndex = _mm_setzero_ps();
+    for(int k = 0; k < N; k += 4)
+    {
+      __m128 dist = _mm_setzero_ps();
+      for(int c = 0; c < channels; c++)
+      {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(&palette[c][k]), _mm_set1_ps(float(texel[c])));
+        dist     = _mm_add_ps(dist, _mm_mul_ps(d, d));
+      }
+      __m128 closer = _mm_cmplt_ps(dist, best);
+      best          = _mm_min_ps(dist, best);
+      __m128 index  = _mm_set_ps(float(k + 3), float(k + 2), float(k + 1), float(k));
+      bestIndex     = _mm_or_ps(_mm_and_ps(closer, index), _mm_andnot_ps(closer, bestIndex));
+    }
+    float dists[4], idx[4];
+    _mm_storeu_ps(dists, best);
+    _mm_storeu_ps(idx, bestIndex);
+    int lane = 0;
+    for(int l = 1; l < 4; l++)
+      if(dists[l] < dists[lane] || (dists[l] == dists[lane] && idx[l] < idx[lane]))
+        lane = l;
+    indices[i] = static_cast<uint8_t>(idx[lane]);
+#else
+    float bestDist = 1e30f;
+    for(int k = 0; k < N; k++)
+    {
+      float dist = 0.f;
+      for(int c = 0; c < channels; c++)
+      {
+        float d = palette[c][k] - texel[c];
+        dist += d * d;
+      }
+      if(dist < bestDist)
+      {
+        bestDist   = dist;
+        indices[i] = static_cast<uint8_t>(k);
+      }
+    }
+#endif
+  }
+}
+
+inline uint16_t packRGB565(const float c[3])
+{
+  uint32_t r = static_cast<uint32_t>(c[0] * 31.f / 255.f + 0.5f);
+  uint32_t g = static_cast<uint32_t>(c[1] * 63.f / 255.f + 0.5f);
+  uint32_t b = static_cast<uint32_t>(c[2] * 31.f / 255.f + 0.5f);
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRGB565(uint16_t v, float c[3])
+{
+  uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+  c[0]       = float((r << 3) | (r >> 2));
+  c[1]       = float((g << 2) | (g >> 4));
+  c[2]       = float((b << 3) | (b >> 2));
+}
+
+// BC1 color block, always in 4 color mode so it can also be used by BC3
+void encodeColorBlock(const uint8_t block[64], uint8_t out[8])
+{
+  float e0[4], e1[4];
+  principalEndpoints(block, 3, e0, e1);
+
+  // Inset the endpoints a little, the extremes are reached by interpolation rounding anyway
+  for(int c = 0; c < 3; c++)
+  {
+    float inset = (e1[c] - e0[c]) / 16.f;
+    e0[c] += inset;
+    e1[c] -= inset;
+  }
+
+  uint16_t c0 = packRGB565(e1);
+  uint16_t c1 = packRGB565(e0);
+  if(c0 < c1)
+    std::swap(c0, c1);
+
+  uint32_t bits = 0;
+  if(c0 != c1)
+  {
+    float p0[3], p1[3];
+    unpackRGB565(c0, p0);
+    unpackRGB565(c1, p1);
+    float palette[4][4] = {};
+    for(int c = 0; c < 3; c++)
+    {
+      palette[c][0] = p0[c];
+      palette[c][1] = p1[c];
+      palette[c][2] = (2.f * p0[c] + p1[c]) / 3.f;
+      palette[c][3] = (p0[c] + 2.f * p1[c]) / 3.f;
+    }
+    uint8_t indices[16];
+    closestIndices<4>(block, 3, palette, indices);
+    for(int i = 0; i < 16; i++)
+      bits |= uint32_t(indices[i]) << (2 * i);
+  }
+
+  out[0] = uint8_t(c0);
+  out[1] = uint8_t(c0 >> 8);
+  out[2] = uint8_t(c1);
+  out[3] = uint8_t(c1 >> 8);
+  memcpy(out + 4, &bits, 4);
+}
+
+// BC4 style alpha block of BC3, in 8 alpha mode
+void encodeAlphaBlock(const uint8_t block[64], uint8_t out[8])
+{
+  uint8_t a0 = 0, a1 = 255;
+  for(int i = 0; i < 16; i++)
+  {
+    a0 = std::max(a0, block[i * 4 + 3]);
+    a1 = std::min(a1, block[i * 4 + 3]);
+  }
+
+  uint64_t bits = 0;
+  if(a0 != a1)
+  {
+    // Position along [a1, a0] in 1/7 steps, mapped to the block indices
+    static const uint8_t stepToIndex[8] = {1, 7, 6, 5, 4, 3, 2, 0};
+    float                scale          = 7.f / float(a0 - a1);
+    for(int i = 0; i < 16; i++)
+    {
+      int step = static_cast<int>((block[i * 4 + 3] - a1) * scale + 0.5f);
+      bits |= uint64_t(stepToIndex[step]) << (3 * i);
+    }
+  }
+
+  out[0] = a0;
+  out[1] = a1;
+  for(int i = 0; i < 6; i++)
+    out[2 + i] = uint8_t(bits >> (8 * i));
+}
+
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each, 4 bit indices
+void encodeBC7Block(const uint8_t block[64], uint8_t out[16])
+{
+  static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  float e[2][4];
+  principalEndpoints(block, 4, e[0], e[1]);
+
+  // Quantize each endpoint with the p-bit that fits it best
+  uint32_t q[2][4], p[2];
+  for(int n = 0; n < 2; n++)
+  {
+    float bestErr = 1e30f;
+    for(uint32_t pbit = 0; pbit < 2; pbit++)
+    {
+      uint32_t qn[4];
+      float    err = 0.f;
+      for(int c = 0; c < 4; c++)
+      {
+        int v = static_cast<int>((e[n][c] - pbit) / 2.f + 0.5f);
+        qn[c] = static_cast<uint32_t>(std::min(127, std::max(0, v)));
+        float d = float((qn[c] << 1) | pbit) - e[n][c];
+        err += d * d;
+      }
+      if(err < bestErr)
+      {
+        bestErr = err;
+        p[n]    = pbit;
+        memcpy(q[n], qn, sizeof(qn));
+      }
+    }
+  }
+
+  float palette[4][16];
+  for(int c = 0; c < 4; c++)
+  {
+    int d0 = (q[0][c] << 1) | p[0];
+    int d1 = (q[1][c] << 1) | p[1];
+    for(int k = 0; k < 16; k++)
+      palette[c][k] = float(((64 - weights[k]) * d0 + weights[k] * d1 + 32) >> 6);
+  }
+  uint8_t indices[16];
+  closestIndices<16>(block, 4, palette, indices);
+
+  // The most significant bit of the first index is implicit and must be 0
+  if(indices[0] >= 8)
+  {
+    std::swap(q[0], q[1]);
+    std::swap(p[0], p[1]);
+    for(auto& index : indices)
+      index = 15 - index;
+  }
+
+  uint64_t lo = 0, hi = 0;
+  uint32_t pos = 0;
+  auto     put = [&](uint64_t value, uint32_t count) {
+    if(pos < 64)
+    {
+      lo |= value << pos;
+      if(pos + count > 64)
+        hi |= value >> (64 - pos);
+    }
+    else
+    {
+      hi |= value << (pos - 64);
+    }
+    pos += count;
+  };
+  put(1 << 6, 7);  // Mode 6
+  for(int c = 0; c < 4; c++)
+  {
+    put(q[0][c], 7);
+    put(q[1][c], 7);
+  }
+  put(p[0], 1);
+  put(p[1], 1);
+  put(indices[0], 3);
+  for(int i = 1; i < 16; i++)
+    put(indices[i], 4);
+
+  memcpy(out, &lo, 8);
+  memcpy(out + 8, &hi, 8);
+}
+
+void compressLevel(const uint8_t*     rgba,
+                   uint32_t           width,
+                   uint32_t           height,
+                   TextureCompression compression,
+                   uint8_t*           out,
+                   uint32_t           nbThreads)
+{
+  uint32_t blocksX   = (width + 3) / 4;
+  uint32_t blocksY   = (height + 3) / 4;
+  uint32_t blockSize = textureBlockSize(compression);
+
+  parallelRanges(
+      blocksY, 4,
+      [&](size_t yBegin, size_t yEnd) {
+        uint8_t block[64];
+        for(size_t by = yBegin; by < yEnd; by++)
+        {
+          for(uint32_t bx = 0; bx < blocksX; bx++)
+          {
+            fetchBlock(rgba, width, height, bx, static_cast<uint32_t>(by), block);
+            uint8_t* dst = out + (by * blocksX + bx) * blockSize;
+            switch(compression)
+            {
+              case TextureCompression::eBC1:
+                encodeColorBlock(block, dst);
+                break;
+              case TextureCompression::eBC3:
+                encodeAlphaBlock(block, dst);
+                encodeColorBlock(block, dst + 8);
+                break;
+              case TextureCompression::eBC7:
+                encodeBC7Block(block, dst);
+                break;
+              default:
+                break;
+            }
+          }
+        }
+      },
+      nbThreads);
+}
+
+uint64_t levelSize(TextureCompression compression, uint32_t width, uint32_t height)
+{
+  if(compression == TextureCompression::eNone)
+    return uint64_t(width) * height * 4;
+  return uint64_t((width + 3) / 4) * ((height + 3) / 4) * textureBlockSize(compression);
+}
+
+std::string bakedTextureCacheFilename(const std::string& imageFile, TextureCompression compression, bool srgb)
+{
+  static const char* names[] = {"rgba8", "bc1", "bc3", "bc7"};
+  return sceneCacheFilename(imageFile + "." + names[int(compression)] + (srgb ? "-srgb" : ""));
+}
+
+}  // namespace
+
+uint32_t textureBlockSize(TextureCompression compression)
+{
+  switch(compression)
+  {
+    case TextureCompression::eBC1:
+      return 8;
+    case TextureCompression::eBC3:
+    case TextureCompression::eBC7:
+      return 16;
+    default:
+      return 4;
+  }
+}
+
+void bakeTexture(uint32_t           width,
+                 uint32_t           height,
+                 const uint8_t*     rgba,
+                 TextureCompression compression,
+                 bool               srgb,
+                 BakedTexture&      out,
+                 uint32_t           nbThreads)
+{
+  out.compression = compression;
+  out.srgb        = srgb;
+  out.levels.clear();
+  out.cache.close();
+
+  // Layout of the chain
+  uint64_t offset = 0;
+  for(uint32_t w = width, h = height;; w = std::max(1u, w / 2), h = std::max(1u, h / 2))
+  {
+    BakedMipLevel level{w, h, offset, levelSize(compression, w, h)};
+    out.levels.push_back(level);
+    offset += level.size;
+    if(w == 1 && h == 1)
+      break;
+  }
+  out.storage.resize(offset);
+
+  // Each level is filtered from the previous one, then compressed
+  std::vector<uint8_t> current(rgba, rgba + size_t(width) * height * 4), next;
+  for(size_t l = 0; l < out.levels.size(); l++)
+  {
+    const BakedMipLevel& level = out.levels[l];
+    if(l > 0)
+    {
+      const BakedMipLevel& prev = out.levels[l - 1];
+      next.resize(size_t(level.width) * level.height * 4);
+      downsample(current.data(), prev.width, prev.height, next.data(), srgb, nbThreads);
+      current.swap(next);
+    }
+    if(compression == TextureCompression::eNone)
+      memcpy(out.storage.data() + level.offset, current.data(), level.size);
+    else
+      compressLevel(current.data(), level.width, level.height, compression, out.storage.data() + level.offset, nbThreads);
+  }
+
+  out.data     = out.storage.data();
+  out.dataSize = out.storage.size();
+}
+
+bool loadBakedTexture(const std::string& imageFile, TextureCompression compression, bool srgb, BakedTexture& out)
+{
+  if(!out.cache.open(bakedTextureCacheFilename(imageFile, compression, srgb), kTextureCacheVersion))
+    return false;
+
+  size_t                     nbHeaders = 0, nbLevels = 0, size = 0;
+  const CachedTextureHeader* header    = out.cache.chunk<CachedTextureHeader>(kChunkHeader, nbHeaders);
+  const BakedMipLevel*       levels    = out.cache.chunk<BakedMipLevel>(kChunkLevels, nbLevels);
+  const void*                data      = out.cache.chunk(kChunkData, size);
+  bool valid = nbHeaders == 1 && header->compression == uint32_t(compression) && header->srgb == uint32_t(srgb)
+               && nbLevels > 0 && data;
+  for(size_t l = 0; valid && l < nbLevels; l++)
+    valid = levels[l].offset + levels[l].size <= size;
+  if(!valid)
+  {
+    out.cache.close();
+    return false;
+  }
+
+  out.compression = compression;
+  out.srgb        = srgb;
+  out.levels.assign(levels, levels + nbLevels);
+  out.storage.clear();
+  out.data     = static_cast<const uint8_t*>(data);
+  out.dataSize = size;
+  return true;
+}
+
+bool saveBakedTexture(const std::string& imageFile, const BakedTexture& texture)
+{
+  CachedTextureHeader header{uint32_t(texture.compression), uint32_t(texture.srgb)};
+
+  SceneCacheWriter writer;
+  writer.addSource(imageFile);
+  writer.addChunk(kChunkHeader, &header, sizeof(header));
+  writer.addChunk(kChunkLevels, texture.levels);
+  writer.addChunk(kChunkData, texture.data, texture.dataSize);
+  return writer.write(bakedTextureCacheFilename(imageFile, texture.compression, texture.srgb), kTextureCacheVersion);
+}
+
+std::vector<std::shared_ptr<const BakedTexture>> bakeTextures(const std::vector<std::string>& files,
+                                                              TextureCompression              compression,
+                                                              bool                            srgb)
+{
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  // One bake per distinct path, in order of first appearance
+  std::unordered_map<std::string, size_t> uniqueIndex;
+  std::vector<size_t>                     fileToUnique(files.size());
+  std::vector<const std::string*>         uniqueFiles;
+  for(size_t i = 0; i < files.size(); i++)
+  {
+    auto it = uniqueIndex.emplace(files[i], uniqueFiles.size());
+    if(it.second)
+      uniqueFiles.push_back(&files[i]);
+    fileToUnique[i] = it.first->second;
+  }
+
+  // Files are spread over the threads; with fewer files than threads, each bake
+  // also splits its blocks.
+  uint32_t nbThreads   = getWorkerCount();
+  uint32_t innerThreads = std::max<uint32_t>(1, nbThreads / static_cast<uint32_t>(std::max<size_t>(uniqueFiles.size(), 1)));
+  std::atomic<uint32_t> nbCached{0};
+
+  std::vector<std::shared_ptr<const BakedTexture>> baked(uniqueFiles.size());
+  parallelFor(
+      uniqueFiles.size(),
+      [&](size_t i) {
+        const std::string& file    = *uniqueFiles[i];
+        auto               texture = std::make_shared<BakedTexture>();
+        if(loadBakedTexture(file, compression, srgb, *texture))
+        {
+          nbCached++;
+        }
+        else
+        {
+          ImageRGBA8 image;
+          if(decodeImageRGBA8(file, image))
+          {
+            bakeTexture(image.width, image.height, image.pixels.data(), compression, srgb, *texture, innerThreads);
+            saveBakedTexture(file, *texture);
+          }
+          else
+          {
+            LOGW("Cannot load texture: %s\n", file.c_str());
+            const uint8_t magenta[4] = {255, 0, 255, 255};
+            bakeTexture(1, 1, magenta, compression, srgb, *texture, 1);
+          }
+        }
+        baked[i] = texture;
+      },
+      nbThreads);
+
+  std::vector<std::shared_ptr<const BakedTexture>> textures(files.size());
+  for(size_t i = 0; i < files.size(); i++)
+    textures[i] = baked[fileToUnique[i]];
+
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime);
+  LOGI("Baked %zu textures (%zu unique files, %u from cache) in %.1f ms\n", files.size(), uniqueFiles.size(),
+       nbCached.load(), elapsed.count());
+  return textures;
+}
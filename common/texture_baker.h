@@ -0,0 +1,72 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "parallel.h"
+#include "scene_cache.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Offline texture baking
+// Builds the full mip chain of an RGBA8 image on the CPU, filtering sRGB images
+// in linear space, and optionally block-compresses every level. Baked textures
+// are cached next to their source image, so loaders only upload them.
+
+enum class TextureCompression
+{
+  eNone,  // RGBA8, 4 bytes per texel
+  eBC1,   // RGB, 0.5 byte per texel. Alpha is dropped
+  eBC3,   // RGB + interpolated alpha, 1 byte per texel
+  eBC7,   // RGBA, mode 6 only, 1 byte per texel
+};
+
+struct BakedMipLevel
+{
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset;  // In bytes, from BakedTexture::data
+  uint64_t size;
+};
+
+struct BakedTexture
+{
+  TextureCompression         compression{TextureCompression::eNone};
+  bool                       srgb{true};
+  std::vector<BakedMipLevel> levels;  // Level 0 is the full resolution image
+
+  // All levels back to back. The data is either owned by `storage`, by the
+  // mapping of `cache`, or by whoever created the texture.
+  const uint8_t* data{nullptr};
+  size_t         dataSize{0};
+
+  std::vector<uint8_t> storage;
+  SceneCache           cache;
+};
+
+// Bytes per 4x4 block, or per texel for eNone
+uint32_t textureBlockSize(TextureCompression compression);
+
+// Bakes an RGBA8 image; `out` owns its data
+void bakeTexture(uint32_t           width,
+                 uint32_t           height,
+                 const uint8_t*     rgba,
+                 TextureCompression compression,
+                 bool               srgb,
+                 BakedTexture&      out,
+                 uint32_t           nbThreads = getWorkerCount());
+
+// Baked texture cache of an image file, keyed on the content of the file and the
+// baking settings (see scene_cache.h)
+bool loadBakedTexture(const std::string& imageFile, TextureCompression compression, bool srgb, BakedTexture& out);
+bool saveBakedTexture(const std::string& imageFile, const BakedTexture& texture);
+
+// Returns the baked textures of image files, in the order of `files`. Each file
+// is loaded from its cache, or decoded, baked and cached. Identical paths are
+// processed once, and the files are spread over the worker threads. A file that
+// cannot be decoded gets a 1x1 magenta texture, so indices stay valid.
+std::vector<std::shared_ptr<const BakedTexture>> bakeTextures(const std::vector<std::string>& files,
+                                                              TextureCompression              compression,
+                                                              bool                            srgb);
@@ -0,0 +1,26 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "texture_loader.h"
+#include "fileformats/stb_image.h"  // The implementation is in the sample
+#include "mapped_file.h"
+
+bool decodeImageRGBA8(const std::string& filename, ImageRGBA8& image)
+{
+  image = ImageRGBA8();
+
+  MappedFile file(filename);
+  int        width = 0, height = 0, channels = 0;
+  stbi_uc*   pixels = nullptr;
+  if(file.valid() && file.size() > 0)
+    pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &channels, STBI_rgb_alpha);
+  if(!pixels)
+    return false;
+
+  image.width  = static_cast<uint32_t>(width);
+  image.height = static_cast<uint32_t>(height);
+  image.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+  stbi_image_free(pixels);
+  return true;
+}
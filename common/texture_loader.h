@@ -0,0 +1,19 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Decoded image, always 4 channels
+struct ImageRGBA8
+{
+  uint32_t             width{0};
+  uint32_t             height{0};
+  std::vector<uint8_t> pixels;
+};
+
+// Decodes one image file. Returns false, leaving `image` empty, if it cannot be decoded.
+bool decodeImageRGBA8(const std::string& filename, ImageRGBA8& image);
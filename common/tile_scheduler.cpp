@@ -0,0 +1,196 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "tile_scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+// Spreads the 16 low bits of v to the even bits
+inline uint32_t expandBits2(uint32_t v)
+{
+  v = (v | (v << 8)) & 0x00FF00FFu;
+  v = (v | (v << 4)) & 0x0F0F0F0Fu;
+  v = (v | (v << 2)) & 0x33333333u;
+  v = (v | (v << 1)) & 0x55555555u;
+  return v;
+}
+
+inline uint32_t mortonCode2(uint32_t x, uint32_t y)
+{
+  return expandBits2(x) | (expandBits2(y) << 1);
+}
+
+// Range of positions in the tile order owned by one thread. Threads pop from the front of their
+// own range and steal from the back of the others.
+struct alignas(64) TileQueue
+{
+  std::mutex mutex;
+  uint32_t   begin{0};
+  uint32_t   end{0};
+};
+
+using Clock = std::chrono::high_resolution_clock;
+
+inline double secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+}  // namespace
+
+void TileScheduler::resize(uint32_t width, uint32_t height, uint32_t tileSize)
+{
+  tileSize = std::max(tileSize, 1u);
+  if(width == m_width && height == m_height && tileSize == m_tileSize)
+    return;
+  m_width    = width;
+  m_height   = height;
+  m_tileSize = tileSize;
+
+  uint32_t columns = (width + tileSize - 1) / tileSize;
+  uint32_t rows    = (height + tileSize - 1) / tileSize;
+  m_tiles.clear();
+  m_tiles.reserve(size_t(columns) * rows);
+  for(uint32_t ty = 0; ty < rows; ty++)
+  {
+    for(uint32_t tx = 0; tx < columns; tx++)
+    {
+      RenderTile tile;
+      tile.x      = tx * tileSize;
+      tile.y      = ty * tileSize;
+      tile.width  = std::min(tileSize, width - tile.x);
+      tile.height = std::min(tileSize, height - tile.y);
+      m_tiles.push_back(tile);
+    }
+  }
+  std::sort(m_tiles.begin(), m_tiles.end(), [&](const RenderTile& a, const RenderTile& b) {
+    return mortonCode2(a.x / tileSize, a.y / tileSize) < mortonCode2(b.x / tileSize, b.y / tileSize);
+  });
+  for(size_t i = 0; i < m_tiles.size(); i++)
+    m_tiles[i].index = uint32_t(i);
+  m_costs.assign(m_tiles.size(), 0.f);
+}
+
+bool TileScheduler::run(const TileFn& fn, uint32_t threadCount, const std::atomic<bool>* cancel)
+{
+  auto     start     = Clock::now();
+  uint32_t tileCount = uint32_t(m_tiles.size());
+  threadCount        = std::max(1u, std::min(threadCount, tileCount));
+
+  // Tiles that never ran cost the average of the others, or all the same on the first run
+  double knownCost  = 0.0;
+  size_t knownCount = 0;
+  for(float cost : m_costs)
+  {
+    knownCost += cost;
+    knownCount += cost > 0.f;
+  }
+  float defaultCost = knownCount ? float(knownCost / knownCount) : 1.f;
+
+  // Contiguous runs of equal estimated cost
+  std::unique_ptr<TileQueue[]> queues(new TileQueue[threadCount]);
+  double                       total = 0.0;
+  for(float cost : m_costs)
+    total += cost > 0.f ? cost : defaultCost;
+  double   accumulated = 0.0;
+  uint32_t next        = 0;
+  for(uint32_t t = 0; t < threadCount; t++)
+  {
+    queues[t].begin = next;
+    double target   = total * (t + 1) / threadCount;
+    while(next < tileCount && (t + 1 == threadCount || accumulated < target))
+    {
+      accumulated += m_costs[next] > 0.f ? m_costs[next] : defaultCost;
+      next++;
+    }
+    queues[t].end = next;
+  }
+
+  std::atomic<uint32_t> steals{0};
+  std::atomic<uint32_t> tilesRun{0};
+  std::vector<double>   busy(threadCount, 0.0);
+
+  auto pop = [&](uint32_t thread, uint32_t& item) {
+    TileQueue&                  queue = queues[thread];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.begin == queue.end)
+      return false;
+    item = queue.begin++;
+    return true;
+  };
+
+  // Takes the back half of the largest run left; the first tile is returned, the rest becomes
+  // the run of the thief
+  auto steal = [&](uint32_t thread, uint32_t& item) {
+    for(;;)
+    {
+      uint32_t victim = thread, largest = 0;
+      for(uint32_t t = 0; t < threadCount; t++)
+      {
+        std::lock_guard<std::mutex> lock(queues[t].mutex);
+        if(queues[t].end - queues[t].begin > largest)
+        {
+          largest = queues[t].end - queues[t].begin;
+          victim  = t;
+        }
+      }
+      if(largest == 0)
+        return false;
+
+      uint32_t first, last;
+      {
+        std::lock_guard<std::mutex> lock(queues[victim].mutex);
+        uint32_t                    left = queues[victim].end - queues[victim].begin;
+        if(left == 0)
+          continue;  // Emptied in the meantime
+        last                = queues[victim].end;
+        first               = last - (left + 1) / 2;
+        queues[victim].end = first;
+      }
+      steals++;
+      item = first;
+      std::lock_guard<std::mutex> lock(queues[thread].mutex);
+      queues[thread].begin = first + 1;
+      queues[thread].end   = last;
+      return true;
+    }
+  };
+
+  auto worker = [&](uint32_t thread) {
+    uint32_t item;
+    while(true)
+    {
+      if(cancel && cancel->load(std::memory_order_relaxed))
+        break;
+      if(!pop(thread, item) && !steal(thread, item))
+        break;
+      auto tileStart = Clock::now();
+      fn(m_tiles[item], thread);
+      double seconds = secondsSince(tileStart);
+      m_costs[item]  = float(seconds);
+      busy[thread] += seconds;
+      tilesRun++;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount - 1);
+  for(uint32_t t = 1; t < threadCount; t++)
+    threads.emplace_back(worker, t);
+  worker(0);
+  for(auto& t : threads)
+    t.join();
+
+  m_stats             = TileRunStats();
+  m_stats.seconds     = secondsSince(start);
+  m_stats.threadCount = threadCount;
+  m_stats.tileCount   = tilesRun;
+  m_stats.steals      = steals;
+  for(double seconds : busy)
+    m_stats.busySeconds += seconds;
+  return tilesRun == tileCount;
+}
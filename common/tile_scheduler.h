@@ -0,0 +1,74 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "parallel.h"
+
+// Work-stealing scheduler of image tiles for the CPU renderers.
+// The image is cut into square tiles ordered along a Morton curve, so that the tiles following
+// each other are close on screen and hit the same parts of the hierarchies. Each thread starts
+// with a contiguous run of that order holding the same estimated cost: the time each tile took
+// the last time it ran, which progressive passes repeat closely. A thread whose run is empty
+// steals the back half of the largest run left, so the expensive regions (any-hit foliage,
+// glass) end up shared instead of holding back the whole image.
+// Cancelling is cooperative: once the flag is raised no tile is started, the tiles in progress
+// finish (or check the flag themselves) and run() returns false.
+
+struct RenderTile
+{
+  uint32_t x{0};
+  uint32_t y{0};
+  uint32_t width{0};
+  uint32_t height{0};
+  uint32_t index{0};  // In TileScheduler::tiles()
+};
+
+struct TileRunStats
+{
+  double   seconds{0.0};      // Wall clock time of the run
+  double   busySeconds{0.0};  // Time spent in the tiles, summed over the threads
+  uint32_t threadCount{0};
+  uint32_t tileCount{0};  // Tiles run, fewer than all of them if cancelled
+  uint32_t steals{0};
+
+  // Fraction of the time the threads spent in tiles
+  float efficiency() const { return seconds > 0.0 ? float(busySeconds / (seconds * threadCount)) : 1.f; }
+};
+
+class TileScheduler
+{
+public:
+  using TileFn = std::function<void(const RenderTile& tile, uint32_t thread)>;
+
+  // Cuts the image in tiles of tileSize x tileSize pixels, smaller on the right and bottom edges.
+  // The tile costs are kept if the tiles are the same.
+  void resize(uint32_t width, uint32_t height, uint32_t tileSize = 32);
+
+  // Calls fn on every tile from threadCount threads, the calling one included.
+  // Returns false if the run was cancelled before all tiles were started.
+  bool run(const TileFn& fn, uint32_t threadCount = getWorkerCount(), const std::atomic<bool>* cancel = nullptr);
+
+  const std::vector<RenderTile>& tiles() const { return m_tiles; }
+  // Seconds spent in each tile the last time it ran, 0 if it never did
+  const std::vector<float>& tileCosts() const { return m_costs; }
+  const TileRunStats&       lastRun() const { return m_stats; }
+
+  uint32_t width() const { return m_width; }
+  uint32_t height() const { return m_height; }
+  uint32_t tileSize() const { return m_tileSize; }
+
+private:
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  uint32_t m_tileSize{0};
+
+  std::vector<RenderTile> m_tiles;  // In Morton order
+  std::vector<float>      m_costs;
+  TileRunStats            m_stats;
+};
@@ -0,0 +1,30 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "nvvk/raytraceKHR_vk.hpp"
+
+// Ray tracing builder whose TLAS can be built again.
+// An update of the TLAS (updateTlasMatrices) keeps its hierarchy and only refits the boxes:
+// it is meant for instances that move a little, not for instances that change of BLAS, like
+// the LOD levels. But nvvk::RaytracingBuilderKHR::buildTlas allocates a new acceleration
+// structure and instance buffer at each call, so the previous ones are freed here first.
+class RebuildableRaytracingBuilder : public nvvk::RaytracingBuilderKHR
+{
+public:
+  // The device must no longer use the previous TLAS. The handle changes: the descriptors
+  // holding it have to be written again.
+  template <typename TAllocator>
+  void rebuildTlas(TAllocator&                            alloc,
+                   const std::vector<Instance>&           instances,
+                   vk::BuildAccelerationStructureFlagsKHR flags)
+  {
+    alloc.destroy(m_tlas.as);
+    alloc.destroy(m_instBuffer);
+    buildTlas(instances, flags);
+  }
+};
@@ -0,0 +1,312 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "vertex_packing.h"
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+
+namespace {
+const float kOctScale    = 65534.f;
+const float kOctDecode   = 2.f / 65534.f;
+const float kUnormScale  = 65535.f;
+const float kUnormDecode = 1.f / 65535.f;
+
+float signNotZero(float f)
+{
+  return f < 0.f ? -1.f : 1.f;
+}
+
+#if NV_SIMD_SSE2
+// The octahedron kernels are written once for SSE2 and AVX2 lanes
+struct Sse
+{
+  using F = __m128;
+  using I = __m128i;
+  enum
+  {
+    width = 4
+  };
+
+  static F set1(float f) { return _mm_set1_ps(f); }
+  static F add(F a, F b) { return _mm_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm_div_ps(a, b); }
+  static F max(F a, F b) { return _mm_max_ps(a, b); }
+  static F sqrt(F a) { return _mm_sqrt_ps(a); }
+  static F abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+  static F bitAnd(F a, F b) { return _mm_and_ps(a, b); }
+  static F lessThan(F a, F b) { return _mm_cmplt_ps(a, b); }
+  // a where the mask is set, b elsewhere
+  static F select(F mask, F a, F b)
+  {
+#if NV_SIMD_SSE41
+    return _mm_blendv_ps(b, a, mask);
+#else
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+#endif
+  }
+
+  static I truncate(F a) { return _mm_cvttps_epi32(a); }
+  static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+  static I pack(I low, I high) { return _mm_or_si128(low, _mm_slli_epi32(high, 16)); }
+  static I low16(I a) { return _mm_and_si128(a, _mm_set1_epi32(0xFFFF)); }
+  static I high16(I a) { return _mm_srli_epi32(a, 16); }
+  static I load(const uint32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+  static void store(uint32_t* p, I a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+
+  // 4 vec3 <-> x, y and z registers
+  static void load3(const nvmath::vec3f* p, F& x, F& y, F& z)
+  {
+    const float* f   = &p->x;
+    F            a0  = _mm_loadu_ps(f);      // x0 y0 z0 x1
+    F            a1  = _mm_loadu_ps(f + 4);  // y1 z1 x2 y2
+    F            a2  = _mm_loadu_ps(f + 8);  // z2 x3 y3 z3
+    F            x23 = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(0, 1, 0, 2));
+    F            y01 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(0, 0, 0, 1));
+    F            y23 = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(2, 2, 3, 3));
+    F            z01 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(1, 1, 2, 2));
+    F            z23 = _mm_shuffle_ps(a2, a2, _MM_SHUFFLE(3, 3, 0, 0));
+    x                = _mm_shuffle_ps(a0, x23, _MM_SHUFFLE(2, 0, 3, 0));
+    y                = _mm_shuffle_ps(y01, y23, _MM_SHUFFLE(2, 0, 2, 0));
+    z                = _mm_shuffle_ps(z01, z23, _MM_SHUFFLE(2, 0, 2, 0));
+  }
+  static void store3(nvmath::vec3f* p, F x, F y, F z)
+  {
+    float* f    = &p->x;
+    F      xy01 = _mm_unpacklo_ps(x, y);  // x0 y0 x1 y1
+    F      xy23 = _mm_unpackhi_ps(x, y);  // x2 y2 x3 y3
+    F      zx01 = _mm_shuffle_ps(z, xy01, _MM_SHUFFLE(2, 2, 0, 0));
+    F      yz1  = _mm_shuffle_ps(xy01, z, _MM_SHUFFLE(1, 1, 3, 3));
+    F      zx23 = _mm_shuffle_ps(z, xy23, _MM_SHUFFLE(2, 2, 2, 2));
+    F      yz3  = _mm_shuffle_ps(xy23, z, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(f, _mm_shuffle_ps(xy01, zx01, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(f + 4, _mm_shuffle_ps(yz1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(f + 8, _mm_shuffle_ps(zx23, yz3, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+};
+#endif
+
+#if NV_SIMD_AVX2
+struct Avx2
+{
+  using F = __m256;
+  using I = __m256i;
+  enum
+  {
+    width = 8
+  };
+
+  static F set1(float f) { return _mm256_set1_ps(f); }
+  static F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm256_div_ps(a, b); }
+  static F max(F a, F b) { return _mm256_max_ps(a, b); }
+  static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+  static F abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+  static F bitAnd(F a, F b) { return _mm256_and_ps(a, b); }
+  static F lessThan(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static F select(F mask, F a, F b) { return _mm256_blendv_ps(b, a, mask); }
+
+  static I truncate(F a) { return _mm256_cvttps_epi32(a); }
+  static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+  static I pack(I low, I high) { return _mm256_or_si256(low, _mm256_slli_epi32(high, 16)); }
+  static I low16(I a) { return _mm256_and_si256(a, _mm256_set1_epi32(0xFFFF)); }
+  static I high16(I a) { return _mm256_srli_epi32(a, 16); }
+  static I load(const uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+  static void store(uint32_t* p, I a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+
+  // Two SSE transpositions
+  static F combine(__m128 low, __m128 high) { return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1); }
+  static void load3(const nvmath::vec3f* p, F& x, F& y, F& z)
+  {
+    __m128 x0, y0, z0, x1, y1, z1;
+    Sse::load3(p, x0, y0, z0);
+    Sse::load3(p + 4, x1, y1, z1);
+    x = combine(x0, x1);
+    y = combine(y0, y1);
+    z = combine(z0, z1);
+  }
+  static void store3(nvmath::vec3f* p, F x, F y, F z)
+  {
+    Sse::store3(p, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+    Sse::store3(p + 4, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+  }
+};
+#endif
+
+#if NV_SIMD_SSE2
+// Same operations, in the same order, as octEncodeUnitVector. Returns the number of vectors encoded.
+template <class S>
+size_t octEncodeBatch(const nvmath::vec3f* vectors, size_t count, uint32_t* out)
+{
+  using F = typename S::F;
+  const F zero = S::set1(0.f), one = S::set1(1.f), minusOne = S::set1(-1.f), half = S::set1(0.5f);
+  const F scale = S::set1(kOctScale);
+
+  size_t i = 0;
+  for(; i + S::width <= count; i += S::width)
+  {
+    F x, y, z;
+    S::load3(vectors + i, x, y, z);
+    F sum = S::add(S::add(S::abs(x), S::abs(y)), S::abs(z));
+    F inv = S::bitAnd(S::lessThan(zero, sum), S::div(one, sum));
+    F px  = S::mul(x, inv);
+    F py  = S::mul(y, inv);
+
+    // Lower hemisphere: fold the triangles of the octahedron over
+    F foldX = S::mul(S::sub(one, S::abs(py)), S::select(S::lessThan(px, zero), minusOne, one));
+    F foldY = S::mul(S::sub(one, S::abs(px)), S::select(S::lessThan(py, zero), minusOne, one));
+    F lower = S::lessThan(z, zero);
+    px      = S::select(lower, foldX, px);
+    py      = S::select(lower, foldY, py);
+
+    F ux = S::mul(S::add(S::mul(px, half), half), scale);
+    F uy = S::mul(S::add(S::mul(py, half), half), scale);
+    S::store(out + i, S::pack(S::truncate(ux), S::truncate(uy)));
+  }
+  return i;
+}
+
+// Same operations, in the same order, as octDecodeUnitVector. Returns the number of vectors decoded.
+template <class S>
+size_t octDecodeBatch(const uint32_t* encoded, size_t count, nvmath::vec3f* out)
+{
+  using F = typename S::F;
+  const F zero = S::set1(0.f), one = S::set1(1.f), decode = S::set1(kOctDecode);
+
+  size_t i = 0;
+  for(; i + S::width <= count; i += S::width)
+  {
+    auto words = S::load(encoded + i);
+    F    px    = S::sub(S::mul(S::toFloat(S::low16(words)), decode), one);
+    F    py    = S::sub(S::mul(S::toFloat(S::high16(words)), decode), one);
+    F    z     = S::sub(S::sub(one, S::abs(px)), S::abs(py));
+
+    // Unfold the lower hemisphere
+    F t = S::max(S::sub(zero, z), zero);
+    F x = S::add(px, S::select(S::lessThan(px, zero), t, S::sub(zero, t)));
+    F y = S::add(py, S::select(S::lessThan(py, zero), t, S::sub(zero, t)));
+
+    F inv = S::div(one, S::sqrt(S::add(S::add(S::mul(x, x), S::mul(y, y)), S::mul(z, z))));
+    S::store3(out + i, S::mul(x, inv), S::mul(y, inv), S::mul(z, inv));
+  }
+  return i;
+}
+#endif
+}  // namespace
+
+uint32_t octEncodeUnitVector(const nvmath::vec3f& v)
+{
+  // Project the sphere onto the octahedron
+  float sum = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+  float inv = 0.f < sum ? 1.f / sum : 0.f;
+  float px  = v.x * inv;
+  float py  = v.y * inv;
+  if(v.z < 0.f)
+  {
+    float foldX = (1.f - std::abs(py)) * signNotZero(px);
+    float foldY = (1.f - std::abs(px)) * signNotZero(py);
+    px          = foldX;
+    py          = foldY;
+  }
+  float ux = (px * 0.5f + 0.5f) * kOctScale;
+  float uy = (py * 0.5f + 0.5f) * kOctScale;
+  return uint32_t(ux) | (uint32_t(uy) << 16);
+}
+
+nvmath::vec3f octDecodeUnitVector(uint32_t encoded)
+{
+  float px = float(encoded & 0xFFFF) * kOctDecode - 1.f;
+  float py = float(encoded >> 16) * kOctDecode - 1.f;
+  float z  = 1.f - std::abs(px) - std::abs(py);
+  float t  = std::max(0.f - z, 0.f);
+  float x  = px + (px < 0.f ? t : 0.f - t);
+  float y  = py + (py < 0.f ? t : 0.f - t);
+
+  float inv = 1.f / std::sqrt(x * x + y * y + z * z);
+  return nvmath::vec3f(x * inv, y * inv, z * inv);
+}
+
+uint32_t packUnorm2x16(const nvmath::vec2f& v)
+{
+  float u = std::min(std::max(v.x, 0.f), 1.f) * kUnormScale + 0.5f;
+  float w = std::min(std::max(v.y, 0.f), 1.f) * kUnormScale + 0.5f;
+  return uint32_t(u) | (uint32_t(w) << 16);
+}
+
+nvmath::vec2f unpackUnorm2x16(uint32_t packed)
+{
+  return nvmath::vec2f(float(packed & 0xFFFF) * kUnormDecode, float(packed >> 16) * kUnormDecode);
+}
+
+void octEncodeUnitVectors(const nvmath::vec3f* vectors, size_t count, uint32_t* out)
+{
+  size_t i = 0;
+#if NV_SIMD_AVX2
+  i = octEncodeBatch<Avx2>(vectors, count, out);
+#elif NV_SIMD_SSE2
+  i = octEncodeBatch<Sse>(vectors, count, out);
+#endif
+  for(; i < count; i++)
+    out[i] = octEncodeUnitVector(vectors[i]);
+}
+
+void octDecodeUnitVectors(const uint32_t* encoded, size_t count, nvmath::vec3f* out)
+{
+  size_t i = 0;
+#if NV_SIMD_AVX2
+  i = octDecodeBatch<Avx2>(encoded, count, out);
+#elif NV_SIMD_SSE2
+  i = octDecodeBatch<Sse>(encoded, count, out);
+#endif
+  for(; i < count; i++)
+    out[i] = octDecodeUnitVector(encoded[i]);
+}
+
+void packUnorm2x16(const nvmath::vec2f* values, size_t count, uint32_t* out)
+{
+  size_t i = 0;
+#if NV_SIMD_SSE2
+  // 4 vec2 at a time: 8 unorm16, packed with signed saturation around 32768
+  const float* f     = &values->x;
+  const __m128 zero  = _mm_setzero_ps();
+  const __m128 one   = _mm_set1_ps(1.f);
+  const __m128 scale = _mm_set1_ps(kUnormScale);
+  const __m128 round = _mm_set1_ps(0.5f);
+  const __m128i bias = _mm_set1_epi32(32768);
+  const __m128i sign = _mm_set1_epi16(-32768);
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128  a  = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(f + 2 * i), zero), one);
+    __m128  b  = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(f + 2 * i + 4), zero), one);
+    __m128i ia = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), round)), bias);
+    __m128i ib = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), round)), bias);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(_mm_packs_epi32(ia, ib), sign));
+  }
+#endif
+  for(; i < count; i++)
+    out[i] = packUnorm2x16(values[i]);
+}
+
+void unpackUnorm2x16(const uint32_t* packed, size_t count, nvmath::vec2f* out)
+{
+  size_t i = 0;
+#if NV_SIMD_SSE2
+  float*        f      = &out->x;
+  const __m128  decode = _mm_set1_ps(kUnormDecode);
+  const __m128i zero   = _mm_setzero_si128();
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + i));
+    _mm_storeu_ps(f + 2 * i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), decode));
+    _mm_storeu_ps(f + 2 * i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)), decode));
+  }
+#endif
+  for(; i < count; i++)
+    out[i] = unpackUnorm2x16(packed[i]);
+}
@@ -0,0 +1,29 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "nvmath/nvmath.h"
+
+// Compressed vertex attributes, one uint32 per value, low half first
+// - Unit vectors are octahedron encoded: the sphere is projected onto the octahedron,
+//   which is unfolded onto the [-1,1] square. Both coordinates are stored as 16-bit
+//   unsigned integers, (p * 0.5 + 0.5) * 65534, so that 0 is exact.
+// - Texture coordinates are clamped to [0,1] and stored as two unorm16.
+//
+// The batch versions work on whole attribute arrays (e.g. GltfScene::m_normals) and use
+// SSE2 or AVX2 when available, see simd.h. They give the same results as the scalar
+// functions as long as the compiler does not fuse the multiply-adds of the latter.
+
+uint32_t      octEncodeUnitVector(const nvmath::vec3f& v);
+nvmath::vec3f octDecodeUnitVector(uint32_t encoded);
+uint32_t      packUnorm2x16(const nvmath::vec2f& v);
+nvmath::vec2f unpackUnorm2x16(uint32_t packed);
+
+void octEncodeUnitVectors(const nvmath::vec3f* vectors, size_t count, uint32_t* out);
+void octDecodeUnitVectors(const uint32_t* encoded, size_t count, nvmath::vec3f* out);
+void packUnorm2x16(const nvmath::vec2f* values, size_t count, uint32_t* out);
+void unpackUnorm2x16(const uint32_t* packed, size_t count, nvmath::vec2f* out);
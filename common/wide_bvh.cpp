@@ -0,0 +1,338 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#include "wide_bvh.h"
+#include "simd.h"
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+using nvmath::vec3f;
+
+inline uint32_t lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return uint32_t(index);
+#else
+  return uint32_t(__builtin_ctz(mask));
+#endif
+}
+
+float boxArea(const BvhNode& node)
+{
+  vec3f d = node.bboxMax - node.bboxMin;
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+template <uint32_t N>
+WideBvhNode<N> emptyNode()
+{
+  WideBvhNode<N> node;
+  for(uint32_t i = 0; i < N; i++)
+  {
+    node.bboxMinX[i] = node.bboxMinY[i] = node.bboxMinZ[i] = FLT_MAX;
+    node.bboxMaxX[i] = node.bboxMaxY[i] = node.bboxMaxZ[i] = -FLT_MAX;
+    node.child[i]                                          = 0;
+    node.count[i]                                          = 0;
+  }
+  return node;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Slab tests of all children of a node
+// The planes of a node are 6 arrays of N floats starting at bboxMinX. The near and far planes
+// of each axis only depend on the sign of the direction, so they are picked once per ray as
+// offsets in these arrays.
+//
+struct TraversalRay
+{
+  vec3f    origin;
+  vec3f    invDirection;
+  uint32_t nearPlanes[3];  // Offsets from bboxMinX, in floats
+  uint32_t farPlanes[3];
+  float    tMin;
+
+  TraversalRay(const BvhRay& ray, uint32_t width)
+      : origin(ray.origin)
+      , invDirection(safeInverse(ray.direction))
+      , tMin(ray.tMin)
+  {
+    for(uint32_t axis = 0; axis < 3; axis++)
+    {
+      bool negative    = invDirection[axis] < 0.f;
+      nearPlanes[axis] = axis * width + (negative ? 3 * width : 0);
+      farPlanes[axis]  = axis * width + (negative ? 0 : 3 * width);
+    }
+  }
+};
+
+// Lanes [first, first + count) of the node, one at a time
+inline uint32_t slabTestScalar(const float* planes, const TraversalRay& ray, uint32_t first, uint32_t count, float tMax, float* tEnter)
+{
+  uint32_t mask = 0;
+  for(uint32_t i = first; i < first + count; i++)
+  {
+    float enter = ray.tMin;
+    float exit  = tMax;
+    for(int axis = 0; axis < 3; axis++)
+    {
+      enter = std::max(enter, (planes[ray.nearPlanes[axis] + i] - ray.origin[axis]) * ray.invDirection[axis]);
+      exit  = std::min(exit, (planes[ray.farPlanes[axis] + i] - ray.origin[axis]) * ray.invDirection[axis]);
+    }
+    tEnter[i] = enter;
+    if(enter <= exit * kBvhRobustExit)
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+#if NV_SIMD_SSE2
+// Lanes [first, first + 4)
+inline uint32_t slabTestSse(const float* planes, const TraversalRay& ray, uint32_t first, float tMax, float* tEnter)
+{
+  __m128 enter = _mm_set1_ps(ray.tMin);
+  __m128 exit  = _mm_set1_ps(tMax);
+  for(int axis = 0; axis < 3; axis++)
+  {
+    __m128 origin = _mm_set1_ps(ray.origin[axis]);
+    __m128 inv    = _mm_set1_ps(ray.invDirection[axis]);
+    __m128 tNear  = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(planes + ray.nearPlanes[axis] + first), origin), inv);
+    __m128 tFar   = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(planes + ray.farPlanes[axis] + first), origin), inv);
+    enter         = _mm_max_ps(enter, tNear);
+    exit          = _mm_min_ps(exit, tFar);
+  }
+  _mm_store_ps(tEnter + first, enter);
+  return uint32_t(_mm_movemask_ps(_mm_cmple_ps(enter, _mm_mul_ps(exit, _mm_set1_ps(kBvhRobustExit))))) << first;
+}
+#endif
+
+#if NV_SIMD_AVX2
+inline uint32_t slabTestAvx(const float* planes, const TraversalRay& ray, float tMax, float* tEnter)
+{
+  __m256 enter = _mm256_set1_ps(ray.tMin);
+  __m256 exit  = _mm256_set1_ps(tMax);
+  for(int axis = 0; axis < 3; axis++)
+  {
+    __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+    __m256 inv    = _mm256_set1_ps(ray.invDirection[axis]);
+    __m256 tNear  = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(planes + ray.nearPlanes[axis]), origin), inv);
+    __m256 tFar   = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(planes + ray.farPlanes[axis]), origin), inv);
+    enter         = _mm256_max_ps(enter, tNear);
+    exit          = _mm256_min_ps(exit, tFar);
+  }
+  _mm256_store_ps(tEnter, enter);
+  __m256 robustExit = _mm256_mul_ps(exit, _mm256_set1_ps(kBvhRobustExit));
+  return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(enter, robustExit, _CMP_LE_OQ)));
+}
+#endif
+
+// Mask of the children hit before tMax, with their entry distances
+template <uint32_t N>
+uint32_t slabTest(const WideBvhNode<N>& node, const TraversalRay& ray, float tMax, float* tEnter);
+
+template <>
+inline uint32_t slabTest<4>(const WideBvhNode<4>& node, const TraversalRay& ray, float tMax, float* tEnter)
+{
+#if NV_SIMD_SSE2
+  return slabTestSse(node.bboxMinX, ray, 0, tMax, tEnter);
+#else
+  return slabTestScalar(node.bboxMinX, ray, 0, 4, tMax, tEnter);
+#endif
+}
+
+template <>
+inline uint32_t slabTest<8>(const WideBvhNode<8>& node, const TraversalRay& ray, float tMax, float* tEnter)
+{
+#if NV_SIMD_AVX2
+  return slabTestAvx(node.bboxMinX, ray, tMax, tEnter);
+#elif NV_SIMD_SSE2
+  return slabTestSse(node.bboxMinX, ray, 0, tMax, tEnter) | slabTestSse(node.bboxMinX, ray, 4, tMax, tEnter);
+#else
+  return slabTestScalar(node.bboxMinX, ray, 0, 8, tMax, tEnter);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+// Ordered traversal: the children hit by the ray are sorted by entry distance, the closest one
+// is visited next and the others are pushed, farthest first. Entries farther than the closest
+// hit found since they were pushed are skipped when popped.
+//
+template <uint32_t N, bool anyHit>
+bool traverse(const WideBvh<N>& bvh, const BvhRay& ray, BvhHit& hit)
+{
+  if(bvh.empty())
+    return false;
+
+  struct Entry
+  {
+    uint32_t child;
+    uint32_t count;  // 0 for interior nodes
+    float    tEnter;
+  };
+  Entry         stack[kBvhMaxDepth * (N - 1)];
+  uint32_t      stackSize = 0;
+  TraversalRay  tray(ray, N);
+  WatertightRay wray(ray.direction);
+  float         tMax    = ray.tMax;
+  bool          found   = false;
+  Entry         current = {0, 0, ray.tMin};
+  while(true)
+  {
+    if(current.count == 0)
+    {
+      const WideBvhNode<N>& node = bvh.nodes[current.child];
+      alignas(32) float     tEnter[N];
+      uint32_t              mask = slabTest<N>(node, tray, tMax, tEnter);
+
+      Entry    hits[N];
+      uint32_t hitCount = 0;
+      for(; mask; mask &= mask - 1)
+      {
+        uint32_t i = lowestBit(mask);
+        Entry    entry{node.child[i], node.count[i], tEnter[i]};
+        // Insertion, farthest first
+        uint32_t k = hitCount++;
+        for(; k > 0 && hits[k - 1].tEnter < entry.tEnter; k--)
+          hits[k] = hits[k - 1];
+        hits[k] = entry;
+      }
+      if(hitCount > 0)
+      {
+        for(uint32_t k = 0; k + 1 < hitCount; k++)
+          stack[stackSize++] = hits[k];
+        current = hits[hitCount - 1];
+        continue;
+      }
+    }
+    else
+    {
+      for(uint32_t i = current.child; i < current.child + current.count; i++)
+      {
+        if(intersectTriangle(bvh.triangles[i], ray, wray, tMax, hit))
+        {
+          if(anyHit)
+            return true;
+          found = true;
+          tMax  = hit.t;
+        }
+      }
+    }
+
+    do
+    {
+      if(stackSize == 0)
+        return found;
+      current = stack[--stackSize];
+    } while(current.tEnter > tMax * kBvhRobustExit);
+  }
+}
+}  // namespace
+
+template <uint32_t N>
+WideBvh<N> collapseBvh(const TriangleBvh& source)
+{
+  WideBvh<N> wide;
+  wide.triangles     = source.triangles;
+  const auto& binary = source.bvh.nodes;
+  if(binary.empty())
+    return wide;
+
+  // Wide node to fill and binary node it replaces
+  std::vector<std::pair<uint32_t, uint32_t>> stack{{0, 0}};
+  wide.nodes.resize(1);
+  while(!stack.empty())
+  {
+    auto [wideIndex, binaryIndex] = stack.back();
+    stack.pop_back();
+
+    // Children of the binary node, the interior child with the largest surface being
+    // replaced by its own two children until there are N of them
+    uint32_t children[N];
+    uint32_t childCount = 0;
+    if(binary[binaryIndex].isLeaf())
+    {
+      children[childCount++] = binaryIndex;
+    }
+    else
+    {
+      children[childCount++] = binary[binaryIndex].offset;
+      children[childCount++] = binary[binaryIndex].offset + 1;
+    }
+    while(childCount < N)
+    {
+      int   largest     = -1;
+      float largestArea = -1.f;
+      for(uint32_t i = 0; i < childCount; i++)
+      {
+        const BvhNode& child = binary[children[i]];
+        if(!child.isLeaf() && boxArea(child) > largestArea)
+        {
+          largest     = int(i);
+          largestArea = boxArea(child);
+        }
+      }
+      if(largest < 0)
+        break;
+      uint32_t opened        = children[largest];
+      children[largest]      = binary[opened].offset;
+      children[childCount++] = binary[opened].offset + 1;
+    }
+
+    WideBvhNode<N> node = emptyNode<N>();
+    for(uint32_t i = 0; i < childCount; i++)
+    {
+      const BvhNode& child = binary[children[i]];
+      node.bboxMinX[i]     = child.bboxMin.x;
+      node.bboxMinY[i]     = child.bboxMin.y;
+      node.bboxMinZ[i]     = child.bboxMin.z;
+      node.bboxMaxX[i]     = child.bboxMax.x;
+      node.bboxMaxY[i]     = child.bboxMax.y;
+      node.bboxMaxZ[i]     = child.bboxMax.z;
+      if(child.isLeaf())
+      {
+        node.child[i] = child.offset;
+        node.count[i] = child.count;
+      }
+      else
+      {
+        node.child[i] = uint32_t(wide.nodes.size());
+        wide.nodes.emplace_back();
+        stack.push_back({node.child[i], children[i]});
+      }
+    }
+    wide.nodes[wideIndex] = node;
+  }
+  return wide;
+}
+
+template Bvh4 collapseBvh<4>(const TriangleBvh& source);
+template Bvh8 collapseBvh<8>(const TriangleBvh& source);
+
+bool intersectClosest(const Bvh4& bvh, const BvhRay& ray, BvhHit& hit)
+{
+  hit = BvhHit();
+  return traverse<4, false>(bvh, ray, hit);
+}
+
+bool intersectClosest(const Bvh8& bvh, const BvhRay& ray, BvhHit& hit)
+{
+  hit = BvhHit();
+  return traverse<8, false>(bvh, ray, hit);
+}
+
+bool intersectAny(const Bvh4& bvh, const BvhRay& ray)
+{
+  BvhHit hit;
+  return traverse<4, true>(bvh, ray, hit);
+}
+
+bool intersectAny(const Bvh8& bvh, const BvhRay& ray)
+{
+  BvhHit hit;
+  return traverse<8, true>(bvh, ray, hit);
+}
@@ -0,0 +1,51 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+#pragma once
+#include "bvh.h"
+
+// Wide hierarchies: 4 or 8 children per node, collapsed from a binary TriangleBvh.
+// Each node stores the boxes of its children as arrays of planes (SoA), so one slab test
+// covers all children in SSE (4-wide) or AVX2 (8-wide) registers; builds without AVX2 test
+// 8-wide nodes as two halves, builds without SSE2 one child at a time (see simd.h).
+// Collapsing pulls in the children of the interior child with the largest surface until the
+// node is full, which keeps the SAH cost of the binary tree.
+
+template <uint32_t N>
+struct alignas(64) WideBvhNode
+{
+  // Empty slots have an inverted box, which no slab test can hit
+  float bboxMinX[N];
+  float bboxMinY[N];
+  float bboxMinZ[N];
+  float bboxMaxX[N];
+  float bboxMaxY[N];
+  float bboxMaxZ[N];
+  // Interior child: index in WideBvh::nodes, count 0. Leaf child: first triangle in
+  // WideBvh::triangles and number of triangles.
+  uint32_t child[N];
+  uint32_t count[N];
+};
+static_assert(sizeof(WideBvhNode<4>) == 128 && sizeof(WideBvhNode<8>) == 256, "Nodes cover whole cache lines");
+
+template <uint32_t N>
+struct WideBvh
+{
+  std::vector<WideBvhNode<N>, AlignedAllocator<WideBvhNode<N>, 64>> nodes;  // Root at 0
+  std::vector<BvhTriangle>                                           triangles;
+
+  bool empty() const { return nodes.empty(); }
+};
+
+using Bvh4 = WideBvh<4>;
+using Bvh8 = WideBvh<8>;
+
+template <uint32_t N>
+WideBvh<N> collapseBvh(const TriangleBvh& bvh);
+
+// Same contracts as the binary versions in bvh.h
+bool intersectClosest(const Bvh4& bvh, const BvhRay& ray, BvhHit& hit);
+bool intersectClosest(const Bvh8& bvh, const BvhRay& ray, BvhHit& hit);
+bool intersectAny(const Bvh4& bvh, const BvhRay& ray);
+bool intersectAny(const Bvh8& bvh, const BvhRay& ray);
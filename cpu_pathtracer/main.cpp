@@ -0,0 +1,377 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+// Headless reference renderer of the glTF sample: loads a scene like RenderScene, traces it with
+// CpuPathTracer (the CPU port of shaders/pathtrace.*) and writes the average of the samples to a
+// PFM image, for comparison with the accumulated output of the GPU path tracer.
+// The samples are rendered in progressive passes of --pass-spp samples over tiles of --tile pixels
+// (see tile_scheduler.h). --scaling renders the image with 1, 2, 4... 64 threads instead and
+// reports the speedup and efficiency of each. Only the rows up to the number of hardware threads
+// measure scaling; the others are marked as oversubscribed.
+// --wavefront renders with CpuWavefrontTracer instead, --compare renders with both integrators and
+// reports their throughput and the largest difference of their images, which should be 0.
+// --sampler selects the random numbers of the paths (sampler.h). --convergence renders the image
+// with each sampler at 1, 2, 4... --spp samples and reports their RMSE against a Sobol reference of
+// --reference-spp samples, rendered with other scrambles than the ones measured.
+//
+// Usage: cpu_pathtracer <scene.gltf|scene.glb> [--out <image.pfm>] [--size <width>x<height>] [--spp <count>]
+//          [--eye x,y,z] [--center x,y,z] [--up x,y,z] [--fov <degrees>] [--bounces <count>]
+//          [--first-bounce <index>] [--flags <renderFlags>] [--sky <intensity>] [--sun <intensity>]
+//          [--light x,y,z] [--focal <distance>] [--lens <radius>] [--threads <count>]
+//          [--tile <size>] [--pass-spp <count>] [--scaling] [--wavefront] [--compare]
+//          [--sampler random|sobol|bluenoise] [--convergence] [--reference-spp <count>]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The samples define these in their main file
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include "CpuPathTracer.h"
+#include "CpuProgressiveRenderer.h"
+#include "CpuWavefrontTracer.h"
+#include "SceneData.h"
+
+namespace {
+using nvmath::vec3f;
+
+bool parseVec3(const char* text, vec3f& v)
+{
+  return sscanf(text, "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+void printUsage()
+{
+  fprintf(stderr,
+          "Usage: cpu_pathtracer <scene.gltf|scene.glb> [--out <image.pfm>] [--size <width>x<height>] [--spp <count>]\n"
+          "         [--eye x,y,z] [--center x,y,z] [--up x,y,z] [--fov <degrees>] [--bounces <count>]\n"
+          "         [--first-bounce <index>] [--flags <renderFlags>] [--sky <intensity>] [--sun <intensity>]\n"
+          "         [--light x,y,z] [--focal <distance>] [--lens <radius>] [--threads <count>]\n"
+          "         [--tile <size>] [--pass-spp <count>] [--scaling] [--wavefront] [--compare]\n"
+          "         [--sampler random|sobol|bluenoise] [--convergence] [--reference-spp <count>]\n");
+}
+
+const char* kSamplerNames[3] = {"random", "sobol", "bluenoise"};
+
+bool parseSampler(const char* text, int& sampler)
+{
+  for(int k = 0; k < 3; k++)
+  {
+    if(!strcmp(text, kSamplerNames[k]))
+    {
+      sampler = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+void printScaling(const CpuIntegrator&     tracer,
+                  const Eye&               camera,
+                  uint32_t                 width,
+                  uint32_t                 height,
+                  uint32_t                 spp,
+                  uint32_t                 tileSize,
+                  const PathTraceSettings& settings)
+{
+  TileScheduler scheduler;
+  scheduler.resize(width, height, tileSize);
+  std::vector<vec3f> image;
+  // Measures the tile costs, that the runs below balance
+  tracer.renderPass(camera, width, height, 0, spp, settings, image, scheduler, getWorkerCount());
+
+  uint32_t hardwareThreads = getWorkerCount();
+  printf("%u hardware threads, %zu tiles of %u pixels\n", hardwareThreads, scheduler.tiles().size(), tileSize);
+  printf("%7s %10s %8s %10s %8s %7s\n", "Threads", "Time (ms)", "Speedup", "Efficiency", "Busy", "Steals");
+  double reference = 0.0;
+  for(uint32_t threads = 1; threads <= 64; threads *= 2)
+  {
+    tracer.renderPass(camera, width, height, 0, spp, settings, image, scheduler, threads);
+    const TileRunStats& run = scheduler.lastRun();
+    if(threads == 1)
+      reference = run.seconds;
+    double speedup = reference / run.seconds;
+    printf("%7u %10.1f %8.2f %9.1f%% %7.1f%% %7u%s\n", threads, run.seconds * 1000.0, speedup,
+           100.0 * speedup / threads, 100.f * run.efficiency(), run.steals,
+           threads > hardwareThreads ? "  oversubscribed" : "");
+  }
+  if(hardwareThreads < 64)
+    printf("Oversubscribed: more threads than hardware threads, the row shows the overhead of the scheduler, "
+           "not its scaling\n");
+}
+
+void printComparison(const CpuPathTracer&      megakernel,
+                     const CpuWavefrontTracer& wavefront,
+                     const Eye&                camera,
+                     uint32_t                  width,
+                     uint32_t                  height,
+                     uint32_t                  spp,
+                     uint32_t                  tileSize,
+                     uint32_t                  threads,
+                     const PathTraceSettings&  settings)
+{
+  TileScheduler scheduler;
+  scheduler.resize(width, height, tileSize);
+  threads = threads ? threads : getWorkerCount();
+
+  std::vector<vec3f> images[2];
+  double             seconds[2];
+  const char*        names[2] = {"megakernel", "wavefront"};
+  for(int k = 0; k < 2; k++)
+  {
+    const CpuIntegrator& integrator = k == 0 ? static_cast<const CpuIntegrator&>(megakernel) : wavefront;
+    // The first pass measures the tile costs, the second one is balanced and timed
+    integrator.renderPass(camera, width, height, 0, 1, settings, images[k], scheduler, threads);
+    integrator.renderPass(camera, width, height, 0, spp, settings, images[k], scheduler, threads);
+    seconds[k] = scheduler.lastRun().seconds;
+  }
+
+  // Both trace the same rays
+  CpuWavefrontTracer::Stats stats   = wavefront.lastPass();
+  double                    samples = double(width) * height * spp;
+  uint64_t                  rays    = stats.extensionRays + stats.shadowRays;
+  printf("%zu paths, %zu extension rays, %zu shadow rays, %u threads\n", size_t(stats.paths),
+         size_t(stats.extensionRays), size_t(stats.shadowRays), threads);
+  printf("%10s %10s %12s %10s\n", "Integrator", "Time (ms)", "Msamples/s", "Mrays/s");
+  for(int k = 0; k < 2; k++)
+    printf("%10s %10.1f %12.3f %10.3f\n", names[k], seconds[k] * 1000.0, samples / seconds[k] * 1e-6,
+           double(rays) / seconds[k] * 1e-6);
+
+  double stageTotal = stats.generateSeconds + stats.extendSeconds + stats.sortSeconds + stats.shadeSeconds + stats.connectSeconds;
+  if(stageTotal > 0.0)
+    printf("Wavefront stages: generate %.1f%%, extend %.1f%%, sort %.1f%%, shade %.1f%%, connect %.1f%%\n",
+           100.0 * stats.generateSeconds / stageTotal, 100.0 * stats.extendSeconds / stageTotal,
+           100.0 * stats.sortSeconds / stageTotal, 100.0 * stats.shadeSeconds / stageTotal,
+           100.0 * stats.connectSeconds / stageTotal);
+
+  float maxDifference = 0.f;
+  for(size_t i = 0; i < images[0].size(); i++)
+  {
+    vec3f d       = images[0][i] - images[1][i];
+    maxDifference = std::max(maxDifference, std::max(std::fabs(d.x), std::max(std::fabs(d.y), std::fabs(d.z))));
+  }
+  printf("Largest difference of the images: %g\n", maxDifference);
+}
+
+float rmse(const std::vector<vec3f>& image, const std::vector<vec3f>& reference)
+{
+  double sum = 0.0;
+  for(size_t i = 0; i < image.size(); i++)
+  {
+    vec3f d = image[i] - reference[i];
+    sum += double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z;
+  }
+  return float(std::sqrt(sum / (3.0 * double(image.size()))));
+}
+
+void printConvergence(const CpuIntegrator&     integrator,
+                      const CpuIntegrator&     reference,
+                      const Eye&               camera,
+                      uint32_t                 width,
+                      uint32_t                 height,
+                      uint32_t                 spp,
+                      uint32_t                 referenceSpp,
+                      uint32_t                 threads,
+                      const PathTraceSettings& settings)
+{
+  std::vector<vec3f> referenceImage;
+  PathTraceSettings  referenceSettings = settings;
+  referenceSettings.samplerType        = kSamplerSobol;
+  reference.render(camera, width, height, referenceSpp, referenceSettings, referenceImage, threads);
+
+  // Each pass doubles the samples of the image: 1, 2, 4... spp
+  std::vector<uint32_t> counts;
+  for(uint32_t count = 1; count <= spp; count *= 2)
+    counts.push_back(count);
+  std::vector<float> errors[3];
+  TileScheduler      scheduler;
+  scheduler.resize(width, height, 32);
+  for(int k = 0; k < 3; k++)
+  {
+    PathTraceSettings samplerSettings = settings;
+    samplerSettings.samplerType       = k;
+    std::vector<vec3f> image;
+    for(uint32_t count : counts)
+    {
+      uint32_t first = count / 2;
+      integrator.renderPass(camera, width, height, first, count - first, samplerSettings, image, scheduler, threads);
+      errors[k].push_back(rmse(image, referenceImage));
+    }
+  }
+
+  printf("RMSE against a Sobol reference of %u spp\n", referenceSpp);
+  printf("%6s %12s %12s %12s\n", "spp", kSamplerNames[0], kSamplerNames[1], kSamplerNames[2]);
+  for(size_t i = 0; i < counts.size(); i++)
+    printf("%6u %12.6f %12.6f %12.6f\n", counts[i], errors[0][i], errors[1][i], errors[2][i]);
+
+  // Samples each one needs for the error of random at the most samples, interpolated in log-log
+  float target = errors[kSamplerRandom].back();
+  for(int k = 1; k < 3; k++)
+  {
+    size_t i = 0;
+    while(i < counts.size() && errors[k][i] > target)
+      i++;
+    if(i == counts.size())
+    {
+      printf("%s: the error of random at %u spp is not reached\n", kSamplerNames[k], counts.back());
+      continue;
+    }
+    double needed = counts[i];
+    if(i > 0)
+    {
+      double t = std::log(errors[k][i - 1] / target) / std::log(errors[k][i - 1] / errors[k][i]);
+      needed   = counts[i - 1] * std::pow(2.0, t);
+    }
+    printf("%s: error of random at %u spp reached at %.1f spp (%.2fx fewer samples)\n", kSamplerNames[k],
+           counts.back(), needed, counts.back() / needed);
+  }
+}
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// Application Entry
+//
+int main(int argc, char** argv)
+{
+  std::string       filename, outFilename = "cpu_pathtracer.pfm";
+  uint32_t          width = 1280, height = 720, spp = 64, threads = 0;
+  uint32_t          tileSize = 32, passSpp = 0, referenceSpp = 0;
+  bool              scaling = false, useWavefront = false, compare = false, convergence = false;
+  vec3f             eye(0.f, 0.f, 15.f), center(0.f), up(0.f, 1.f, 0.f);
+  vec3f             light(0.f, 4.5f, 0.f);  // Default light of the sample, normalized below
+  float             fov = 60.f;
+  PathTraceSettings settings;
+  bool              valid = true;
+  for(int i = 1; i < argc && valid; i++)
+  {
+    bool hasValue = i + 1 < argc;
+    if(!strcmp(argv[i], "--out") && hasValue)
+      outFilename = argv[++i];
+    else if(!strcmp(argv[i], "--size") && hasValue)
+      valid = sscanf(argv[++i], "%ux%u", &width, &height) == 2 && width > 0 && height > 0;
+    else if(!strcmp(argv[i], "--spp") && hasValue)
+      spp = uint32_t(std::max(1, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--eye") && hasValue)
+      valid = parseVec3(argv[++i], eye);
+    else if(!strcmp(argv[i], "--center") && hasValue)
+      valid = parseVec3(argv[++i], center);
+    else if(!strcmp(argv[i], "--up") && hasValue)
+      valid = parseVec3(argv[++i], up);
+    else if(!strcmp(argv[i], "--fov") && hasValue)
+      fov = float(atof(argv[++i]));
+    else if(!strcmp(argv[i], "--bounces") && hasValue)
+      settings.maxBounces = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--first-bounce") && hasValue)
+      settings.firstBounce = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--flags") && hasValue)
+      settings.renderFlags = int(strtol(argv[++i], nullptr, 0));
+    else if(!strcmp(argv[i], "--sky") && hasValue)
+      settings.skyIntensity = float(atof(argv[++i]));
+    else if(!strcmp(argv[i], "--sun") && hasValue)
+      settings.sunIntensity = float(atof(argv[++i]));
+    else if(!strcmp(argv[i], "--light") && hasValue)
+      valid = parseVec3(argv[++i], light);
+    else if(!strcmp(argv[i], "--focal") && hasValue)
+      settings.focalDistance = float(atof(argv[++i]));
+    else if(!strcmp(argv[i], "--lens") && hasValue)
+      settings.lensRadius = float(atof(argv[++i]));
+    else if(!strcmp(argv[i], "--threads") && hasValue)
+      threads = uint32_t(std::max(0, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--tile") && hasValue)
+      tileSize = uint32_t(std::max(1, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--pass-spp") && hasValue)
+      passSpp = uint32_t(std::max(1, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--scaling"))
+      scaling = true;
+    else if(!strcmp(argv[i], "--wavefront"))
+      useWavefront = true;
+    else if(!strcmp(argv[i], "--compare"))
+      compare = true;
+    else if(!strcmp(argv[i], "--sampler") && hasValue)
+      valid = parseSampler(argv[++i], settings.samplerType);
+    else if(!strcmp(argv[i], "--convergence"))
+      convergence = true;
+    else if(!strcmp(argv[i], "--reference-spp") && hasValue)
+      referenceSpp = uint32_t(std::max(1, atoi(argv[++i])));
+    else if(argv[i][0] != '-' && filename.empty())
+      filename = argv[i];
+    else
+      valid = false;
+  }
+  if(!valid || filename.empty())
+  {
+    printUsage();
+    return -1;
+  }
+  settings.lightPosition = nvmath::normalize(light);
+
+  auto      loadStart = std::chrono::high_resolution_clock::now();
+  SceneData scene;
+  if(!scene.loadGltf(filename))
+  {
+    fprintf(stderr, "Could not load %s\n", filename.c_str());
+    return -1;
+  }
+  CpuPathTracer        tracer(scene);
+  CpuWavefrontTracer   wavefront(tracer);
+  const CpuIntegrator& integrator = useWavefront ? static_cast<const CpuIntegrator&>(wavefront) : tracer;
+  auto                 renderStart = std::chrono::high_resolution_clock::now();
+
+  // Same camera as the sample: perspectiveVK flips y, the first row of the image is the top one
+  Eye camera;
+  camera.worldFromView = nvmath::invert(nvmath::look_at(eye, center, up));
+  camera.projection    = nvmath::perspectiveVK(fov, float(width) / float(height), 0.1f, 1000.0f);
+
+  auto ms = [](auto start, auto end) { return std::chrono::duration<double, std::milli>(end - start).count(); };
+  printf("%zu triangles loaded in %.1f ms\n", scene.m_numTriangles, ms(loadStart, renderStart));
+  if(compare)
+  {
+    printComparison(tracer, wavefront, camera, width, height, spp, tileSize, threads, settings);
+    return 0;
+  }
+  if(convergence)
+  {
+    CpuPathTracer reference(scene, 1);
+    printConvergence(integrator, reference, camera, width, height, spp, referenceSpp ? referenceSpp : 16 * spp, threads, settings);
+    return 0;
+  }
+  if(scaling)
+  {
+    printScaling(integrator, camera, width, height, spp, tileSize, settings);
+    return 0;
+  }
+
+  std::vector<vec3f> image;
+  {
+    CpuProgressiveRenderer renderer(integrator, width, height, passSpp ? passSpp : spp, spp, tileSize, threads);
+    renderer.updateFrame(camera, settings);
+    for(uint32_t target = passSpp ? passSpp : spp;; target += passSpp)
+    {
+      uint32_t     samples = renderer.waitForSamples(target);
+      TileRunStats pass    = renderer.lastPass();
+      printf("%4u spp: pass of %.1f ms on %u threads, %.1f%% busy, %u steals\n", samples, pass.seconds * 1000.0,
+             pass.threadCount, 100.f * pass.efficiency(), pass.steals);
+      if(samples >= spp)
+        break;
+    }
+    renderer.getImage(image);
+  }
+  auto renderEnd = std::chrono::high_resolution_clock::now();
+  printf("%ux%u at %u spp rendered in %.1f ms\n", width, height, spp, ms(renderStart, renderEnd));
+
+  if(!writePfm(outFilename, image, width, height))
+  {
+    fprintf(stderr, "Could not write %s\n", outFilename.c_str());
+    return -1;
+  }
+  return 0;
+}
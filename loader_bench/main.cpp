@@ -0,0 +1,958 @@
+/******************************************************************************
+ * Copyright 1998-2018 NVIDIA Corp. All Rights Reserved.
+ *****************************************************************************/
+
+// Timings of the scene loaders and of the processing the samples run at load time, each
+// checked against its reference implementation. Returns non-zero when a check fails.
+// - obj: parses an OBJ file with tinyobjloader and with the parallel parser of ObjLoader (see
+//   ObjParser), compares their outputs and reports the parse times. --synthetic first writes a
+//   grid of the given number of triangles to the file.
+// - packing: round trip of random normals and uvs through the encoders of vertex_packing.h,
+//   with the largest errors, and the batch encoders and decoders against the scalar ones, which
+//   they must match bit for bit. Then the timings of both, unless --check is given.
+// - tangents: tangent_space.h on sphere patches, half of them with mirrored uvs. eAccumulate must
+//   match the former RenderScene::generateTangentSpace bit for bit and eMikkTSpace must follow the
+//   analytic tangents, on one thread and on --threads (all by default) alike. Then the timings of
+//   all three, unless --check is given.
+// - meshlets: meshlet_builder.h on a sphere, with the triangles in mesh order and shuffled. Every
+//   triangle must come out once, within the limits and the bounds of its meshlet, and no meshlet
+//   may be culled by meshletBackfacing while one of its triangles faces the camera, from random
+//   viewpoints. Then the statistics and the build times, unless --check is given.
+// - textures: the images of a folder (media/textures by default) decoded one after the other with
+//   stbi_load, as the samples did before texture_baker.h, then through bakeTextures: decoded and
+//   baked on all threads into a cache, then loaded from that cache. The images are copied to a
+//   temporary folder first, so that the caches are not written next to the originals.
+//
+// Usage: loader_bench obj <scene.obj> [--synthetic <triangles>] [--repeat <count>]
+//        loader_bench packing [--count <values>] [--repeat <count>] [--check]
+//        loader_bench tangents [--patches <count>] [--resolution <quads>] [--threads <count>] [--repeat <count>] [--check]
+//        loader_bench meshlets [--triangles <count>] [--viewpoints <count>] [--repeat <count>] [--check]
+//        loader_bench textures [<folder>] [--compression none|bc1|bc3|bc7] [--repeat <count>]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+// The samples define it in their main file, common/texture_loader.cpp needs it
+#define STB_IMAGE_IMPLEMENTATION
+#include "fileformats/stb_image.h"
+
+#include "mapped_file.h"
+#include "meshlet_builder.h"
+#include "obj_loader.h"
+#include "parallel.h"
+#include "tangent_space.h"
+#include "texture_baker.h"
+#include "vertex_packing.h"
+
+namespace {
+using nvmath::vec3f;
+
+using Clock = std::chrono::high_resolution_clock;
+
+double elapsedMs(Clock::time_point startTime)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+}
+
+// Best time of `repeat` runs of fn(), which is given the index of the run
+template <class Fn>
+double bestTimeMs(uint32_t repeat, Fn&& fn)
+{
+  double best = 0.0;
+  for(uint32_t i = 0; i < repeat; i++)
+  {
+    auto   startTime = Clock::now();
+    fn(i);
+    double ms        = elapsedMs(startTime);
+    best             = i == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+void printUsage()
+{
+  fprintf(stderr,
+          "Usage: loader_bench obj <scene.obj> [--synthetic <triangles>] [--repeat <count>]\n"
+          "       loader_bench packing [--count <values>] [--repeat <count>] [--check]\n"
+          "       loader_bench tangents [--patches <count>] [--resolution <quads>] [--threads <count>] [--repeat <count>] [--check]\n"
+          "       loader_bench meshlets [--triangles <count>] [--viewpoints <count>] [--repeat <count>] [--check]\n"
+          "       loader_bench textures [<folder>] [--compression none|bc1|bc3|bc7] [--repeat <count>]\n");
+}
+
+//--------------------------------------------------------------------------------------------------
+// obj
+//
+
+// Square grid of at least `triangles` triangles over a gentle height field, with normals and
+// uvs, in groups of 256 rows. Positions, normals and uvs share their indices.
+bool writeSyntheticObj(const std::string& filename, size_t triangles)
+{
+  FILE* file = fopen(filename.c_str(), "w");
+  if(!file)
+    return false;
+
+  size_t cells = std::max<size_t>(1, size_t(std::ceil(std::sqrt(double(triangles) / 2.0))));
+  size_t side  = cells + 1;
+  fprintf(file, "# %zu x %zu grid, %zu triangles\n", cells, cells, 2 * cells * cells);
+  for(size_t y = 0; y < side; y++)
+  {
+    for(size_t x = 0; x < side; x++)
+    {
+      float u = float(x) / float(cells), v = float(y) / float(cells);
+      float h = 0.05f * std::sin(12.f * u) * std::cos(9.f * v);
+      // Normal of the height field h(u, v)
+      vec3f n = nvmath::normalize(vec3f(-0.6f * std::cos(12.f * u) * std::cos(9.f * v),
+                                        0.45f * std::sin(12.f * u) * std::sin(9.f * v), 1.f));
+      fprintf(file, "v %.6f %.6f %.6f\nvn %.5f %.5f %.5f\nvt %.6f %.6f\n", u, v, h, n.x, n.y, n.z, u, v);
+    }
+  }
+  for(size_t y = 0; y < cells; y++)
+  {
+    if(y % 256 == 0)
+      fprintf(file, "g rows%zu\n", y);
+    for(size_t x = 0; x < cells; x++)
+    {
+      size_t a = y * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+      fprintf(file, "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\nf %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n", a, a, a, b, b,
+              b, d, d, d, a, a, a, d, d, d, c, c, c);
+    }
+  }
+  return fclose(file) == 0;
+}
+
+bool sameOutputs(const ObjLoader& a, const ObjLoader& b)
+{
+  return a.m_vertices.size() == b.m_vertices.size() && a.m_indices == b.m_indices && a.m_matIndx == b.m_matIndx
+         && a.m_materials.size() == b.m_materials.size() && a.m_textures == b.m_textures
+         && memcmp(a.m_vertices.data(), b.m_vertices.data(), a.m_vertices.size() * sizeof(VertexObj)) == 0;
+}
+
+int benchObj(int argc, char** argv)
+{
+  std::string filename;
+  size_t      synthetic = 0;
+  uint32_t    repeat    = 3;
+  for(int i = 0; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--synthetic") && i + 1 < argc)
+      synthetic = size_t(atoll(argv[++i]));
+    else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = std::max(1, atoi(argv[++i]));
+    else if(argv[i][0] != '-' && filename.empty())
+      filename = argv[i];
+    else
+    {
+      printUsage();
+      return -1;
+    }
+  }
+  if(filename.empty())
+  {
+    printUsage();
+    return -1;
+  }
+
+  if(synthetic > 0)
+  {
+    auto startTime = Clock::now();
+    if(!writeSyntheticObj(filename, synthetic))
+    {
+      fprintf(stderr, "Could not write %s\n", filename.c_str());
+      return -1;
+    }
+    printf("Wrote %s in %.0f ms\n", filename.c_str(), elapsedMs(startTime));
+  }
+  size_t fileSize = MappedFile(filename).size();
+  if(fileSize == 0)
+  {
+    fprintf(stderr, "Could not read %s\n", filename.c_str());
+    return -1;
+  }
+
+  // The loaders append to their outputs: a fresh one per run, the last one kept for the check
+  ObjLoader reference, parallel;
+  double    tinyObjMs = bestTimeMs(repeat, [&](uint32_t) {
+    reference = ObjLoader();
+    reference.loadModel(filename, ObjParser::eTinyObj);
+  });
+  double    parallelMs = bestTimeMs(repeat, [&](uint32_t) {
+    parallel = ObjLoader();
+    parallel.loadModel(filename, ObjParser::eParallel);
+  });
+
+  double megabytes = double(fileSize) / (1024.0 * 1024.0);
+  printf("%s: %.1f MB, %zu triangles, best of %u\n", filename.c_str(), megabytes, parallel.m_indices.size() / 3, repeat);
+  printf("  tinyobj   %9.1f ms %8.1f MB/s\n", tinyObjMs, megabytes * 1000.0 / tinyObjMs);
+  printf("  parallel  %9.1f ms %8.1f MB/s  %.2fx on %u threads\n", parallelMs, megabytes * 1000.0 / parallelMs,
+         tinyObjMs / parallelMs, getWorkerCount());
+
+  bool same = sameOutputs(reference, parallel);
+  printf("  outputs %s\n", same ? "identical" : "DIFFER");
+  return same ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// packing
+//
+
+// Largest errors accepted by the round trip. The octahedron coordinates are truncated to steps of
+// 2 / 65534, which moves a direction by up to 0.0074 degrees where the projection stretches them
+// the most; uvs are rounded to the nearest of 65535 steps.
+const float kMaxNormalErrorDegrees = 0.01f;
+const float kMaxUvError            = 0.5f / 65535.f + 1e-7f;
+
+// When the target has FMA the compiler may fuse the multiply-adds of the scalar functions, which
+// then round differently from the batch ones (see vertex_packing.h): encoded values may move by
+// one step and decoded ones by the last bits.
+#ifdef __FP_FAST_FMAF
+const bool kFusedMultiplyAdd = true;
+#else
+const bool kFusedMultiplyAdd = false;
+#endif
+const uint32_t kMaxFusedEncodeSteps   = 1;
+const float    kMaxFusedDecodeDifference = 1e-6f;
+
+// Random unit vectors, led by the ones on the edges of the octahedron
+std::vector<vec3f> testNormals(size_t count, std::mt19937& rng)
+{
+  std::vector<vec3f> normals = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},   {0, -1, 0},
+                                {0, 0, 1},  {0, 0, -1}, {0.f, -0.f, -1.f}, {-0.f, 0.f, -1.f}};
+  for(int i = 0; i < 8; i++)
+    normals.push_back(nvmath::normalize(vec3f(i & 1 ? -1.f : 1.f, i & 2 ? -1.f : 1.f, i & 4 ? -1.f : 1.f)));
+  std::normal_distribution<float> gaussian;
+  while(normals.size() < count)
+  {
+    vec3f v(gaussian(rng), gaussian(rng), gaussian(rng));
+    float length = nvmath::length(v);
+    if(length > 1e-6f)
+      normals.push_back(v / length);
+  }
+  normals.resize(count);
+  return normals;
+}
+
+// Random uvs, some of them out of [0, 1] to go through the clamp
+std::vector<nvmath::vec2f> testUvs(size_t count, std::mt19937& rng)
+{
+  std::vector<nvmath::vec2f>            uvs = {{0.f, 0.f}, {1.f, 1.f}, {-0.5f, 2.f}, {0.5f, -0.f}};
+  std::uniform_real_distribution<float> uniform(-0.1f, 1.1f);
+  while(uvs.size() < count)
+    uvs.emplace_back(uniform(rng), uniform(rng));
+  uvs.resize(count);
+  return uvs;
+}
+
+float angleDegrees(const vec3f& a, const vec3f& b)
+{
+  // atan2 keeps its precision for tiny angles, unlike acos of the dot product
+  return std::atan2(nvmath::length(nvmath::cross(a, b)), nvmath::dot(a, b)) * 57.29578f;
+}
+
+// Values of a and b that differ, and the largest difference of their 16-bit halves
+size_t compareEncoded(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, uint32_t& maxSteps)
+{
+  size_t differences = 0;
+  for(size_t i = 0; i < a.size(); i++)
+  {
+    if(a[i] == b[i])
+      continue;
+    differences++;
+    for(uint32_t shift : {0u, 16u})
+    {
+      int32_t low  = int32_t((a[i] >> shift) & 0xFFFF);
+      int32_t high = int32_t((b[i] >> shift) & 0xFFFF);
+      maxSteps     = std::max(maxSteps, uint32_t(std::abs(low - high)));
+    }
+  }
+  return differences;
+}
+
+// Floats of a and b that differ, and the largest difference
+template <class T>
+size_t compareDecoded(const std::vector<T>& a, const std::vector<T>& b, float& maxDifference)
+{
+  const float* fa          = reinterpret_cast<const float*>(a.data());
+  const float* fb          = reinterpret_cast<const float*>(b.data());
+  size_t       differences = 0;
+  for(size_t i = 0; i < a.size() * sizeof(T) / sizeof(float); i++)
+  {
+    if(memcmp(&fa[i], &fb[i], sizeof(float)) == 0)
+      continue;
+    differences++;
+    maxDifference = std::max(maxDifference, std::abs(fa[i] - fb[i]));
+  }
+  return differences;
+}
+
+int benchPacking(int argc, char** argv)
+{
+  size_t   count  = 4 << 20;
+  uint32_t repeat = 5;
+  bool     check  = false;
+  for(int i = 0; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--count") && i + 1 < argc)
+      count = std::max<size_t>(16, size_t(atoll(argv[++i])));
+    else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--check"))
+      check = true;
+    else
+    {
+      printUsage();
+      return -1;
+    }
+  }
+  // Not a multiple of the SIMD widths, so that the scalar tails are covered
+  count |= 3;
+
+  std::mt19937               rng(2020);
+  std::vector<vec3f>         normals = testNormals(count, rng);
+  std::vector<nvmath::vec2f> uvs     = testUvs(count, rng);
+
+  std::vector<uint32_t>      scalarNormals(count), batchNormals(count), scalarUvs(count), batchUvs(count);
+  std::vector<vec3f>         scalarDecodedNormals(count), batchDecodedNormals(count);
+  std::vector<nvmath::vec2f> scalarDecodedUvs(count), batchDecodedUvs(count);
+
+  auto encodeScalar = [&](uint32_t) {
+    for(size_t i = 0; i < count; i++)
+      scalarNormals[i] = octEncodeUnitVector(normals[i]);
+    for(size_t i = 0; i < count; i++)
+      scalarUvs[i] = packUnorm2x16(uvs[i]);
+  };
+  auto encodeBatch = [&](uint32_t) {
+    octEncodeUnitVectors(normals.data(), count, batchNormals.data());
+    packUnorm2x16(uvs.data(), count, batchUvs.data());
+  };
+  auto decodeScalar = [&](uint32_t) {
+    for(size_t i = 0; i < count; i++)
+      scalarDecodedNormals[i] = octDecodeUnitVector(scalarNormals[i]);
+    for(size_t i = 0; i < count; i++)
+      scalarDecodedUvs[i] = unpackUnorm2x16(scalarUvs[i]);
+  };
+  auto decodeBatch = [&](uint32_t) {
+    octDecodeUnitVectors(scalarNormals.data(), count, batchDecodedNormals.data());
+    unpackUnorm2x16(scalarUvs.data(), count, batchDecodedUvs.data());
+  };
+  double encodeScalarMs = bestTimeMs(check ? 1 : repeat, encodeScalar);
+  double encodeBatchMs  = bestTimeMs(check ? 1 : repeat, encodeBatch);
+  double decodeScalarMs = bestTimeMs(check ? 1 : repeat, decodeScalar);
+  double decodeBatchMs  = bestTimeMs(check ? 1 : repeat, decodeBatch);
+
+  // The zero vector has no direction: it encodes to +Z
+  bool  zeroToZ        = octDecodeUnitVector(octEncodeUnitVector(vec3f(0.f))).z == 1.f;
+  float maxNormalError = 0.f, maxUvError = 0.f;
+  for(size_t i = 0; i < count; i++)
+  {
+    maxNormalError = std::max(maxNormalError, angleDegrees(normals[i], scalarDecodedNormals[i]));
+    for(int c = 0; c < 2; c++)
+    {
+      float clamped = std::min(std::max(uvs[i][c], 0.f), 1.f);
+      maxUvError    = std::max(maxUvError, std::abs(scalarDecodedUvs[i][c] - clamped));
+    }
+  }
+  uint32_t maxEncodeSteps = 0;
+  float    maxDecodeDifference = 0.f;
+  size_t   encodeDifferences =
+      compareEncoded(scalarNormals, batchNormals, maxEncodeSteps) + compareEncoded(scalarUvs, batchUvs, maxEncodeSteps);
+  size_t decodeDifferences = compareDecoded(scalarDecodedNormals, batchDecodedNormals, maxDecodeDifference)
+                             + compareDecoded(scalarDecodedUvs, batchDecodedUvs, maxDecodeDifference);
+  bool batchMatches = kFusedMultiplyAdd ?
+                          maxEncodeSteps <= kMaxFusedEncodeSteps && maxDecodeDifference <= kMaxFusedDecodeDifference :
+                          encodeDifferences == 0 && decodeDifferences == 0;
+
+  bool passed = zeroToZ && maxNormalError <= kMaxNormalErrorDegrees && maxUvError <= kMaxUvError && batchMatches;
+  printf("%zu normals and uvs\n", count);
+  printf("  normal error %.5f degrees (max %.5f), uv error %.3g (max %.3g), zero vector %s\n", maxNormalError,
+         kMaxNormalErrorDegrees, maxUvError, kMaxUvError, zeroToZ ? "to +Z" : "WRONG");
+  printf("  batch against scalar: %zu encoded values differ by up to %u steps, %zu decoded ones by up to %.3g%s\n",
+         encodeDifferences, maxEncodeSteps, decodeDifferences, maxDecodeDifference,
+         kFusedMultiplyAdd ? " (fused multiply-adds)" : "");
+  if(!check)
+  {
+    printf("  encode  scalar %7.1f ms  batch %7.1f ms  %.2fx\n", encodeScalarMs, encodeBatchMs, encodeScalarMs / encodeBatchMs);
+    printf("  decode  scalar %7.1f ms  batch %7.1f ms  %.2fx\n", decodeScalarMs, decodeBatchMs, decodeScalarMs / decodeBatchMs);
+  }
+  printf("  %s\n", passed ? "passed" : "FAILED");
+  return passed ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// tangents
+//
+
+// Largest angle between the MikkTSpace tangents and the analytic ones. The vertices of the patch
+// borders only see one side of the curvature, the others agree to a fraction of this.
+const float kMaxTangentErrorDegrees = 1.f;
+
+// A resolution x resolution grid over a part of the unit sphere, with the analytic tangents
+struct SpherePatch
+{
+  std::vector<vec3f>         positions;
+  std::vector<vec3f>         normals;
+  std::vector<nvmath::vec2f> uvs;
+  std::vector<uint32_t>      indices;
+  std::vector<nvmath::vec4f> expected;
+  std::vector<nvmath::vec4f> tangents;
+};
+
+// Patch `index` covers an eighth of the longitudes, rotated by its index, between 36 and 144
+// degrees of latitude. u follows the longitude, reversed on odd patches, and v the latitude.
+SpherePatch makeSpherePatch(uint32_t index, uint32_t resolution)
+{
+  const float pi       = 3.14159265f;
+  bool        mirrored = (index & 1) != 0;
+  float       phi0     = float(index) * 0.37f;
+  uint32_t    side     = resolution + 1;
+
+  SpherePatch patch;
+  for(uint32_t y = 0; y < side; y++)
+  {
+    for(uint32_t x = 0; x < side; x++)
+    {
+      float u = float(x) / float(resolution), v = float(y) / float(resolution);
+      float phi   = phi0 + u * pi * 0.25f;
+      float theta = (0.2f + 0.6f * v) * pi;
+      vec3f p(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+      // Direction of increasing u, and bitangent along increasing v
+      vec3f t     = vec3f(-std::sin(phi), 0.f, std::cos(phi)) * (mirrored ? -1.f : 1.f);
+      vec3f dPdv(std::cos(theta) * std::cos(phi), -std::sin(theta), std::cos(theta) * std::sin(phi));
+      float w = nvmath::dot(nvmath::cross(p, t), dPdv) < 0.f ? -1.f : 1.f;
+      patch.positions.push_back(p);
+      patch.normals.push_back(p);
+      patch.uvs.emplace_back(mirrored ? 1.f - u : u, v);
+      patch.expected.emplace_back(t.x, t.y, t.z, w);
+    }
+  }
+  for(uint32_t y = 0; y < resolution; y++)
+  {
+    for(uint32_t x = 0; x < resolution; x++)
+    {
+      uint32_t a = y * side + x, b = a + 1, c = a + side, d = c + 1;
+      patch.indices.insert(patch.indices.end(), {a, b, d, a, d, c});
+    }
+  }
+  patch.tangents.resize(patch.positions.size());
+  return patch;
+}
+
+// RenderScene::generateTangentSpace as it was before tangent_space.h, the reference of eAccumulate
+std::vector<nvmath::vec4f> legacyGenerateTangentSpace(const std::vector<vec3f>&         positions,
+                                                      const std::vector<vec3f>&         normals,
+                                                      const std::vector<nvmath::vec2f>& uvs,
+                                                      const std::vector<uint32_t>&      indices,
+                                                      size_t                            nIndices,
+                                                      size_t                            nVertices)
+{
+  using nvmath::vec2f;
+  using nvmath::vec4f;
+  std::vector<vec4f> tangentVectors;
+  tangentVectors.resize(nVertices);
+  std::fill(tangentVectors.begin(), tangentVectors.end(), vec4f(0.f, 0.f, 0.f, 0.f));
+
+  for(size_t i = 0; i < nIndices; i += 3)
+  {
+    auto i0 = indices[i + 0];
+    auto i1 = indices[i + 1];
+    auto i2 = indices[i + 2];
+
+    vec2f localUvs[3] = {uvs[i0], uvs[i1], uvs[i2]};
+    vec3f localPos[3] = {positions[i0], positions[i1], positions[i2]};
+
+    vec2f deltaUV1 = localUvs[1] - localUvs[0];
+    vec2f deltaUV2 = localUvs[2] - localUvs[0];
+
+    vec3f deltaPos1 = localPos[1] - localPos[0];
+    vec3f deltaPos2 = localPos[2] - localPos[0];
+
+    auto determinant = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+
+    vec3f triangleTangent = (deltaPos1 * deltaUV2.y - deltaUV1.y * deltaPos2) * (1 / determinant);
+
+    tangentVectors[i0] += vec4f(triangleTangent.x, triangleTangent.y, triangleTangent.z, determinant);
+    tangentVectors[i1] += vec4f(triangleTangent.x, triangleTangent.y, triangleTangent.z, determinant);
+    tangentVectors[i2] += vec4f(triangleTangent.x, triangleTangent.y, triangleTangent.z, determinant);
+  }
+
+  for(size_t i = 0; i < tangentVectors.size(); ++i)
+  {
+    auto& tangent  = tangentVectors[i];
+    vec3f tangent3 = {tangent.x, tangent.y, tangent.z};
+    auto& normal   = normals[i];
+
+    tangent3 = tangent3 - (nvmath::dot(tangent3, normal) * normal);
+    tangent3 = nvmath::normalize(tangent3);
+    tangent  = {tangent3.x, tangent3.y, tangent3.z, std::signbit(-tangent.w) ? -1.f : 1.f};
+  }
+
+  return tangentVectors;
+}
+
+int benchTangents(int argc, char** argv)
+{
+  uint32_t patchCount = 64;
+  uint32_t resolution = 256;
+  uint32_t workers    = getWorkerCount();
+  uint32_t repeat     = 3;
+  bool     check      = false;
+  for(int i = 0; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--patches") && i + 1 < argc)
+      patchCount = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+      workers = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--resolution") && i + 1 < argc)
+      resolution = std::max(2, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--check"))
+      check = true;
+    else
+    {
+      printUsage();
+      return -1;
+    }
+  }
+  if(check)
+    repeat = 1;
+
+  std::vector<SpherePatch>      patches(patchCount);
+  std::vector<TangentPrimitive> primitives(patchCount);
+  size_t                        vertexCount = 0, triangleCount = 0;
+  parallelFor(patchCount, [&](size_t i) { patches[i] = makeSpherePatch(uint32_t(i), resolution); });
+  for(uint32_t i = 0; i < patchCount; i++)
+  {
+    SpherePatch&      patch = patches[i];
+    TangentPrimitive& prim  = primitives[i];
+    prim.positions          = patch.positions.data();
+    prim.normals            = patch.normals.data();
+    prim.uvs                = patch.uvs.data();
+    prim.indices            = patch.indices.data();
+    prim.indexCount         = patch.indices.size();
+    prim.vertexCount        = patch.positions.size();
+    prim.tangents           = patch.tangents.data();
+    vertexCount += prim.vertexCount;
+    triangleCount += prim.indexCount / 3;
+  }
+  auto snapshot = [&]() {
+    std::vector<nvmath::vec4f> all;
+    all.reserve(vertexCount);
+    for(const SpherePatch& patch : patches)
+      all.insert(all.end(), patch.tangents.begin(), patch.tangents.end());
+    return all;
+  };
+  auto sameBits = [](const std::vector<nvmath::vec4f>& a, const std::vector<nvmath::vec4f>& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(nvmath::vec4f)) == 0;
+  };
+
+  // The former loader ran the primitives one after the other and copied each result
+  double legacyMs = bestTimeMs(repeat, [&](uint32_t) {
+    for(SpherePatch& patch : patches)
+    {
+      std::vector<nvmath::vec4f> tangents = legacyGenerateTangentSpace(
+          patch.positions, patch.normals, patch.uvs, patch.indices, patch.indices.size(), patch.positions.size());
+      std::copy(tangents.begin(), tangents.end(), patch.tangents.begin());
+    }
+  });
+  std::vector<nvmath::vec4f> legacy = snapshot();
+
+  auto run = [&](TangentSpaceMode mode, uint32_t nbThreads) {
+    return bestTimeMs(repeat, [&](uint32_t) {
+      generateTangents(primitives.data(), primitives.size(), mode, nbThreads);
+    });
+  };
+  double                     accumulateMs        = run(TangentSpaceMode::eAccumulate, 1);
+  std::vector<nvmath::vec4f> accumulate          = snapshot();
+  double                     accumulateThreadsMs = run(TangentSpaceMode::eAccumulate, workers);
+  bool accumulateMatches = sameBits(legacy, accumulate) && sameBits(accumulate, snapshot());
+
+  double                     mikkMs        = run(TangentSpaceMode::eMikkTSpace, 1);
+  std::vector<nvmath::vec4f> mikk          = snapshot();
+  double                     mikkThreadsMs = run(TangentSpaceMode::eMikkTSpace, workers);
+  bool                       mikkStable    = sameBits(mikk, snapshot());
+
+  float  maxError = 0.f;
+  size_t flipped  = 0, index = 0;
+  for(const SpherePatch& patch : patches)
+  {
+    for(const nvmath::vec4f& expected : patch.expected)
+    {
+      const nvmath::vec4f& tangent = mikk[index++];
+      float                error   = angleDegrees(vec3f(tangent.x, tangent.y, tangent.z),
+                                              vec3f(expected.x, expected.y, expected.z));
+      maxError = std::max(maxError, error);
+      flipped += tangent.w != expected.w ? 1 : 0;
+    }
+  }
+
+  bool passed = accumulateMatches && mikkStable && maxError <= kMaxTangentErrorDegrees && flipped == 0;
+  printf("%u sphere patches, %zu vertices, %zu triangles\n", patchCount, vertexCount, triangleCount);
+  printf("  eAccumulate against the former function: %s\n", accumulateMatches ? "same bits" : "DIFFERENT");
+  printf("  eMikkTSpace: error %.3f degrees (max %.3f), %zu flipped handedness, %s on %u threads\n", maxError,
+         kMaxTangentErrorDegrees, flipped, mikkStable ? "same bits" : "DIFFERENT", workers);
+  if(!check)
+  {
+    printf("  former function  %8.1f ms\n", legacyMs);
+    printf("  eAccumulate      %8.1f ms  %.2fx, %8.1f ms on %u threads\n", accumulateMs, legacyMs / accumulateMs,
+           accumulateThreadsMs, workers);
+    printf("  eMikkTSpace      %8.1f ms         %8.1f ms on %u threads\n", mikkMs, mikkThreadsMs, workers);
+  }
+  printf("  %s\n", passed ? "passed" : "FAILED");
+  return passed ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// meshlets
+//
+
+// Tolerance of the bounds, relative to the unit sphere of the test mesh
+const float kMeshletBoundsEpsilon = 1e-5f;
+
+// Unit sphere of latitude rings, without the caps at the poles, facing outwards
+void makeSphere(size_t triangles, std::vector<vec3f>& positions, std::vector<uint32_t>& indices)
+{
+  const float pi    = 3.14159265f;
+  uint32_t    rings = std::max<uint32_t>(2, uint32_t(std::sqrt(double(triangles) / 4.0)));
+  uint32_t    slices = std::max<uint32_t>(3, uint32_t(triangles / (2 * size_t(rings))));
+  positions.clear();
+  indices.clear();
+  for(uint32_t y = 0; y <= rings; y++)
+  {
+    float theta = (0.02f + 0.96f * float(y) / float(rings)) * pi;
+    for(uint32_t x = 0; x < slices; x++)
+    {
+      float phi = 2.f * pi * float(x) / float(slices);
+      positions.emplace_back(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+    }
+  }
+  for(uint32_t y = 0; y < rings; y++)
+  {
+    for(uint32_t x = 0; x < slices; x++)
+    {
+      uint32_t a = y * slices + x, b = y * slices + (x + 1) % slices, c = a + slices, d = b + slices;
+      indices.insert(indices.end(), {a, b, d, a, d, c});
+    }
+  }
+}
+
+// Checks a meshlet split of `indices` and returns the first problem found, or nullptr
+const char* validateMeshlets(const MeshletMesh&           mesh,
+                             const std::vector<uint32_t>& triangleOrder,
+                             const std::vector<vec3f>&    positions,
+                             const std::vector<uint32_t>& indices)
+{
+  size_t                triangleCount = indices.size() / 3;
+  std::vector<uint32_t> seen(triangleCount, 0);
+  size_t                next = 0;
+  if(triangleOrder.size() != triangleCount)
+    return "triangle order of the wrong size";
+  for(const Meshlet& meshlet : mesh.meshlets)
+  {
+    if(meshlet.vertexCount == 0 || meshlet.vertexCount > kMeshletMaxVertices || meshlet.triangleCount == 0
+       || meshlet.triangleCount > kMeshletMaxTriangles)
+      return "meshlet limits exceeded";
+    if(meshlet.triangleOffset != next || size_t(meshlet.vertexOffset) + meshlet.vertexCount > mesh.vertices.size()
+       || (size_t(meshlet.triangleOffset) + meshlet.triangleCount) * 3 > mesh.triangles.size())
+      return "meshlet ranges out of the arrays";
+    const uint32_t* vertices = &mesh.vertices[meshlet.vertexOffset];
+    for(uint32_t v = 0; v < meshlet.vertexCount; v++)
+    {
+      const vec3f& p      = positions[vertices[v]];
+      bool         inside = nvmath::length(p - meshlet.center) <= meshlet.radius + kMeshletBoundsEpsilon;
+      for(int c = 0; c < 3; c++)
+        inside = inside && p[c] >= meshlet.bboxMin[c] - kMeshletBoundsEpsilon
+                 && p[c] <= meshlet.bboxMax[c] + kMeshletBoundsEpsilon;
+      if(!inside)
+        return "vertex outside the bounds of its meshlet";
+    }
+    for(uint32_t t = 0; t < meshlet.triangleCount; t++, next++)
+    {
+      const uint8_t* local  = &mesh.triangles[next * 3];
+      uint32_t       source = triangleOrder[next];
+      if(local[0] >= meshlet.vertexCount || local[1] >= meshlet.vertexCount || local[2] >= meshlet.vertexCount)
+        return "local index out of the meshlet";
+      if(source >= triangleCount || seen[source]++)
+        return "triangle emitted twice";
+      for(int c = 0; c < 3; c++)
+        if(vertices[local[c]] != indices[size_t(source) * 3 + c])
+          return "meshlet triangle differs from its source";
+    }
+  }
+  if(next != triangleCount)
+    return "triangle missing";
+  return nullptr;
+}
+
+// Culled meshlets seen from random points around the mesh, and those culled by mistake: with a
+// triangle facing the camera
+void checkCulling(const MeshletMesh&        mesh,
+                  const std::vector<vec3f>& positions,
+                  uint32_t                  viewpoints,
+                  size_t&                   culled,
+                  size_t&                   wrong)
+{
+  std::mt19937                          rng(12);
+  std::uniform_real_distribution<float> uniform(-3.f, 3.f);
+  culled = wrong = 0;
+  for(uint32_t i = 0; i < viewpoints; i++)
+  {
+    vec3f camera(uniform(rng), uniform(rng), uniform(rng));
+    for(const Meshlet& meshlet : mesh.meshlets)
+    {
+      if(!meshletBackfacing(meshlet, camera))
+        continue;
+      culled++;
+      const uint32_t* vertices = &mesh.vertices[meshlet.vertexOffset];
+      for(uint32_t t = 0; t < meshlet.triangleCount; t++)
+      {
+        const uint8_t* local = &mesh.triangles[(size_t(meshlet.triangleOffset) + t) * 3];
+        const vec3f&   p0    = positions[vertices[local[0]]];
+        vec3f normal = nvmath::cross(positions[vertices[local[1]]] - p0, positions[vertices[local[2]]] - p0);
+        vec3f toCamera = camera - p0;
+        if(nvmath::dot(normal, toCamera) > kMeshletBoundsEpsilon * nvmath::length(normal) * nvmath::length(toCamera))
+        {
+          wrong++;
+          break;
+        }
+      }
+    }
+  }
+}
+
+int benchMeshlets(int argc, char** argv)
+{
+  size_t   triangles  = 2000000;
+  uint32_t viewpoints = 200;
+  uint32_t repeat     = 3;
+  bool     check      = false;
+  for(int i = 0; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--triangles") && i + 1 < argc)
+      triangles = std::max<size_t>(16, size_t(atoll(argv[++i])));
+    else if(!strcmp(argv[i], "--viewpoints") && i + 1 < argc)
+      viewpoints = uint32_t(std::max(0, atoi(argv[++i])));
+    else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = std::max(1, atoi(argv[++i]));
+    else if(!strcmp(argv[i], "--check"))
+      check = true;
+    else
+    {
+      printUsage();
+      return -1;
+    }
+  }
+  if(check)
+    repeat = 1;
+
+  std::vector<vec3f>    positions;
+  std::vector<uint32_t> meshOrder;
+  makeSphere(triangles, positions, meshOrder);
+
+  // Same triangles in random order, each keeping its winding
+  std::vector<uint32_t> shuffle(meshOrder.size() / 3), shuffled(meshOrder.size());
+  for(size_t t = 0; t < shuffle.size(); t++)
+    shuffle[t] = uint32_t(t);
+  std::mt19937 rng(7);
+  std::shuffle(shuffle.begin(), shuffle.end(), rng);
+  for(size_t t = 0; t < shuffle.size(); t++)
+    for(int c = 0; c < 3; c++)
+      shuffled[t * 3 + c] = meshOrder[size_t(shuffle[t]) * 3 + c];
+
+  size_t triangleCount = meshOrder.size() / 3;
+  printf("Sphere of %zu vertices, %zu triangles, %u viewpoints\n", positions.size(), triangleCount, viewpoints);
+  bool passed = true;
+  for(const std::vector<uint32_t>* indices : {&meshOrder, &shuffled})
+  {
+    MeshletMesh           mesh;
+    std::vector<uint32_t> triangleOrder;
+    double                ms = bestTimeMs(repeat, [&](uint32_t) {
+      mesh = buildMeshlets(positions.data(), sizeof(vec3f), positions.size(), indices->data(), indices->size(),
+                           &triangleOrder);
+    });
+
+    const char* problem = validateMeshlets(mesh, triangleOrder, positions, *indices);
+    size_t      culled = 0, wrong = 0;
+    checkCulling(mesh, positions, viewpoints, culled, wrong);
+    MeshletStats stats = meshletStats(mesh);
+    passed             = passed && !problem && wrong == 0;
+
+    printf("  %s\n", indices == &meshOrder ? "mesh order" : "shuffled");
+    printf("    %zu meshlets, %.1f vertices and %.1f triangles on average, %zu with a normal cone\n",
+           stats.meshletCount, stats.averageVertices, stats.averageTriangles, stats.cullableCount);
+    printf("    %s, %.1f%% culled per viewpoint, %zu culled by mistake\n", problem ? problem : "valid",
+           viewpoints ? 100.0 * double(culled) / (double(viewpoints) * double(stats.meshletCount)) : 0.0, wrong);
+    if(!check)
+      printf("    build %.1f ms, %.0f ns per triangle\n", ms, ms * 1e6 / double(triangleCount));
+  }
+  printf("  %s\n", passed ? "passed" : "FAILED");
+  return passed ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// textures
+//
+
+// Files of a folder with the extension of an image format of stb_image, sorted by name
+std::vector<std::string> listImages(const std::string& folder)
+{
+  std::vector<std::string> files;
+  std::error_code          error;
+  for(const auto& entry : std::filesystem::directory_iterator(folder, error))
+  {
+    std::string extension = entry.path().extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(tolower(c)); });
+    if(entry.is_regular_file()
+       && (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".tga" || extension == ".bmp"))
+      files.push_back(entry.path().string());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+int benchTextures(int argc, char** argv)
+{
+  std::string        folder      = "media/textures";
+  TextureCompression compression = TextureCompression::eBC7;
+  uint32_t           repeat      = 3;
+  bool               valid       = true;
+  for(int i = 0; i < argc && valid; i++)
+  {
+    if(!strcmp(argv[i], "--compression") && i + 1 < argc)
+    {
+      const char* names[] = {"none", "bc1", "bc3", "bc7"};
+      const char* name    = argv[++i];
+      valid               = false;
+      for(int k = 0; k < 4; k++)
+        if(!strcmp(name, names[k]))
+        {
+          compression = TextureCompression(k);
+          valid       = true;
+        }
+    }
+    else if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = std::max(1, atoi(argv[++i]));
+    else if(argv[i][0] != '-')
+      folder = argv[i];
+    else
+      valid = false;
+  }
+  if(!valid)
+  {
+    printUsage();
+    return -1;
+  }
+
+  std::vector<std::string> sources = listImages(folder);
+  if(sources.empty())
+  {
+    fprintf(stderr, "No image in %s\n", folder.c_str());
+    return -1;
+  }
+
+  // Copies in a folder of their own, where the caches can be written and removed
+  std::filesystem::path workFolder = std::filesystem::temp_directory_path() / "loader_bench_textures";
+  std::error_code       error;
+  std::filesystem::remove_all(workFolder, error);
+  std::filesystem::create_directories(workFolder, error);
+  std::vector<std::string> files;
+  uint64_t                 fileBytes = 0;
+  for(const auto& source : sources)
+  {
+    std::filesystem::path copy = workFolder / std::filesystem::path(source).filename();
+    if(!std::filesystem::copy_file(source, copy, error))
+    {
+      fprintf(stderr, "Could not copy %s to %s\n", source.c_str(), copy.string().c_str());
+      return -1;
+    }
+    files.push_back(copy.string());
+    fileBytes += std::filesystem::file_size(copy, error);
+  }
+  auto removeCaches = [&]() {
+    for(const auto& entry : std::filesystem::directory_iterator(workFolder, error))
+      if(entry.path().extension() == ".scache")
+        std::filesystem::remove(entry.path(), error);
+  };
+
+  // As the samples did: one image after the other
+  uint64_t decodedTexels = 0;
+  size_t   failed        = 0;
+  double   serialMs      = bestTimeMs(repeat, [&](uint32_t) {
+    decodedTexels = 0;
+    failed        = 0;
+    for(const auto& file : files)
+    {
+      int      width = 0, height = 0, channels = 0;
+      stbi_uc* pixels = stbi_load(file.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+      if(pixels)
+        decodedTexels += uint64_t(width) * uint64_t(height);
+      else
+        failed++;
+      stbi_image_free(pixels);
+    }
+  });
+
+  // Decoded and baked without caches, then loaded from the caches of the last run
+  double bakeMs = 0.0;
+  for(uint32_t i = 0; i < repeat; i++)
+  {
+    removeCaches();
+    auto   startTime = Clock::now();
+    auto   baked     = bakeTextures(files, compression, true);
+    double ms        = elapsedMs(startTime);
+    bakeMs           = i == 0 ? ms : std::min(bakeMs, ms);
+  }
+  // The caches are mapped: one byte per page is read, as the upload to the staging buffer would
+  size_t            bakedLevels = 0;
+  volatile uint32_t touched     = 0;
+  double            cachedMs    = bestTimeMs(repeat, [&](uint32_t) {
+    auto baked  = bakeTextures(files, compression, true);
+    bakedLevels = 0;
+    for(const auto& texture : baked)
+    {
+      bakedLevels += texture->levels.size();
+      for(size_t offset = 0; offset < texture->dataSize; offset += 4096)
+        touched += texture->data[offset];
+    }
+  });
+  std::filesystem::remove_all(workFolder, error);
+
+  const char* compressionNames[] = {"RGBA8", "BC1", "BC3", "BC7"};
+  double      megabytes          = double(fileBytes) / (1024.0 * 1024.0);
+  printf("%s: %zu images, %.1f MB of files, %.1f Mtexels, best of %u\n", folder.c_str(), files.size(), megabytes,
+         double(decodedTexels) * 1e-6, repeat);
+  if(failed)
+    printf("  %zu images could not be decoded\n", failed);
+  printf("  stbi_load, serial      %9.1f ms\n", serialMs);
+  printf("  bakeTextures, no cache %9.1f ms  %.2fx, decode + %s mip chains on %u threads\n", bakeMs,
+         serialMs / bakeMs, compressionNames[int(compression)], getWorkerCount());
+  printf("  bakeTextures, cached   %9.1f ms  %.2fx, %zu levels\n", cachedMs, serialMs / cachedMs, bakedLevels);
+  return 0;
+}
+}  // namespace
+
+//--------------------------------------------------------------------------------------------------
+// Application Entry
+//
+int main(int argc, char** argv)
+{
+  if(argc >= 2 && !strcmp(argv[1], "obj"))
+    return benchObj(argc - 2, argv + 2);
+  if(argc >= 2 && !strcmp(argv[1], "packing"))
+    return benchPacking(argc - 2, argv + 2);
+  if(argc >= 2 && !strcmp(argv[1], "tangents"))
+    return benchTangents(argc - 2, argv + 2);
+  if(argc >= 2 && !strcmp(argv[1], "meshlets"))
+    return benchMeshlets(argc - 2, argv + 2);
+  if(argc >= 2 && !strcmp(argv[1], "textures"))
+    return benchTextures(argc - 2, argv + 2);
+  printUsage();
+  return -1;
+}
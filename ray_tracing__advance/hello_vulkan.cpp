@@ -36,6 +36,7 @@ extern std::vector<std::string> defaultSearchPaths;
 #define STB_IMAGE_IMPLEMENTATION
 #include "fileformats/stb_image.h"
 #include "obj_loader.h"
+#include "baked_texture_vk.h"
 
 #include "hello_vulkan.h"
 #include "nvh//cameramanipulator.hpp"
@@ -248,14 +249,22 @@ void HelloVulkan::createGraphicsPipeline()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Loading the OBJ file and setting up all buffers
+// Loading the OBJ file and setting up all buffers. With weld, identical vertices are merged
+// into an indexed mesh (see ObjLoader::weldVertices).
 //
-void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform)
+void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform, bool weld)
 {
   using vkBU = vk::BufferUsageFlagBits;
 
   ObjLoader loader;
-  loader.loadModel(filename);
+  if(!loader.loadCache(filename, weld))
+  {
+    loader.loadModel(filename);
+    if(weld)
+      loader.weldVertices();
+    loader.buildMeshlets();
+    loader.saveCache(filename);
+  }
 
   // Converting from Srgb to linear
   for(auto& m : loader.m_materials)
@@ -271,9 +280,21 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   instance.transformIT = nvmath::transpose(nvmath::invert(transform));
   instance.txtOffset   = static_cast<uint32_t>(m_textures.size());
 
+  // LOD chain over the same vertices: all levels go in the index buffer, one after the
+  // other, and the material of a simplified triangle is the one of its source triangle
+  bool     hasMatIndx = loader.m_matIndx.size() * 3 >= loader.m_indices.size();
+  LodChain lodChain =
+      buildLodChain(&loader.m_vertices.data()->pos, sizeof(VertexObj), loader.m_vertices.size(),
+                    loader.m_indices.data(), loader.m_indices.size(),
+                    hasMatIndx ? loader.m_matIndx.data() : nullptr);
+  std::vector<uint32_t> lodMatIndx(lodChain.triangles.size(), 0);
+  for(size_t t = 0; t < lodChain.triangles.size() && hasMatIndx; t++)
+    lodMatIndx[t] = loader.m_matIndx[lodChain.triangles[t]];
+
   ObjModel model;
   model.nbIndices  = static_cast<uint32_t>(loader.m_indices.size());
   model.nbVertices = static_cast<uint32_t>(loader.m_vertices.size());
+  model.lods       = lodChain.lods;
 
   // Create the buffers on Device and copy vertices, indices and materials
   nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
@@ -282,10 +303,11 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
       m_alloc.createBuffer(cmdBuf, loader.m_vertices,
                            vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   model.indexBuffer =
-      m_alloc.createBuffer(cmdBuf, loader.m_indices,
+      m_alloc.createBuffer(cmdBuf, lodChain.indices,
                            vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   model.matColorBuffer = m_alloc.createBuffer(cmdBuf, loader.m_materials, vkBU::eStorageBuffer);
-  model.matIndexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_matIndx, vkBU::eStorageBuffer);
+  model.matIndexBuffer =
+      m_alloc.createBuffer(cmdBuf, hasMatIndx ? lodMatIndx : loader.m_matIndx, vkBU::eStorageBuffer);
   // Creates all textures found
   createTextureImages(cmdBuf, loader.m_textures);
   cmdBufGet.submitAndWait(cmdBuf);
@@ -343,8 +365,6 @@ void HelloVulkan::createSceneDescriptionBuffer()
 void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
                                       const std::vector<std::string>& textures)
 {
-  using vkIU = vk::ImageUsageFlagBits;
-
   vk::SamplerCreateInfo samplerCreateInfo{
       {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
   samplerCreateInfo.setMaxLod(FLT_MAX);
@@ -372,43 +392,16 @@ void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
   }
   else
   {
-    // Uploading all images
+    // Mip chains and block compression are baked on the CPU and cached next to the images
+    std::vector<std::string> txtFiles;
+    txtFiles.reserve(textures.size());
     for(const auto& texture : textures)
-    {
-      std::stringstream o;
-      int               texWidth, texHeight, texChannels;
-      o << "media/textures/" << texture;
-      std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths);
-
-      stbi_uc* stbi_pixels = stbi_load(txtFile.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-      std::array<stbi_uc, 4> color{255u, 0u, 255u, 255u};
-
-      stbi_uc* pixels = stbi_pixels;
-      // Handle failure
-      if(!stbi_pixels)
-      {
-        texWidth = texHeight = 1;
-        texChannels          = 4;
-        pixels               = reinterpret_cast<stbi_uc*>(color.data());
-      }
-
-      vk::DeviceSize bufferSize = static_cast<uint64_t>(texWidth) * texHeight * sizeof(uint8_t) * 4;
-      auto           imgSize    = vk::Extent2D(texWidth, texHeight);
-      auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, vkIU::eSampled, true);
-
-      {
-        nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, pixels, imageCreateInfo);
-        nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-        vk::ImageViewCreateInfo ivInfo =
-            nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        nvvk::Texture texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-        m_textures.push_back(texture);
-      }
-
-      stbi_image_free(stbi_pixels);
-    }
+      txtFiles.push_back(nvh::findFile("media/textures/" + texture, defaultSearchPaths));
+    TextureCompression compression = supportedTextureCompression(m_physicalDevice, TextureCompression::eBC7, true);
+    std::vector<std::shared_ptr<const BakedTexture>> baked = bakeTextures(txtFiles, compression, true);
+
+    // Uploading all levels of all images
+    createBakedTextures(m_alloc, m_device, m_graphicsQueueIndex, baked, samplerCreateInfo, m_textures);
   }
 }
 
@@ -513,7 +506,7 @@ void HelloVulkan::initOffscreen()
 void HelloVulkan::initRayTracing()
 {
   m_raytrace.createBottomLevelAS(m_objModel, m_implObjects);
-  m_raytrace.createTopLevelAS(m_objInstance, m_implObjects);
+  m_raytrace.createTopLevelAS(m_objModel, m_objInstance, m_implObjects, m_size);
   m_raytrace.createRtDescriptorSet(m_offscreen.colorTexture().descriptor.imageView);
   m_raytrace.createRtPipeline(m_descSetLayout);
   m_raytrace.createRtShaderBindingTable();
@@ -524,6 +517,9 @@ void HelloVulkan::initRayTracing()
 //
 void HelloVulkan::raytrace(const vk::CommandBuffer& cmdBuf, const nvmath::vec4f& clearColor)
 {
+  // Instances changing of LOD or moving change the image: accumulation starts over
+  if(m_raytrace.updateLods(m_objModel, m_objInstance, m_size))
+    resetFrame();
   updateFrame();
   if(m_pushConstants.frame >= m_maxFrames)
     return;
@@ -103,6 +103,7 @@ void renderUI(HelloVulkan& helloVk)
     helloVk.m_pushConstants.lightSpotCutoff      = cos(deg2rad(dCutoff));
     helloVk.m_pushConstants.lightSpotOuterCutoff = cos(deg2rad(dOutCutoff));
   }
+  changed |= ImGui::SliderFloat("LOD Error (pixels)", &helloVk.raytracer().m_lodPixelError, 0.f, 8.f);
   changed |= ImGui::InputInt("Max Frames", &helloVk.m_maxFrames);
   helloVk.m_maxFrames = std::max(helloVk.m_maxFrames, 1);
   if(changed)
@@ -208,11 +209,13 @@ int main(int argc, char** argv)
   helloVk.initGUI(0);  // Using sub-pass 0
 
   // Creating scene
-  helloVk.loadModel(nvh::findFile("media/scenes/Medieval_building.obj", defaultSearchPaths));
-  helloVk.loadModel(nvh::findFile("media/scenes/plane.obj", defaultSearchPaths));
+  // Welded, the LOD chains need the triangles to share their vertices
+  helloVk.loadModel(nvh::findFile("media/scenes/Medieval_building.obj", defaultSearchPaths), nvmath::mat4f(1), true);
+  helloVk.loadModel(nvh::findFile("media/scenes/plane.obj", defaultSearchPaths), nvmath::mat4f(1), true);
   helloVk.loadModel(nvh::findFile("media/scenes/wuson.obj", defaultSearchPaths),
                     nvmath::scale_mat4(nvmath::vec3f(0.5f))
-                        * nvmath::translation_mat4(nvmath::vec3f(0.0f, 0.0f, 6.0f)));
+                        * nvmath::translation_mat4(nvmath::vec3f(0.0f, 0.0f, 6.0f)),
+                    true);
 
   std::random_device              rd;  // Will be used to obtain a seed for the random number engine
   std::mt19937                    gen(rd());  // Standard mersenne_twister_engine seeded with rd()
@@ -1,4 +1,5 @@
 #pragma once
+#include "mesh_simplifier.h"
 #include "obj_loader.h"
 
 // The OBJ model
@@ -7,9 +8,11 @@ struct ObjModel
   uint32_t   nbIndices{0};
   uint32_t   nbVertices{0};
   nvvk::Buffer vertexBuffer;    // Device buffer of all 'Vertex'
-  nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles
+  nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles, all LOD levels
   nvvk::Buffer matColorBuffer;  // Device buffer of array of 'Wavefront material'
   nvvk::Buffer matIndexBuffer;  // Device buffer of array of 'Wavefront material'
+  LodSet       lods;            // Level 0 is the full mesh, the first `nbIndices` indices
+  uint32_t     blasOffset{0};   // BLAS of level 0, the other levels follow
 };
 
 // Instance of the OBJ
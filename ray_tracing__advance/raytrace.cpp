@@ -27,6 +27,7 @@
 
 
 #include "raytrace.hpp"
+#include "nvh/cameramanipulator.hpp"
 #include "nvh/fileoperations.hpp"
 #include "nvvk/descriptorsets_vk.hpp"
 
@@ -67,16 +68,18 @@ void Raytracer::destroy()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Converting a OBJ primitive to the ray tracing geometry used for the BLAS
+// Converting a LOD level of an OBJ primitive to the ray tracing geometry used for the BLAS
 //
-nvvk::RaytracingBuilderKHR::Blas Raytracer::objectToVkGeometryKHR(const ObjModel& model)
+nvvk::RaytracingBuilderKHR::Blas Raytracer::objectToVkGeometryKHR(const ObjModel& model, uint32_t lod)
 {
+  const LodLevel& level = model.lods.levels[lod];
+
   // Setting up the creation info of acceleration structure
   vk::AccelerationStructureCreateGeometryTypeInfoKHR asCreate;
   asCreate.setGeometryType(vk::GeometryTypeKHR::eTriangles);
   asCreate.setIndexType(vk::IndexType::eUint32);
   asCreate.setVertexFormat(vk::Format::eR32G32B32Sfloat);
-  asCreate.setMaxPrimitiveCount(model.nbIndices / 3);  // Nb triangles
+  asCreate.setMaxPrimitiveCount(level.indexCount / 3);  // Nb triangles
   asCreate.setMaxVertexCount(model.nbVertices);
   asCreate.setAllowsTransforms(VK_FALSE);  // No adding transformation matrices
 
@@ -102,7 +105,7 @@ nvvk::RaytracingBuilderKHR::Blas Raytracer::objectToVkGeometryKHR(const ObjModel
   vk::AccelerationStructureBuildOffsetInfoKHR offset;
   offset.setFirstVertex(0);
   offset.setPrimitiveCount(asCreate.maxPrimitiveCount);
-  offset.setPrimitiveOffset(0);
+  offset.setPrimitiveOffset(level.firstIndex * sizeof(uint32_t));  // Level in the index buffer
   offset.setTransformOffset(0);
 
   nvvk::RaytracingBuilderKHR::Blas blas;
@@ -157,15 +160,14 @@ nvvk::RaytracingBuilderKHR::Blas Raytracer::implicitToVkGeometryKHR(const ImplIn
 
 void Raytracer::createBottomLevelAS(std::vector<ObjModel>& models, ImplInst& implicitObj)
 {
-  // BLAS - Storing each primitive in a geometry
+  // BLAS - Storing each LOD level of each primitive in a geometry
   std::vector<nvvk::RaytracingBuilderKHR::Blas> allBlas;
   allBlas.reserve(models.size());
-  for(const auto& obj : models)
+  for(auto& obj : models)
   {
-    auto blas = objectToVkGeometryKHR(obj);
-
-    // We could add more geometry in each BLAS, but we add only one for now
-    allBlas.emplace_back(blas);
+    obj.blasOffset = static_cast<uint32_t>(allBlas.size());
+    for(uint32_t lod = 0; lod < obj.lods.levels.size(); lod++)
+      allBlas.emplace_back(objectToVkGeometryKHR(obj, lod));
   }
 
   // Adding implicit
@@ -181,34 +183,118 @@ void Raytracer::createBottomLevelAS(std::vector<ObjModel>& models, ImplInst& imp
                                      | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction);
 }
 
-void Raytracer::createTopLevelAS(std::vector<ObjInstance>& instances, ImplInst& implicitObj)
+void Raytracer::createTopLevelAS(const std::vector<ObjModel>&    models,
+                                 const std::vector<ObjInstance>& instances,
+                                 ImplInst&                       implicitObj,
+                                 const vk::Extent2D&             size)
 {
-  std::vector<nvvk::RaytracingBuilderKHR::Instance> tlas;
-  tlas.reserve(instances.size());
+  nvmath::vec3f eye, center, up;
+  CameraManip.getLookat(eye, center, up);
+
+  m_tlas.clear();
+  m_tlas.reserve(instances.size() + 1);
+  m_instanceLod.resize(instances.size());
   for(int i = 0; i < static_cast<int>(instances.size()); i++)
   {
+    const ObjModel& model = models[instances[i].objIndex];
+
     nvvk::RaytracingBuilderKHR::Instance rayInst;
     rayInst.transform  = instances[i].transform;  // Position of the instance
-    rayInst.instanceId = i;                       // gl_InstanceID
-    rayInst.blasId     = instances[i].objIndex;
     rayInst.hitGroupId = 0;  // We will use the same hit group for all objects
     rayInst.flags      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    tlas.emplace_back(rayInst);
+    m_instanceLod[i]   = selectInstanceLod(model, instances[i], eye, size);
+    setInstanceLod(rayInst, model, m_instanceLod[i]);
+    m_tlas.emplace_back(rayInst);
   }
 
   // Add the blas containing all implicit
   if(!implicitObj.objImpl.empty())
   {
     nvvk::RaytracingBuilderKHR::Instance rayInst;
-    rayInst.transform  = implicitObj.transform;                      // Position of the instance
-    rayInst.instanceId = static_cast<uint32_t>(implicitObj.blasId);  // Same for material index
+    rayInst.transform  = implicitObj.transform;                // Position of the instance
+    rayInst.instanceId = static_cast<uint32_t>(models.size());  // Material buffer, after the OBJ ones
     rayInst.blasId     = static_cast<uint32_t>(implicitObj.blasId);
     rayInst.hitGroupId = 1;  // We will use the same hit group for all objects (the second one)
     rayInst.flags      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    tlas.emplace_back(rayInst);
+    m_tlas.emplace_back(rayInst);
   }
 
-  m_rtBuilder.buildTlas(tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
+  // Updatable for the instances that move, rebuilt when they change of LOD (see updateLods)
+  m_rtBuilder.buildTlas(m_tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+                                    | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+}
+
+//--------------------------------------------------------------------------------------------------
+// LOD level of an instance from the error of the levels projected on screen (see mesh_simplifier.h)
+//
+uint32_t Raytracer::selectInstanceLod(const ObjModel&      model,
+                                      const ObjInstance&   instance,
+                                      const nvmath::vec3f& eye,
+                                      const vk::Extent2D&  size) const
+{
+  return selectLodLevel(model.lods, instance.transform, eye, CameraManip.getFov(),
+                        static_cast<float>(size.height), m_lodPixelError);
+}
+
+// The hit shaders find the instance with gl_InstanceID, which leaves the custom index to
+// hold the first triangle of the level in the index and material index buffers
+void Raytracer::setInstanceLod(nvvk::RaytracingBuilderKHR::Instance& rayInst,
+                               const ObjModel&                       model,
+                               uint32_t                              lod) const
+{
+  rayInst.instanceId = model.lods.levels[lod].firstIndex / 3;  // gl_InstanceCustomIndexEXT
+  rayInst.blasId     = model.blasOffset + lod;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Called at each frame. OBJ instances whose LOD changed with the camera are switched to the BLAS
+// of their new level and the TLAS is built again. Instances that only moved are refitted in
+// place. Returns true if the TLAS changed.
+//
+bool Raytracer::updateLods(const std::vector<ObjModel>&    models,
+                           const std::vector<ObjInstance>& instances,
+                           const vk::Extent2D&             size)
+{
+  nvmath::vec3f eye, center, up;
+  CameraManip.getLookat(eye, center, up);
+
+  bool lodChanged = false;
+  bool moved      = false;
+  for(size_t i = 0; i < instances.size(); i++)
+  {
+    if(memcmp(&m_tlas[i].transform, &instances[i].transform, sizeof(nvmath::mat4f)) != 0)
+    {
+      m_tlas[i].transform = instances[i].transform;
+      moved               = true;
+    }
+    const ObjModel& model = models[instances[i].objIndex];
+    uint32_t        lod   = selectInstanceLod(model, instances[i], eye, size);
+    if(lod == m_instanceLod[i])
+      continue;
+    m_instanceLod[i] = lod;
+    setInstanceLod(m_tlas[i], model, lod);
+    lodChanged = true;
+  }
+
+  if(lodChanged)
+  {
+    // The previous TLAS is destroyed, and the new one has another handle
+    m_device.waitIdle();
+    m_rtBuilder.rebuildTlas(*m_alloc, m_tlas,
+                            vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+                                | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+
+    vk::AccelerationStructureKHR                   tlas = m_rtBuilder.getAccelerationStructure();
+    vk::WriteDescriptorSetAccelerationStructureKHR descASInfo;
+    descASInfo.setAccelerationStructureCount(1);
+    descASInfo.setPAccelerationStructures(&tlas);
+    m_device.updateDescriptorSets(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 0, &descASInfo), nullptr);
+  }
+  else if(moved)
+  {
+    m_rtBuilder.updateTlasMatrices(m_tlas);
+  }
+  return lodChanged || moved;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -33,6 +33,7 @@
 #include "nvmath/nvmath.h"
 #include "nvvk/raytraceKHR_vk.hpp"
 #include "obj.hpp"
+#include "tlas_builder_vk.h"
 
 class Raytracer
 {
@@ -43,10 +44,16 @@ public:
              uint32_t                  queueFamily);
   void destroy();
 
-  nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model);
+  nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model, uint32_t lod = 0);
   nvvk::RaytracingBuilderKHR::Blas implicitToVkGeometryKHR(const ImplInst& implicitObj);
   void createBottomLevelAS(std::vector<ObjModel>& models, ImplInst& implicitObj);
-  void createTopLevelAS(std::vector<ObjInstance>& instances, ImplInst& implicitObj);
+  void createTopLevelAS(const std::vector<ObjModel>&    models,
+                        const std::vector<ObjInstance>& instances,
+                        ImplInst&                       implicitObj,
+                        const vk::Extent2D&             size);
+  bool updateLods(const std::vector<ObjModel>&    models,
+                  const std::vector<ObjInstance>& instances,
+                  const vk::Extent2D&             size);
   void createRtDescriptorSet(const vk::ImageView& outputImage);
   void updateRtDescriptorSet(const vk::ImageView& outputImage);
   void createRtPipeline(vk::DescriptorSetLayout& sceneDescLayout);
@@ -57,7 +64,17 @@ public:
                 vk::Extent2D&            size,
                 ObjPushConstants&        sceneConstants);
 
+  float m_lodPixelError{1.f};  // Largest LOD error on screen
+
 private:
+  uint32_t selectInstanceLod(const ObjModel&      model,
+                             const ObjInstance&   instance,
+                             const nvmath::vec3f& eye,
+                             const vk::Extent2D&  size) const;
+  void     setInstanceLod(nvvk::RaytracingBuilderKHR::Instance& rayInst,
+                          const ObjModel&                       model,
+                          uint32_t                              lod) const;
+
   nvvk::Allocator*   m_alloc{nullptr};  // Allocator for buffer, images, acceleration structures
   vk::PhysicalDevice m_physicalDevice;
   vk::Device         m_device;
@@ -66,7 +83,7 @@ private:
 
 
   vk::PhysicalDeviceRayTracingPropertiesKHR           m_rtProperties;
-  nvvk::RaytracingBuilderKHR                          m_rtBuilder;
+  RebuildableRaytracingBuilder                        m_rtBuilder;
   nvvk::DescriptorSetBindings                         m_rtDescSetLayoutBind;
   vk::DescriptorPool                                  m_rtDescPool;
   vk::DescriptorSetLayout                             m_rtDescSetLayout;
@@ -75,6 +92,8 @@ private:
   vk::PipelineLayout                                  m_rtPipelineLayout;
   vk::Pipeline                                        m_rtPipeline;
   nvvk::Buffer                                        m_rtSBTBuffer;
+  std::vector<nvvk::RaytracingBuilderKHR::Instance>   m_tlas;
+  std::vector<uint32_t>                               m_instanceLod;  // Level of each OBJ instance
 
   struct RtPushConstants
   {
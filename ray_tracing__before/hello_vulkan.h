@@ -48,7 +48,7 @@ public:
              uint32_t                  queueFamily) override;
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
-  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1));
+  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1), bool weld = false);
   void updateDescriptorSet();
   void createUniformBuffer();
   void createSceneDescriptionBuffer();
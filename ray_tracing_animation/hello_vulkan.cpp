@@ -33,6 +33,7 @@ extern std::vector<std::string> defaultSearchPaths;
 #define STB_IMAGE_IMPLEMENTATION
 #include "fileformats/stb_image.h"
 #include "obj_loader.h"
+#include "baked_texture_vk.h"
 
 #include "hello_vulkan.h"
 #include "nvh//cameramanipulator.hpp"
@@ -206,14 +207,22 @@ void HelloVulkan::createGraphicsPipeline()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Loading the OBJ file and setting up all buffers
+// Loading the OBJ file and setting up all buffers. With weld, identical vertices are merged
+// into an indexed mesh (see ObjLoader::weldVertices).
 //
-void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform)
+void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform, bool weld)
 {
   using vkBU = vk::BufferUsageFlagBits;
 
   ObjLoader loader;
-  loader.loadModel(filename);
+  if(!loader.loadCache(filename, weld))
+  {
+    loader.loadModel(filename);
+    if(weld)
+      loader.weldVertices();
+    loader.buildMeshlets();
+    loader.saveCache(filename);
+  }
 
   // Converting from Srgb to linear
   for(auto& m : loader.m_materials)
@@ -232,6 +241,8 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
   ObjModel model;
   model.nbIndices  = static_cast<uint32_t>(loader.m_indices.size());
   model.nbVertices = static_cast<uint32_t>(loader.m_vertices.size());
+  model.bvh        = std::make_shared<DeformingBvh>();
+  model.bvh->build(&loader.m_vertices.data()->pos, sizeof(VertexObj), loader.m_indices.data(), loader.m_indices.size());
 
   // Create the buffers on Device and copy vertices, indices and materials
   nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
@@ -297,8 +308,6 @@ void HelloVulkan::createSceneDescriptionBuffer()
 void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
                                       const std::vector<std::string>& textures)
 {
-  using vkIU = vk::ImageUsageFlagBits;
-
   vk::SamplerCreateInfo samplerCreateInfo{
       {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
   samplerCreateInfo.setMaxLod(FLT_MAX);
@@ -326,44 +335,16 @@ void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
   }
   else
   {
-    // Uploading all images
+    // Mip chains and block compression are baked on the CPU and cached next to the images
+    std::vector<std::string> txtFiles;
+    txtFiles.reserve(textures.size());
     for(const auto& texture : textures)
-    {
-      std::stringstream o;
-      int               texWidth, texHeight, texChannels;
-      o << "media/textures/" << texture;
-      std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths);
-
-      stbi_uc* stbi_pixels = stbi_load(txtFile.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-      std::array<stbi_uc, 4> color{255u, 0u, 255u, 255u};
-
-      stbi_uc* pixels = stbi_pixels;
-      // Handle failure
-      if(!stbi_pixels)
-      {
-        texWidth = texHeight = 1;
-        texChannels          = 4;
-        pixels               = reinterpret_cast<stbi_uc*>(color.data());
-      }
-
-      vk::DeviceSize bufferSize = static_cast<uint64_t>(texWidth) * texHeight * sizeof(uint8_t) * 4;
-      auto           imgSize    = vk::Extent2D(texWidth, texHeight);
-      auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, vkIU::eSampled, true);
-
-      {
-        nvvk::ImageDedicated image =
-            m_alloc.createImage(cmdBuf, bufferSize, pixels, imageCreateInfo);
-        nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-        vk::ImageViewCreateInfo ivInfo =
-            nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        nvvk::Texture texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-        m_textures.push_back(texture);
-      }
-
-      stbi_image_free(stbi_pixels);
-    }
+      txtFiles.push_back(nvh::findFile("media/textures/" + texture, defaultSearchPaths));
+    TextureCompression compression = supportedTextureCompression(m_physicalDevice, TextureCompression::eBC7, true);
+    std::vector<std::shared_ptr<const BakedTexture>> baked = bakeTextures(txtFiles, compression, true);
+
+    // Uploading all levels of all images
+    createBakedTextures(m_alloc, m_device, m_graphicsQueueIndex, baked, samplerCreateInfo, m_textures);
   }
 }
 
@@ -703,6 +684,15 @@ void HelloVulkan::createTopLevelAS()
   }
   m_rtBuilder.buildTlas(m_tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
                                     | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+
+  // Same instances on the CPU, over the BLAS of each model
+  std::vector<std::shared_ptr<const TriangleBvh>> blas;
+  for(const auto& model : m_objModel)
+    blas.push_back(model.bvh->bvh());
+  std::vector<SceneBvhInstance> instances(m_objInstance.size());
+  for(size_t i = 0; i < m_objInstance.size(); i++)
+    instances[i] = {m_objInstance[i].transform, m_objInstance[i].objIndex};
+  m_sceneBvh.build(std::move(blas), instances);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -967,6 +957,7 @@ void HelloVulkan::animationInstances(float time)
   m_alloc.destroy(stagingBuffer);
 
   m_rtBuilder.updateTlasMatrices(m_tlas);
+  m_sceneBvh.refit(&m_objInstance[0].transform, sizeof(ObjInstance));
 }
 
 void HelloVulkan::animationObject(float time)
@@ -986,6 +977,18 @@ void HelloVulkan::animationObject(float time)
   cmdBuf.dispatch(model.nbVertices, 1, 1);
   genCmdBuf.submitAndWait(cmdBuf);
   m_rtBuilder.updateBlas(2);
+
+  // Same deformation as anim.comp on the CPU side, then refit or rebuild of the hierarchies
+  std::vector<nvmath::vec3f> positions = model.bvh->positions();
+  for(auto& pos : positions)
+  {
+    const float PI     = 3.14159265f;
+    const float signY  = (pos.y >= 0 ? 1.f : -1.f);
+    const float radius = sqrtf(pos.x * pos.x + pos.z * pos.z);
+    pos.y              = signY * fabsf(sinf(time * 4 + radius * PI)) * 0.5f;
+  }
+  model.bvh->update(positions.data(), sizeof(nvmath::vec3f));
+  m_sceneBvh.refit(&m_objInstance[0].transform, sizeof(ObjInstance));
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -35,6 +35,9 @@
 // #VKRay
 #include "nvvk/raytraceKHR_vk.hpp"
 
+#include "lbvh.h"
+#include "scene_bvh.h"
+
 //--------------------------------------------------------------------------------------------------
 // Simple rasterizer of OBJ objects
 // - Each OBJ loaded are stored in an `ObjModel` and referenced by a `ObjInstance`
@@ -51,7 +54,7 @@ public:
              uint32_t                  queueFamily) override;
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
-  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1));
+  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1), bool weld = false);
   void updateDescriptorSet();
   void createUniformBuffer();
   void createSceneDescriptionBuffer();
@@ -71,6 +74,7 @@ public:
     nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles
     nvvk::Buffer matColorBuffer;  // Device buffer of array of 'Wavefront material'
     nvvk::Buffer matIndexBuffer;  // Device buffer of array of 'Wavefront material'
+    std::shared_ptr<DeformingBvh> bvh;  // CPU-side BLAS, shared by all instances
   };
 
   // Instance of the OBJ
@@ -156,6 +160,7 @@ public:
 
   std::vector<nvvk::RaytracingBuilderKHR::Instance> m_tlas;
   std::vector<nvvk::RaytracingBuilderKHR::Blas>     m_blas;
+  SceneBvh                                          m_sceneBvh;  // CPU counterpart of the TLAS
 
   struct RtPushConstant
   {
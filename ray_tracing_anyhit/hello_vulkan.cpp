@@ -33,6 +33,7 @@ extern std::vector<std::string> defaultSearchPaths;
 #define STB_IMAGE_IMPLEMENTATION
 #include "fileformats/stb_image.h"
 #include "obj_loader.h"
+#include "baked_texture_vk.h"
 
 #include "hello_vulkan.h"
 #include "nvh//cameramanipulator.hpp"
@@ -209,14 +210,22 @@ void HelloVulkan::createGraphicsPipeline()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Loading the OBJ file and setting up all buffers
+// Loading the OBJ file and setting up all buffers. With weld, identical vertices are merged
+// into an indexed mesh (see ObjLoader::weldVertices).
 //
-void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform)
+void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform, bool weld)
 {
   using vkBU = vk::BufferUsageFlagBits;
 
   ObjLoader loader;
-  loader.loadModel(filename);
+  if(!loader.loadCache(filename, weld))
+  {
+    loader.loadModel(filename);
+    if(weld)
+      loader.weldVertices();
+    loader.buildMeshlets();
+    loader.saveCache(filename);
+  }
 
   // Converting from Srgb to linear
   for(auto& m : loader.m_materials)
@@ -300,8 +309,6 @@ void HelloVulkan::createSceneDescriptionBuffer()
 void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
                                       const std::vector<std::string>& textures)
 {
-  using vkIU = vk::ImageUsageFlagBits;
-
   vk::SamplerCreateInfo samplerCreateInfo{
       {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
   samplerCreateInfo.setMaxLod(FLT_MAX);
@@ -329,44 +336,16 @@ void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
   }
   else
   {
-    // Uploading all images
+    // Mip chains and block compression are baked on the CPU and cached next to the images
+    std::vector<std::string> txtFiles;
+    txtFiles.reserve(textures.size());
     for(const auto& texture : textures)
-    {
-      std::stringstream o;
-      int               texWidth, texHeight, texChannels;
-      o << "media/textures/" << texture;
-      std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths);
-
-      stbi_uc* stbi_pixels = stbi_load(txtFile.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-      std::array<stbi_uc, 4> color{255u, 0u, 255u, 255u};
-
-      stbi_uc* pixels = stbi_pixels;
-      // Handle failure
-      if(!stbi_pixels)
-      {
-        texWidth = texHeight = 1;
-        texChannels          = 4;
-        pixels               = reinterpret_cast<stbi_uc*>(color.data());
-      }
-
-      vk::DeviceSize bufferSize = static_cast<uint64_t>(texWidth) * texHeight * sizeof(uint8_t) * 4;
-      auto           imgSize    = vk::Extent2D(texWidth, texHeight);
-      auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, vkIU::eSampled, true);
-
-      {
-        nvvk::ImageDedicated image =
-            m_alloc.createImage(cmdBuf, bufferSize, pixels, imageCreateInfo);
-        nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-        vk::ImageViewCreateInfo ivInfo =
-            nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        nvvk::Texture texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-        m_textures.push_back(texture);
-      }
-
-      stbi_image_free(stbi_pixels);
-    }
+      txtFiles.push_back(nvh::findFile("media/textures/" + texture, defaultSearchPaths));
+    TextureCompression compression = supportedTextureCompression(m_physicalDevice, TextureCompression::eBC7, true);
+    std::vector<std::shared_ptr<const BakedTexture>> baked = bakeTextures(txtFiles, compression, true);
+
+    // Uploading all levels of all images
+    createBakedTextures(m_alloc, m_device, m_graphicsQueueIndex, baked, samplerCreateInfo, m_textures);
   }
 }
 
@@ -0,0 +1,811 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "CpuPathTracer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "parallel.h"
+#include "vertex_packing.h"
+
+using nvmath::mat4f;
+using nvmath::vec2f;
+using nvmath::vec3f;
+using nvmath::vec4f;
+
+namespace {
+// --- sampling.glsl ---
+const float kPi    = 3.14159265f;
+const float kTwoPi = 6.2831852436065673828125f;
+
+float rnd(SampleStream& prev)
+{
+	return prev.next();
+}
+
+vec3f samplingCosHemisphere(const vec2f& u, const vec3f& x, const vec3f& y, const vec3f& z)
+{
+	float r1 = u.x;
+	float r2 = u.y;
+	float sq = std::sqrt(1.f - r2);
+
+	return x * (std::cos(2 * kPi * r1) * sq) + y * (std::sin(2 * kPi * r1) * sq) + z * std::sqrt(r2);
+}
+
+void createCoordinateSystem(const vec3f& n, vec3f& b1, vec3f& b2)
+{
+	float sign = n.z > 0.f ? 1.f : -1.f;
+	float a    = -1.f / (sign + n.z);
+	float b    = n.x * n.y * a;
+	b1         = vec3f(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	b2         = vec3f(b, sign + n.y * n.y * a, -n.y);
+}
+
+vec2f sampleDisk(SampleStream& seed, float rad)
+{
+	float r    = std::sqrt(rnd(seed)) * rad;
+	float t    = rnd(seed) * kTwoPi - kPi;
+	float cost = std::cos(t);
+	float sint = std::sqrt(1 - cost * cost) * float((t > 0.f) - (t < 0.f));
+	return vec2f(r * cost, r * sint);
+}
+
+vec3f sampleConeDirection(const vec2f& u, const vec3f& axisDir, float oneMinusCosR)
+{
+	// Uniform in solid angle: cos(theta) is uniform in [cos(R), 1]
+	float oneMinusCost = u.x * oneMinusCosR;
+	float cost         = 1.f - oneMinusCost;
+	float sint         = std::sqrt(std::max(0.f, oneMinusCost * (2.f - oneMinusCost)));
+	float phi          = kTwoPi * u.y;
+
+	// Create a tangent space around the cone axis
+	vec3f b, t;
+	createCoordinateSystem(axisDir, t, b);
+
+	// Reconstruct the sampled direction
+	return t * (std::cos(phi) * sint) + b * (std::sin(phi) * sint) + axisDir * cost;
+}
+
+float conePdf(float oneMinusCosR)
+{
+	return 1.f / (kTwoPi * oneMinusCosR);
+}
+
+// --- pathtrace.rgen ---
+float D_GGX(float ndh, float a)
+{
+	float k = a / std::max(1e-4f, (ndh * ndh) * (a * a - 1) + 1);
+	return k * k / kPi;
+}
+
+float mix(float x, float y, float a)
+{
+	return x + (y - x) * a;
+}
+
+vec3f mix(const vec3f& x, const vec3f& y, float a)
+{
+	return x + (y - x) * a;
+}
+
+float SmithGGX_G2Approx(float ndv, float ndl, float a)
+{
+	return 0.5f / mix(2 * ndl * ndv, ndl + ndv, a);
+}
+
+float SmithGGXG1(float ndv, float alpha)
+{
+	float a2  = alpha * alpha;
+	float num = 2 * ndv;
+	float den = ndv + std::sqrt(a2 + (1 - a2) * ndv * ndv);
+	return num / std::max(den, 1e-6f);
+}
+
+vec3f F_Schlick(float hdl, const vec3f& f0)
+{
+	float p  = (1 - hdl);
+	float p2 = p * p;
+	float p5 = p * p2 * p2;
+	return f0 + (vec3f(1.f) - f0) * p5;
+}
+
+vec3f sampleGGXVNDF(const vec2f& u, const vec3f& Ve, float alpha_x, float alpha_y)
+{
+	float U1 = u.x;
+	float U2 = u.y;
+
+	// Transform view direction into hemisphere configuration
+	vec3f Vh = normalize(vec3f(alpha_x * Ve.x, alpha_y * Ve.y, Ve.z));
+
+	// Orthonormal basis (with special case if cross product is zero)
+	float lensq = Vh.x * Vh.x + Vh.y * Vh.y;
+	vec3f T1    = lensq > 0 ? vec3f(-Vh.y, Vh.x, 0) / std::sqrt(lensq) : vec3f(1, 0, 0);
+	vec3f T2    = cross(Vh, T1);
+
+	// Parameterization of the projected area
+	float r   = std::sqrt(U1);
+	float phi = 2.f * kPi * U2;
+	float t1  = r * std::cos(phi);
+	float t2  = r * std::sin(phi);
+	float s   = 0.5f * (1.f + Vh.z);
+	t2        = (1.f - s) * std::sqrt(1.f - t1 * t1) + s * t2;
+
+	// Reprojection onto hemisphere
+	vec3f Nh = T1 * t1 + T2 * t2 + Vh * std::sqrt(std::max(0.f, 1.f - t1 * t1 - t2 * t2));
+
+	// Transforming the normal back to the ellipsoid configuration
+	return normalize(vec3f(alpha_x * Nh.x, alpha_y * Nh.y, std::max(0.f, Nh.z)));
+}
+
+// Power heuristic of Veach, weight of the strategy of pdf a against the one of pdf b
+float misWeight(float a, float b)
+{
+	float a2 = a * a;
+	float b2 = b * b;
+	return a2 + b2 > 0.f ? a2 / (a2 + b2) : 0.f;
+}
+
+// Stretches a random number below threshold, or above it, back to [0, 1)
+float stretch(float u, float threshold)
+{
+	float v = u < threshold ? u / threshold : (u - threshold) / (1.f - threshold);
+	return std::min(v, 0.99999994f);
+}
+
+vec3f reflect(const vec3f& i, const vec3f& n)
+{
+	return i - n * (2.f * dot(n, i));
+}
+
+vec3f mul(const vec3f& a, const vec3f& b)
+{
+	return vec3f(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+vec4f mul(const vec4f& a, const vec4f& b)
+{
+	return vec4f(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w);
+}
+
+template <class T>
+T interpolate(const T& a, const T& b, const T& c, const vec3f& barycentrics)
+{
+	return a * barycentrics.x + b * barycentrics.y + c * barycentrics.z;
+}
+
+// Leaves the hits of opaque materials to the closest hit, like the driver with rayFlags 0
+bool isOpaque(const nvh::GltfMaterial& mat)
+{
+	return mat.alphaMode == 0 || ((mat.pbrBaseColorTexture < 0) && (mat.pbrBaseColorFactor.w == 1));
+}
+
+const float kTMax = 10000.f;
+
+const float kSunAngularRadius = 0.0046f;  // Radians
+// Below this, D_GGX does not resolve the peak of the lobe any more
+const float kMinAlpha = 1e-2f;
+
+float luminance(const vec3f& color)
+{
+	return dot(color, vec3f(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Texel values of the R8G8B8A8_UNORM and R8G8B8A8_SRGB textures of RenderScene
+struct TexelTables
+{
+	float unorm[256];
+	float srgb[256];
+
+	TexelTables()
+	{
+		for(int i = 0; i < 256; i++)
+		{
+			float v  = float(i) / 255.f;
+			unorm[i] = v;
+			srgb[i]  = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+		}
+	}
+};
+const TexelTables kTexelTables;
+}  // namespace
+
+// Diffuse lobe and GGX lobe sampled by its visible normals, picked with specularProbability
+struct CpuPathTracer::Bsdf
+{
+	vec3f normal;
+	vec3f tangent;
+	vec3f bitangent;
+	vec3f eye;  // Towards the viewer
+	vec3f diffuseColor;
+	vec3f specularColor;
+	float alpha;
+	float diffuseWeight;   // 0 if the render flags ignore the lobe
+	float specularWeight;  // Same
+	float specularProbability;
+
+	// BSDF times the cosine of direction l, and the pdf of sample() returning l
+	vec3f eval(const vec3f& l, float& pdf) const
+	{
+		pdf       = 0.f;
+		float ndl = dot(l, normal);
+		if(!(ndl > 0))
+			return vec3f(0.f);
+
+		vec3f H   = normalize(l + eye);
+		float ndh = std::max(0.f, dot(H, normal));
+		float hdl = std::max(0.f, dot(H, l));
+		float ndv = std::max(1e-4f, dot(normal, eye));
+		float D   = D_GGX(ndh, alpha);
+		float G   = SmithGGX_G2Approx(ndv, ndl, alpha);
+		vec3f Fr  = F_Schlick(hdl, specularColor) * (D * G);
+
+		// The visible normals have the density G1 * D * vdh / ndv, the reflection divides it by 4 vdh
+		pdf = (1.f - specularProbability) * ndl / kPi + specularProbability * SmithGGXG1(ndv, alpha) * D / (4.f * ndv);
+		return (diffuseColor * (diffuseWeight / kPi) + Fr * specularWeight) * ndl;
+	}
+
+	// The lobe and the direction share two dimensions: the first one picks the lobe, then is
+	// stretched back to [0, 1)
+	vec3f sample(vec2f u) const
+	{
+		bool specular = u.x < specularProbability;
+		u.x           = stretch(u.x, specularProbability);
+		if(!specular)
+			return samplingCosHemisphere(u, tangent, bitangent, normal);
+
+		// Scatter ray direction using the distribution of visible normals, in tangent space
+		vec3f tsEye(dot(eye, tangent), dot(eye, bitangent), dot(eye, normal));
+		vec3f tsH = sampleGGXVNDF(u, tsEye, alpha, alpha);
+		vec3f H   = tangent * tsH.x + bitangent * tsH.y + normal * tsH.z;
+		return reflect(-eye, H);
+	}
+};
+
+// Environment of pathtrace.rgen
+struct CpuPathTracer::Environment
+{
+	vec3f sunDirection;
+	float sunOneMinusCos;
+	float sunIntensity;
+	float sunRadiance;  // Its irradiance at normal incidence is the sun intensity
+	// Shape of the luminance of the sky: low below the horizon, then linear up to high at the zenith
+	float skyLow;
+	float skyHigh;
+	float skyMass;   // Integral of the shape over the height of the direction, in [-1, 1]
+	float skyScale;  // Luminance of the sky is the shape times this
+	bool  mis;       // The sky is light sampled as well, else the sun only is
+
+	explicit Environment(const PathTraceSettings& settings)
+	{
+		float sunSin   = std::sin(0.5f * kSunAngularRadius);
+		sunDirection   = settings.lightPosition;
+		sunOneMinusCos = 2.f * sunSin * sunSin;
+		sunIntensity   = std::max(0.f, settings.sunIntensity);
+		sunRadiance    = settings.sunIntensity * conePdf(sunOneMinusCos);
+
+		// Luminance of the sky colors, see skyColor
+		bool  greyFurnace = (settings.renderFlags & kFlagGreyFurnace) != 0;
+		vec3f clearColor(settings.clearColor);
+		skyScale          = greyFurnace ? 0.7f : std::max(0.f, settings.skyIntensity);
+		skyLow            = greyFurnace ? 1.f : std::max(0.f, luminance(clearColor));
+		skyHigh           = 1.f;
+		skyMass           = skyLow + 0.5f * (skyLow + skyHigh);
+		mis               = (settings.renderFlags & kFlagImportanceSampling) != 0;
+	}
+
+	// Probability of the light samples of a hit to pick the sun, the others sample the sky, or -1
+	// if there is nothing to sample. There is one shadow ray per hit: the sun, small and bright,
+	// gets it whenever it is above the horizon of the hit, BSDF samples find the sky well already.
+	float sunSampleProbability(const Bsdf& bsdf) const
+	{
+		if(!mis || (sunIntensity > 0.f && dot(sunDirection, bsdf.normal) > 0.f))
+			return 1.f;
+		return skyScale > 0.f ? 0.f : -1.f;
+	}
+
+	bool inSun(const vec3f& direction) const { return dot(direction, sunDirection) >= 1.f - sunOneMinusCos; }
+
+	float skyPdf(const vec3f& direction) const
+	{
+		float shape = direction.y > 0.f ? skyLow + (skyHigh - skyLow) * std::min(direction.y, 1.f) : skyLow;
+		return shape / (kTwoPi * skyMass);
+	}
+
+	// The height of the direction follows the shape, its azimuth is uniform
+	vec3f sampleSky(const vec2f& u) const
+	{
+		float m = u.x * skyMass;
+		float y;
+		if(m < skyLow)
+			y = m / skyLow - 1.f;
+		else
+		{
+			float t = m - skyLow;
+			y       = std::min(1.f, 2.f * t / std::max(1e-8f, skyLow + std::sqrt(skyLow * skyLow + 2.f * (skyHigh - skyLow) * t)));
+		}
+		float r   = std::sqrt(std::max(0.f, 1.f - y * y));
+		float phi = kTwoPi * u.y;
+		return vec3f(r * std::cos(phi), y, r * std::sin(phi));
+	}
+
+	// Density of the light samples of a hit
+	float lightPdf(const vec3f& direction, float sunProbability) const
+	{
+		if(sunProbability < 0.f)
+			return 0.f;
+		float pdf = inSun(direction) ? sunProbability * conePdf(sunOneMinusCos) : 0.f;
+		if(sunProbability < 1.f)
+			pdf += (1.f - sunProbability) * skyPdf(direction);
+		return pdf;
+	}
+};
+
+CpuPathTracer::CpuPathTracer(const SceneData& scene, uint32_t samplerSeed)
+	: m_scene(scene)
+	, m_samplerTables(samplerSeed)
+{
+	// The hierarchies stay owned by the scene
+	std::vector<std::shared_ptr<const TriangleBvh>> blas;
+	blas.reserve(scene.m_bvhs.size());
+	for(const auto& bvh : scene.m_bvhs)
+		blas.emplace_back(std::shared_ptr<const TriangleBvh>(), &bvh);
+
+	std::vector<SceneBvhInstance> instances(scene.m_worldFromInstance.size());
+	m_instances.resize(instances.size());
+	for(size_t i = 0; i < instances.size(); i++)
+	{
+		const mat4f& worldFromObject = scene.m_worldFromInstance[i];
+		uint32_t     primitive       = scene.m_nodePrimitivesLUT[i];
+		instances[i].transform       = worldFromObject;
+		instances[i].blasId          = scene.m_primitiveBvh[primitive];
+		m_instances[i]               = {worldFromObject, transpose(invert(worldFromObject)), primitive};
+	}
+	m_sceneBvh.build(std::move(blas), instances);
+
+	for(const auto& material : scene.m_materials.values())
+		m_alphaTested |= !isOpaque(material);
+}
+
+void CpuIntegrator::render(const Eye&               eye,
+						   uint32_t                 width,
+						   uint32_t                 height,
+						   uint32_t                 spp,
+						   const PathTraceSettings& settings,
+						   std::vector<vec3f>&      image,
+						   uint32_t                 threadCount) const
+{
+	TileScheduler scheduler;
+	image.assign(size_t(width) * height, vec3f(0.f));
+	renderPass(eye, width, height, 0, spp, settings, image, scheduler, threadCount);
+}
+
+void CpuIntegrator::accumulate(vec3f& pixel, const vec3f& sum, uint32_t firstSample, uint32_t spp)
+{
+	// Running average, as the GPU accumulates its frames
+	float historyWeight = float(firstSample) / float(firstSample + spp);
+	float sampleWeight  = 1.f / float(firstSample + spp);
+	pixel               = firstSample ? pixel * historyWeight + sum * sampleWeight : sum * sampleWeight;
+}
+
+bool CpuPathTracer::renderPass(const Eye&               eye,
+							   uint32_t                 width,
+							   uint32_t                 height,
+							   uint32_t                 firstSample,
+							   uint32_t                 spp,
+							   const PathTraceSettings& settings,
+							   std::vector<vec3f>&      image,
+							   TileScheduler&           scheduler,
+							   uint32_t                 threadCount,
+							   const std::atomic<bool>* cancel) const
+{
+	image.resize(size_t(width) * height, vec3f(0.f));
+	if(spp == 0)
+		return true;
+	if(scheduler.width() != width || scheduler.height() != height)
+		scheduler.resize(width, height, scheduler.tileSize() ? scheduler.tileSize() : 32);
+
+	mat4f projInverse = invert(eye.projection);
+	auto  renderTile  = [&](const RenderTile& tile, uint32_t) {
+		for(uint32_t y = tile.y; y < tile.y + tile.height; y++)
+		{
+			if(cancel && cancel->load(std::memory_order_relaxed))
+				return;
+			for(uint32_t x = tile.x; x < tile.x + tile.width; x++)
+			{
+				vec3f sum(0.f);
+				for(uint32_t s = firstSample; s < firstSample + spp; s++)
+					sum += tracePath(eye.worldFromView, projInverse, x, y, width, height, s, settings);
+				accumulate(image[size_t(y) * width + x], sum, firstSample, spp);
+			}
+		}
+	};
+	bool done = scheduler.run(renderTile, threadCount ? threadCount : getWorkerCount(), cancel);
+	return done && !(cancel && cancel->load());
+}
+
+vec3f CpuPathTracer::tracePath(const mat4f&             viewInverse,
+							   const mat4f&             projInverse,
+							   uint32_t                 x,
+							   uint32_t                 y,
+							   uint32_t                 width,
+							   uint32_t                 height,
+							   uint32_t                 sample,
+							   const PathTraceSettings& settings) const
+{
+	vec3f        rayOrigin, rayDirection;
+	SampleStream seed = cameraRay(viewInverse, projInverse, x, y, width, height, sample, settings, rayOrigin, rayDirection);
+
+	vec3f lightModulation(1.f);
+	vec3f rayAccumLight(0.f);
+
+	HitPayload prd;
+	float      escapeWeight = 1.f;
+	for(int rayDepth = 0; rayDepth <= settings.maxBounces; rayDepth++)
+	{
+		SceneBvhHit hit;
+		if(!intersect(rayOrigin, rayDirection, seed.anyHitStream(rayDepth, false), hit))
+		{
+			// The light of the previous hit, always show the background
+			if(rayDepth > settings.firstBounce || rayDepth == 0)
+				rayAccumLight += mul(lightModulation, escapedLight(rayDirection, escapeWeight, settings));
+			break;
+		}
+		closestHit(hit, settings, prd);
+		rayAccumLight += mul(lightModulation, prd.emittance);  // Emissive light from the model
+
+		vec3f       brdf;
+		LightSample light;
+		bool scattered = scatter(prd, rayDepth, settings, seed, rayOrigin, rayDirection, brdf, escapeWeight, light);
+		if(light.valid && !occluded(rayOrigin, light.direction, light.anyHitSamples))
+			rayAccumLight += mul(lightModulation, light.radiance);
+		if(!scattered)
+			break;
+		lightModulation = mul(lightModulation, brdf);
+	}
+	return rayAccumLight;
+}
+
+SampleStream CpuPathTracer::cameraRay(const mat4f&             viewInverse,
+									  const mat4f&             projInverse,
+									  uint32_t                 x,
+									  uint32_t                 y,
+									  uint32_t                 width,
+									  uint32_t                 height,
+									  uint32_t                 sample,
+									  const PathTraceSettings& settings,
+									  vec3f&                   rayOrigin,
+									  vec3f&                   rayDirection) const
+{
+	// Initialize the random number
+	SampleStream seed = SampleStream::start(m_samplerTables, settings.samplerType, x, y, width, sample);
+
+	float       jitterX = rnd(seed);
+	float       jitterY = rnd(seed);
+	const vec2f inUV((float(x) + jitterX) / float(width), (float(y) + jitterY) / float(height));
+	vec2f       d = inUV * 2.f - vec2f(1.f, 1.f);
+
+	vec4f origin    = viewInverse * vec4f(0, 0, 0, 1);
+	vec4f target    = projInverse * vec4f(d.x, d.y, 1, 1);
+	vec4f direction = viewInverse * vec4f(normalize(vec3f(target)), 0);
+
+	if(settings.renderFlags & kFlagDepthOfField)
+	{
+		vec2f lens = sampleDisk(seed, settings.lensRadius);
+		vec4f viewSpaceLensSample(lens.x, lens.y * float(width) / float(height), 0, 1);
+		origin = viewInverse * viewSpaceLensSample;
+
+		direction = viewInverse * vec4f(normalize(vec3f(target) * settings.focalDistance - vec3f(viewSpaceLensSample)), 0);
+	}
+
+	rayOrigin    = vec3f(origin);
+	rayDirection = vec3f(direction);
+	return seed;
+}
+
+vec3f CpuPathTracer::skyColor(const vec3f& direction, const PathTraceSettings& settings) const
+{
+	if(settings.renderFlags & kFlagGreyFurnace)
+		return vec3f(0.7f);
+	return mix(vec3f(settings.clearColor), vec3f(1.f), std::max(0.f, std::min(1.f, direction.y))) * settings.skyIntensity;
+}
+
+vec3f CpuPathTracer::escapedLight(const vec3f& direction, float escapeWeight, const PathTraceSettings& settings) const
+{
+	vec3f light = skyColor(direction, settings);
+	// Without MIS, the sun is only reached by light samples
+	if(!(settings.renderFlags & kFlagImportanceSampling))
+		return light;
+
+	Environment environment(settings);
+	if(environment.inSun(direction))
+		light += vec3f(environment.sunRadiance);
+	return light * escapeWeight;
+}
+
+bool CpuPathTracer::scatter(const HitPayload&        prd,
+							int                      rayDepth,
+							const PathTraceSettings& settings,
+							SampleStream&            seed,
+							vec3f&                   rayOrigin,
+							vec3f&                   rayDirection,
+							vec3f&                   brdf,
+							float&                   escapeWeight,
+							LightSample&             light) const
+{
+	Bsdf bsdf;
+	bsdf.normal = prd.worldNormal;
+	rayOrigin   = vec3f(prd.worldPosition) + bsdf.normal * std::max(1e-6f, 1e-6f * prd.worldPosition.w);
+	bsdf.eye    = -rayDirection;
+	bsdf.alpha  = std::max(kMinAlpha, prd.roughness * prd.roughness);
+
+	// Reconstruct PBR material
+	bsdf.specularColor = mix(vec3f(0.04f), vec3f(prd.baseColor), prd.metallic);
+	bsdf.diffuseColor  = vec3f(prd.baseColor) * (1.f - prd.metallic);
+
+	// 50% probability for each lobe, the render flags may ignore one at the first hit
+	bsdf.diffuseWeight       = rayDepth == 0 && (settings.renderFlags & kFlagSpecularOnly) ? 0.f : 1.f;
+	bsdf.specularWeight      = rayDepth == 0 && (settings.renderFlags & kFlagDiffuseOnly) ? 0.f : 1.f;
+	bsdf.specularProbability = bsdf.specularWeight == 0.f ? 0.f : bsdf.diffuseWeight == 0.f ? 1.f : 0.5f;
+	createCoordinateSystem(bsdf.normal, bsdf.tangent, bsdf.bitangent);
+
+	seed.startBounce(rayDepth);
+
+	// Explicitly sample sun and sky light
+	Environment environment(settings);
+	float       sunProbability = environment.sunSampleProbability(bsdf);
+	bool        lightSampling  = rayDepth >= settings.firstBounce && rayDepth < settings.maxBounces;
+	light                      = LightSample();
+	if(lightSampling)
+		light = sampleLight(seed, rayDepth, bsdf, environment, sunProbability, settings);
+
+	if(bsdf.diffuseWeight == 0.f && bsdf.specularWeight == 0.f)
+		return false;
+	vec2f u;
+	u.x           = rnd(seed);
+	u.y           = rnd(seed);
+	vec3f L       = bsdf.sample(u);
+	float bsdfPdf = 0.f;
+	vec3f fr      = bsdf.eval(L, bsdfPdf);
+	if(!(bsdfPdf > 0))
+		return false;  // Below the surface, should really do multiple scattering here
+
+	// If the new ray misses, the light samples could have found the same light
+	escapeWeight = lightSampling ? misWeight(bsdfPdf, environment.lightPdf(L, sunProbability)) : 1.f;
+	brdf         = fr / bsdfPdf;
+	rayDirection = L;
+	return true;
+}
+
+bool CpuPathTracer::intersect(const vec3f& origin, const vec3f& direction, SampleStream anyHitSamples, SceneBvhHit& hit) const
+{
+	BvhRay ray;
+	ray.origin    = origin;
+	ray.direction = direction;
+	ray.tMax      = kTMax;
+	if(!m_alphaTested)
+		return m_sceneBvh.intersectClosest(ray, hit);
+	return m_sceneBvh.intersectClosest(ray, hit, [&](const SceneBvhHit& candidate) { return anyHit(candidate, anyHitSamples); });
+}
+
+// The shader traces a full ray towards the sun, but only tests whether it missed
+bool CpuPathTracer::occluded(const vec3f& origin, const vec3f& direction, SampleStream anyHitSamples) const
+{
+	BvhRay ray;
+	ray.origin    = origin;
+	ray.direction = direction;
+	ray.tMax      = kTMax;
+	if(!m_alphaTested)
+		return m_sceneBvh.intersectAny(ray);
+	return m_sceneBvh.intersectAny(ray, [&](const SceneBvhHit& candidate) { return anyHit(candidate, anyHitSamples); });
+}
+
+std::array<uint32_t, 3> CpuPathTracer::triangleIndices(uint32_t primitive, uint32_t triangle) const
+{
+	const auto&      mesh = m_scene.m_primitives[primitive];
+	PackedIndexRange range{mesh.firstIndex, m_scene.m_primitiveIndices16[primitive] != 0};
+	return {packedIndex(m_scene.m_indices, range, 3 * triangle + 0) + mesh.vertexOffset,
+			packedIndex(m_scene.m_indices, range, 3 * triangle + 1) + mesh.vertexOffset,
+			packedIndex(m_scene.m_indices, range, 3 * triangle + 2) + mesh.vertexOffset};
+}
+
+vec4f CpuPathTracer::sampleTexture(int texture, const vec2f& uv) const
+{
+	if(texture < 0 || size_t(texture) >= m_scene.m_images.size())
+		return vec4f(1.f, 1.f, 1.f, 1.f);
+	const SceneData::Image& image = m_scene.m_images[texture];
+	if(image.width == 0 || image.height == 0)
+		return vec4f(1.f, 1.f, 1.f, 1.f);
+
+	float x  = uv.x * float(image.width) - 0.5f;
+	float y  = uv.y * float(image.height) - 0.5f;
+	float x0 = std::floor(x);
+	float y0 = std::floor(y);
+	float fx = x - x0;
+	float fy = y - y0;
+
+	auto wrap = [](float c, uint32_t size) {
+		int64_t i = int64_t(c) % int64_t(size);
+		return uint32_t(i < 0 ? i + size : i);
+	};
+	// Decoded before filtering, like the sampler does. Alpha is always linear.
+	const float* color = image.srgb ? kTexelTables.srgb : kTexelTables.unorm;
+	auto         texel = [&](uint32_t tx, uint32_t ty) {
+		const uint8_t* p = &image.pixels[(size_t(ty) * image.width + tx) * 4];
+		return vec4f(color[p[0]], color[p[1]], color[p[2]], kTexelTables.unorm[p[3]]);
+	};
+	uint32_t tx0 = wrap(x0, image.width), tx1 = wrap(x0 + 1, image.width);
+	uint32_t ty0 = wrap(y0, image.height), ty1 = wrap(y0 + 1, image.height);
+	vec4f    top    = texel(tx0, ty0) * (1 - fx) + texel(tx1, ty0) * fx;
+	vec4f    bottom = texel(tx0, ty1) * (1 - fx) + texel(tx1, ty1) * fx;
+	return top * (1 - fy) + bottom * fy;
+}
+
+// pathtrace.rahit
+bool CpuPathTracer::anyHit(const SceneBvhHit& hit, SampleStream& seed) const
+{
+	uint32_t primitive = m_instances[hit.instance].primitive;
+	int      matIndex  = m_scene.m_primitives[primitive].materialIndex;
+	if(matIndex < 0)
+		return true;  // Accept intersection. Default material is opaque.
+
+	const nvh::GltfMaterial& mat = m_scene.m_materials.values()[matIndex];
+	if(isOpaque(mat))
+		return true;
+
+	auto  indices      = triangleIndices(primitive, hit.hit.triangle);
+	vec3f barycentrics = vec3f(1.f - hit.hit.u - hit.hit.v, hit.hit.u, hit.hit.v);
+	vec2f texcoord0    = interpolate(unpackUnorm2x16(m_scene.m_uvs[indices[0]]), unpackUnorm2x16(m_scene.m_uvs[indices[1]]),
+									 unpackUnorm2x16(m_scene.m_uvs[indices[2]]), barycentrics);
+
+	float alpha = sampleTexture(mat.pbrBaseColorTexture, texcoord0).w;
+	alpha *= mat.pbrBaseColorFactor.w;
+
+	if(mat.alphaMode == 1)  // Cutoff
+		alpha = alpha > mat.alphaCutoff ? 1.f : 0.f;
+	return !(rnd(seed) > alpha);  // Pass through
+}
+
+// pathtrace.rchit
+void CpuPathTracer::closestHit(const SceneBvhHit& hit, const PathTraceSettings& settings, HitPayload& prd) const
+{
+	const Instance& instance = m_instances[hit.instance];
+	auto            indices  = triangleIndices(instance.primitive, hit.hit.triangle);
+	int             matIndex = m_scene.m_primitives[instance.primitive].materialIndex;
+
+	const vec3f barycentrics(1.f - hit.hit.u - hit.hit.v, hit.hit.u, hit.hit.v);
+
+	// Vertex of the triangle
+	const auto& positions = m_scene.m_vtxPositions;
+	vec3f       position  = interpolate(positions[indices[0]], positions[indices[1]], positions[indices[2]], barycentrics);
+	prd.worldPosition     = instance.worldFromObject * vec4f(position, 1.f);
+	prd.worldPosition.w   = hit.hit.t;
+
+	// Normal
+	vec3f msNormal    = interpolate(octDecodeUnitVector(m_scene.m_normals[indices[0]]), octDecodeUnitVector(m_scene.m_normals[indices[1]]),
+								  octDecodeUnitVector(m_scene.m_normals[indices[2]]), barycentrics);
+	vec3f worldNormal = normalize(vec3f(instance.normalFromObject * vec4f(msNormal, 0.f)));
+
+	// Tangent
+	const auto& tangents  = m_scene.m_tangents;
+	vec4f       msTangent = interpolate(tangents[indices[0]], tangents[indices[1]], tangents[indices[2]], barycentrics);
+
+	vec3f wsTangent   = normalize(vec3f(instance.normalFromObject * vec4f(vec3f(msTangent), 0.f)));
+	vec3f wsBitangent = cross(worldNormal, wsTangent) * msTangent.w;
+
+	// TexCoord
+	vec2f texcoord0 = interpolate(unpackUnorm2x16(m_scene.m_uvs[indices[0]]), unpackUnorm2x16(m_scene.m_uvs[indices[1]]),
+								  unpackUnorm2x16(m_scene.m_uvs[indices[2]]), barycentrics);
+
+	// Material of the object
+	if(matIndex >= 0)
+	{
+		const nvh::GltfMaterial& mat = m_scene.m_materials.values()[matIndex];
+		// Emissive color
+		prd.emittance = mat.emissiveFactor;
+		if(mat.emissiveTexture > -1)
+			prd.emittance = mul(prd.emittance, vec3f(sampleTexture(mat.emissiveTexture, texcoord0)));
+		// baseColor
+		prd.baseColor = mat.pbrBaseColorFactor;
+		if(mat.pbrBaseColorTexture > -1)
+			prd.baseColor = mul(prd.baseColor, sampleTexture(mat.pbrBaseColorTexture, texcoord0));
+		if(settings.renderFlags & kFlagOverrideAlbedo85)
+		{
+			prd.baseColor = vec4f(0.85f, 0.85f, 0.85f, prd.baseColor.w);
+			prd.emittance = vec3f(0.f);
+		}
+
+		if(mat.normalTexture >= 0)
+		{
+			vec3f tsNormal = vec3f(sampleTexture(mat.normalTexture, texcoord0)) * 2.f - vec3f(1.f);
+			worldNormal    = normalize(wsTangent * tsNormal.x + wsBitangent * tsNormal.y + worldNormal * tsNormal.z);
+		}
+
+		// Metallic & Roughness
+		prd.metallic  = mat.pbrMetallicFactor;
+		prd.roughness = mat.pbrRoughnessFactor;
+		if(mat.pbrMetallicRoughnessTexture > -1)
+		{
+			vec4f metallicRoughness = sampleTexture(mat.pbrMetallicRoughnessTexture, texcoord0);
+			prd.metallic *= metallicRoughness.z;
+			prd.roughness *= metallicRoughness.y;
+		}
+	}
+	else
+	{
+		prd.baseColor = vec4f(1.f, 1.f, 1.f, 1.f);
+		prd.emittance = vec3f(0.f);
+		prd.metallic  = 0.f;
+		prd.roughness = 1.f;
+	}
+
+	prd.worldNormal = worldNormal;
+}
+
+// lightContrib of pathtrace.rgen, but the shadow ray is left to the caller
+CpuPathTracer::LightSample CpuPathTracer::sampleLight(SampleStream&            seed,
+													  int                      rayDepth,
+													  const Bsdf&              bsdf,
+													  const Environment&       environment,
+													  float                    sunProbability,
+													  const PathTraceSettings& settings) const
+{
+	LightSample light;
+	if(sunProbability < 0.f)
+		return light;
+
+	vec2f u;
+	u.x      = rnd(seed);
+	u.y      = rnd(seed);
+	bool sun = u.x < sunProbability;
+	u.x      = stretch(u.x, sunProbability);
+	light.direction = sun ? sampleConeDirection(u, environment.sunDirection, environment.sunOneMinusCos) : environment.sampleSky(u);
+	light.anyHitSamples = seed.anyHitStream(rayDepth, true);
+
+	float lightPdf = environment.lightPdf(light.direction, sunProbability);
+	float bsdfPdf;
+	vec3f fr = bsdf.eval(light.direction, bsdfPdf);
+	if(!(bsdfPdf > 0) || !(lightPdf > 0))
+		return light;
+
+	// Both lights with MIS, else the sun alone
+	vec3f radiance = environment.inSun(light.direction) ? vec3f(environment.sunRadiance) : vec3f(0.f);
+	float weight   = 1.f;
+	if(environment.mis)
+	{
+		radiance += skyColor(light.direction, settings);
+		weight = misWeight(lightPdf, bsdfPdf);
+	}
+	light.valid    = true;
+	light.radiance = mul(fr, radiance) * (weight / lightPdf);
+	return light;
+}
+
+bool writePfm(const std::string& fileName, const std::vector<vec3f>& image, uint32_t width, uint32_t height)
+{
+	FILE* file = fopen(fileName.c_str(), "wb");
+	if(!file)
+		return false;
+
+	// Rows go from the bottom to the top, a negative scale means little endian
+	fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+	bool ok = true;
+	for(uint32_t y = height; y-- > 0 && ok;)
+		ok = fwrite(&image[size_t(y) * width], sizeof(vec3f), width, file) == width;
+	ok &= fclose(file) == 0;
+	return ok;
+}
@@ -0,0 +1,218 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <nvmath/nvmath.h>
+
+#include "SceneData.h"
+#include "sampler.h"
+#include "scene_bvh.h"
+#include "tile_scheduler.h"
+#include "util.h"
+
+// Render flags, see raycommon.glsl
+const int kFlagOverrideWhiteDiffuse = 1 << 0;
+const int kFlagOverrideAlbedo85     = 1 << 1;
+const int kFlagOverrideMirror       = 1 << 2;
+const int kFlagGreyFurnace          = 1 << 3;
+const int kFlagDiffuseOnly          = 1 << 4;
+const int kFlagSpecularOnly         = 1 << 5;
+const int kFlagImportanceSampling   = 1 << 6;  // Sun and sky light samples combined with MIS
+const int kFlagDepthOfField         = 1 << 7;
+
+// Parameters of the path tracer, with the defaults of HelloVulkan::RtPushConstant
+struct PathTraceSettings
+{
+	nvmath::vec4f clearColor{1.f, 1.f, 1.f, 1.f};
+	nvmath::vec3f lightPosition{0.f, 1.f, 0.f};  // Direction to the sun, normalized
+	float         skyIntensity{4.f};
+	float         sunIntensity{10.f};
+	int           maxBounces{4};
+	int           firstBounce{0};
+	float         focalDistance{1.f};
+	float         lensRadius{0.01f};
+	int           renderFlags{0};
+	int           samplerType{kSamplerSobol};
+};
+
+// Interface of the CPU integrators: CpuPathTracer and CpuWavefrontTracer render the same images,
+// organized differently.
+class CpuIntegrator
+{
+public:
+	virtual ~CpuIntegrator() = default;
+
+	// Averages spp samples per pixel into image, width * height pixels, top row first like the
+	// storage image of the GPU path tracer.
+	void render(const Eye&                  eye,
+				uint32_t                    width,
+				uint32_t                    height,
+				uint32_t                    spp,
+				const PathTraceSettings&    settings,
+				std::vector<nvmath::vec3f>& image,
+				uint32_t                    threadCount = 0) const;
+
+	// One progressive pass, like a frame of the GPU path tracer: adds samples
+	// [firstSample, firstSample + spp) to image, which holds the average of the samples before.
+	// The tiles of the scheduler (resized to the image) are spread over threadCount threads.
+	// Returns false if cancel was raised: the image is then partly updated and must be restarted.
+	virtual bool renderPass(const Eye&                  eye,
+							uint32_t                    width,
+							uint32_t                    height,
+							uint32_t                    firstSample,
+							uint32_t                    spp,
+							const PathTraceSettings&    settings,
+							std::vector<nvmath::vec3f>& image,
+							TileScheduler&              scheduler,
+							uint32_t                    threadCount = 0,
+							const std::atomic<bool>*    cancel      = nullptr) const = 0;
+
+protected:
+	// Adds the sum of spp new samples to the average of firstSample samples
+	static void accumulate(nvmath::vec3f& pixel, const nvmath::vec3f& sum, uint32_t firstSample, uint32_t spp);
+};
+
+// CPU reference of the GPU path tracer (shaders/pathtrace.*): same camera, sampling, materials and
+// random number sequences (sampler.h), traced against the CPU hierarchies of a SceneData instead of
+// the TLAS. It gives ground truth images to compare the GPU output against, on machines without
+// ray tracing. Images are reproducible whatever the number of threads.
+// Each path is traced from start to end like an invocation of pathtrace.rgen (megakernel);
+// the stages it is made of are shared with CpuWavefrontTracer.
+class CpuPathTracer : public CpuIntegrator
+{
+public:
+	// The scene must outlive the tracer. The sampler seed selects other scrambles than the ones of
+	// the GPU, for references independent from the images they are compared to.
+	explicit CpuPathTracer(const SceneData& scene, uint32_t samplerSeed = 0);
+
+	bool renderPass(const Eye&                  eye,
+					uint32_t                    width,
+					uint32_t                    height,
+					uint32_t                    firstSample,
+					uint32_t                    spp,
+					const PathTraceSettings&    settings,
+					std::vector<nvmath::vec3f>& image,
+					TileScheduler&              scheduler,
+					uint32_t                    threadCount = 0,
+					const std::atomic<bool>*    cancel      = nullptr) const override;
+
+private:
+	friend class CpuWavefrontTracer;
+
+	// Ray payload, see raycommon.glsl
+	struct HitPayload
+	{
+		nvmath::vec4f worldPosition;  // w: distance
+		nvmath::vec3f worldNormal;
+		nvmath::vec3f emittance;
+		nvmath::vec4f baseColor;
+		float         roughness;
+		float         metallic;
+	};
+
+	// Sun or sky light sampled at a hit, added if it is not occluded from the new ray origin
+	struct LightSample
+	{
+		bool          valid{false};
+		nvmath::vec3f direction;
+		nvmath::vec3f radiance;       // To be multiplied by the throughput of the path
+		SampleStream  anyHitSamples;  // Of the any-hit invocations of the shadow ray
+	};
+
+	// Sun and sky of a pass, and how light samples choose between them
+	struct Environment;
+	// Diffuse and GGX lobes of a hit
+	struct Bsdf;
+
+	struct Instance
+	{
+		nvmath::mat4f worldFromObject;
+		nvmath::mat4f normalFromObject;  // Transposed inverse of worldFromObject
+		uint32_t      primitive;
+	};
+
+	// One sample of pixel (x, y), the work of one invocation of pathtrace.rgen
+	nvmath::vec3f tracePath(const nvmath::mat4f&     viewInverse,
+							const nvmath::mat4f&     projInverse,
+							uint32_t                 x,
+							uint32_t                 y,
+							uint32_t                 width,
+							uint32_t                 height,
+							uint32_t                 sample,
+							const PathTraceSettings& settings) const;
+
+	// --- Stages of a path ---
+	// Primary ray of a sample, returns the random numbers of the path
+	SampleStream cameraRay(const nvmath::mat4f&     viewInverse,
+						   const nvmath::mat4f&     projInverse,
+						   uint32_t                 x,
+						   uint32_t                 y,
+						   uint32_t                 width,
+						   uint32_t                 height,
+						   uint32_t                 sample,
+						   const PathTraceSettings& settings,
+						   nvmath::vec3f&           origin,
+						   nvmath::vec3f&           direction) const;
+	// anyHitSamples is the stream of the any-hit invocations of the ray, see SampleStream::anyHitStream
+	bool intersect(const nvmath::vec3f& origin, const nvmath::vec3f& direction, SampleStream anyHitSamples, SceneBvhHit& hit) const;
+	bool occluded(const nvmath::vec3f& origin, const nvmath::vec3f& direction, SampleStream anyHitSamples) const;
+	bool anyHit(const SceneBvhHit& hit, SampleStream& seed) const;
+	void closestHit(const SceneBvhHit& hit, const PathTraceSettings& settings, HitPayload& payload) const;
+	nvmath::vec3f skyColor(const nvmath::vec3f& direction, const PathTraceSettings& settings) const;
+	// Sky and sun seen by a ray that missed the scene. escapeWeight is the MIS weight of the BSDF
+	// sample the ray comes from against the light samples of its hit, 1 for camera rays.
+	nvmath::vec3f escapedLight(const nvmath::vec3f& direction, float escapeWeight, const PathTraceSettings& settings) const;
+	// Samples the lights and the next direction at a hit: origin moves to the hit, direction becomes
+	// the new one, brdf the factor of the throughput and escapeWeight the MIS weight of the new ray
+	// if it misses. Returns false if the path ends there.
+	bool scatter(const HitPayload&        prd,
+				 int                      rayDepth,
+				 const PathTraceSettings& settings,
+				 SampleStream&            seed,
+				 nvmath::vec3f&           origin,
+				 nvmath::vec3f&           direction,
+				 nvmath::vec3f&           brdf,
+				 float&                   escapeWeight,
+				 LightSample&             light) const;
+	LightSample sampleLight(SampleStream&            seed,
+							int                      rayDepth,
+							const Bsdf&              bsdf,
+							const Environment&       environment,
+							float                    sunProbability,
+							const PathTraceSettings& settings) const;
+
+	// Indices of the vertices of a triangle, in the whole vertex arrays
+	std::array<uint32_t, 3> triangleIndices(uint32_t primitive, uint32_t triangle) const;
+	// Bilinear lookup in the first level of a texture, with repeat addressing
+	nvmath::vec4f sampleTexture(int texture, const nvmath::vec2f& uv) const;
+
+	const SceneData&      m_scene;
+	SamplerTables         m_samplerTables;
+	std::vector<Instance> m_instances;
+	SceneBvh              m_sceneBvh;
+	bool                  m_alphaTested{false};  // If some material needs the any-hit shader
+};
+
+// Writes a little endian PFM image, top row first. Returns false if the file can't be written.
+bool writePfm(const std::string& fileName, const std::vector<nvmath::vec3f>& image, uint32_t width, uint32_t height);
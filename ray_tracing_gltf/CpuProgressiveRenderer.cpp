@@ -0,0 +1,127 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "CpuProgressiveRenderer.h"
+#include <cstring>
+
+CpuProgressiveRenderer::CpuProgressiveRenderer(const CpuIntegrator& tracer,
+											   uint32_t             width,
+											   uint32_t             height,
+											   uint32_t             samplesPerPass,
+											   uint32_t             maxSamples,
+											   uint32_t             tileSize,
+											   uint32_t             threadCount)
+	: m_tracer(tracer)
+	, m_width(width)
+	, m_height(height)
+	, m_samplesPerPass(std::max(samplesPerPass, 1u))
+	, m_maxSamples(maxSamples)
+	, m_threadCount(threadCount ? threadCount : getWorkerCount())
+{
+	m_scheduler.resize(width, height, tileSize);
+	m_thread = std::thread(&CpuProgressiveRenderer::run, this);
+}
+
+CpuProgressiveRenderer::~CpuProgressiveRenderer()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit   = true;
+		m_cancel = true;
+	}
+	m_changed.notify_all();
+	m_thread.join();
+}
+
+void CpuProgressiveRenderer::updateFrame(const Eye& eye, const PathTraceSettings& settings)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_hasFrame && memcmp(&m_eye, &eye, sizeof(Eye)) == 0
+	   && memcmp(&m_settings, &settings, sizeof(PathTraceSettings)) == 0)
+		return;
+	m_eye      = eye;
+	m_settings = settings;
+	m_hasFrame = true;
+	m_frame++;
+	m_samples = 0;
+	m_cancel  = true;
+	m_changed.notify_all();
+}
+
+void CpuProgressiveRenderer::resetFrame()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_frame++;
+	m_samples = 0;
+	m_cancel  = true;
+	m_changed.notify_all();
+}
+
+uint32_t CpuProgressiveRenderer::getImage(std::vector<nvmath::vec3f>& image) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	image = m_image;
+	return m_samples;
+}
+
+uint32_t CpuProgressiveRenderer::waitForSamples(uint32_t sampleCount) const
+{
+	if(m_maxSamples)
+		sampleCount = std::min(sampleCount, m_maxSamples);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_changed.wait(lock, [&]() { return m_quit || (m_hasFrame && m_samples >= sampleCount); });
+	return m_samples;
+}
+
+TileRunStats CpuProgressiveRenderer::lastPass() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_lastPass;
+}
+
+void CpuProgressiveRenderer::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(true)
+	{
+		m_changed.wait(lock, [&]() { return m_quit || (m_hasFrame && (m_maxSamples == 0 || m_samples < m_maxSamples)); });
+		if(m_quit)
+			return;
+
+		// The pass works on copies: the next updateFrame() can come in while it runs
+		Eye               eye         = m_eye;
+		PathTraceSettings settings    = m_settings;
+		uint64_t          frame       = m_frame;
+		uint32_t          firstSample = m_samples;
+		uint32_t          spp = m_maxSamples ? std::min(m_samplesPerPass, m_maxSamples - firstSample) : m_samplesPerPass;
+		m_cancel = false;
+		lock.unlock();
+
+		bool done = m_tracer.renderPass(eye, m_width, m_height, firstSample, spp, settings, m_accumulation, m_scheduler,
+										m_threadCount, &m_cancel);
+
+		lock.lock();
+		// A restart during the pass makes it stale even if it was not cancelled in time
+		if(done && frame == m_frame)
+		{
+			m_samples  = firstSample + spp;
+			m_image    = m_accumulation;
+			m_lastPass = m_scheduler.lastRun();
+			m_changed.notify_all();
+		}
+	}
+}
@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CpuPathTracer.h"
+
+// Progressive rendering with a CpuIntegrator on a background thread, following the frame logic of
+// HelloVulkan: updateFrame() restarts the accumulation when the camera or the settings change and
+// resetFrame() restarts it unconditionally. A restart cancels the pass in flight, which stops in
+// the middle of its tiles instead of finishing them with the old camera.
+class CpuProgressiveRenderer
+{
+public:
+	// The tracer must outlive the renderer. Accumulation stops after maxSamples, 0 for no limit.
+	CpuProgressiveRenderer(const CpuIntegrator& tracer,
+						   uint32_t             width,
+						   uint32_t             height,
+						   uint32_t             samplesPerPass = 1,
+						   uint32_t             maxSamples     = 0,
+						   uint32_t             tileSize       = 32,
+						   uint32_t             threadCount    = 0);
+	~CpuProgressiveRenderer();
+
+	CpuProgressiveRenderer(const CpuProgressiveRenderer&) = delete;
+	CpuProgressiveRenderer& operator=(const CpuProgressiveRenderer&) = delete;
+
+	void updateFrame(const Eye& eye, const PathTraceSettings& settings);
+	void resetFrame();
+
+	// Copies the last complete pass, returns its number of samples per pixel
+	uint32_t getImage(std::vector<nvmath::vec3f>& image) const;
+	// Blocks until the image has at least sampleCount samples per pixel, or maxSamples
+	uint32_t waitForSamples(uint32_t sampleCount) const;
+
+	// Statistics of the last pass
+	TileRunStats lastPass() const;
+
+private:
+	void run();
+
+	const CpuIntegrator& m_tracer;
+	const uint32_t       m_width;
+	const uint32_t       m_height;
+	const uint32_t       m_samplesPerPass;
+	const uint32_t       m_maxSamples;
+	const uint32_t       m_threadCount;
+
+	mutable std::mutex              m_mutex;
+	mutable std::condition_variable m_changed;  // New frame, new pass done or quitting
+	Eye                             m_eye;
+	PathTraceSettings               m_settings;
+	bool                            m_hasFrame{false};
+	bool                            m_quit{false};
+	uint64_t                        m_frame{0};    // Incremented by each restart
+	uint32_t                        m_samples{0};  // Of m_image
+	std::vector<nvmath::vec3f>      m_image;
+	TileRunStats                    m_lastPass;
+	std::atomic<bool>               m_cancel{false};
+
+	// Owned by the render thread
+	TileScheduler              m_scheduler;
+	std::vector<nvmath::vec3f> m_accumulation;
+	std::thread                m_thread;
+};
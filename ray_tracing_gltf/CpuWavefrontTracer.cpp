@@ -0,0 +1,303 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "CpuWavefrontTracer.h"
+#include <algorithm>
+#include <chrono>
+
+using nvmath::mat4f;
+using nvmath::vec3f;
+
+namespace {
+using Clock = std::chrono::high_resolution_clock;
+
+inline double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+vec3f mul(const vec3f& a, const vec3f& b)
+{
+	return vec3f(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+// Hit waiting for the shade stage
+struct ShadeItem
+{
+	uint64_t key;  // Material, then primitive
+	uint32_t path;
+
+	bool operator<(const ShadeItem& other) const
+	{
+		return key < other.key || (key == other.key && path < other.path);
+	}
+};
+}  // namespace
+
+struct CpuWavefrontTracer::Workspace
+{
+	// Path state, by path
+	std::vector<vec3f>        origin;
+	std::vector<vec3f>        direction;
+	std::vector<vec3f>        throughput;
+	std::vector<vec3f>        radiance;
+	std::vector<float>        escapeWeight;  // MIS weight of the sky and sun if the ray misses
+	std::vector<SampleStream> seed;
+
+	// Results of the extend stage, by path
+	std::vector<float>    hitT;
+	std::vector<float>    hitU;
+	std::vector<float>    hitV;
+	std::vector<uint32_t> hitTriangle;
+	std::vector<uint32_t> hitInstance;
+
+	// Queues of paths
+	std::vector<uint32_t>  active;  // Rays to extend
+	std::vector<uint32_t>  next;    // Rays of the next bounce
+	std::vector<uint32_t>  missed;
+	std::vector<ShadeItem> hits;
+
+	// Shadow rays of the connect stage
+	std::vector<vec3f>        shadowOrigin;
+	std::vector<vec3f>        shadowDirection;
+	std::vector<vec3f>        shadowRadiance;  // Multiplied by the throughput already
+	std::vector<SampleStream> shadowSeed;
+	std::vector<uint32_t>     shadowPath;
+
+	std::vector<vec3f> tileSum;  // By pixel of the tile
+
+	Stats stats;
+
+	void resize(size_t pathCount)
+	{
+		for(auto* v : {&origin, &direction, &throughput, &radiance})
+			v->resize(pathCount);
+		seed.resize(pathCount);
+		for(auto* v : {&hitTriangle, &hitInstance})
+			v->resize(pathCount);
+		for(auto* v : {&escapeWeight, &hitT, &hitU, &hitV})
+			v->resize(pathCount);
+	}
+
+	void clearShadows()
+	{
+		for(auto* v : {&shadowOrigin, &shadowDirection, &shadowRadiance})
+			v->clear();
+		shadowSeed.clear();
+		shadowPath.clear();
+	}
+};
+
+bool CpuWavefrontTracer::renderPass(const Eye&               eye,
+									uint32_t                 width,
+									uint32_t                 height,
+									uint32_t                 firstSample,
+									uint32_t                 spp,
+									const PathTraceSettings& settings,
+									std::vector<vec3f>&      image,
+									TileScheduler&           scheduler,
+									uint32_t                 threadCount,
+									const std::atomic<bool>* cancel) const
+{
+	image.resize(size_t(width) * height, vec3f(0.f));
+	if(spp == 0)
+		return true;
+	if(scheduler.width() != width || scheduler.height() != height)
+		scheduler.resize(width, height, scheduler.tileSize() ? scheduler.tileSize() : 32);
+	threadCount = threadCount ? threadCount : getWorkerCount();
+
+	mat4f                  projInverse = invert(eye.projection);
+	std::vector<Workspace> workspaces(threadCount);
+	bool done = scheduler.run(
+		[&](const RenderTile& tile, uint32_t thread) {
+			renderTile(tile, eye.worldFromView, projInverse, width, height, firstSample, spp, settings, image,
+					   workspaces[thread], cancel);
+		},
+		threadCount, cancel);
+
+	Stats stats;
+	for(const Workspace& workspace : workspaces)
+	{
+		stats.paths += workspace.stats.paths;
+		stats.extensionRays += workspace.stats.extensionRays;
+		stats.shadowRays += workspace.stats.shadowRays;
+		stats.generateSeconds += workspace.stats.generateSeconds;
+		stats.extendSeconds += workspace.stats.extendSeconds;
+		stats.sortSeconds += workspace.stats.sortSeconds;
+		stats.shadeSeconds += workspace.stats.shadeSeconds;
+		stats.connectSeconds += workspace.stats.connectSeconds;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_statsMutex);
+		m_lastPass = stats;
+	}
+	return done && !(cancel && cancel->load());
+}
+
+CpuWavefrontTracer::Stats CpuWavefrontTracer::lastPass() const
+{
+	std::lock_guard<std::mutex> lock(m_statsMutex);
+	return m_lastPass;
+}
+
+bool CpuWavefrontTracer::renderTile(const RenderTile&        tile,
+									const mat4f&             viewInverse,
+									const mat4f&             projInverse,
+									uint32_t                 width,
+									uint32_t                 height,
+									uint32_t                 firstSample,
+									uint32_t                 spp,
+									const PathTraceSettings& settings,
+									std::vector<vec3f>&      image,
+									Workspace&               ws,
+									const std::atomic<bool>* cancel) const
+{
+	const auto& scene        = m_tracer.m_scene;
+	uint32_t    pixelCount   = tile.width * tile.height;
+	uint32_t    batchSamples = std::max(1u, std::min(spp, m_maxBatchPaths / std::max(pixelCount, 1u)));
+	ws.tileSum.assign(pixelCount, vec3f(0.f));
+
+	for(uint32_t batchStart = firstSample; batchStart < firstSample + spp; batchStart += batchSamples)
+	{
+		// Paths are ordered by sample then pixel: neighbor paths start as neighbor camera rays
+		uint32_t sampleCount = std::min(batchSamples, firstSample + spp - batchStart);
+		uint32_t pathCount   = sampleCount * pixelCount;
+		ws.resize(pathCount);
+		ws.stats.paths += pathCount;
+
+		// Generate
+		auto stageStart = Clock::now();
+		ws.active.resize(pathCount);
+		for(uint32_t path = 0; path < pathCount; path++)
+		{
+			uint32_t pixel  = path % pixelCount;
+			uint32_t sample = batchStart + path / pixelCount;
+			uint32_t x      = tile.x + pixel % tile.width;
+			uint32_t y      = tile.y + pixel / tile.width;
+			ws.seed[path] = m_tracer.cameraRay(viewInverse, projInverse, x, y, width, height, sample, settings,
+											   ws.origin[path], ws.direction[path]);
+			ws.throughput[path]   = vec3f(1.f);
+			ws.radiance[path]     = vec3f(0.f);
+			ws.escapeWeight[path] = 1.f;
+			ws.active[path]       = path;
+		}
+		ws.stats.generateSeconds += secondsSince(stageStart);
+
+		for(int rayDepth = 0; rayDepth <= settings.maxBounces && !ws.active.empty(); rayDepth++)
+		{
+			if(cancel && cancel->load(std::memory_order_relaxed))
+				return false;
+
+			// Extend
+			stageStart = Clock::now();
+			ws.missed.clear();
+			ws.hits.clear();
+			for(uint32_t path : ws.active)
+			{
+				SceneBvhHit hit;
+				if(!m_tracer.intersect(ws.origin[path], ws.direction[path], ws.seed[path].anyHitStream(rayDepth, false), hit))
+				{
+					ws.missed.push_back(path);
+					continue;
+				}
+				ws.hitT[path]        = hit.hit.t;
+				ws.hitU[path]        = hit.hit.u;
+				ws.hitV[path]        = hit.hit.v;
+				ws.hitTriangle[path] = hit.hit.triangle;
+				ws.hitInstance[path] = hit.instance;
+
+				uint32_t primitive = m_tracer.m_instances[hit.instance].primitive;
+				uint32_t material  = uint32_t(scene.m_primitives[primitive].materialIndex + 1);  // -1 first
+				ws.hits.push_back({(uint64_t(material) << 32) | primitive, path});
+			}
+			ws.stats.extensionRays += ws.active.size();
+			ws.stats.extendSeconds += secondsSince(stageStart);
+
+			stageStart = Clock::now();
+			std::sort(ws.hits.begin(), ws.hits.end());
+			ws.stats.sortSeconds += secondsSince(stageStart);
+
+			// Shade
+			stageStart = Clock::now();
+			// The light of the previous hit, always show the background
+			if(rayDepth > settings.firstBounce || rayDepth == 0)
+			{
+				for(uint32_t path : ws.missed)
+					ws.radiance[path] += mul(ws.throughput[path], m_tracer.escapedLight(ws.direction[path], ws.escapeWeight[path], settings));
+			}
+			ws.next.clear();
+			ws.clearShadows();
+			for(const ShadeItem& item : ws.hits)
+			{
+				uint32_t    path = item.path;
+				SceneBvhHit hit;
+				hit.hit.t        = ws.hitT[path];
+				hit.hit.u        = ws.hitU[path];
+				hit.hit.v        = ws.hitV[path];
+				hit.hit.triangle = ws.hitTriangle[path];
+				hit.instance     = ws.hitInstance[path];
+
+				CpuPathTracer::HitPayload prd;
+				m_tracer.closestHit(hit, settings, prd);
+				ws.radiance[path] += mul(ws.throughput[path], prd.emittance);
+
+				vec3f                      brdf;
+				CpuPathTracer::LightSample light;
+				bool scattered = m_tracer.scatter(prd, rayDepth, settings, ws.seed[path], ws.origin[path],
+												  ws.direction[path], brdf, ws.escapeWeight[path], light);
+				if(light.valid)
+				{
+					ws.shadowOrigin.push_back(ws.origin[path]);
+					ws.shadowDirection.push_back(light.direction);
+					ws.shadowRadiance.push_back(mul(ws.throughput[path], light.radiance));
+					ws.shadowSeed.push_back(light.anyHitSamples);
+					ws.shadowPath.push_back(path);
+				}
+				if(scattered)
+				{
+					ws.throughput[path] = mul(ws.throughput[path], brdf);
+					ws.next.push_back(path);
+				}
+			}
+			ws.stats.shadeSeconds += secondsSince(stageStart);
+
+			// Connect
+			stageStart = Clock::now();
+			for(size_t i = 0; i < ws.shadowPath.size(); i++)
+			{
+				if(!m_tracer.occluded(ws.shadowOrigin[i], ws.shadowDirection[i], ws.shadowSeed[i]))
+					ws.radiance[ws.shadowPath[i]] += ws.shadowRadiance[i];
+			}
+			ws.stats.shadowRays += ws.shadowPath.size();
+			ws.stats.connectSeconds += secondsSince(stageStart);
+
+			std::swap(ws.active, ws.next);
+		}
+
+		// Same summation order as CpuPathTracer: sample after sample
+		for(uint32_t path = 0; path < pathCount; path++)
+			ws.tileSum[path % pixelCount] += ws.radiance[path];
+	}
+
+	for(uint32_t pixel = 0; pixel < pixelCount; pixel++)
+	{
+		uint32_t x = tile.x + pixel % tile.width;
+		uint32_t y = tile.y + pixel / tile.width;
+		accumulate(image[size_t(y) * width + x], ws.tileSum[pixel], firstSample, spp);
+	}
+	return true;
+}
@@ -0,0 +1,92 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include <mutex>
+
+#include "CpuPathTracer.h"
+
+// Wavefront organization of CpuPathTracer, after Laine, Karras and Aila, "Megakernels Considered
+// Harmful: Wavefront Path Tracing on GPUs" (HPG 2013). The paths of a tile advance together, one
+// bounce at a time, through stages that each run over a whole queue:
+// - generate: the camera rays of all the samples of the tile
+// - extend: the closest hits of the queued rays
+// - shade: the hits sorted by material and primitive, so that the material, texture and vertex
+//   fetches of pathtrace.rchit for the same surface follow each other. Scatters the paths and
+//   queues the shadow rays of their sun and sky samples
+// - connect: the occlusion queries of the shadow rays, in one batch
+// The state of the paths is a structure of arrays indexed by path, the queues hold path indices.
+// Every path does the same work with the same random numbers as in CpuPathTracer and the samples
+// are summed in the same order, so the images are identical: only the order of the work changes.
+class CpuWavefrontTracer : public CpuIntegrator
+{
+public:
+	// The tracer must outlive this one
+	explicit CpuWavefrontTracer(const CpuPathTracer& tracer)
+		: m_tracer(tracer)
+	{
+	}
+
+	bool renderPass(const Eye&                  eye,
+					uint32_t                    width,
+					uint32_t                    height,
+					uint32_t                    firstSample,
+					uint32_t                    spp,
+					const PathTraceSettings&    settings,
+					std::vector<nvmath::vec3f>& image,
+					TileScheduler&              scheduler,
+					uint32_t                    threadCount = 0,
+					const std::atomic<bool>*    cancel      = nullptr) const override;
+
+	// Work of a pass, summed over the threads
+	struct Stats
+	{
+		uint64_t paths{0};
+		uint64_t extensionRays{0};
+		uint64_t shadowRays{0};
+		double   generateSeconds{0.0};
+		double   extendSeconds{0.0};
+		double   sortSeconds{0.0};
+		double   shadeSeconds{0.0};
+		double   connectSeconds{0.0};
+	};
+	Stats lastPass() const;
+
+	// Paths in flight per thread: the samples of a tile are traced in batches of at most this many
+	uint32_t m_maxBatchPaths{1 << 16};
+
+private:
+	struct Workspace;
+
+	// Returns false if cancelled
+	bool renderTile(const RenderTile&        tile,
+					const nvmath::mat4f&     viewInverse,
+					const nvmath::mat4f&     projInverse,
+					uint32_t                 width,
+					uint32_t                 height,
+					uint32_t                 firstSample,
+					uint32_t                 spp,
+					const PathTraceSettings& settings,
+					std::vector<nvmath::vec3f>& image,
+					Workspace&               workspace,
+					const std::atomic<bool>* cancel) const;
+
+	const CpuPathTracer& m_tracer;
+	mutable std::mutex   m_statsMutex;
+	mutable Stats        m_lastPass;
+};
@@ -0,0 +1,298 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "GltfFile.h"
+
+#include <cstring>
+
+#include "fileformats/stb_image.h"
+
+namespace {
+// GLB container, see the "Binary glTF Layout" section of the glTF 2.0 specification
+const uint32_t kGlbMagic     = 0x46546C67;  // "glTF"
+const uint32_t kGlbChunkJson = 0x4E4F534A;  // "JSON"
+const uint32_t kGlbChunkBin  = 0x004E4942;  // "BIN\0"
+
+struct GlbHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t length;
+};
+
+struct GlbChunkHeader
+{
+	uint32_t length;
+	uint32_t type;
+};
+
+// What tinygltf gets instead of a mapped buffer or embedded image: one decoded byte
+const char* kPlaceholderUri = "data:application/octet-stream;base64,AA==";
+
+std::string baseDirectory(const std::string& fileName)
+{
+	size_t slash = fileName.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : fileName.substr(0, slash + 1);
+}
+
+bool isDataUri(const std::string& uri)
+{
+	return uri.compare(0, 5, "data:") == 0;
+}
+}  // namespace
+
+bool GltfFile::load(const std::string& fileName, tinygltf::Model& model, std::string& warn, std::string& error)
+{
+	m_externalBuffers.clear();
+	m_buffers.clear();
+	m_images.clear();
+	m_isBinary = false;
+
+	if(!m_file.open(fileName))
+	{
+		error = "Cannot open " + fileName;
+		return false;
+	}
+
+	// Find the JSON and, for .glb files, the binary chunk
+	const char*    json     = m_file.begin();
+	size_t         jsonSize = m_file.size();
+	const uint8_t* bin      = nullptr;
+	size_t         binSize  = 0;
+	if(m_file.size() >= sizeof(GlbHeader) && reinterpret_cast<const GlbHeader*>(m_file.data())->magic == kGlbMagic)
+	{
+		const GlbHeader* header = reinterpret_cast<const GlbHeader*>(m_file.data());
+		if(header->version != 2 || header->length > m_file.size())
+		{
+			error = "Invalid glb header in " + fileName;
+			return false;
+		}
+
+		json          = nullptr;
+		size_t offset = sizeof(GlbHeader);
+		while(offset + sizeof(GlbChunkHeader) <= header->length)
+		{
+			const GlbChunkHeader* chunk = reinterpret_cast<const GlbChunkHeader*>(m_file.data() + offset);
+			offset += sizeof(GlbChunkHeader);
+			if(chunk->length > header->length - offset)
+				break;
+			if(chunk->type == kGlbChunkJson && !json)
+			{
+				json     = m_file.begin() + offset;
+				jsonSize = chunk->length;
+			}
+			else if(chunk->type == kGlbChunkBin && !bin)
+			{
+				bin     = m_file.data() + offset;
+				binSize = chunk->length;
+			}
+			offset += (chunk->length + 3) & ~3u;
+		}
+		if(!json)
+		{
+			error = "No JSON chunk in " + fileName;
+			return false;
+		}
+		m_isBinary = true;
+	}
+
+	nlohmann::json doc = nlohmann::json::parse(json, json + jsonSize, nullptr, false);
+	if(doc.is_discarded() || !doc.is_object())
+	{
+		error = "Invalid JSON in " + fileName;
+		return false;
+	}
+
+	// Map the binary buffers and stub them out of the JSON
+	std::string baseDir = baseDirectory(fileName);
+	auto        buffers = doc.find("buffers");
+	if(buffers != doc.end() && buffers->is_array())
+	{
+		m_buffers.resize(buffers->size());
+		m_externalBuffers.reserve(buffers->size());
+		for(size_t i = 0; i < buffers->size(); i++)
+		{
+			nlohmann::json& buffer     = (*buffers)[i];
+			size_t          byteLength = buffer.value("byteLength", size_t(0));
+			std::string     uri        = buffer.value("uri", std::string());
+
+			BufferSource source;
+			if(uri.empty() && m_isBinary && i == 0)
+			{
+				if(!bin)
+				{
+					error = "No binary chunk in " + fileName;
+					return false;
+				}
+				source = {bin, binSize};
+			}
+			else if(!uri.empty() && !isDataUri(uri))
+			{
+				MappedFile external(baseDir + uri);
+				if(!external.valid())
+				{
+					error = "Cannot open buffer " + baseDir + uri;
+					return false;
+				}
+				source = {external.data(), external.size()};
+				m_externalBuffers.push_back(std::move(external));
+			}
+			else
+			{
+				continue;  // Data URI, decoded by tinygltf
+			}
+
+			if(source.size < byteLength)
+			{
+				error = "Buffer " + std::to_string(i) + " of " + fileName + " is truncated";
+				return false;
+			}
+			m_buffers[i] = {source.data, byteLength};
+			buffer["uri"]        = kPlaceholderUri;
+			buffer["byteLength"] = 1;
+		}
+	}
+
+	// Embedded images in a mapped buffer: tinygltf would read them from the placeholder
+	auto images      = doc.find("images");
+	auto bufferViews = doc.find("bufferViews");
+	if(images != doc.end() && images->is_array() && bufferViews != doc.end() && bufferViews->is_array())
+	{
+		m_images.resize(images->size());
+		for(size_t i = 0; i < images->size(); i++)
+		{
+			nlohmann::json& image = (*images)[i];
+			size_t          view  = image.value("bufferView", bufferViews->size());
+			if(view >= bufferViews->size())
+				continue;
+
+			const nlohmann::json& bufferView = (*bufferViews)[view];
+			size_t                buffer     = bufferView.value("buffer", m_buffers.size());
+			size_t                offset     = bufferView.value("byteOffset", size_t(0));
+			size_t                length     = bufferView.value("byteLength", size_t(0));
+			if(buffer >= m_buffers.size() || !m_buffers[buffer].data)
+				continue;
+			if(offset > m_buffers[buffer].size || length > m_buffers[buffer].size - offset)
+			{
+				error = "Image " + std::to_string(i) + " of " + fileName + " is out of its buffer";
+				return false;
+			}
+
+			m_images[i] = {m_buffers[buffer].data + offset, length};
+			image.erase("bufferView");
+			image.erase("mimeType");
+			image["uri"] = kPlaceholderUri;
+		}
+	}
+
+	std::string patched = doc.dump();
+
+	tinygltf::TinyGLTF context;
+	context.SetImageLoader(&GltfFile::loadImage, this);
+	if(!context.LoadASCIIFromString(&model, &error, &warn, patched.c_str(), static_cast<unsigned int>(patched.size()), baseDir))
+		return false;
+
+	// Placeholders only hold one byte
+	for(size_t i = 0; i < m_buffers.size() && i < model.buffers.size(); i++)
+		if(m_buffers[i].data)
+			model.buffers[i].data.clear();
+	return true;
+}
+
+bool GltfFile::accessor(const tinygltf::Model& model, int index, AccessorView& view) const
+{
+	view = AccessorView();
+	if(index < 0 || size_t(index) >= model.accessors.size())
+		return false;
+
+	const tinygltf::Accessor& accessor = model.accessors[index];
+	view.count                         = accessor.count;
+	view.componentType                 = accessor.componentType;
+	view.numComponents                 = tinygltf::GetNumComponentsInType(accessor.type);
+	view.normalized                    = accessor.normalized;
+	int componentSize                  = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	if(view.numComponents <= 0 || componentSize <= 0)
+		return false;
+	if(accessor.bufferView < 0)
+		return true;
+	if(size_t(accessor.bufferView) >= model.bufferViews.size())
+		return false;
+
+	const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	if(bufferView.buffer < 0 || size_t(bufferView.buffer) >= model.buffers.size())
+		return false;
+
+	const uint8_t* data = nullptr;
+	size_t         size = 0;
+	if(size_t(bufferView.buffer) < m_buffers.size() && m_buffers[bufferView.buffer].data)
+	{
+		data = m_buffers[bufferView.buffer].data;
+		size = m_buffers[bufferView.buffer].size;
+	}
+	else
+	{
+		data = model.buffers[bufferView.buffer].data.data();
+		size = model.buffers[bufferView.buffer].data.size();
+	}
+
+	size_t elementSize = size_t(componentSize) * view.numComponents;
+	size_t offset      = bufferView.byteOffset + accessor.byteOffset;
+	view.stride        = bufferView.byteStride ? bufferView.byteStride : elementSize;
+	if(view.count > 0 && (offset > size || (view.count - 1) * view.stride + elementSize > size - offset))
+		return false;
+
+	view.data = data + offset;
+	return true;
+}
+
+bool GltfFile::loadImage(tinygltf::Image*     image,
+						 const int            imageIndex,
+						 std::string*         error,
+						 std::string*         /*warn*/,
+						 int                  /*reqWidth*/,
+						 int                  /*reqHeight*/,
+						 const unsigned char* bytes,
+						 int                  size,
+						 void*                userData)
+{
+	// Embedded images come from the mapping, the placeholder bytes are ignored
+	const GltfFile* file = static_cast<const GltfFile*>(userData);
+	if(imageIndex >= 0 && size_t(imageIndex) < file->m_images.size() && file->m_images[imageIndex].data)
+	{
+		bytes = file->m_images[imageIndex].data;
+		size  = static_cast<int>(file->m_images[imageIndex].size);
+	}
+
+	int      width = 0, height = 0, channels = 0;
+	stbi_uc* pixels = stbi_load_from_memory(bytes, size, &width, &height, &channels, STBI_rgb_alpha);
+	if(!pixels)
+	{
+		if(error)
+			*error += "Cannot decode image " + std::to_string(imageIndex) + "\n";
+		return false;
+	}
+
+	image->width      = width;
+	image->height     = height;
+	image->component  = 4;
+	image->bits       = 8;
+	image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+	image->image.assign(pixels, pixels + size_t(width) * height * 4);
+	stbi_image_free(pixels);
+	return true;
+}
@@ -0,0 +1,79 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "fileformats/tiny_gltf.h"
+#include "mapped_file.h"
+
+// Memory mapped glTF (.gltf or .glb) file.
+// tinygltf copies every buffer into the model while parsing. Here the file and its external .bin
+// buffers are mapped instead, and tinygltf only sees the JSON with those buffers stubbed out:
+// accessor data is read straight from the mapping, which must outlive the reads.
+// Embedded images are decoded from the mapping as well. Data URI buffers are still decoded by
+// tinygltf, accessors into them work the same way.
+class GltfFile
+{
+public:
+	// Strided view of the elements of an accessor
+	struct AccessorView
+	{
+		const uint8_t* data{nullptr};  // Null if the accessor has no buffer view: all elements are zero
+		size_t         count{0};
+		size_t         stride{0};
+		int            componentType{0};  // TINYGLTF_COMPONENT_TYPE_*
+		int            numComponents{0};
+		bool           normalized{false};
+
+		const uint8_t* element(size_t i) const { return data + i * stride; }
+	};
+
+	GltfFile() = default;
+	GltfFile(const GltfFile&) = delete;
+	GltfFile& operator=(const GltfFile&) = delete;
+
+	// Loads the structure of the file into `model`. The buffers of `model` that were mapped only
+	// hold a placeholder byte: use accessor() to read them.
+	bool load(const std::string& fileName, tinygltf::Model& model, std::string& warn, std::string& error);
+
+	// Returns false if the accessor does not exist or does not fit in its buffer
+	bool accessor(const tinygltf::Model& model, int index, AccessorView& view) const;
+
+	bool isBinary() const { return m_isBinary; }
+
+private:
+	struct BufferSource
+	{
+		const uint8_t* data{nullptr};  // Null for buffers left to tinygltf
+		size_t         size{0};
+	};
+
+	static bool loadImage(tinygltf::Image* image, const int imageIndex, std::string* error, std::string* warn,
+						  int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData);
+
+	MappedFile                m_file;
+	std::vector<MappedFile>   m_externalBuffers;
+	std::vector<BufferSource> m_buffers;
+	// Embedded images whose buffer is mapped, by image index. Empty for the others
+	std::vector<BufferSource> m_images;
+	bool                      m_isBinary{false};
+};
@@ -24,14 +24,15 @@
 #include <vulkan/vulkan.hpp>
 
 #define NVVK_ALLOC_DEDICATED
-#include "nvh/gltfscene.hpp"
 #include "nvvk/allocator_vk.hpp"
 #include "nvvk/debug_util_vk.hpp"
-#include <nvmath/nvmath_types.h>
 
+#include "SceneData.h"
 #include "util.h"
 
-class RenderScene
+// Scene loaded with SceneData::loadGltf, with its textures on the device from the start and its
+// buffers uploaded by submitToGPU
+class RenderScene : public SceneData
 {
 public:
 	RenderScene(
@@ -41,8 +42,6 @@ public:
 		uint32_t gfxQueueNdx);
 	~RenderScene();
 
-	void loadGltf(const std::string& fileName, nvmath::mat4f = nvmath::mat4f(1));
-
 	void submitToGPU(const vk::CommandBuffer& cmdBuf);
 
 	struct TextureTypeTag
@@ -61,12 +60,6 @@ public:
 
 	static_assert(sizeof(nvh::GltfMaterial) % sizeof(nvmath::vec4f) == 0, "Materials need padding to a vec4");
 
-	// --- CPU buffers ---
-	std::vector<nvmath::mat4f> m_worldFromInstance;
-	std::vector<nvh::GltfPrimMesh>     m_primitives;
-	std::vector<uint32_t>      m_nodePrimitivesLUT;
-	std::vector<nvh::GltfMaterial>       m_materials;
-
 	// --- GPU buffers ---
 	// Geometry
 	nvvk::Buffer m_vtxPositionsBuffer;
@@ -84,20 +77,8 @@ public:
 	nvvk::Buffer m_instancePrimitivesBuffer;
 	nvvk::Buffer m_worldFromInstanceBuffer;
 
-	// Statistics
-	size_t m_numVertices             = 0;
-	size_t m_numTriangles            = 0;
-	size_t m_maxVerticesPerPrimitive = 0;
-
-	static std::vector<vec4f> generateTangentSpace(
-		const std::vector<vec3f>&    positions,
-		const std::vector<vec3f>&    normals,
-		const std::vector<vec2f>&    uvs,
-		const std::vector<uint32_t>& indices,
-		size_t                       nIndices,
-		size_t                       nVertices,
-		size_t                       indexOffset,
-		size_t                       vertexOffset);
+protected:
+	uint32_t addImages(tinygltf::Model& gltfModel) override;
 
 private:
 	void clearResources();
@@ -105,12 +86,6 @@ private:
 	void updateTextureDescriptors();
 	// We shouldn't bind empty arrays, so if there are no textures, we create a dummy one before submitting the scene
 	void addDefaultTexture(const vk::CommandBuffer& cmdBuf);
-	// Reverve space for n more textures
-	void reserveTextures(size_t n);
-	void createTextureImages(const vk::CommandBuffer& cmdBuf, tinygltf::Model& gltfModel);
-
-	std::vector<uint32_t> octEncodeVec3ToU32(const std::vector<nvmath::vec3>& normals);
-	std::vector<uint32_t> packVec2ToU32(const std::vector<nvmath::vec2>& uvs);
 
 	const vk::Device&         m_device;
 	nvvk::AllocatorDedicated& m_alloc;
@@ -119,12 +94,4 @@ private:
 
 	std::vector<nvvk::Texture>           m_textures;
 	std::vector<vk::DescriptorImageInfo> m_textureDescriptors;
-
-	// Temporary storage buffers
-	nvh::GltfScene             m_gltfScene;
-	std::vector<nvmath::vec3f> m_vtxPositions;
-	std::vector<uint32_t>      m_normals;
-	std::vector<nvmath::vec4f> m_tangents;
-	std::vector<uint32_t>      m_uvs;
-	std::vector<uint16_t>      m_indices;
 };
@@ -0,0 +1,527 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// Copyright 2020 Carmelo J. Fernndez-Agera
+#include "SceneData.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <tuple>
+
+#include "nvh/nvprint.hpp"
+#include "parallel.h"
+#include "tangent_space.h"
+#include "vertex_packing.h"
+
+namespace {
+// Element `i` of a float accessor or of an integer one, normalized or not. Missing components are zero.
+template <int N>
+void readFloats(const GltfFile::AccessorView& view, size_t i, float* out)
+{
+	int n = view.data ? std::min(N, view.numComponents) : 0;
+	const uint8_t* element = n ? view.element(i) : nullptr;
+	for(int c = 0; c < n; c++)
+	{
+		switch(view.componentType)
+		{
+			case TINYGLTF_COMPONENT_TYPE_FLOAT:
+				memcpy(&out[c], element + c * sizeof(float), sizeof(float));
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				out[c] = element[c] * (view.normalized ? 1.f / 255.f : 1.f);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_BYTE:
+				out[c] = int8_t(element[c]) * (view.normalized ? 1.f / 127.f : 1.f);
+				if(view.normalized)
+					out[c] = std::max(out[c], -1.f);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+			{
+				uint16_t value;
+				memcpy(&value, element + c * sizeof(value), sizeof(value));
+				out[c] = value * (view.normalized ? 1.f / 65535.f : 1.f);
+				break;
+			}
+			case TINYGLTF_COMPONENT_TYPE_SHORT:
+			{
+				int16_t value;
+				memcpy(&value, element + c * sizeof(value), sizeof(value));
+				out[c] = value * (view.normalized ? 1.f / 32767.f : 1.f);
+				if(view.normalized)
+					out[c] = std::max(out[c], -1.f);
+				break;
+			}
+			default:
+				out[c] = 0.f;
+		}
+	}
+	for(int c = n; c < N; c++)
+		out[c] = 0.f;
+}
+
+uint32_t readIndex(const GltfFile::AccessorView& view, size_t i)
+{
+	if(!view.data)
+		return 0;
+	const uint8_t* element = view.element(i);
+	switch(view.componentType)
+	{
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			return *element;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		{
+			uint16_t index;
+			memcpy(&index, element, sizeof(index));
+			return index;
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		{
+			uint32_t index;
+			memcpy(&index, element, sizeof(index));
+			return index;
+		}
+		default:
+			return 0;
+	}
+}
+
+nvmath::mat4f localMatrix(const tinygltf::Node& node)
+{
+	nvmath::mat4f matrix(1);
+	if(node.matrix.size() == 16)
+	{
+		for(int i = 0; i < 16; ++i)
+			matrix.mat_array[i] = float(node.matrix[i]);
+		return matrix;
+	}
+
+	nvmath::mat4f translation(1), rotation(1), scale(1);
+	if(node.translation.size() == 3)
+		translation.as_translation(vec3f(float(node.translation[0]), float(node.translation[1]), float(node.translation[2])));
+	if(node.rotation.size() == 4)
+		nvmath::quatf(float(node.rotation[0]), float(node.rotation[1]), float(node.rotation[2]), float(node.rotation[3]))
+			.to_matrix(rotation);
+	if(node.scale.size() == 3)
+		scale.as_scale(vec3f(float(node.scale[0]), float(node.scale[1]), float(node.scale[2])));
+	return translation * rotation * scale;
+}
+}  // namespace
+
+bool SceneData::loadGltf(const std::string& fileName, nvmath::mat4f rootTransform)
+{
+	// .gltf and .glb files are mapped, tinygltf does not get a copy of the buffers
+	tinygltf::Model tmodel;
+	GltfFile        gltfFile;
+	std::string     warn, error;
+	bool            loaded = gltfFile.load(fileName, tmodel, warn, error);
+	if(!warn.empty())
+		LOGW("%s\n", warn.c_str());
+	if(!loaded)
+	{
+		LOGE("Error while loading %s: %s\n", fileName.c_str(), error.c_str());
+		return false;
+	}
+
+	m_gltfScene.importMaterials(tmodel);
+
+	// Textures
+	uint32_t textureOffset = addImages(tmodel);
+
+	// Materials: texture indices made relative to the scene textures, then merged with the
+	// identical materials already in the table. materialRemap maps the materials of the file
+	// to their entry in the table.
+	std::vector<uint32_t> materialRemap;
+	materialRemap.reserve(m_gltfScene.m_materials.size());
+	for(const auto& gltfMaterial : m_gltfScene.m_materials)
+	{
+		nvh::GltfMaterial material = gltfMaterial;
+		material.pbrBaseColorTexture = 
+			gltfMaterial.pbrBaseColorTexture > -1 ?
+				tmodel.textures[gltfMaterial.pbrBaseColorTexture].source + textureOffset :
+				-1;
+		material.pbrMetallicRoughnessTexture =
+			gltfMaterial.pbrMetallicRoughnessTexture > -1 ?
+				tmodel.textures[gltfMaterial.pbrMetallicRoughnessTexture].source + textureOffset :
+				-1;
+		material.emissiveTexture =
+			gltfMaterial.emissiveTexture > -1 ?
+				tmodel.textures[gltfMaterial.emissiveTexture].source + textureOffset :
+				-1;
+		material.normalTexture =
+			gltfMaterial.normalTexture > -1 ?
+				tmodel.textures[gltfMaterial.normalTexture].source + textureOffset :
+				-1;
+
+		materialRemap.push_back(m_materials.findOrAdd(material));
+	}
+	if(materialRemap.empty())  // Primitives without material use the default one
+		materialRemap.push_back(m_materials.findOrAdd(nvh::GltfMaterial()));
+	LOGI("%zu materials, %zu unique in the scene\n", m_materials.requested(), m_materials.size());
+
+	// Geometry and instances
+	size_t                             firstPrimitive = m_primitives.size();
+	std::vector<std::vector<uint32_t>> meshPrimitives = importMeshes(gltfFile, tmodel, materialRemap);
+	buildPrimitiveBvhs(firstPrimitive);
+	importNodes(tmodel, meshPrimitives, rootTransform);
+
+	m_gltfScene.destroy();  // Release buffers
+	return true;
+}
+
+uint32_t SceneData::addImages(tinygltf::Model& gltfModel)
+{
+	uint32_t          first = uint32_t(m_images.size());
+	std::vector<bool> srgb  = srgbImages(gltfModel);
+	for(size_t i = 0; i < gltfModel.images.size(); i++)
+	{
+		auto& gltfImage = gltfModel.images[i];
+		Image image;
+		if(gltfImage.width > 0 && gltfImage.height > 0)
+		{
+			image.width  = uint32_t(gltfImage.width);
+			image.height = uint32_t(gltfImage.height);
+			image.srgb   = srgb[i];
+			image.pixels = std::move(gltfImage.image);  // RGBA8, see GltfFile::loadImage
+		}
+		m_images.push_back(std::move(image));
+	}
+	return first;
+}
+
+// The materials of the file are imported before its images, with glTF texture indices
+std::vector<bool> SceneData::srgbImages(const tinygltf::Model& gltfModel) const
+{
+	std::vector<bool> srgb(gltfModel.images.size(), false);
+	auto              colorTexture = [&](int texture) {
+		if(texture > -1 && gltfModel.textures[texture].source > -1)
+			srgb[gltfModel.textures[texture].source] = true;
+	};
+	for(const auto& material : m_gltfScene.m_materials)
+	{
+		colorTexture(material.pbrBaseColorTexture);
+		colorTexture(material.emissiveTexture);
+	}
+	return srgb;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reading the triangle primitives of all meshes into the staging vectors, straight from the
+// mapped buffers. Returns the indices of the primitives of each mesh in m_primitives.
+//
+std::vector<std::vector<uint32_t>> SceneData::importMeshes(const GltfFile&              gltfFile,
+														   const tinygltf::Model&       tmodel,
+														   const std::vector<uint32_t>& materialRemap)
+{
+	std::vector<std::vector<uint32_t>> meshPrimitives(tmodel.meshes.size());
+
+	// Primitives using the same accessors only differ by their material: the geometry is shared
+	std::map<std::array<int, 5>, std::pair<nvh::GltfPrimMesh, bool>> geometryCache;
+
+	for(size_t meshIndex = 0; meshIndex < tmodel.meshes.size(); meshIndex++)
+	{
+		for(const auto& tprimitive : tmodel.meshes[meshIndex].primitives)
+		{
+			if(tprimitive.mode != TINYGLTF_MODE_TRIANGLES)
+				continue;
+
+			auto attribute = [&](const char* name) {
+				auto it = tprimitive.attributes.find(name);
+				return it == tprimitive.attributes.end() ? -1 : it->second;
+			};
+			std::array<int, 5> key = {tprimitive.indices, attribute("POSITION"), attribute("NORMAL"),
+									  attribute("TEXCOORD_0"), attribute("TANGENT")};
+
+			nvh::GltfPrimMesh primitive;
+			bool              indices16 = false;
+			auto              cached    = geometryCache.find(key);
+			if(cached != geometryCache.end())
+			{
+				std::tie(primitive, indices16) = cached->second;
+			}
+			else
+			{
+				if(!importGeometry(gltfFile, tmodel, key[0], key[1], key[2], key[3], key[4], primitive, indices16))
+				{
+					LOGW("Skipping primitive of mesh %zu: invalid accessors\n", meshIndex);
+					continue;
+				}
+				geometryCache[key] = {primitive, indices16};
+			}
+			size_t material         = size_t(std::max(0, tprimitive.material));
+			primitive.materialIndex = materialRemap[material < materialRemap.size() ? material : 0];
+
+			m_numVertices += primitive.vertexCount;
+			m_numTriangles += primitive.indexCount;
+			m_maxVerticesPerPrimitive = std::max<size_t>(m_maxVerticesPerPrimitive, primitive.vertexCount);
+
+			meshPrimitives[meshIndex].push_back(uint32_t(m_primitives.size()));
+			m_primitives.push_back(primitive);
+			m_primitiveIndices16.push_back(indices16 ? 1 : 0);
+		}
+	}
+
+	// Missing tangents, in place and concurrently
+	std::vector<TangentPrimitive> tangentPrimitives;
+	for(const auto& pending : m_pendingTangents)
+	{
+		TangentPrimitive primitive;
+		primitive.positions   = &m_vtxPositions[pending.vertexOffset];
+		primitive.normals     = pending.normals.data();
+		primitive.uvs         = pending.uvs.data();
+		primitive.indices     = pending.indices.data();
+		primitive.indexCount  = pending.indices.size();
+		primitive.vertexCount = pending.normals.size();
+		primitive.tangents    = &m_tangents[pending.vertexOffset];
+		tangentPrimitives.push_back(primitive);
+	}
+	generateTangents(tangentPrimitives.data(), tangentPrimitives.size());
+	m_pendingTangents.clear();
+
+	return meshPrimitives;
+}
+
+bool SceneData::importGeometry(const GltfFile&        gltfFile,
+							   const tinygltf::Model& tmodel,
+							   int                    indicesAccessor,
+							   int                    positionAccessor,
+							   int                    normalAccessor,
+							   int                    uvAccessor,
+							   int                    tangentAccessor,
+							   nvh::GltfPrimMesh&     primitive,
+							   bool&                  indices16)
+{
+	GltfFile::AccessorView positions, indices, normals, uvs, tangents;
+	if(!gltfFile.accessor(tmodel, positionAccessor, positions) || positions.numComponents != 3
+	   || (indicesAccessor > -1 && !gltfFile.accessor(tmodel, indicesAccessor, indices))
+	   || (normalAccessor > -1 && !gltfFile.accessor(tmodel, normalAccessor, normals))
+	   || (uvAccessor > -1 && !gltfFile.accessor(tmodel, uvAccessor, uvs))
+	   || (tangentAccessor > -1 && !gltfFile.accessor(tmodel, tangentAccessor, tangents))
+	   || (normals.count && normals.count < positions.count) || (uvs.count && uvs.count < positions.count)
+	   || (tangents.count && tangents.count < positions.count))
+		return false;
+
+	size_t v0          = m_vtxPositions.size();
+	size_t vertexCount = positions.count;
+	primitive.vertexOffset = uint32_t(v0);
+	primitive.vertexCount  = uint32_t(vertexCount);
+
+	// Positions
+	m_vtxPositions.resize(v0 + vertexCount);
+	if(positions.data && positions.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && positions.stride == sizeof(vec3f))
+		memcpy(&m_vtxPositions[v0], positions.data, vertexCount * sizeof(vec3f));
+	else
+		for(size_t i = 0; i < vertexCount; i++)
+			readFloats<3>(positions, i, &m_vtxPositions[v0 + i].x);
+
+	const tinygltf::Accessor& positionInfo = tmodel.accessors[positionAccessor];
+	if(positionInfo.minValues.size() == 3 && positionInfo.maxValues.size() == 3)
+	{
+		primitive.posMin = vec3f(float(positionInfo.minValues[0]), float(positionInfo.minValues[1]),
+								 float(positionInfo.minValues[2]));
+		primitive.posMax = vec3f(float(positionInfo.maxValues[0]), float(positionInfo.maxValues[1]),
+								 float(positionInfo.maxValues[2]));
+	}
+	else
+	{
+		const float maxFloat = std::numeric_limits<float>::max();
+		primitive.posMin     = vec3f(maxFloat, maxFloat, maxFloat);
+		primitive.posMax     = vec3f(-maxFloat, -maxFloat, -maxFloat);
+		for(size_t i = v0; i < v0 + vertexCount; i++)
+		{
+			primitive.posMin = nvmath::nv_min(primitive.posMin, m_vtxPositions[i]);
+			primitive.posMax = nvmath::nv_max(primitive.posMax, m_vtxPositions[i]);
+		}
+	}
+
+	// Indices, relative to the first vertex of the primitive
+	std::vector<uint32_t> localIndices(indicesAccessor > -1 ? indices.count : vertexCount);
+	for(size_t i = 0; i < localIndices.size(); i++)
+	{
+		localIndices[i] = indicesAccessor > -1 ? readIndex(indices, i) : uint32_t(i);
+		if(localIndices[i] >= vertexCount)
+		{
+			m_vtxPositions.resize(v0);
+			return false;
+		}
+	}
+	PackedIndexRange range = appendPackedIndices(m_indices, localIndices.data(), localIndices.size());
+	primitive.firstIndex   = range.firstIndex;
+	primitive.indexCount   = uint32_t(localIndices.size());
+	indices16              = range.is16Bit;
+
+	// Normals, generated from the triangles if missing
+	std::vector<vec3f> localNormals(vertexCount, vec3f(0.f, 0.f, 0.f));
+	if(normalAccessor > -1)
+	{
+		if(normals.data && normals.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && normals.stride == sizeof(vec3f))
+			memcpy(localNormals.data(), normals.data, vertexCount * sizeof(vec3f));
+		else
+			for(size_t i = 0; i < vertexCount; i++)
+				readFloats<3>(normals, i, &localNormals[i].x);
+	}
+	else
+	{
+		for(size_t i = 0; i + 2 < localIndices.size(); i += 3)
+		{
+			const vec3f& p0 = m_vtxPositions[v0 + localIndices[i + 0]];
+			vec3f        n  = nvmath::cross(m_vtxPositions[v0 + localIndices[i + 1]] - p0,
+										m_vtxPositions[v0 + localIndices[i + 2]] - p0);
+			for(int k = 0; k < 3; k++)
+				localNormals[localIndices[i + k]] += n;
+		}
+		for(auto& n : localNormals)
+			n = nvmath::length(n) > 0.f ? nvmath::normalize(n) : vec3f(0.f, 0.f, 1.f);
+	}
+	m_normals.resize(v0 + vertexCount);
+	octEncodeUnitVectors(localNormals.data(), vertexCount, &m_normals[v0]);
+
+	// Texture coordinates
+	std::vector<vec2f> localUvs(vertexCount, vec2f(0.f, 0.f));
+	if(uvs.data && uvs.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && uvs.stride == sizeof(vec2f))
+		memcpy(localUvs.data(), uvs.data, vertexCount * sizeof(vec2f));
+	else
+		for(size_t i = 0; i < vertexCount; i++)
+			readFloats<2>(uvs, i, &localUvs[i].x);
+	m_uvs.resize(v0 + vertexCount);
+	packUnorm2x16(localUvs.data(), vertexCount, &m_uvs[v0]);
+
+	// Tangent space, generated with the other primitives missing it at the end of importMeshes
+	m_tangents.resize(v0 + vertexCount);
+	if(tangentAccessor > -1)
+	{
+		for(size_t i = 0; i < vertexCount; i++)
+			readFloats<4>(tangents, i, &m_tangents[v0 + i].x);
+	}
+	else
+	{
+		m_pendingTangents.push_back({v0, std::move(localNormals), std::move(localUvs), std::move(localIndices)});
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+// CPU-side hierarchies of the primitives imported from `firstPrimitive` on, one per distinct
+// geometry. Most primitives are small, so each hierarchy is built on one thread and the
+// primitives are spread over the workers, largest first.
+//
+void SceneData::buildPrimitiveBvhs(size_t firstPrimitive)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	// Primitives sharing their first index and vertex share their geometry
+	std::map<std::pair<uint32_t, uint32_t>, uint32_t> geometryBvh;
+	std::vector<size_t>                               bvhPrimitive;  // Source primitive of each new hierarchy
+	size_t                                            firstBvh = m_bvhs.size();
+	for(size_t i = firstPrimitive; i < m_primitives.size(); i++)
+	{
+		const auto& primitive = m_primitives[i];
+		auto        key       = std::make_pair(primitive.firstIndex, primitive.vertexOffset);
+		auto        inserted  = geometryBvh.emplace(key, uint32_t(firstBvh + bvhPrimitive.size()));
+		if(inserted.second)
+			bvhPrimitive.push_back(i);
+		m_primitiveBvh.push_back(inserted.first->second);
+	}
+
+	std::vector<size_t> order(bvhPrimitive.size());
+	for(size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return m_primitives[bvhPrimitive[a]].indexCount > m_primitives[bvhPrimitive[b]].indexCount;
+	});
+
+	m_bvhs.resize(firstBvh + bvhPrimitive.size());
+	BvhBuildSettings settings;
+	settings.threadCount = 1;
+	parallelFor(order.size(), [&](size_t i) {
+		size_t                p         = bvhPrimitive[order[i]];
+		const auto&           primitive = m_primitives[p];
+		PackedIndexRange      range{primitive.firstIndex, m_primitiveIndices16[p] != 0};
+		std::vector<uint32_t> indices(primitive.indexCount);
+		for(size_t k = 0; k < indices.size(); k++)
+			indices[k] = packedIndex(m_indices, range, k);
+		m_bvhs[firstBvh + order[i]] = buildTriangleBvh(&m_vtxPositions[primitive.vertexOffset], sizeof(vec3f),
+													   indices.data(), indices.size(), settings);
+	});
+
+	// SAH costs weighted by the triangle counts
+	double sahCost   = 0.;
+	size_t triangles = 0;
+	for(size_t b = firstBvh; b < m_bvhs.size(); b++)
+	{
+		sahCost += double(bvhSahCost(m_bvhs[b].bvh, settings)) * m_bvhs[b].triangles.size();
+		triangles += m_bvhs[b].triangles.size();
+	}
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime);
+	LOGI("%zu BVHs over %zu triangles in %.1f ms, SAH cost %.2f on average\n", bvhPrimitive.size(), triangles,
+		 elapsed.count(), triangles ? sahCost / triangles : 0.);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Instancing the primitives of the nodes of the default scene
+//
+void SceneData::importNodes(const tinygltf::Model&                    tmodel,
+							const std::vector<std::vector<uint32_t>>& meshPrimitives,
+							const nvmath::mat4f&                      rootTransform)
+{
+	std::vector<int> roots;
+	if(!tmodel.scenes.empty())
+	{
+		int scene = tmodel.defaultScene > -1 ? tmodel.defaultScene : 0;
+		roots     = tmodel.scenes[std::min<size_t>(scene, tmodel.scenes.size() - 1)].nodes;
+	}
+	else
+	{
+		// No scene: every node without a parent is a root
+		std::vector<bool> isChild(tmodel.nodes.size(), false);
+		for(const auto& node : tmodel.nodes)
+			for(int child : node.children)
+				if(child >= 0 && size_t(child) < isChild.size())
+					isChild[child] = true;
+		for(size_t i = 0; i < tmodel.nodes.size(); i++)
+			if(!isChild[i])
+				roots.push_back(int(i));
+	}
+
+	// Depth first, nodes with the world matrix of their parent
+	std::vector<std::pair<int, nvmath::mat4f>> stack;
+	for(auto it = roots.rbegin(); it != roots.rend(); ++it)
+		stack.emplace_back(*it, rootTransform);
+	while(!stack.empty())
+	{
+		auto [nodeIndex, parentMatrix] = stack.back();
+		stack.pop_back();
+		if(nodeIndex < 0 || size_t(nodeIndex) >= tmodel.nodes.size())
+			continue;
+
+		const tinygltf::Node& node        = tmodel.nodes[nodeIndex];
+		nvmath::mat4f         worldMatrix = parentMatrix * localMatrix(node);
+		if(node.mesh > -1 && size_t(node.mesh) < meshPrimitives.size())
+		{
+			for(uint32_t primitive : meshPrimitives[node.mesh])
+			{
+				m_worldFromInstance.push_back(worldMatrix);
+				m_nodePrimitivesLUT.push_back(primitive);
+			}
+		}
+		for(auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+			stack.emplace_back(*it, worldMatrix);
+	}
+}
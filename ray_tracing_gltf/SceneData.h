@@ -0,0 +1,116 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Copyright 2020 Carmelo J Fdez-Aguera
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+// and associated documentation files (the "Software"), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge, publish, distribute,
+// sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or
+// substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+// NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "nvh/gltfscene.hpp"
+#include <nvmath/nvmath_types.h>
+
+#include "GltfFile.h"
+#include "bvh.h"
+#include "dedup_table.h"
+#include "packed_indices.h"
+
+// CPU side of a RenderScene: the glTF files imported into the arrays that are uploaded as they
+// are, without any Vulkan object. RenderScene adds the GPU resources on top of it; the CPU
+// renderers (CpuPathTracer.h) read it directly.
+class SceneData
+{
+public:
+	virtual ~SceneData() = default;
+
+	// Returns false if the file could not be loaded
+	bool loadGltf(const std::string& fileName, nvmath::mat4f = nvmath::mat4f(1));
+
+	// Image of the scene, decoded to RGBA8
+	struct Image
+	{
+		uint32_t             width{0};
+		uint32_t             height{0};
+		bool                 srgb{false};  // Color in sRGB, alpha linear. See srgbImages.
+		std::vector<uint8_t> pixels;
+	};
+
+	// --- CPU buffers ---
+	std::vector<nvmath::mat4f> m_worldFromInstance;
+	std::vector<nvh::GltfPrimMesh>     m_primitives;
+	std::vector<uint32_t>      m_primitiveIndices16;  // Per primitive, non zero if its indices are 16-bit
+	std::vector<uint32_t>      m_nodePrimitivesLUT;
+	DedupTable<nvh::GltfMaterial> m_materials;  // Identical materials of all loaded files merged
+	// CPU-side hierarchies in the space of each primitive (see bvh.h), for picking and validation.
+	// Primitives sharing their geometry share their hierarchy.
+	std::vector<TriangleBvh>   m_bvhs;
+	std::vector<uint32_t>      m_primitiveBvh;  // Per primitive, index in m_bvhs
+
+	// Vertex attributes, in the layout of the GPU buffers. RenderScene releases them once uploaded.
+	std::vector<nvmath::vec3f> m_vtxPositions;
+	std::vector<uint32_t>      m_normals;  // Octahedron encoded, see vertex_packing.h
+	std::vector<nvmath::vec4f> m_tangents;
+	std::vector<uint32_t>      m_uvs;      // unorm16 pairs
+	std::vector<uint32_t>      m_indices;  // 16 and 32-bit indices, see packed_indices.h
+
+	// Textures of the materials, in the order of their indices. Only kept by the CPU renderers:
+	// RenderScene turns them into textures instead.
+	std::vector<Image> m_images;
+
+	// Statistics
+	size_t m_numVertices             = 0;
+	size_t m_numTriangles            = 0;
+	size_t m_maxVerticesPerPrimitive = 0;
+
+protected:
+	// Takes the decoded images of a file being loaded, before its materials are added.
+	// Returns the index of the first one, which the texture indices of the materials are offset by.
+	virtual uint32_t addImages(tinygltf::Model& gltfModel);
+
+	// Per image of the file being loaded, true if a material uses it as a base color or emissive
+	// texture. Their colors are sRGB encoded; the other textures hold linear data (glTF 2.0 3.9).
+	std::vector<bool> srgbImages(const tinygltf::Model& gltfModel) const;
+
+private:
+	std::vector<std::vector<uint32_t>> importMeshes(const GltfFile&              gltfFile,
+													const tinygltf::Model&       tmodel,
+													const std::vector<uint32_t>& materialRemap);
+	bool importGeometry(const GltfFile&        gltfFile,
+						const tinygltf::Model& tmodel,
+						int                    indicesAccessor,
+						int                    positionAccessor,
+						int                    normalAccessor,
+						int                    uvAccessor,
+						int                    tangentAccessor,
+						nvh::GltfPrimMesh&     primitive,
+						bool&                  indices16);
+	void buildPrimitiveBvhs(size_t firstPrimitive);
+	void importNodes(const tinygltf::Model&                    tmodel,
+					 const std::vector<std::vector<uint32_t>>& meshPrimitives,
+					 const nvmath::mat4f&                      rootTransform);
+
+	nvh::GltfScene m_gltfScene;
+
+	// Primitives without tangents, see importMeshes
+	struct PendingTangents
+	{
+		size_t                     vertexOffset;
+		std::vector<nvmath::vec3f> normals;
+		std::vector<nvmath::vec2f> uvs;
+		std::vector<uint32_t>      indices;  // Local to the primitive
+	};
+	std::vector<PendingTangents> m_pendingTangents;
+};
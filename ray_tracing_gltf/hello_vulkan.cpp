@@ -25,6 +25,9 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <sstream>
 #include <vulkan/vulkan.hpp>
 
@@ -48,7 +51,13 @@ extern std::vector<std::string> defaultSearchPaths;
 
 #include "RenderContext.h"
 #include "RenderScene.h"
+#include "baked_texture_vk.h"
+#include "meshlet_builder.h"
+#include "packed_indices.h"
+#include "quantized_positions.h"
+#include "scene_cache.h"
 #include "shaders/binding.glsl"
+#include "tangent_space.h"
 
 // Holding the camera matrices
 struct CameraMatrices
@@ -90,6 +99,8 @@ void HelloVulkan::renderUI()
 		mustClean |= ImGui::Checkbox("Ignore diffuse", &specularOnly);
 		bool importanceSampling = m_rtPushConstants.renderFlags & (1 << 6);
 		mustClean |= ImGui::Checkbox("Importance sampling", &importanceSampling);
+		// Same order as kSampler* of sampler.h
+		mustClean |= ImGui::Combo("Sampler", &m_rtPushConstants.samplerType, "Random (tea, lcg)\0Owen-scrambled Sobol\0R2 + blue noise\0");
 		bool useDOF = m_rtPushConstants.renderFlags & (1 << 7);
 		mustClean |= ImGui::Checkbox("Depth of field", &useDOF);
 		m_rtPushConstants.renderFlags =
@@ -174,6 +185,8 @@ void HelloVulkan::createDescriptorSetLayout()
   auto nbTextures = static_cast<uint32_t>(m_textures.size());
   bind.addBinding(vkDS(B_TEXTURES, vkDT::eCombinedImageSampler, nbTextures,
 					   vkSS::eFragment | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
+  bind.addBinding(vkDS(B_SAMPLER, vkDT::eStorageBuffer, 1,
+					   vkSS::eRaygenKHR | vkSS::eClosestHitKHR | vkSS::eAnyHitKHR));
 
 
   m_descSetLayout = m_descSetLayoutBind.createLayout(m_device);
@@ -197,6 +210,7 @@ void HelloVulkan::updateDescriptorSet()
   vk::DescriptorBufferInfo uvDesc{m_uvBuffer.buffer, 0, VK_WHOLE_SIZE};
   vk::DescriptorBufferInfo materialDesc{m_materialBuffer.buffer, 0, VK_WHOLE_SIZE};
   vk::DescriptorBufferInfo matrixDesc{m_matrixBuffer.buffer, 0, VK_WHOLE_SIZE};
+  vk::DescriptorBufferInfo samplerDesc{m_samplerBuffer.buffer, 0, VK_WHOLE_SIZE};
 
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, B_CAMERA, &dbiUnif));
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, B_VERTICES, &vertexDesc));
@@ -206,6 +220,7 @@ void HelloVulkan::updateDescriptorSet()
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, B_TEXCOORDS, &uvDesc));
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, B_MATERIALS, &materialDesc));
   writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, B_MATRICES, &matrixDesc));
+  writes.emplace_back(m_descSetLayoutBind.makeWrite(m_descSet, B_SAMPLER, &samplerDesc));
 
   // All texture samplers
   std::vector<vk::DescriptorImageInfo> diit;
@@ -242,10 +257,12 @@ void HelloVulkan::createGraphicsPipeline()
   gpb.depthStencilState.depthTestEnable = true;
   gpb.addShader(nvh::loadFile("shaders/vert_shader.vert.spv", true, paths), vkSS::eVertex);
   gpb.addShader(nvh::loadFile("shaders/frag_shader.frag.spv", true, paths), vkSS::eFragment);
+  uint32_t   positionStride = m_quantizePositions ? sizeof(QuantizedPosition) : sizeof(nvmath::vec3);
+  vk::Format positionFormat = m_quantizePositions ? vk::Format::eR16G16B16A16Unorm : vk::Format::eR32G32B32Sfloat;
   gpb.addBindingDescriptions(
-	  {{0, sizeof(nvmath::vec3)}, {1, sizeof(nvmath::vec3)}, {2, sizeof(nvmath::vec2)}});
+	  {{0, positionStride}, {1, sizeof(nvmath::vec3)}, {2, sizeof(nvmath::vec2)}});
   gpb.addAttributeDescriptions({
-	  {0, 0, vk::Format::eR32G32B32Sfloat, 0},  // Position
+	  {0, 0, positionFormat, 0},  // Position
 	  {1, 1, vk::Format::eR32G32B32Sfloat, 0},  // Normal
 	  {2, 2, vk::Format::eR32G32Sfloat, 0},     // Texcoord0
   });
@@ -253,17 +270,68 @@ void HelloVulkan::createGraphicsPipeline()
   m_debug.setObjectName(m_graphicsPipeline, "Graphics");
 }
 
+//--------------------------------------------------------------------------------------------------
+// Tables of the samplers of the path tracer, see sampler.glsl
+//
+void HelloVulkan::createSamplerBuffer()
+{
+  nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
+  vk::CommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
+
+  SamplerTables tables;
+  m_samplerBuffer = m_alloc.createBuffer(cmdBuf, tables.buffer(), vk::BufferUsageFlagBits::eStorageBuffer);
+
+  cmdBufGet.submitAndWait(cmdBuf);
+  m_alloc.finalizeAndReleaseStaging();
+  m_debug.setObjectName(m_samplerBuffer.buffer, "Sampler");
+}
+
 //--------------------------------------------------------------------------------------------------
 // Loading the OBJ file and setting up all buffers
 //
 void HelloVulkan::loadScene(const std::string& filename)
+{
+  // Create the buffers on Device and copy vertices, indices and materials
+  nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
+  vk::CommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
+
+  SceneCache cache;
+  if(cache.open(sceneCacheFilename(filename), kGltfCacheVersion) && loadSceneCache(cmdBuf, cache))
+  {
+    LOGI("Loaded %s from cache\n", filename.c_str());
+  }
+  else
+  {
+    importScene(cmdBuf, filename);
+  }
+  cache.close();
+
+  cmdBufGet.submitAndWait(cmdBuf);
+  m_alloc.finalizeAndReleaseStaging();
+
+  m_debug.setObjectName(m_vertexBuffer.buffer, "Vertex");
+  m_debug.setObjectName(m_indexBuffer.buffer, "Index");
+  m_debug.setObjectName(m_normalBuffer.buffer, "Normal");
+  m_debug.setObjectName(m_tangentBuffer.buffer, "Tangent");
+  m_debug.setObjectName(m_uvBuffer.buffer, "TexCoord");
+  m_debug.setObjectName(m_materialBuffer.buffer, "Material");
+  m_debug.setObjectName(m_matrixBuffer.buffer, "Matrix");
+}
+
+//--------------------------------------------------------------------------------------------------
+// Loading the glTF file with tinygltf, then writing the baked cache for the next run
+//
+void HelloVulkan::importScene(const vk::CommandBuffer& cmdBuf, const std::string& filename)
 {
   using vkBU = vk::BufferUsageFlagBits;
   tinygltf::Model    tmodel;
   tinygltf::TinyGLTF tcontext;
   std::string        warn, error;
 
-  if(!tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, filename))
+  bool isBinary = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".glb") == 0;
+  bool loaded   = isBinary ? tcontext.LoadBinaryFromFile(&tmodel, &error, &warn, filename) :
+                           tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, filename);
+  if(!loaded)
   {
 	assert(!"Error while loading scene");
   }
@@ -275,16 +343,6 @@ void HelloVulkan::loadScene(const std::string& filename)
   m_gltfScene.importDrawableNodes(tmodel,
 								  nvh::GltfAttributes::Normal | nvh::GltfAttributes::Texcoord_0);
 
-  // Create the buffers on Device and copy vertices, indices and materials
-  nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
-  vk::CommandBuffer cmdBuf = cmdBufGet.createCommandBuffer();
-
-  m_vertexBuffer =
-	  m_alloc.createBuffer(cmdBuf, m_gltfScene.m_positions,
-						   vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
-  m_indexBuffer =
-	  m_alloc.createBuffer(cmdBuf, m_gltfScene.m_indices,
-						   vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   m_normalBuffer   = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_normals,
 										vkBU::eVertexBuffer | vkBU::eStorageBuffer);
   m_uvBuffer       = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_texcoords0,
@@ -292,23 +350,30 @@ void HelloVulkan::loadScene(const std::string& filename)
   m_materialBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_materials, vkBU::eStorageBuffer);
 
   // Generate or load tangent space
-  std::vector<vec4f> tangents;
   if(m_gltfScene.m_tangents.size()
      != m_gltfScene.m_positions.size())  // No tangents provided. Generate them
   {
-    m_gltfScene.m_tangents.clear();
+    m_gltfScene.m_tangents.resize(m_gltfScene.m_positions.size());
+    std::vector<TangentPrimitive> tangentPrimitives;
+    std::set<uint32_t>            generated;  // Primitives sharing their vertices
     for(const auto& primitive : m_gltfScene.m_primMeshes)
     {
-      tangents = RenderScene::generateTangentSpace(m_gltfScene.m_positions, m_gltfScene.m_normals,
-                                      m_gltfScene.m_texcoords0, m_gltfScene.m_indices,
-                                      primitive.indexCount, primitive.vertexCount,
-                                      primitive.firstIndex, primitive.vertexOffset);
-      m_gltfScene.m_tangents.insert(m_gltfScene.m_tangents.end(), tangents.begin(), tangents.end());
+      if(!generated.insert(primitive.vertexOffset).second)
+        continue;
+      TangentPrimitive prim;
+      prim.positions   = &m_gltfScene.m_positions[primitive.vertexOffset];
+      prim.normals     = &m_gltfScene.m_normals[primitive.vertexOffset];
+      prim.uvs         = &m_gltfScene.m_texcoords0[primitive.vertexOffset];
+      prim.indices     = &m_gltfScene.m_indices[primitive.firstIndex];
+      prim.indexCount  = primitive.indexCount;
+      prim.vertexCount = primitive.vertexCount;
+      prim.tangents    = &m_gltfScene.m_tangents[primitive.vertexOffset];
+      tangentPrimitives.push_back(prim);
     }
+    generateTangents(tangentPrimitives.data(), tangentPrimitives.size());
   }
 
-  tangents = m_gltfScene.m_tangents;
-  m_tangentBuffer = m_alloc.createBuffer(cmdBuf, tangents,
+  m_tangentBuffer = m_alloc.createBuffer(cmdBuf, m_gltfScene.m_tangents,
                                         vkBU::eVertexBuffer | vkBU::eStorageBuffer);
 
   // Instance Matrices used by rasterizer
@@ -319,28 +384,346 @@ void HelloVulkan::loadScene(const std::string& filename)
   }
   m_matrixBuffer = m_alloc.createBuffer(cmdBuf, nodeMatrices, vkBU::eStorageBuffer);
 
-  // The following is used to find the primitive mesh information in the CHIT
-  std::vector<RtPrimitiveLookup> primLookup;
-  for(auto& primMesh : m_gltfScene.m_primMeshes)
+  // Triangles of each primitive in meshlet order, for locality (see meshlet_builder.h)
+  std::vector<size_t> meshletPrims;
+  std::set<uint32_t>  reordered;  // Primitives sharing their indices
+  for(size_t i = 0; i < m_gltfScene.m_primMeshes.size(); i++)
+    if(reordered.insert(m_gltfScene.m_primMeshes[i].firstIndex).second)
+      meshletPrims.push_back(i);
+  std::vector<MeshletStats> primStats(meshletPrims.size());
+  parallelFor(meshletPrims.size(), [&](size_t i) {
+    const auto&           primMesh = m_gltfScene.m_primMeshes[meshletPrims[i]];
+    uint32_t*             indices  = &m_gltfScene.m_indices[primMesh.firstIndex];
+    std::vector<uint32_t> triangleOrder;
+    MeshletMesh meshlets = buildMeshlets(&m_gltfScene.m_positions[primMesh.vertexOffset], sizeof(nvmath::vec3f),
+                                         primMesh.vertexCount, indices, primMesh.indexCount, &triangleOrder);
+    if(triangleOrder.size() * 3 == primMesh.indexCount)  // Unless some indices were out of range
+    {
+      std::vector<uint32_t> meshletIndices = reorderIndices(indices, triangleOrder);
+      std::copy(meshletIndices.begin(), meshletIndices.end(), indices);
+    }
+    primStats[i] = meshletStats(meshlets);
+  });
+  MeshletStats stats;
+  for(const auto& primStat : primStats)
+  {
+    stats.meshletCount += primStat.meshletCount;
+    stats.triangleCount += primStat.triangleCount;
+    stats.vertexCount += primStat.vertexCount;
+    stats.cullableCount += primStat.cullableCount;
+  }
+  LOGI("%zu meshlets, %.1f vertices and %.1f triangles on average, %zu with a normal cone\n", stats.meshletCount,
+       stats.meshletCount ? float(stats.vertexCount) / stats.meshletCount : 0.f,
+       stats.meshletCount ? float(stats.triangleCount) / stats.meshletCount : 0.f, stats.cullableCount);
+
+  // Positions are 16-bit, relative to the box of their primitive, when m_quantizePositions is set
+  // (see quantized_positions.h). Primitives sharing their vertices share their quantization.
+  std::vector<QuantizedPosition>    quantizedPositions;
+  std::vector<PositionQuantization> primQuantization(m_gltfScene.m_primMeshes.size());
+  if(m_quantizePositions)
+  {
+	quantizedPositions.resize(m_gltfScene.m_positions.size(), QuantizedPosition{0, 0, 0, 0});
+	std::map<uint32_t, PositionQuantization> quantizedRanges;
+	for(size_t i = 0; i < m_gltfScene.m_primMeshes.size(); i++)
+	{
+	  const auto& primMesh = m_gltfScene.m_primMeshes[i];
+	  auto        it       = quantizedRanges.find(primMesh.vertexOffset);
+	  if(it == quantizedRanges.end())
+	  {
+		const nvmath::vec3f* positions    = &m_gltfScene.m_positions[primMesh.vertexOffset];
+		PositionQuantization quantization = makePositionQuantization(positions, primMesh.vertexCount);
+		quantizePositions(positions, primMesh.vertexCount, quantization, &quantizedPositions[primMesh.vertexOffset]);
+		it = quantizedRanges.emplace(primMesh.vertexOffset, quantization).first;
+	  }
+	  primQuantization[i] = it->second;
+	}
+	m_vertexBuffer =
+		m_alloc.createBuffer(cmdBuf, quantizedPositions,
+							 vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
+  }
+  else
+  {
+	m_vertexBuffer =
+		m_alloc.createBuffer(cmdBuf, m_gltfScene.m_positions,
+							 vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
+  }
+
+  // Indices are 16-bit for the primitives where they fit, see packed_indices.h. The first index
+  // of the primitives is now in the packed buffer.
+  std::vector<uint32_t>                indexWords;
+  std::map<uint32_t, PackedIndexRange> packedRanges;  // Primitives sharing their indices
+  m_primLookup.clear();
+  for(size_t i = 0; i < m_gltfScene.m_primMeshes.size(); i++)
   {
-	primLookup.push_back({primMesh.firstIndex, primMesh.vertexOffset, primMesh.materialIndex});
+	auto& primMesh = m_gltfScene.m_primMeshes[i];
+	auto  it       = packedRanges.find(primMesh.firstIndex);
+	if(it == packedRanges.end())
+	{
+	  PackedIndexRange range = appendPackedIndices(indexWords, &m_gltfScene.m_indices[primMesh.firstIndex],
+												   primMesh.indexCount);
+	  it = packedRanges.emplace(primMesh.firstIndex, range).first;
+	}
+	primMesh.firstIndex = it->second.firstIndex;
+
+	// The following is used to find the primitive mesh information in the CHIT
+	RtPrimitiveLookup lookup{primMesh.firstIndex, primMesh.vertexOffset, primMesh.materialIndex,
+							 it->second.is16Bit ? 1u : 0u};
+	if(m_quantizePositions)
+	{
+	  lookup.positionScale  = nvmath::vec4f(primQuantization[i].scale, 1.f);
+	  lookup.positionOffset = nvmath::vec4f(primQuantization[i].offset, 0.f);
+	}
+	m_primLookup.push_back(lookup);
   }
+  LOGI("Index buffer: %zu bytes, %zu with 32-bit indices only\n", indexWords.size() * sizeof(uint32_t),
+	   m_gltfScene.m_indices.size() * sizeof(uint32_t));
+
+  m_indexBuffer =
+	  m_alloc.createBuffer(cmdBuf, indexWords,
+						   vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   m_rtPrimLookup =
-	  m_alloc.createBuffer(cmdBuf, primLookup, vk::BufferUsageFlagBits::eStorageBuffer);
+	  m_alloc.createBuffer(cmdBuf, m_primLookup, vk::BufferUsageFlagBits::eStorageBuffer);
 
+  // The acceleration structures are built from the decoded positions, so they match the shading
+  if(m_quantizePositions)
+  {
+	std::vector<nvmath::vec3f> decoded = decodePositions(quantizedPositions.data(), quantizedPositions.size());
+	float                      maxError = 0.f, errorBound = 0.f;
+	for(size_t i = 0; i < m_gltfScene.m_primMeshes.size(); i++)
+	{
+	  const auto& primMesh = m_gltfScene.m_primMeshes[i];
+	  errorBound           = std::max(errorBound, quantizationErrorBound(primQuantization[i]));
+	  for(uint32_t v = primMesh.vertexOffset; v < primMesh.vertexOffset + primMesh.vertexCount; v++)
+		maxError = std::max(maxError, nvmath::length(decoded[v] - m_gltfScene.m_positions[v]));
+	}
+	LOGI("Quantized positions: %zu bytes instead of %zu, max error %g (bound %g)\n",
+		 quantizedPositions.size() * sizeof(QuantizedPosition), m_gltfScene.m_positions.size() * sizeof(nvmath::vec3f),
+		 maxError, errorBound);
+	m_blasPositions = m_alloc.createBuffer(cmdBuf, decoded, vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
+  }
 
   // Creates all textures found
-  createTextureImages(cmdBuf, tmodel);
-  cmdBufGet.submitAndWait(cmdBuf);
-  m_alloc.finalizeAndReleaseStaging();
+  std::vector<std::shared_ptr<const BakedTexture>> textures = bakeTextureImages(tmodel);
+  createTextureImages(textures);
 
-  m_debug.setObjectName(m_vertexBuffer.buffer, "Vertex");
-  m_debug.setObjectName(m_indexBuffer.buffer, "Index");
-  m_debug.setObjectName(m_normalBuffer.buffer, "Normal");
-  m_debug.setObjectName(m_tangentBuffer.buffer, "Tangent");
-  m_debug.setObjectName(m_uvBuffer.buffer, "TexCoord");
-  m_debug.setObjectName(m_materialBuffer.buffer, "Material");
-  m_debug.setObjectName(m_matrixBuffer.buffer, "Matrix");
+  saveSceneCache(filename, tmodel, quantizedPositions, indexWords, textures);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Baked scene cache
+// The vertex streams, indices, materials, primitive tables and decoded images are stored in the
+// layout of the GPU buffers. A cached load uploads them straight from the memory mapping: tinygltf,
+// the tangent generation and the image decoding are skipped.
+//
+namespace {
+const uint32_t kChunkPositions   = makeChunkId('P', 'O', 'S', 'N');
+const uint32_t kChunkNormals     = makeChunkId('N', 'R', 'M', 'L');
+const uint32_t kChunkTexcoords   = makeChunkId('T', 'E', 'X', '0');
+const uint32_t kChunkTangents    = makeChunkId('T', 'A', 'N', 'G');
+const uint32_t kChunkIndices     = makeChunkId('I', 'N', 'D', 'X');
+const uint32_t kChunkMaterials   = makeChunkId('M', 'A', 'T', 'L');
+const uint32_t kChunkPrimMeshes  = makeChunkId('P', 'R', 'I', 'M');
+const uint32_t kChunkNodes       = makeChunkId('N', 'O', 'D', 'E');
+const uint32_t kChunkPrimLookup  = makeChunkId('L', 'O', 'O', 'K');
+const uint32_t kChunkImages      = makeChunkId('I', 'M', 'G', 'S');
+const uint32_t kChunkImageLevels = makeChunkId('I', 'M', 'L', 'V');
+const uint32_t kChunkImageData   = makeChunkId('I', 'M', 'D', 'A');
+
+// nvh::GltfPrimMesh and nvh::GltfNode hold more than we need, only these fields are stored
+struct CachedPrimMesh
+{
+  uint32_t      firstIndex;
+  uint32_t      indexCount;
+  uint32_t      vertexOffset;
+  uint32_t      vertexCount;
+  int           materialIndex;
+  nvmath::vec3f posMin;
+  nvmath::vec3f posMax;
+};
+
+struct CachedNode
+{
+  nvmath::mat4f worldMatrix;
+  int           primMesh;
+};
+
+// Baked texture: its levels are [firstLevel, firstLevel + levelCount) in the level chunk, and its
+// data is at [offset, offset + size) in the data chunk
+struct CachedImage
+{
+  uint32_t compression;
+  uint32_t srgb;
+  uint32_t firstLevel;
+  uint32_t levelCount;
+  uint64_t offset;
+  uint64_t size;
+};
+
+bool isExternalUri(const std::string& uri)
+{
+  return !uri.empty() && uri.compare(0, 5, "data:") != 0;
+}
+
+// Directory of a file, with its trailing separator
+std::string baseDirectory(const std::string& filename)
+{
+  size_t sep = filename.find_last_of("\\/");
+  return sep == std::string::npos ? std::string() : filename.substr(0, sep + 1);
+}
+}  // namespace
+
+void HelloVulkan::saveSceneCache(const std::string&                                      filename,
+                                 const tinygltf::Model&                                  tmodel,
+                                 const std::vector<QuantizedPosition>&                   quantizedPositions,
+                                 const std::vector<uint32_t>&                            indexWords,
+                                 const std::vector<std::shared_ptr<const BakedTexture>>& textures)
+{
+  SceneCacheWriter writer;
+
+  // The glTF file and everything it references
+  std::string baseDir = baseDirectory(filename);
+  writer.addSource(filename);
+  for(const auto& buffer : tmodel.buffers)
+    if(isExternalUri(buffer.uri))
+      writer.addSource(baseDir + buffer.uri);
+  for(const auto& image : tmodel.images)
+    if(isExternalUri(image.uri))
+      writer.addSource(baseDir + image.uri);
+
+  std::vector<CachedPrimMesh> primMeshes;
+  for(const auto& p : m_gltfScene.m_primMeshes)
+    primMeshes.push_back({p.firstIndex, p.indexCount, p.vertexOffset, p.vertexCount, p.materialIndex,
+                          p.posMin, p.posMax});
+  std::vector<CachedNode> nodes;
+  for(const auto& n : m_gltfScene.m_nodes)
+    nodes.push_back({n.worldMatrix, n.primMesh});
+
+  std::vector<CachedImage>   images;
+  std::vector<BakedMipLevel> levels;
+  std::vector<uint8_t>       data;
+  for(const auto& texture : textures)
+  {
+    images.push_back({uint32_t(texture->compression), uint32_t(texture->srgb), uint32_t(levels.size()),
+                      uint32_t(texture->levels.size()), data.size(), texture->dataSize});
+    levels.insert(levels.end(), texture->levels.begin(), texture->levels.end());
+    data.insert(data.end(), texture->data, texture->data + texture->dataSize);
+  }
+
+  if(quantizedPositions.empty())
+    writer.addChunk(kChunkPositions, m_gltfScene.m_positions);
+  else
+    writer.addChunk(kChunkPositions, quantizedPositions);
+  writer.addChunk(kChunkNormals, m_gltfScene.m_normals);
+  writer.addChunk(kChunkTexcoords, m_gltfScene.m_texcoords0);
+  writer.addChunk(kChunkTangents, m_gltfScene.m_tangents);
+  writer.addChunk(kChunkIndices, indexWords);
+  writer.addChunk(kChunkMaterials, m_gltfScene.m_materials);
+  writer.addChunk(kChunkPrimMeshes, primMeshes);
+  writer.addChunk(kChunkNodes, nodes);
+  writer.addChunk(kChunkPrimLookup, m_primLookup);
+  writer.addChunk(kChunkImages, images);
+  writer.addChunk(kChunkImageLevels, levels);
+  writer.addChunk(kChunkImageData, data);
+  writer.write(sceneCacheFilename(filename), kGltfCacheVersion);
+}
+
+bool HelloVulkan::loadSceneCache(const vk::CommandBuffer& cmdBuf, const SceneCache& cache)
+{
+  using vkBU = vk::BufferUsageFlagBits;
+
+  struct Stream
+  {
+    uint32_t             id;
+    nvvk::Buffer&        buffer;
+    vk::BufferUsageFlags usage;
+    const void*          data;
+    size_t               size;
+  };
+  Stream streams[] = {
+      {kChunkPositions, m_vertexBuffer, vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress},
+      {kChunkIndices, m_indexBuffer, vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress},
+      {kChunkNormals, m_normalBuffer, vkBU::eVertexBuffer | vkBU::eStorageBuffer},
+      {kChunkTexcoords, m_uvBuffer, vkBU::eVertexBuffer | vkBU::eStorageBuffer},
+      {kChunkTangents, m_tangentBuffer, vkBU::eVertexBuffer | vkBU::eStorageBuffer},
+      {kChunkMaterials, m_materialBuffer, vkBU::eStorageBuffer},
+      {kChunkPrimLookup, m_rtPrimLookup, vkBU::eStorageBuffer},
+  };
+
+  size_t                nbPrimMeshes = 0, nbNodes = 0, nbImages = 0, nbLevels = 0, dataSize = 0;
+  const CachedPrimMesh* primMeshes   = cache.chunk<CachedPrimMesh>(kChunkPrimMeshes, nbPrimMeshes);
+  const CachedNode*     nodes        = cache.chunk<CachedNode>(kChunkNodes, nbNodes);
+  const CachedImage*    images       = cache.chunk<CachedImage>(kChunkImages, nbImages);
+  const BakedMipLevel*  levels       = cache.chunk<BakedMipLevel>(kChunkImageLevels, nbLevels);
+  const uint8_t*        data         = static_cast<const uint8_t*>(cache.chunk(kChunkImageData, dataSize));
+  bool                  valid        = primMeshes && nodes && data;
+  for(auto& stream : streams)
+    valid = valid && (stream.data = cache.chunk(stream.id, stream.size)) != nullptr;
+  // The positions must have the requested format
+  valid = valid && cache.read(kChunkPrimLookup, m_primLookup)
+          && std::all_of(m_primLookup.begin(), m_primLookup.end(), [&](const RtPrimitiveLookup& lookup) {
+               return (lookup.positionScale.w != 0.f) == m_quantizePositions;
+             });
+  for(size_t i = 0; valid && i < nbImages; i++)
+    valid = images[i].levelCount > 0 && images[i].firstLevel + images[i].levelCount <= nbLevels
+            && images[i].offset + images[i].size <= dataSize;
+
+  // Baked for a format this device cannot sample: rebuild
+  for(size_t i = 0; valid && i < nbImages; i++)
+  {
+    TextureCompression compression = TextureCompression(images[i].compression);
+    valid = supportedTextureCompression(m_physicalDevice, compression, images[i].srgb != 0) == compression;
+  }
+  if(!valid)
+    return false;
+
+  // Host side of the scene: only what the rasterizer and the acceleration structures need
+  m_gltfScene.m_primMeshes.resize(nbPrimMeshes);
+  for(size_t i = 0; i < nbPrimMeshes; i++)
+  {
+    auto& p         = m_gltfScene.m_primMeshes[i];
+    p.firstIndex    = primMeshes[i].firstIndex;
+    p.indexCount    = primMeshes[i].indexCount;
+    p.vertexOffset  = primMeshes[i].vertexOffset;
+    p.vertexCount   = primMeshes[i].vertexCount;
+    p.materialIndex = primMeshes[i].materialIndex;
+    p.posMin        = primMeshes[i].posMin;
+    p.posMax        = primMeshes[i].posMax;
+  }
+  std::vector<nvmath::mat4f> nodeMatrices(nbNodes);
+  m_gltfScene.m_nodes.resize(nbNodes);
+  for(size_t i = 0; i < nbNodes; i++)
+  {
+    m_gltfScene.m_nodes[i].worldMatrix = nodes[i].worldMatrix;
+    m_gltfScene.m_nodes[i].primMesh    = nodes[i].primMesh;
+    nodeMatrices[i]                    = nodes[i].worldMatrix;
+  }
+  cache.read(kChunkMaterials, m_gltfScene.m_materials);
+
+  // Device side, straight from the mapping
+  for(auto& stream : streams)
+    stream.buffer = m_alloc.createBuffer(cmdBuf, stream.size, stream.data, stream.usage);
+  m_matrixBuffer = m_alloc.createBuffer(cmdBuf, nodeMatrices, vkBU::eStorageBuffer);
+  if(m_quantizePositions)
+  {
+    const QuantizedPosition* positions = static_cast<const QuantizedPosition*>(streams[0].data);
+    m_blasPositions = m_alloc.createBuffer(cmdBuf, decodePositions(positions, streams[0].size / sizeof(QuantizedPosition)),
+                                           vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
+  }
+
+  // Baked textures, uploaded from the mapping as well
+  std::vector<std::shared_ptr<const BakedTexture>> textures;
+  for(size_t i = 0; i < nbImages; i++)
+  {
+    auto texture         = std::make_shared<BakedTexture>();
+    texture->compression = TextureCompression(images[i].compression);
+    texture->srgb        = images[i].srgb != 0;
+    texture->levels.assign(levels + images[i].firstLevel, levels + images[i].firstLevel + images[i].levelCount);
+    texture->data     = data + images[i].offset;
+    texture->dataSize = images[i].size;
+    textures.push_back(texture);
+  }
+  createTextureImages(textures);
+  return true;
 }
 
 
@@ -359,56 +742,68 @@ void HelloVulkan::createUniformBuffer()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Creating all textures and samplers
+// Baking the mip chains of the glTF images on the CPU, block compressed when the device
+// supports it. Images that could not be decoded get a white texture.
 //
-void HelloVulkan::createTextureImages(const vk::CommandBuffer& cmdBuf, tinygltf::Model& gltfModel)
+std::vector<std::shared_ptr<const BakedTexture>> HelloVulkan::bakeTextureImages(const tinygltf::Model& gltfModel)
 {
-  using vkIU = vk::ImageUsageFlagBits;
-
-  vk::SamplerCreateInfo samplerCreateInfo{
-	  {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
-  samplerCreateInfo.setMaxLod(FLT_MAX);
-  vk::Format format = vk::Format::eR8G8B8A8Srgb;
-
-  auto addDefaultTexture = [this]() {
-	// Make dummy image(1,1), needed as we cannot have an empty array
-	nvvk::ScopeCommandBuffer cmdBuf(m_device, m_graphicsQueueIndex);
-	std::array<uint8_t, 4>   white = {255, 255, 255, 255};
-	m_textures.emplace_back(m_alloc.createTexture(
-		cmdBuf, 4, white.data(), nvvk::makeImage2DCreateInfo(vk::Extent2D{1, 1}), {}));
-	m_debug.setObjectName(m_textures.back().image, "dummy");
-  };
+  TextureCompression compression = supportedTextureCompression(m_physicalDevice, TextureCompression::eBC7, true);
+
+  uint32_t nbThreads    = getWorkerCount();
+  uint32_t innerThreads = std::max<uint32_t>(1, nbThreads / std::max<uint32_t>(1, uint32_t(gltfModel.images.size())));
+  std::vector<std::shared_ptr<const BakedTexture>> textures(gltfModel.images.size());
+  parallelFor(
+	  gltfModel.images.size(),
+	  [&](size_t i) {
+		const auto& gltfimage = gltfModel.images[i];
+		auto        texture   = std::make_shared<BakedTexture>();
+		if(gltfimage.image.empty() || gltfimage.width <= 0 || gltfimage.height <= 0)
+		{
+		  const uint8_t white[4] = {255, 255, 255, 255};
+		  bakeTexture(1, 1, white, compression, true, *texture, 1);
+		}
+		else
+		{
+		  bakeTexture(gltfimage.width, gltfimage.height, gltfimage.image.data(), compression, true, *texture,
+					  innerThreads);
+		}
+		textures[i] = texture;
+	  },
+	  nbThreads);
+  return textures;
+}
 
-  if(gltfModel.images.empty())
+//--------------------------------------------------------------------------------------------------
+// Creating all textures and samplers
+//
+void HelloVulkan::createTextureImages(const std::vector<std::shared_ptr<const BakedTexture>>& textures)
+{
+  if(textures.empty())
   {
 	addDefaultTexture();
 	return;
   }
 
-  m_textures.reserve(gltfModel.images.size());
-  for(size_t i = 0; i < gltfModel.images.size(); i++)
-  {
-	auto&        gltfimage  = gltfModel.images[i];
-	void*        buffer     = &gltfimage.image[0];
-	VkDeviceSize bufferSize = gltfimage.image.size();
-	auto         imgSize    = vk::Extent2D(gltfimage.width, gltfimage.height);
-
-	if(bufferSize == 0 || gltfimage.width == -1 || gltfimage.height == -1)
-	{
-	  addDefaultTexture();
-	  continue;
-	}
-
-	vk::ImageCreateInfo imageCreateInfo =
-		nvvk::makeImage2DCreateInfo(imgSize, format, vkIU::eSampled, true);
-
-	nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, buffer, imageCreateInfo);
-	nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-	vk::ImageViewCreateInfo ivInfo = nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-	m_textures.emplace_back(m_alloc.createTexture(image, ivInfo, samplerCreateInfo));
+  vk::SamplerCreateInfo samplerCreateInfo{
+	  {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
+  samplerCreateInfo.setMaxLod(FLT_MAX);
 
+  size_t first = m_textures.size();
+  createBakedTextures(m_alloc, m_device, m_graphicsQueueIndex, textures, samplerCreateInfo, m_textures);
+  for(size_t i = first; i < m_textures.size(); i++)
 	m_debug.setObjectName(m_textures[i].image, std::string("Txt" + std::to_string(i)).c_str());
-  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Make dummy image(1,1), needed as we cannot have an empty array
+//
+void HelloVulkan::addDefaultTexture()
+{
+  nvvk::ScopeCommandBuffer cmdBuf(m_device, m_graphicsQueueIndex);
+  std::array<uint8_t, 4>   white = {255, 255, 255, 255};
+  m_textures.emplace_back(m_alloc.createTexture(
+	  cmdBuf, 4, white.data(), nvvk::makeImage2DCreateInfo(vk::Extent2D{1, 1}), {}));
+  m_debug.setObjectName(m_textures.back().image, "dummy");
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -430,6 +825,8 @@ void HelloVulkan::destroyResources()
   m_alloc.destroy(m_materialBuffer);
   m_alloc.destroy(m_matrixBuffer);
   m_alloc.destroy(m_rtPrimLookup);
+  m_alloc.destroy(m_blasPositions);
+  m_alloc.destroy(m_samplerBuffer);
 
   for(auto& t : m_textures)
   {
@@ -476,15 +873,28 @@ void HelloVulkan::rasterize(const vk::CommandBuffer& cmdBuf)
 										   m_uvBuffer.buffer};
   cmdBuf.bindVertexBuffers(0, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(),
 						   offsets.data());
-  cmdBuf.bindIndexBuffer(m_indexBuffer.buffer, 0, vk::IndexType::eUint32);
 
-  uint32_t idxNode = 0;
+  // The index buffer is rebound when the index width changes, see packed_indices.h
+  uint32_t      idxNode   = 0;
+  vk::IndexType boundType = vk::IndexType::eNoneKHR;
   for(auto& node : m_gltfScene.m_nodes)
   {
 	auto& primitive = m_gltfScene.m_primMeshes[node.primMesh];
+	if(primitiveIndexType(node.primMesh) != boundType)
+	{
+	  boundType = primitiveIndexType(node.primMesh);
+	  cmdBuf.bindIndexBuffer(m_indexBuffer.buffer, 0, boundType);
+	}
 
 	m_pushConstant.instanceId = idxNode++;
 	m_pushConstant.materialId = primitive.materialIndex;
+
+	// Quantized positions come as unorm attributes, in [0,1]
+	const RtPrimitiveLookup& lookup = m_primLookup[node.primMesh];
+	m_pushConstant.positionScale    = lookup.positionScale;
+	m_pushConstant.positionOffset   = lookup.positionOffset;
+	if(m_quantizePositions)
+	  m_pushConstant.positionScale = nvmath::vec4f(nvmath::vec3f(lookup.positionScale) * 65535.f, 1.f);
 	cmdBuf.pushConstants<ObjPushConstant>(
 		m_pipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0,
 		m_pushConstant);
@@ -678,19 +1088,21 @@ void HelloVulkan::initRayTracing()
 //--------------------------------------------------------------------------------------------------
 // Converting a GLTF primitive in the Raytracing Geometry used for the BLAS
 //
-nvvk::RaytracingBuilderKHR::Blas HelloVulkan::primitiveToGeometry(const nvh::GltfPrimMesh& prim)
+nvvk::RaytracingBuilderKHR::Blas HelloVulkan::primitiveToGeometry(const nvh::GltfPrimMesh& prim,
+                                                                 vk::IndexType            indexType)
 {
   // Setting up the creation info of acceleration structure
   vk::AccelerationStructureCreateGeometryTypeInfoKHR asCreate;
   asCreate.setGeometryType(vk::GeometryTypeKHR::eTriangles);
-  asCreate.setIndexType(vk::IndexType::eUint32);
+  asCreate.setIndexType(indexType);
   asCreate.setVertexFormat(vk::Format::eR32G32B32Sfloat);
   asCreate.setMaxPrimitiveCount(prim.indexCount / 3);  // Nb triangles
   asCreate.setMaxVertexCount(prim.vertexCount);
   asCreate.setAllowsTransforms(VK_FALSE);  // No adding transformation matrices
 
   // Building part
-  vk::DeviceAddress vertexAddress = m_device.getBufferAddress({m_vertexBuffer.buffer});
+  vk::DeviceAddress vertexAddress =
+      m_device.getBufferAddress({m_quantizePositions ? m_blasPositions.buffer : m_vertexBuffer.buffer});
   vk::DeviceAddress indexAddress  = m_device.getBufferAddress({m_indexBuffer.buffer});
 
   vk::AccelerationStructureGeometryTrianglesDataKHR triangles;
@@ -711,7 +1123,7 @@ nvvk::RaytracingBuilderKHR::Blas HelloVulkan::primitiveToGeometry(const nvh::Glt
   vk::AccelerationStructureBuildOffsetInfoKHR offset;
   offset.setFirstVertex(prim.vertexOffset);
   offset.setPrimitiveCount(prim.indexCount / 3);
-  offset.setPrimitiveOffset(prim.firstIndex * sizeof(uint32_t));
+  offset.setPrimitiveOffset(prim.firstIndex * (indexType == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t)));
   offset.setTransformOffset(0);
 
   nvvk::RaytracingBuilderKHR::Blas blas;
@@ -729,12 +1141,32 @@ void HelloVulkan::createBottomLevelAS()
   // BLAS - Storing each primitive in a geometry
   std::vector<nvvk::RaytracingBuilderKHR::Blas> allBlas;
   allBlas.reserve(m_gltfScene.m_primMeshes.size());
-  for(auto& primMesh : m_gltfScene.m_primMeshes)
+  for(size_t i = 0; i < m_gltfScene.m_primMeshes.size(); i++)
   {
-	auto geo = primitiveToGeometry(primMesh);
+	auto geo = primitiveToGeometry(m_gltfScene.m_primMeshes[i], primitiveIndexType(i));
 	allBlas.push_back({geo});
   }
   m_rtBuilder.buildBlas(allBlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
+  m_alloc.destroy(m_blasPositions);  // Decoded positions are only needed by the build
+}
+
+//--------------------------------------------------------------------------------------------------
+// Decoding quantized positions with the quantization of their primitive
+//
+std::vector<nvmath::vec3f> HelloVulkan::decodePositions(const QuantizedPosition* positions, size_t count) const
+{
+  std::vector<nvmath::vec3f> decoded(count, nvmath::vec3f(0.f, 0.f, 0.f));
+  for(size_t i = 0; i < m_gltfScene.m_primMeshes.size(); i++)
+  {
+	const auto&          primMesh = m_gltfScene.m_primMeshes[i];
+	PositionQuantization quantization;
+	quantization.scale  = nvmath::vec3f(m_primLookup[i].positionScale);
+	quantization.offset = nvmath::vec3f(m_primLookup[i].positionOffset);
+	if(size_t(primMesh.vertexOffset) + primMesh.vertexCount <= count)
+	  dequantizePositions(positions + primMesh.vertexOffset, primMesh.vertexCount, quantization,
+						  &decoded[primMesh.vertexOffset]);
+  }
+  return decoded;
 }
 
 void HelloVulkan::createTopLevelAS()
@@ -38,9 +38,13 @@
 #include "nvvk/raytraceKHR_vk.hpp"
 
 #include "RaytracingPipeline.h"
+#include "sampler.h"
 #include <memory>
 
 class RenderContext;
+class SceneCache;
+struct BakedTexture;
+struct QuantizedPosition;
 
 //--------------------------------------------------------------------------------------------------
 // Simple rasterizer of OBJ objects
@@ -63,7 +67,10 @@ public:
 	void loadScene(const std::string& filename);
 	void updateDescriptorSet();
 	void createUniformBuffer();
-	void createTextureImages(const vk::CommandBuffer& cmdBuf, tinygltf::Model& gltfModel);
+	void createSamplerBuffer();
+	std::vector<std::shared_ptr<const BakedTexture>> bakeTextureImages(const tinygltf::Model& gltfModel);
+	void createTextureImages(const std::vector<std::shared_ptr<const BakedTexture>>& textures);
+	void addDefaultTexture();
 	void updateUniformBuffer();
 	void onResize(int /*w*/, int /*h*/) override;
 	void destroyResources();
@@ -77,8 +84,22 @@ public:
 		uint32_t indexOffset;
 		uint32_t vertexOffset;
 		int      materialIndex;
+		uint32_t indices16;  // Non zero if the indices are 16-bit, see packed_indices.h
+		// position = offset + scale * quantized position. w of the scale is non zero if the
+		// positions are quantized, see quantized_positions.h
+		nvmath::vec4f positionScale{1.f, 1.f, 1.f, 0.f};
+		nvmath::vec4f positionOffset{0.f, 0.f, 0.f, 0.f};
 	};
 
+	// Baked scene cache, see scene_cache.h. Bump the version when the layout of a chunk changes.
+	static constexpr uint32_t kGltfCacheVersion = 6;
+	void importScene(const vk::CommandBuffer& cmdBuf, const std::string& filename);
+	bool loadSceneCache(const vk::CommandBuffer& cmdBuf, const SceneCache& cache);
+	void saveSceneCache(const std::string&                                      filename,
+						const tinygltf::Model&                                  tmodel,
+						const std::vector<QuantizedPosition>&                   quantizedPositions,
+						const std::vector<uint32_t>&                            indexWords,
+						const std::vector<std::shared_ptr<const BakedTexture>>& textures);
 
 	nvh::GltfScene m_gltfScene;
 	nvvk::Buffer   m_vertexBuffer;
@@ -89,6 +110,18 @@ public:
 	nvvk::Buffer   m_materialBuffer;
 	nvvk::Buffer   m_matrixBuffer;
 	nvvk::Buffer   m_rtPrimLookup;
+	nvvk::Buffer   m_samplerBuffer;  // SamplerTables of the path tracer
+
+	std::vector<RtPrimitiveLookup> m_primLookup;  // Host copy of m_rtPrimLookup
+
+	// Store 16-bit positions, see quantized_positions.h. Must be set before loadScene().
+	bool                       m_quantizePositions{true};
+	nvvk::Buffer               m_blasPositions;  // Decoded positions, until the BLAS are built
+	std::vector<nvmath::vec3f> decodePositions(const QuantizedPosition* positions, size_t count) const;
+	vk::IndexType                  primitiveIndexType(size_t primMesh) const
+	{
+		return m_primLookup[primMesh].indices16 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+	}
 
 	// Information pushed at each draw call
 	struct ObjPushConstant
@@ -98,6 +131,10 @@ public:
 		float         lightIntensity{10.f};
 		int           lightType{1};  // 0: point, 1: infinite
 		int           materialId{0};
+		int           padding{0};
+		// Dequantization of the position attribute, see RtPrimitiveLookup
+		nvmath::vec4f positionScale{1.f, 1.f, 1.f, 0.f};
+		nvmath::vec4f positionOffset{0.f, 0.f, 0.f, 0.f};
 	};
 	ObjPushConstant m_pushConstant;
 
@@ -136,7 +173,7 @@ public:
 	vk::Format                  m_offscreenDepthFormat{vk::Format::eD32Sfloat};
 
 	// #VKRay
-	nvvk::RaytracingBuilderKHR::Blas primitiveToGeometry(const nvh::GltfPrimMesh& prim);
+	nvvk::RaytracingBuilderKHR::Blas primitiveToGeometry(const nvh::GltfPrimMesh& prim, vk::IndexType indexType);
 
 	void initRayTracing();
 	void createBottomLevelAS();
@@ -168,6 +205,7 @@ public:
 		float			focalDistance{1.f};
 		float			lensRadius {0.01f};
 		int				renderFlags{0};
+		int				samplerType{kSamplerSobol};
 	} m_rtPushConstants;
 
 private:
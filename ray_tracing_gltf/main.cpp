@@ -141,6 +141,7 @@ int main(int argc, char** argv)
 	helloVk.createDescriptorSetLayout();
 	helloVk.createGraphicsPipeline();
 	helloVk.createUniformBuffer();
+	helloVk.createSamplerBuffer();
 	helloVk.updateDescriptorSet();
 
 	// #VKRay
@@ -9,3 +9,4 @@
 #define B_MATERIALS 6
 #define B_MATRICES 7
 #define B_TEXTURES 8
+#define B_SAMPLER 9
@@ -34,6 +34,11 @@ struct PrimMeshInfo
   uint indexOffset;
   uint vertexOffset;
   int  materialIndex;
+  uint indices16;  // Non zero if the primitive has 16-bit indices, see indices.glsl
+  // position = positionOffset + positionScale * quantized position. positionScale.w is non zero
+  // if the positions are quantized (4 x uint16 per vertex)
+  vec4 positionScale;
+  vec4 positionOffset;
 };
 
 
@@ -0,0 +1,25 @@
+// Reading the index buffer, see packed_indices.h.
+// Needs PrimMeshInfo (gltf.glsl) and the `indices` buffer to be declared before inclusion.
+// The buffer holds 32-bit words; the indices of 16-bit primitives are packed two per word.
+
+// Local indices of triangle `primitiveID` of a primitive mesh
+ivec3 getTriangleIndices(PrimMeshInfo pinfo, uint primitiveID)
+{
+  // Getting the 'first index' for this mesh (offset of the mesh + offset of the triangle)
+  uint indexOffset = pinfo.indexOffset + (3 * primitiveID);
+  if(pinfo.indices16 == 0)
+  {
+    return ivec3(indices[nonuniformEXT(indexOffset + 0)],  //
+                 indices[nonuniformEXT(indexOffset + 1)],  //
+                 indices[nonuniformEXT(indexOffset + 2)]);
+  }
+
+  ivec3 triangleIndex;
+  for(uint i = 0; i < 3; i++)
+  {
+    uint index       = indexOffset + i;
+    uint word        = indices[nonuniformEXT(index >> 1)];
+    triangleIndex[i] = int((word >> ((index & 1) * 16)) & 0xFFFF);
+  }
+  return triangleIndex;
+}
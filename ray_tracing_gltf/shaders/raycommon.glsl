@@ -20,4 +20,9 @@ struct hitPayload
 #define FLAG_DIFFUSE_ONLY (1<<4)
 #define FLAG_SPECULAR_ONLY (1<<5)
 #define FLAG_IMPORTANCE_SAMPLING (1<<6)
-#define FLAG_DOF (1<<7)
\ No newline at end of file
+#define FLAG_DOF (1<<7)
+
+// Samplers, see sampler.glsl
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
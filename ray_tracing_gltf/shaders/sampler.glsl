@@ -0,0 +1,97 @@
+// Samplers of the path tracer, keyed by pixel, sample index and dimension. The tables are made
+// on the CPU by SamplerTables (common/sampler.h), which computes the same values for the CPU
+// renderers: see there for the methods.
+// Needs binding.glsl and raycommon.glsl. Each shader sets the key of its invocation with
+// initSampler before drawing numbers with rnd (sampling.glsl).
+
+#define SAMPLER_TILE_SIZE 64u
+#define SAMPLER_SOBOL_DIMENSIONS 4u
+#define SAMPLER_SCRAMBLE_OFFSET (SAMPLER_SOBOL_DIMENSIONS * 32)
+#define SAMPLER_BLUE_NOISE_OFFSET (SAMPLER_SCRAMBLE_OFFSET + SAMPLER_TILE_SIZE * SAMPLER_TILE_SIZE)
+
+// Sobol matrices, scramble seeds of the pixels of a tile, blue noise ranks
+layout(set = 1, binding = B_SAMPLER) readonly buffer _SamplerTables {uint samplerTables[];};
+
+int   g_sampler = SAMPLER_RANDOM;
+uvec2 g_samplePixel;
+uint  g_sampleIndex;
+
+void initSampler(int samplerType, uvec2 pixel, uint index)
+{
+  g_sampler     = samplerType;
+  g_samplePixel = pixel;
+  g_sampleIndex = index;
+}
+
+// lowbias32 of Chris Wellons
+uint hashUint(uint x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+uint hashCombine(uint seed, uint v)
+{
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+// Burley, "Practical Hash-based Owen Scrambling", JCGT 2020
+uint laineKarrasPermutation(uint x, uint seed)
+{
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed)
+{
+  return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+float toUnitFloat(uint x)
+{
+  return float(x >> 8) * (1.0 / 16777216.0);
+}
+
+float sampleSobol(uint dimension)
+{
+  uvec2 pixel     = g_samplePixel;
+  uint  cell      = (pixel.y % SAMPLER_TILE_SIZE) * SAMPLER_TILE_SIZE + pixel.x % SAMPLER_TILE_SIZE;
+  uint  tile      = (pixel.y / SAMPLER_TILE_SIZE) << 16 | (pixel.x / SAMPLER_TILE_SIZE);
+  uint  pixelSeed = hashCombine(samplerTables[SAMPLER_SCRAMBLE_OFFSET + cell], hashUint(tile));
+  uint  blockSeed = hashUint(hashCombine(pixelSeed, dimension / SAMPLER_SOBOL_DIMENSIONS));
+  uint  shuffled  = nestedUniformScramble(g_sampleIndex, blockSeed);
+
+  uint matrix = (dimension % SAMPLER_SOBOL_DIMENSIONS) * 32;
+  uint v      = 0;
+  for(uint bit = 0; shuffled != 0; shuffled >>= 1, bit++)
+  {
+    if((shuffled & 1) != 0)
+      v ^= samplerTables[matrix + bit];
+  }
+  return toUnitFloat(nestedUniformScramble(v, hashUint(hashCombine(blockSeed, dimension))));
+}
+
+// R2 lattice shifted by the blue noise mask, read with a shift of its own in each dimension
+float sampleBlueNoise(uint dimension)
+{
+  const uint alpha[2] = uint[2](3242174889u, 2447445414u);  // 1/g and 1/g^2, 32-bit fixed point
+
+  uint  shift  = hashUint(hashCombine(samplerTables[SAMPLER_SCRAMBLE_OFFSET], dimension));
+  uvec2 cell   = (g_samplePixel + uvec2(shift, shift >> 16)) % SAMPLER_TILE_SIZE;
+  uint  rank   = samplerTables[SAMPLER_BLUE_NOISE_OFFSET + cell.y * SAMPLER_TILE_SIZE + cell.x];
+  uint  offset = (2 * rank + 1) * (0x80000000u / (SAMPLER_TILE_SIZE * SAMPLER_TILE_SIZE));
+  return toUnitFloat(offset + alpha[dimension & 1] * g_sampleIndex);
+}
+
+float sampleDimension(uint dimension)
+{
+  return g_sampler == SAMPLER_SOBOL ? sampleSobol(dimension) : sampleBlueNoise(dimension);
+}
@@ -32,10 +32,40 @@ uint lcg(inout uint prev)
   return prev & 0x00FFFFFF;
 }
 
-// Generate a random float in [0, 1) given the previous RNG state
+#include "sampler.glsl"
+
+// Generate a random float in [0, 1) given the previous RNG state: the lcg state with
+// SAMPLER_RANDOM, the next dimension with the other samplers
 float rnd(inout uint prev)
 {
-  return (float(lcg(prev)) / float(0x01000000));
+  if(g_sampler == SAMPLER_RANDOM)
+    return (float(lcg(prev)) / float(0x01000000));
+  return sampleDimension(prev++);
+}
+
+// First state of the sample of the invocation, after initSampler. The seed of SAMPLER_RANDOM
+// comes from the pixel and the sample index, so that images are reproducible.
+uint samplerStart()
+{
+  if(g_sampler == SAMPLER_RANDOM)
+    return tea(g_samplePixel.y * gl_LaunchSizeEXT.x + g_samplePixel.x, g_sampleIndex);
+  return 0;
+}
+
+// The low-discrepancy samplers only stratify if every sample of a pixel makes the same decisions
+// with the same dimensions: the camera uses [0, 4), bounce n [4n + 4, 4n + 8)
+uint samplerBounce(uint state, int rayDepth)
+{
+  return g_sampler == SAMPLER_RANDOM ? state : uint(4 * rayDepth + 4);
+}
+
+// First state of the any-hit invocations of the ray traced at rayDepth, or of its shadow ray. Each
+// ray has dimensions of its own, from 2^31 + (2 * rayDepth + shadow) * 2^16, and SAMPLER_RANDOM a
+// new lcg seed, so that no two rays of a path draw the same numbers.
+uint samplerAnyHit(uint state, int rayDepth, bool shadow)
+{
+  uint ray = uint(2 * rayDepth + (shadow ? 1 : 0));
+  return g_sampler == SAMPLER_RANDOM ? tea(state, 0x80000000u | ray) : 0x80000000u + (ray << 16);
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -44,11 +74,10 @@ float rnd(inout uint prev)
 
 // Randomly sampling around +Z
 // Cosine weighted distribution
-vec3 samplingCosHemisphere(inout uint seed, in vec3 x, in vec3 y, in vec3 z)
+vec3 samplingCosHemisphere(in vec2 u, in vec3 x, in vec3 y, in vec3 z)
 {
-
-  float r1 = rnd(seed);
-  float r2 = rnd(seed);
+  float r1 = u.x;
+  float r2 = u.y;
   float sq = sqrt(1.0 - r2);
 
   vec3 direction = vec3(cos(2 * M_PI * r1) * sq, sin(2 * M_PI * r1) * sq, sqrt(r2));
@@ -57,6 +86,13 @@ vec3 samplingCosHemisphere(inout uint seed, in vec3 x, in vec3 y, in vec3 z)
   return direction;
 }
 
+vec3 samplingCosHemisphere(inout uint seed, in vec3 x, in vec3 y, in vec3 z)
+{
+  float r1 = rnd(seed);
+  float r2 = rnd(seed);
+  return samplingCosHemisphere(vec2(r1, r2), x, y, z);
+}
+
 vec3 samplingGGXHemisphere(inout uint seed, in float alpha)
 {
   float alpha2 = alpha*alpha;
@@ -89,19 +125,42 @@ vec2 sampleDisk(inout uint seed, float rad)
   return r*vec2(cost, sint);
 }
 
-vec3 sampleConeDirection(inout uint seed, in vec3 axisDir, in float cosR)
+// Uniform direction in the cone of half-angle R around axisDir, given 1 - cos(R) for the
+// precision of small cones. Its pdf is conePdf(oneMinusCosR).
+vec3 sampleConeDirection(in vec2 u, in vec3 axisDir, in float oneMinusCosR)
 {
-  // Sample a unit disk, scale it by cosR
-  float r = sqrt(rnd(seed)) * cosR;
-  float cost = cos(rnd(seed));
-  float sint = sqrt(1-cost*cost) * (seed%2==0 ? 1 : -1);
+  // Uniform in solid angle: cos(theta) is uniform in [cos(R), 1]
+  float oneMinusCost = u.x * oneMinusCosR;
+  float cost = 1.0 - oneMinusCost;
+  float sint = sqrt(max(0.0, oneMinusCost * (2.0 - oneMinusCost)));
+  float phi = TwoPi*u.y;
 
   // Create a tangent space around the cone axis
   vec3 b,t;
   createCoordinateSystem(axisDir,t,b);
 
   // Reconstruct the sampled direction
-  return normalize(r*(cost*t + sint*b)+axisDir);
+  return (cos(phi)*sint)*t + (sin(phi)*sint)*b + cost*axisDir;
+}
+
+float conePdf(in float oneMinusCosR)
+{
+  return 1.0 / (TwoPi * oneMinusCosR);
+}
+
+// Power heuristic of Veach, weight of the strategy of pdf a against the one of pdf b
+float misWeight(in float a, in float b)
+{
+  float a2 = a*a;
+  float b2 = b*b;
+  return a2 + b2 > 0.0 ? a2 / (a2 + b2) : 0.0;
+}
+
+// Stretches a random number below threshold, or above it, back to [0, 1)
+float stretch(in float u, in float threshold)
+{
+  float v = u < threshold ? u / threshold : (u - threshold) / (1.0 - threshold);
+  return min(v, 0.99999994);
 }
 
 vec3 randomUnitVector(in vec2 seed)
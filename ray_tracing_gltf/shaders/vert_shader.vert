@@ -24,6 +24,9 @@ layout(push_constant) uniform shaderInformation
   float lightIntensity;
   int   lightType;
   int materialId;
+  int padding;
+  vec4 positionScale;  // position = positionOffset + positionScale * inPosition
+  vec4 positionOffset;
 }
 pushC;
 
@@ -51,7 +54,8 @@ void main()
 
   vec3 origin = vec3(ubo.viewI * vec4(0, 0, 0, 1));
 
-  worldPos     = vec3(objMatrix * vec4(inPosition, 1.0));
+  vec3 position = pushC.positionOffset.xyz + pushC.positionScale.xyz * inPosition;
+  worldPos      = vec3(objMatrix * vec4(position, 1.0));
   viewDir      = vec3(worldPos - origin);
   fragTexCoord = inTexCoord;
   fragNormal   = vec3(objMatrixIT * vec4(inNormal, 0.0));
@@ -33,6 +33,7 @@ extern std::vector<std::string> defaultSearchPaths;
 #define STB_IMAGE_IMPLEMENTATION
 #include "fileformats/stb_image.h"
 #include "obj_loader.h"
+#include "baked_texture_vk.h"
 
 #define VMA_IMPLEMENTATION
 
@@ -222,14 +223,35 @@ void HelloVulkan::createGraphicsPipeline()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Loading the OBJ file and setting up all buffers
+// Loading the OBJ file and setting up all buffers. With weld, identical vertices are merged
+// into an indexed mesh (see ObjLoader::weldVertices).
 //
-void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform)
+void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform, bool weld)
 {
   using vkBU = vk::BufferUsageFlagBits;
 
+  ObjInstance instance;
+  instance.objIndex    = m_modelRegistry.findOrAdd(filename, static_cast<uint32_t>(m_objModel.size()));
+  instance.transform   = transform;
+  instance.transformIT = nvmath::transpose(nvmath::invert(transform));
+
+  // Same file already loaded: only add an instance of it, sharing its buffers and BLAS
+  if(instance.objIndex < m_objModel.size())
+  {
+    instance.txtOffset = m_objModel[instance.objIndex].txtOffset;
+    m_objInstance.emplace_back(instance);
+    return;
+  }
+
   ObjLoader loader;
-  loader.loadModel(filename);
+  if(!loader.loadCache(filename, weld))
+  {
+    loader.loadModel(filename);
+    if(weld)
+      loader.weldVertices();
+    loader.buildMeshlets();
+    loader.saveCache(filename);
+  }
 
   // Converting from Srgb to linear
   for(auto& m : loader.m_materials)
@@ -239,15 +261,24 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
     m.specular = nvmath::pow(m.specular, 2.2f);
   }
 
-  ObjInstance instance;
-  instance.objIndex    = static_cast<uint32_t>(m_objModel.size());
-  instance.transform   = transform;
-  instance.transformIT = nvmath::transpose(nvmath::invert(transform));
-  instance.txtOffset   = static_cast<uint32_t>(m_textures.size());
+  instance.txtOffset = static_cast<uint32_t>(m_textures.size());
+
+  // LOD chain over the same vertices: all levels go in the index buffer, one after the
+  // other, and the material of a simplified triangle is the one of its source triangle
+  bool     hasMatIndx = loader.m_matIndx.size() * 3 >= loader.m_indices.size();
+  LodChain lodChain =
+      buildLodChain(&loader.m_vertices.data()->pos, sizeof(VertexObj), loader.m_vertices.size(),
+                    loader.m_indices.data(), loader.m_indices.size(),
+                    hasMatIndx ? loader.m_matIndx.data() : nullptr);
+  std::vector<uint32_t> lodMatIndx(lodChain.triangles.size(), 0);
+  for(size_t t = 0; t < lodChain.triangles.size() && hasMatIndx; t++)
+    lodMatIndx[t] = loader.m_matIndx[lodChain.triangles[t]];
 
   ObjModel model;
   model.nbIndices  = static_cast<uint32_t>(loader.m_indices.size());
   model.nbVertices = static_cast<uint32_t>(loader.m_vertices.size());
+  model.txtOffset  = instance.txtOffset;
+  model.lods       = lodChain.lods;
 
   // Create the buffers on Device and copy vertices, indices and materials
   nvvk::CommandPool cmdBufGet(m_device, m_graphicsQueueIndex);
@@ -256,10 +287,11 @@ void HelloVulkan::loadModel(const std::string& filename, nvmath::mat4f transform
       m_alloc.createBuffer(cmdBuf, loader.m_vertices,
                            vkBU::eVertexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   model.indexBuffer =
-      m_alloc.createBuffer(cmdBuf, loader.m_indices,
+      m_alloc.createBuffer(cmdBuf, lodChain.indices,
                            vkBU::eIndexBuffer | vkBU::eStorageBuffer | vkBU::eShaderDeviceAddress);
   model.matColorBuffer = m_alloc.createBuffer(cmdBuf, loader.m_materials, vkBU::eStorageBuffer);
-  model.matIndexBuffer = m_alloc.createBuffer(cmdBuf, loader.m_matIndx, vkBU::eStorageBuffer);
+  model.matIndexBuffer =
+      m_alloc.createBuffer(cmdBuf, hasMatIndx ? lodMatIndx : loader.m_matIndx, vkBU::eStorageBuffer);
   // Creates all textures found
   createTextureImages(cmdBuf, loader.m_textures);
   cmdBufGet.submitAndWait(cmdBuf);
@@ -313,8 +345,6 @@ void HelloVulkan::createSceneDescriptionBuffer()
 void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
                                       const std::vector<std::string>& textures)
 {
-  using vkIU = vk::ImageUsageFlagBits;
-
   vk::SamplerCreateInfo samplerCreateInfo{
       {}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear};
   samplerCreateInfo.setMaxLod(FLT_MAX);
@@ -342,43 +372,16 @@ void HelloVulkan::createTextureImages(const vk::CommandBuffer&        cmdBuf,
   }
   else
   {
-    // Uploading all images
+    // Mip chains and block compression are baked on the CPU and cached next to the images
+    std::vector<std::string> txtFiles;
+    txtFiles.reserve(textures.size());
     for(const auto& texture : textures)
-    {
-      std::stringstream o;
-      int               texWidth, texHeight, texChannels;
-      o << "media/textures/" << texture;
-      std::string txtFile = nvh::findFile(o.str(), defaultSearchPaths);
-
-      stbi_uc* stbi_pixels = stbi_load(txtFile.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-      std::array<stbi_uc, 4> color{255u, 0u, 255u, 255u};
-
-      stbi_uc* pixels = stbi_pixels;
-      // Handle failure
-      if(!stbi_pixels)
-      {
-        texWidth = texHeight = 1;
-        texChannels          = 4;
-        pixels               = reinterpret_cast<stbi_uc*>(color.data());
-      }
-
-      vk::DeviceSize bufferSize = static_cast<uint64_t>(texWidth) * texHeight * sizeof(uint8_t) * 4;
-      auto           imgSize    = vk::Extent2D(texWidth, texHeight);
-      auto imageCreateInfo = nvvk::makeImage2DCreateInfo(imgSize, format, vkIU::eSampled, true);
-
-      {
-        nvvk::Image image = m_alloc.createImage(cmdBuf, bufferSize, pixels, imageCreateInfo);
-        nvvk::cmdGenerateMipmaps(cmdBuf, image.image, format, imgSize, imageCreateInfo.mipLevels);
-        vk::ImageViewCreateInfo ivInfo =
-            nvvk::makeImageViewCreateInfo(image.image, imageCreateInfo);
-        nvvk::Texture texture = m_alloc.createTexture(image, ivInfo, samplerCreateInfo);
-
-        m_textures.push_back(texture);
-      }
-
-      stbi_image_free(stbi_pixels);
-    }
+      txtFiles.push_back(nvh::findFile("media/textures/" + texture, defaultSearchPaths));
+    TextureCompression compression = supportedTextureCompression(m_physicalDevice, TextureCompression::eBC7, true);
+    std::vector<std::shared_ptr<const BakedTexture>> baked = bakeTextures(txtFiles, compression, true);
+
+    // Uploading all levels of all images
+    createBakedTextures(m_alloc, m_device, m_graphicsQueueIndex, baked, samplerCreateInfo, m_textures);
   }
 }
 
@@ -648,16 +651,18 @@ void HelloVulkan::initRayTracing()
 }
 
 //--------------------------------------------------------------------------------------------------
-// Converting a OBJ primitive to the ray tracing geometry used for the BLAS
+// Converting a LOD level of an OBJ primitive to the ray tracing geometry used for the BLAS
 //
-nvvk::RaytracingBuilderKHR::Blas HelloVulkan::objectToVkGeometryKHR(const ObjModel& model)
+nvvk::RaytracingBuilderKHR::Blas HelloVulkan::objectToVkGeometryKHR(const ObjModel& model, uint32_t lod)
 {
+  const LodLevel& level = model.lods.levels[lod];
+
   nvvk::RaytracingBuilderKHR::Blas                   blas;
   vk::AccelerationStructureCreateGeometryTypeInfoKHR asCreate;
   asCreate.setGeometryType(vk::GeometryTypeKHR::eTriangles);
   asCreate.setIndexType(vk::IndexType::eUint32);
   asCreate.setVertexFormat(vk::Format::eR32G32B32Sfloat);
-  asCreate.setMaxPrimitiveCount(model.nbIndices / 3);  // Nb triangles
+  asCreate.setMaxPrimitiveCount(level.indexCount / 3);  // Nb triangles
   asCreate.setMaxVertexCount(model.nbVertices);
   asCreate.setAllowsTransforms(VK_FALSE);  // No adding transformation matrices
   vk::DeviceAddress vertexAddress = m_device.getBufferAddress({model.vertexBuffer.buffer});
@@ -678,7 +683,7 @@ nvvk::RaytracingBuilderKHR::Blas HelloVulkan::objectToVkGeometryKHR(const ObjMod
   vk::AccelerationStructureBuildOffsetInfoKHR offset;
   offset.setFirstVertex(0);
   offset.setPrimitiveCount(asCreate.maxPrimitiveCount);
-  offset.setPrimitiveOffset(0);
+  offset.setPrimitiveOffset(level.firstIndex * sizeof(uint32_t));  // Level in the index buffer
   offset.setTransformOffset(0);
   blas.asGeometry.emplace_back(asGeom);
   blas.asCreateGeometryInfo.emplace_back(asCreate);
@@ -688,34 +693,105 @@ nvvk::RaytracingBuilderKHR::Blas HelloVulkan::objectToVkGeometryKHR(const ObjMod
 
 void HelloVulkan::createBottomLevelAS()
 {
-  // BLAS - Storing each primitive in a geometry
+  // BLAS - Storing each LOD level of each primitive in a geometry
   std::vector<nvvk::RaytracingBuilderKHR::Blas> allBlas;
   allBlas.reserve(m_objModel.size());
-  for(const auto& obj : m_objModel)
+  for(auto& obj : m_objModel)
   {
-    auto blas = objectToVkGeometryKHR(obj);
-
-    // We could add more geometry in each BLAS, but we add only one for now
-    allBlas.emplace_back(blas);
+    obj.blasOffset = static_cast<uint32_t>(allBlas.size());
+    for(uint32_t lod = 0; lod < obj.lods.levels.size(); lod++)
+      allBlas.emplace_back(objectToVkGeometryKHR(obj, lod));
   }
   m_rtBuilder.buildBlas(allBlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
 }
 
 void HelloVulkan::createTopLevelAS()
 {
-  std::vector<nvvk::RaytracingBuilderKHR::Instance> tlas;
-  tlas.reserve(m_objInstance.size());
+  nvmath::vec3f eye, center, up;
+  CameraManip.getLookat(eye, center, up);
+
+  m_tlas.clear();
+  m_tlas.reserve(m_objInstance.size());
+  m_instanceLod.resize(m_objInstance.size());
   for(int i = 0; i < static_cast<int>(m_objInstance.size()); i++)
   {
     nvvk::RaytracingBuilderKHR::Instance rayInst;
     rayInst.transform  = m_objInstance[i].transform;  // Position of the instance
-    rayInst.instanceId = i;                           // gl_InstanceID
-    rayInst.blasId     = m_objInstance[i].objIndex;
     rayInst.hitGroupId = 0;  // We will use the same hit group for all objects
     rayInst.flags      = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    tlas.emplace_back(rayInst);
+    m_instanceLod[i]   = selectInstanceLod(m_objInstance[i], eye);
+    setInstanceLod(rayInst, m_objInstance[i].objIndex, m_instanceLod[i]);
+    m_tlas.emplace_back(rayInst);
+  }
+  // Updatable for the instances that move, rebuilt when they change of LOD (see updateLods)
+  m_rtBuilder.buildTlas(m_tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+                                    | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+}
+
+//--------------------------------------------------------------------------------------------------
+// LOD level of an instance from the error of the levels projected on screen (see mesh_simplifier.h)
+//
+uint32_t HelloVulkan::selectInstanceLod(const ObjInstance& instance, const nvmath::vec3f& eye) const
+{
+  return selectLodLevel(m_objModel[instance.objIndex].lods, instance.transform, eye, CameraManip.getFov(),
+                        static_cast<float>(m_size.height), m_lodPixelError);
+}
+
+// The hit shader finds the instance with gl_InstanceID, which leaves the custom index to
+// hold the first triangle of the level in the index and material index buffers
+void HelloVulkan::setInstanceLod(nvvk::RaytracingBuilderKHR::Instance& rayInst,
+                                 uint32_t                              objIndex,
+                                 uint32_t                              lod) const
+{
+  const ObjModel& model = m_objModel[objIndex];
+  rayInst.instanceId    = model.lods.levels[lod].firstIndex / 3;  // gl_InstanceCustomIndexEXT
+  rayInst.blasId        = model.blasOffset + lod;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Called at each frame. Instances whose LOD changed with the camera are switched to the BLAS of
+// their new level and the TLAS is built again. Instances that only moved are refitted in place.
+//
+void HelloVulkan::updateLods()
+{
+  nvmath::vec3f eye, center, up;
+  CameraManip.getLookat(eye, center, up);
+
+  bool lodChanged = false;
+  bool moved      = false;
+  for(size_t i = 0; i < m_objInstance.size(); i++)
+  {
+    if(memcmp(&m_tlas[i].transform, &m_objInstance[i].transform, sizeof(nvmath::mat4f)) != 0)
+    {
+      m_tlas[i].transform = m_objInstance[i].transform;
+      moved               = true;
+    }
+    uint32_t lod = selectInstanceLod(m_objInstance[i], eye);
+    if(lod == m_instanceLod[i])
+      continue;
+    m_instanceLod[i] = lod;
+    setInstanceLod(m_tlas[i], m_objInstance[i].objIndex, lod);
+    lodChanged = true;
+  }
+
+  if(lodChanged)
+  {
+    // The previous TLAS is destroyed, and the new one has another handle
+    m_device.waitIdle();
+    m_rtBuilder.rebuildTlas(m_alloc, m_tlas,
+                            vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+                                | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate);
+
+    vk::AccelerationStructureKHR                   tlas = m_rtBuilder.getAccelerationStructure();
+    vk::WriteDescriptorSetAccelerationStructureKHR descASInfo;
+    descASInfo.setAccelerationStructureCount(1);
+    descASInfo.setPAccelerationStructures(&tlas);
+    m_device.updateDescriptorSets(m_rtDescSetLayoutBind.makeWrite(m_rtDescSet, 0, &descASInfo), nullptr);
+  }
+  else if(moved)
+  {
+    m_rtBuilder.updateTlasMatrices(m_tlas);
   }
-  m_rtBuilder.buildTlas(tlas, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -39,6 +39,10 @@
 // #VKRay
 #include "nvvk/raytraceKHR_vk.hpp"
 
+#include "mesh_simplifier.h"
+#include "model_registry.h"
+#include "tlas_builder_vk.h"
+
 //--------------------------------------------------------------------------------------------------
 // Simple rasterizer of OBJ objects
 // - Each OBJ loaded are stored in an `ObjModel` and referenced by a `ObjInstance`
@@ -55,7 +59,7 @@ public:
              uint32_t                  queueFamily) override;
   void createDescriptorSetLayout();
   void createGraphicsPipeline();
-  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1));
+  void loadModel(const std::string& filename, nvmath::mat4f transform = nvmath::mat4f(1), bool weld = false);
   void updateDescriptorSet();
   void createUniformBuffer();
   void createSceneDescriptionBuffer();
@@ -71,10 +75,13 @@ public:
   {
     uint32_t     nbIndices{0};
     uint32_t     nbVertices{0};
+    uint32_t     txtOffset{0};    // Offset of its textures in `m_textures`
     nvvk::Buffer vertexBuffer;    // Device buffer of all 'Vertex'
-    nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles
+    nvvk::Buffer indexBuffer;     // Device buffer of the indices forming triangles, all LOD levels
     nvvk::Buffer matColorBuffer;  // Device buffer of array of 'Wavefront material'
     nvvk::Buffer matIndexBuffer;  // Device buffer of array of 'Wavefront material'
+    LodSet       lods;            // Level 0 is the full mesh, the first `nbIndices` indices
+    uint32_t     blasOffset{0};   // BLAS of level 0, the other levels follow
   };
 
   // Instance of the OBJ
@@ -99,6 +106,7 @@ public:
   // Array of objects and instances in the scene
   std::vector<ObjModel>    m_objModel;
   std::vector<ObjInstance> m_objInstance;
+  ModelRegistry            m_modelRegistry;  // Files loaded more than once share their `ObjModel`
 
   // Graphic pipeline
   vk::PipelineLayout          m_pipelineLayout;
@@ -146,9 +154,14 @@ public:
 
   // #VKRay
   void                             initRayTracing();
-  nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model);
+  nvvk::RaytracingBuilderKHR::Blas objectToVkGeometryKHR(const ObjModel& model, uint32_t lod = 0);
   void                             createBottomLevelAS();
   void                             createTopLevelAS();
+  void                             updateLods();
+  uint32_t                         selectInstanceLod(const ObjInstance& instance, const nvmath::vec3f& eye) const;
+  void                             setInstanceLod(nvvk::RaytracingBuilderKHR::Instance& rayInst,
+                                                  uint32_t                              objIndex,
+                                                  uint32_t                              lod) const;
   void                             createRtDescriptorSet();
   void                             updateRtDescriptorSet();
   void                             createRtPipeline();
@@ -157,7 +170,7 @@ public:
 
 
   vk::PhysicalDeviceRayTracingPropertiesKHR           m_rtProperties;
-  nvvk::RaytracingBuilderKHR                          m_rtBuilder;
+  RebuildableRaytracingBuilder                        m_rtBuilder;
   nvvk::DescriptorSetBindings                         m_rtDescSetLayoutBind;
   vk::DescriptorPool                                  m_rtDescPool;
   vk::DescriptorSetLayout                             m_rtDescSetLayout;
@@ -166,6 +179,9 @@ public:
   vk::PipelineLayout                                  m_rtPipelineLayout;
   vk::Pipeline                                        m_rtPipeline;
   nvvk::Buffer                                        m_rtSBTBuffer;
+  std::vector<nvvk::RaytracingBuilderKHR::Instance>   m_tlas;
+  std::vector<uint32_t>                               m_instanceLod;  // Current level of each instance
+  float m_lodPixelError{1.f};  // Largest LOD error on screen, in pixels
 
   struct RtPushConstant
   {